@@ -27,30 +27,57 @@ struct CBPerObject
 	XMFLOAT4X4 WorldViewProj;
 	XMFLOAT3X4 WorldI;
 	XMFLOAT3X4 World;
+	XMFLOAT4 BoundsMin;
+	XMFLOAT4 BoundsMax;
+	XMFLOAT3 Extent;
+	uint32_t HasColorLUT;
 };
 
+static const uint32_t g_lightBrickSize = 16;	// Unit of the time-sliced light-map updates
+
+// Grid of the aspect of the volume, with the given size on the longest axis
+static inline XMUINT3 GetGridSize(uint32_t size, const XMUINT3* pVolumeSize)
+{
+	if (!pVolumeSize) return XMUINT3(size, size, size);
+	if (size == 0) return *pVolumeSize;
+
+	const auto scale = static_cast<float>(size) / (max)((max)(pVolumeSize->x, pVolumeSize->y), pVolumeSize->z);
+	const auto x = static_cast<uint32_t>(pVolumeSize->x * scale + 0.5f);
+	const auto y = static_cast<uint32_t>(pVolumeSize->y * scale + 0.5f);
+	const auto z = static_cast<uint32_t>(pVolumeSize->z * scale + 0.5f);
+
+	return XMUINT3((max)(x, 1u), (max)(y, 1u), (max)(z, 1u));
+}
+
+static inline uint32_t GetMaxSize(const XMUINT3& size)
+{
+	return (max)((max)(size.x, size.y), size.z);
+}
+
 #ifdef _CPU_CUBE_FACE_CULL_
 static_assert(_CPU_CUBE_FACE_CULL_ == 0 || _CPU_CUBE_FACE_CULL_ == 1 || _CPU_CUBE_FACE_CULL_ == 2, "_CPU_CUBE_FACE_CULL_ can only be 0, 1, or 2");
 #endif
 
 #if _CPU_CUBE_FACE_CULL_
-static inline bool IsCubeFaceVisible(uint8_t face, CXMVECTOR localSpaceEyePt)
+static inline bool IsCubeFaceVisible(uint8_t face, CXMVECTOR localSpaceEyePt, const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax)
 {
-	const auto& viewComp = XMVectorGetByIndex(localSpaceEyePt, face >> 1);
+	const auto axis = face >> 1;
+	const auto& viewComp = XMVectorGetByIndex(localSpaceEyePt, axis);
 
-	return (face & 0x1) ? viewComp > -1.0f : viewComp < 1.0f;
+	return (face & 0x1) ? viewComp > (&boundsMin.x)[axis] : viewComp < (&boundsMax.x)[axis];
 }
 #endif
 
 #if _CPU_CUBE_FACE_CULL_ == 1
-static inline uint32_t GenVisibilityMask(CXMMATRIX worldI, const XMFLOAT3& eyePt)
+static inline uint32_t GenVisibilityMask(CXMMATRIX worldI, const XMFLOAT3& eyePt,
+	const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax)
 {
 	const auto localSpaceEyePt = XMVector3Transform(XMLoadFloat3(&eyePt), worldI);
 
 	auto mask = 0u;
 	for (uint8_t i = 0; i < 6; ++i)
 	{
-		const auto isVisible = IsCubeFaceVisible(i, localSpaceEyePt);
+		const auto isVisible = IsCubeFaceVisible(i, localSpaceEyePt, boundsMin, boundsMax);
 		mask |= (isVisible ? 1 : 0) << i;
 	}
 
@@ -62,14 +89,15 @@ struct CBCubeFaceList
 	XMUINT4 Faces[5];
 };
 
-static inline uint8_t GenVisibleCubeFaceList(CBCubeFaceList& faceList, CXMMATRIX worldI, const XMFLOAT3& eyePt)
+static inline uint8_t GenVisibleCubeFaceList(CBCubeFaceList& faceList, CXMMATRIX worldI, const XMFLOAT3& eyePt,
+	const XMFLOAT3& boundsMin, const XMFLOAT3& boundsMax)
 {
 	const auto localSpaceEyePt = XMVector3Transform(XMLoadFloat3(&eyePt), worldI);
 
 	uint8_t count = 0;
 	for (uint8_t i = 0; i < 6; ++i)
 	{
-		if (IsCubeFaceVisible(i, localSpaceEyePt))
+		if (IsCubeFaceVisible(i, localSpaceEyePt, boundsMin, boundsMax))
 		{
 			assert(count < 5);
 			faceList.Faces[count++].x = i;
@@ -80,6 +108,28 @@ static inline uint8_t GenVisibleCubeFaceList(CBCubeFaceList& faceList, CXMMATRIX
 }
 #endif
 
+// Conservative test of a local-space box against the clip volume
+static inline bool IsBoxInFrustum(CXMVECTOR boxMin, CXMVECTOR boxMax, CXMMATRIX worldViewProj)
+{
+	auto outsideMask = 0x3fu;
+	for (uint8_t i = 0; i < 8; ++i)
+	{
+		const auto corner = XMVectorSelect(boxMin, boxMax, XMVectorSelectControl(i & 1, (i >> 1) & 1, (i >> 2) & 1, 0));
+		XMFLOAT4 pos;
+		XMStoreFloat4(&pos, XMVector3Transform(corner, worldViewProj));
+		auto mask = 0u;
+		mask |= pos.x < -pos.w ? 0x01 : 0;
+		mask |= pos.x > pos.w ? 0x02 : 0;
+		mask |= pos.y < -pos.w ? 0x04 : 0;
+		mask |= pos.y > pos.w ? 0x08 : 0;
+		mask |= pos.z < 0.0f ? 0x10 : 0;
+		mask |= pos.z > pos.w ? 0x20 : 0;
+		outsideMask &= mask;
+	}
+
+	return outsideMask == 0;
+}
+
 static inline XMVECTOR ProjectToViewport(uint32_t i, CXMMATRIX worldViewProj, CXMVECTOR viewport)
 {
 	static const XMVECTOR v[] =
@@ -151,13 +201,15 @@ static inline float EstimateCubeEdgePixelSize(const XMVECTOR v[8])
 }
 
 static inline uint8_t EstimateCubeMapLOD(uint32_t& raySampleCount, uint8_t numMips, float cubeMapSize,
-	CXMMATRIX worldViewProj, CXMVECTOR viewport, float upscale = 2.0f, float raySampleCountScale = 2.0f)
+	CXMMATRIX worldViewProj, CXMMATRIX boundsWorldViewProj, CXMVECTOR viewport,
+	float upscale = 2.0f, float raySampleCountScale = 2.0f)
 {
 	XMVECTOR v[8];
 	for (uint8_t i = 0; i < 8; ++i) v[i] = ProjectToViewport(i, worldViewProj, viewport);
 
 	// Calulate the ideal cube-map resolution
-	auto s = EstimateCubeEdgePixelSize(v) / upscale;
+	const auto edgeSize = EstimateCubeEdgePixelSize(v);
+	auto s = edgeSize / upscale;
 	
 	// Get the ideal ray sample amount
 	auto raySampleAmt = raySampleCountScale * s / sqrtf(3.0f);
@@ -170,6 +222,10 @@ static inline uint8_t EstimateCubeMapLOD(uint32_t& raySampleCount, uint8_t numMi
 	raySampleAmt = (min)(raySampleAmt, static_cast<float>(raySampleCount));
 	s = raySampleAmt / raySampleCountScale * sqrtf(3.0f);
 
+	// The cube map only spans the occupancy bounds, so tight bounds take fewer texels at the same sampling rate
+	for (uint8_t i = 0; i < 8; ++i) v[i] = ProjectToViewport(i, boundsWorldViewProj, viewport);
+	s *= edgeSize > 0.0f ? EstimateCubeEdgePixelSize(v) / edgeSize : 1.0f;
+
 	// Use the more detailed integer level for conservation
 	//const auto level = static_cast<uint8_t>(floorf((max)(log2f(cubeMapSize / s), 0.0f)));
 	const auto level = static_cast<uint8_t>((max)(log2f(cubeMapSize / s), 0.0f));
@@ -180,10 +236,29 @@ static inline uint8_t EstimateCubeMapLOD(uint32_t& raySampleCount, uint8_t numMi
 RayCaster::RayCaster() :
 	m_pDepths(nullptr),
 	m_coeffSH(nullptr),
+	m_gridSize(0, 0, 0),
+	m_lightGridSize(0, 0, 0),
+	m_lightBrickCount(0, 0, 0),
 	m_maxRaySamples(256),
 	m_maxLightSamples(64),
+	m_staleLightBrickCount(0),
+	m_lightFrame(0),
+	m_lightMapBudget(0),
+	m_maxLightStaleFrames(8),
 	m_cubeFaceCount(6),
 	m_cubeMapLOD(0),
+	m_occupancyPending(0),
+	m_volumeFilter(VolumeResampler::TRILINEAR),
+	m_densityOnly(false),
+	m_lightMapSweep(false),
+	m_lightMapLit(false),
+	m_irradianceDirty(true),
+	m_lightPassInputs(),
+	m_lightDirtyMin(0.0f, 0.0f, 0.0f),
+	m_lightDirtyMax(1.0f, 1.0f, 1.0f),
+	m_boundsMin(-1.0f, -1.0f, -1.0f),
+	m_boundsMax(1.0f, 1.0f, 1.0f),
+	m_extent(1.0f, 1.0f, 1.0f),
 	m_lightPt(75.0f, 75.0f, -75.0f),
 	m_lightColor(1.0f, 0.7f, 0.3f, 1.0f),
 	m_ambient(0.0f, 0.3f, 1.0f, 0.4f)
@@ -198,36 +273,95 @@ RayCaster::~RayCaster()
 }
 
 bool RayCaster::Init(const Device* pDevice, const DescriptorTableLib::sptr& descriptorTableLib,
-	Format rtFormat, uint32_t gridSize, uint32_t lightGridSize, const DepthStencil::uptr* depths)
+	Format rtFormat, uint32_t gridSize, uint32_t lightGridSize, const DepthStencil::uptr* depths,
+	Format volumeFormat, const XMUINT3* pVolumeSize)
 {
 	m_graphicsPipelineLib = Graphics::PipelineLib::MakeUnique(pDevice);
 	m_computePipelineLib = Compute::PipelineLib::MakeUnique(pDevice);
 	m_pipelineLayoutLib = PipelineLayoutLib::MakeUnique(pDevice);
 	m_descriptorTableLib = descriptorTableLib;
 
-	m_gridSize = gridSize;
-	m_lightGridSize = lightGridSize;
+	// Non-cubic grids keep the aspect of the volume, whose local space spans the extent
+	// of 1 on the longest axis, so that the voxels stay cubic in all spaces
+	m_gridSize = GetGridSize(gridSize, pVolumeSize);
+	m_lightGridSize = GetGridSize(lightGridSize, pVolumeSize);
+	const auto maxGridSize = GetMaxSize(m_gridSize);
+	m_extent.x = static_cast<float>(m_gridSize.x) / maxGridSize;
+	m_extent.y = static_cast<float>(m_gridSize.y) / maxGridSize;
+	m_extent.z = static_cast<float>(m_gridSize.z) / maxGridSize;
 	m_pDepths = depths;
 
-	// Create resources
+	// Create resources; density-only volumes read as float4(1.0.xxx, density) through the SRV swizzle
+	m_densityOnly = volumeFormat == Format::R8_UNORM || volumeFormat == Format::R16_UNORM || volumeFormat == Format::R16_FLOAT;
+	const uint16_t srvComponentMapping = m_densityOnly ?
+		XUSG_ENCODE_SRV_COMPONENT_MAPPING(SrvCM::FV1, SrvCM::FV1, SrvCM::FV1, SrvCM::MC0) :
+		XUSG_DEFAULT_SRV_COMPONENT_MAPPING;
+	const auto numVolumeMips = min<uint8_t>(VOLUME_MIP_COUNT, Texture::CalculateMipLevels(m_gridSize.x, m_gridSize.y, m_gridSize.z));
 	m_volume = Texture3D::MakeUnique();
-	XUSG_N_RETURN(m_volume->Create(pDevice, gridSize, gridSize, gridSize, Format::R16G16B16A16_FLOAT,
+	XUSG_N_RETURN(m_volume->Create(pDevice, m_gridSize.x, m_gridSize.y, m_gridSize.z, volumeFormat,
+		ResourceFlag::ALLOW_UNORDERED_ACCESS | ResourceFlag::ALLOW_SIMULTANEOUS_ACCESS, numVolumeMips,
+		MemoryFlag::NONE, L"Volume", srvComponentMapping), false);
+
+	// Min/max densities per macro cell for empty-space skipping
+	m_macroCells = Texture3D::MakeUnique();
+	XUSG_N_RETURN(m_macroCells->Create(pDevice, XUSG_DIV_UP(m_gridSize.x, MACRO_CELL_SIZE), XUSG_DIV_UP(m_gridSize.y,
+		MACRO_CELL_SIZE), XUSG_DIV_UP(m_gridSize.z, MACRO_CELL_SIZE), Format::R16G16_FLOAT,
+		ResourceFlag::ALLOW_UNORDERED_ACCESS | ResourceFlag::ALLOW_SIMULTANEOUS_ACCESS, 1,
+		MemoryFlag::NONE, L"MacroCells"), false);
+
+	// Occupancy bounds reduced from the macro cells, and read back for the cube-map LOD and face culling
+	m_occupancy = StructuredBuffer::MakeUnique();
+	XUSG_N_RETURN(m_occupancy->Create(pDevice, 2, sizeof(XMFLOAT3), ResourceFlag::ALLOW_UNORDERED_ACCESS,
+		MemoryType::DEFAULT, 0, nullptr, 1, nullptr, MemoryFlag::NONE, L"Occupancy"), false);
+	m_occupancyReadback = Buffer::MakeUnique();
+	XUSG_N_RETURN(m_occupancyReadback->Create(pDevice, sizeof(XMFLOAT3[2]), ResourceFlag::DENY_SHADER_RESOURCE,
+		MemoryType::READBACK, 0, nullptr, 0, nullptr, MemoryFlag::NONE, L"OccupancyReadback"), false);
+	m_boundsMin = XMFLOAT3(-m_extent.x, -m_extent.y, -m_extent.z);
+	m_boundsMax = m_extent;
+	m_occupancyPending = 0;
+
+#ifdef _GRADIENT_VOLUME_
+	// Density-gradient directions and magnitudes for the light-probe GI path
+	m_gradient = Texture3D::MakeUnique();
+	XUSG_N_RETURN(m_gradient->Create(pDevice, m_gridSize.x, m_gridSize.y, m_gridSize.z, Format::R8G8B8A8_SNORM,
 		ResourceFlag::ALLOW_UNORDERED_ACCESS | ResourceFlag::ALLOW_SIMULTANEOUS_ACCESS, 1,
-		MemoryFlag::NONE, L"Volume"), false);
+		MemoryFlag::NONE, L"Gradient"), false);
+#endif
 
+	// The cube map spans the occupancy bounds at the resolution of the longest axis
 	const uint8_t numMips = 5;
 	m_cubeMap = Texture2D::MakeUnique();
-	XUSG_N_RETURN(m_cubeMap->Create(pDevice, gridSize, gridSize, Format::R16G16B16A16_FLOAT, 6,
+	XUSG_N_RETURN(m_cubeMap->Create(pDevice, maxGridSize, maxGridSize, Format::R16G16B16A16_FLOAT, 6,
 		ResourceFlag::ALLOW_UNORDERED_ACCESS, numMips, 1, true, MemoryFlag::NONE, L"RadianceCubeMap"), false);
 
 	m_cubeDepth = Texture2D::MakeUnique();
-	XUSG_N_RETURN(m_cubeDepth->Create(pDevice, gridSize, gridSize, Format::R32_FLOAT, 6,
+	XUSG_N_RETURN(m_cubeDepth->Create(pDevice, maxGridSize, maxGridSize, Format::R32_FLOAT, 6,
 		ResourceFlag::ALLOW_UNORDERED_ACCESS, numMips, 1, true, MemoryFlag::NONE, L"DepthCubeMap"), false);
 
 	m_lightMap = Texture3D::MakeUnique();
-	XUSG_N_RETURN(m_lightMap->Create(pDevice, m_lightGridSize, m_lightGridSize, m_lightGridSize,
+	XUSG_N_RETURN(m_lightMap->Create(pDevice, m_lightGridSize.x, m_lightGridSize.y, m_lightGridSize.z,
 		Format::R11G11B10_FLOAT,ResourceFlag::ALLOW_UNORDERED_ACCESS | ResourceFlag::ALLOW_SIMULTANEOUS_ACCESS,
 		1, MemoryFlag::NONE, L"LightMap"), false);
+	m_lightBrickCount.x = XUSG_DIV_UP(m_lightGridSize.x, g_lightBrickSize);
+	m_lightBrickCount.y = XUSG_DIV_UP(m_lightGridSize.y, g_lightBrickSize);
+	m_lightBrickCount.z = XUSG_DIV_UP(m_lightGridSize.z, g_lightBrickSize);
+	m_lightBrickStamps.assign(m_lightBrickCount.x * m_lightBrickCount.y * m_lightBrickCount.z, UINT32_MAX);
+	m_staleLightBrickCount = 0;
+	m_lightMapLit = false;
+	InvalidateLightMap();
+
+	// AO-weighted light-probe irradiance, baked apart from the per-frame direct light
+	m_irradiance = Texture3D::MakeUnique();
+	XUSG_N_RETURN(m_irradiance->Create(pDevice, m_lightGridSize.x, m_lightGridSize.y, m_lightGridSize.z,
+		Format::R11G11B10_FLOAT, ResourceFlag::ALLOW_UNORDERED_ACCESS | ResourceFlag::ALLOW_SIMULTANEOUS_ACCESS,
+		1, MemoryFlag::NONE, L"Irradiance"), false);
+	InvalidateIrradiance();
+
+	// Ping-pong transmittance slices for the slice-sweep light pass, large enough for the slices of any axis
+	const auto maxLightGridSize = GetMaxSize(m_lightGridSize);
+	m_transm = Texture2D::MakeUnique();
+	XUSG_N_RETURN(m_transm->Create(pDevice, maxLightGridSize, maxLightGridSize, Format::R32_FLOAT, 2,
+		ResourceFlag::ALLOW_UNORDERED_ACCESS, 1, 1, false, MemoryFlag::NONE, L"LightTransmittance"), false);
 
 	m_cbPerFrame = ConstantBuffer::MakeUnique();
 	XUSG_N_RETURN(m_cbPerFrame->Create(pDevice, sizeof(CBPerFrame[FrameCount]), FrameCount,
@@ -253,6 +387,15 @@ bool RayCaster::Init(const Device* pDevice, const DescriptorTableLib::sptr& desc
 
 bool RayCaster::LoadVolumeData(CommandList* pCommandList, const wchar_t* fileName, vector<Resource::uptr>& uploaders)
 {
+	// A filtered volume file loads from its cache file of the grid size, which CSR32FToRGBA16F then copies
+	wstring cacheFileName;
+	if (m_volumeFilter != VolumeResampler::TRILINEAR)
+	{
+		VolumeResampler resampler;
+		XUSG_N_RETURN(resampler.Resample(cacheFileName, fileName, m_gridSize, m_volumeFilter), false);
+		fileName = cacheFileName.c_str();
+	}
+
 	// Load input image
 	{
 		DDS::Loader textureLoader;
@@ -275,29 +418,156 @@ bool RayCaster::LoadVolumeData(CommandList* pCommandList, const wchar_t* fileNam
 	ResourceBarrier barrier;
 	m_volume->SetBarrier(&barrier, ResourceState::UNORDERED_ACCESS);
 
+	convertVolumeData(pCommandList);
+
+	return true;
+}
+
+bool RayCaster::UpdateVolumeData(CommandList* pCommandList, const void* pTexels, uint8_t frameIndex)
+{
+	assert(m_fileSrc);
+
+	// The top mip of the file source
+	SubresourceData texels;
+	texels.pData = pTexels;
+	texels.RowPitch = (DDS::Loader::BitsPerPixel(m_fileSrc->GetFormat()) * m_fileSrc->GetWidth() + 7) / 8;
+	texels.SlicePitch = texels.RowPitch * m_fileSrc->GetHeight();
+
+	// The uploader of the frame index was last recorded FrameCount frames ago, which the GPU has completed
+	m_fileUploaders[frameIndex] = Resource::MakeUnique();
+	XUSG_N_RETURN(m_fileSrc->Upload(pCommandList, m_fileUploaders[frameIndex].get(), &texels,
+		1, ResourceState::NON_PIXEL_SHADER_RESOURCE), false);
+
+	// The previous frames read the volume before the conversion writes it, in the order of the queue
+	ResourceBarrier barrier;
+	const auto numBarriers = m_volume->SetBarrier(&barrier, ResourceState::UNORDERED_ACCESS);
+	pCommandList->Barrier(numBarriers, &barrier);
+
+	convertVolumeData(pCommandList);
+
+	return true;
+}
+
+bool RayCaster::UpdateVolumeRegion(CommandList* pCommandList, const XMUINT3& minCorner,
+	const XMUINT3& maxCorner, const float* pDensities, uint8_t frameIndex)
+{
+	XUSG_N_RETURN(minCorner.x < maxCorner.x && minCorner.y < maxCorner.y && minCorner.z < maxCorner.z, false);
+	XUSG_N_RETURN(maxCorner.x <= m_gridSize.x && maxCorner.y <= m_gridSize.y && maxCorner.z <= m_gridSize.z, false);
+
+	// The densities are read by the shader from an upload buffer of the frame index, released in UpdateFrame()
+	// once the GPU has completed the frame
+	const XMUINT3 regionSize(maxCorner.x - minCorner.x, maxCorner.y - minCorner.y, maxCorner.z - minCorner.z);
+	const auto numDensities = static_cast<size_t>(regionSize.x) * regionSize.y * regionSize.z;
+	auto& uploaders = m_regionUploaders[frameIndex];
+	uploaders.emplace_back(StructuredBuffer::MakeUnique());
+	const auto pUploader = uploaders.back().get();
+	XUSG_N_RETURN(pUploader->Create(m_device.get(), numDensities, sizeof(float), ResourceFlag::NONE,
+		MemoryType::UPLOAD, 0, nullptr, 0, nullptr, MemoryFlag::NONE, L"VolumeRegionUploader"), false);
+	const auto pData = pUploader->Map();
+	XUSG_N_RETURN(pData, false);
+	memcpy(pData, pDensities, sizeof(float) * numDensities);
+	pUploader->Unmap();
+
+	const auto descriptorHeap = m_descriptorTableLib->GetDescriptorHeap(CBV_SRV_UAV_HEAP);
+	pCommandList->SetDescriptorHeaps(1, &descriptorHeap);
+
+	// The previous frames read the volume before the region writes it, in the order of the queue
+	ResourceBarrier barrier;
+	const auto numBarriers = m_volume->SetBarrier(&barrier, ResourceState::UNORDERED_ACCESS);
+	pCommandList->Barrier(numBarriers, &barrier);
+
 	// Set pipeline state
-	pCommandList->SetComputePipelineLayout(m_pipelineLayouts[LOAD_VOLUME_DATA]);
-	pCommandList->SetPipelineState(m_pipelines[LOAD_VOLUME_DATA]);
+	pCommandList->SetComputePipelineLayout(m_pipelineLayouts[UPDATE_VOLUME_REGION]);
+	pCommandList->SetPipelineState(m_pipelines[UPDATE_VOLUME_REGION]);
 
 	// Set descriptor tables
-	pCommandList->SetComputeDescriptorTable(0, m_srvTables[SRV_TABLE_FILE_SRC]);
+	const uint32_t cbRegion[] =
+	{
+		minCorner.x, minCorner.y, minCorner.z, m_densityOnly ? 1u : 0u,
+		regionSize.x, regionSize.y, regionSize.z
+	};
+	pCommandList->SetComputeRootShaderResourceView(0, pUploader);
 	pCommandList->SetComputeDescriptorTable(1, m_uavTable);
-
-	// Dispatch grid
-	pCommandList->Dispatch(XUSG_DIV_UP(m_gridSize, 4), XUSG_DIV_UP(m_gridSize, 4), XUSG_DIV_UP(m_gridSize, 4));
+	pCommandList->SetCompute32BitConstants(2, static_cast<uint32_t>(size(cbRegion)), cbRegion);
+
+	// Dispatch region
+	pCommandList->Dispatch(XUSG_DIV_UP(regionSize.x, 4), XUSG_DIV_UP(regionSize.y, 4), XUSG_DIV_UP(regionSize.z, 4));
+
+	// The macro cells extended by the 1-voxel apron over the region
+	XMUINT3 cellMin, cellMax;
+	cellMin.x = ((max)(minCorner.x, 1u) - 1) / MACRO_CELL_SIZE;
+	cellMin.y = ((max)(minCorner.y, 1u) - 1) / MACRO_CELL_SIZE;
+	cellMin.z = ((max)(minCorner.z, 1u) - 1) / MACRO_CELL_SIZE;
+	cellMax.x = (min)(maxCorner.x / MACRO_CELL_SIZE + 1, m_macroCells->GetWidth());
+	cellMax.y = (min)(maxCorner.y / MACRO_CELL_SIZE + 1, m_macroCells->GetHeight());
+	cellMax.z = (min)(maxCorner.z / MACRO_CELL_SIZE + 1, m_macroCells->GetDepth());
+
+	// The central differences reach 1 voxel on each side
+	XMUINT3 gradientMin, gradientMax;
+	gradientMin.x = (max)(minCorner.x, 1u) - 1;
+	gradientMin.y = (max)(minCorner.y, 1u) - 1;
+	gradientMin.z = (max)(minCorner.z, 1u) - 1;
+	gradientMax.x = (min)(maxCorner.x + 1, m_gridSize.x);
+	gradientMax.y = (min)(maxCorner.y + 1, m_gridSize.y);
+	gradientMax.z = (min)(maxCorner.z + 1, m_gridSize.z);
+
+	generateVolumeMips(pCommandList, minCorner, maxCorner);
+	buildMacroCells(pCommandList, cellMin, cellMax);
+	buildOccupancy(pCommandList);
+	buildGradients(pCommandList, gradientMin, gradientMax);
+	InvalidateLightMap(minCorner, maxCorner);
 
 	return true;
 }
 
+bool RayCaster::GetVolumeFileSize(const wchar_t* fileName, XMUINT3& size)
+{
+	ifstream file(fileName, ios::binary);
+	XUSG_N_RETURN(file, false);
+
+	// Magic number, and then the DDS header up to the depth
+	uint32_t header[7];
+	XUSG_N_RETURN(file.read(reinterpret_cast<char*>(header), sizeof(header)), false);
+	XUSG_N_RETURN(header[0] == 0x20534444, false); // "DDS "
+
+	const auto isVolume = (header[2] & 0x800000) != 0; // DDSD_DEPTH
+	size = XMUINT3(header[4], header[3], isVolume ? (max)(header[6], 1u) : 1);
+
+	return size.x > 0 && size.y > 0;
+}
+
 bool RayCaster::SetDepthMaps(const DepthStencil::uptr* depths)
 {
 	m_pDepths = depths;
+	InvalidateLightMap();
 
 	return createDescriptorTables();
 }
 
+bool RayCaster::SetColorLUT(CommandList* pCommandList, const XMFLOAT3* pColors,
+	uint32_t numColors, vector<Resource::uptr>& uploaders)
+{
+	// Pass no colors to remove the LUT
+	if (!pColors || numColors == 0)
+	{
+		m_colorLUT.reset();
+
+		return true;
+	}
+
+	m_colorLUT = StructuredBuffer::MakeUnique();
+	XUSG_N_RETURN(m_colorLUT->Create(pCommandList->GetDevice(), numColors, sizeof(XMFLOAT3),
+		ResourceFlag::NONE, MemoryType::DEFAULT, 1, nullptr, 0, nullptr, MemoryFlag::NONE, L"ColorLUT"), false);
+	uploaders.emplace_back(Resource::MakeUnique());
+
+	return m_colorLUT->Upload(pCommandList, uploaders.back().get(), pColors, sizeof(XMFLOAT3) * numColors,
+		0, ResourceState::NON_PIXEL_SHADER_RESOURCE | ResourceState::PIXEL_SHADER_RESOURCE);
+}
+
 void RayCaster::InitVolumeData(CommandList* pCommandList)
 {
+	assert(!m_densityOnly);
+
 	const auto descriptorHeap = m_descriptorTableLib->GetDescriptorHeap(CBV_SRV_UAV_HEAP);
 	pCommandList->SetDescriptorHeaps(1, &descriptorHeap);
 
@@ -312,11 +582,21 @@ void RayCaster::InitVolumeData(CommandList* pCommandList)
 	pCommandList->SetComputeDescriptorTable(0, m_uavTable);
 
 	// Dispatch grid
-	pCommandList->Dispatch(XUSG_DIV_UP(m_gridSize, 4), XUSG_DIV_UP(m_gridSize, 4), XUSG_DIV_UP(m_gridSize, 4));
+	pCommandList->Dispatch(XUSG_DIV_UP(m_gridSize.x, 4), XUSG_DIV_UP(m_gridSize.y, 4), XUSG_DIV_UP(m_gridSize.z, 4));
+
+	generateVolumeMips(pCommandList);
+	buildMacroCells(pCommandList);
+	buildOccupancy(pCommandList);
+	buildGradients(pCommandList);
+	InvalidateLightMap();
+	InvalidateIrradiance();
 }
 
 void RayCaster::SetSH(const StructuredBuffer::sptr& coeffSH)
 {
+	// The light map holds the constant ambient only without the SH
+	if ((coeffSH != nullptr) != (m_coeffSH != nullptr)) InvalidateLightMap();
+	if (coeffSH != m_coeffSH) InvalidateIrradiance();
 	m_coeffSH = coeffSH;
 }
 
@@ -348,6 +628,9 @@ void RayCaster::SetAmbient(const XMFLOAT3& color, float intensity)
 
 void RayCaster::UpdateFrame(uint8_t frameIndex, CXMMATRIX viewProj, const XMFLOAT4X4& shadowVP, const XMFLOAT3& eyePt)
 {
+	// The GPU has completed the frame that last used the frame index
+	m_regionUploaders[frameIndex].clear();
+
 	// Per-frame
 	{
 		const auto pCbData = reinterpret_cast<CBPerFrame*>(m_cbPerFrame->Map(frameIndex));
@@ -358,17 +641,51 @@ void RayCaster::UpdateFrame(uint8_t frameIndex, CXMMATRIX viewProj, const XMFLOA
 		pCbData->Ambient = m_ambient;
 	}
 
+	// Light-pass inputs
+	{
+		LightPassInputs inputs;
+		inputs.ShadowViewProj = shadowVP;
+		inputs.World = m_volumeWorld;
+		inputs.LightColor = m_lightColor;
+		inputs.Ambient = m_ambient;
+		inputs.LightPt = m_lightPt;
+		inputs.NumSamples = m_maxLightSamples;
+		if (memcmp(&inputs, &m_lightPassInputs, sizeof(LightPassInputs)) != 0)
+		{
+			// The irradiance turns with the volume, and its AO rays take the light samples
+			if (memcmp(&inputs.World, &m_lightPassInputs.World, sizeof(inputs.World)) != 0 ||
+				inputs.NumSamples != m_lightPassInputs.NumSamples) InvalidateIrradiance();
+			m_lightPassInputs = inputs;
+			InvalidateLightMap();
+		}
+	}
+
+	// Occupancy bounds
+	if (m_occupancyPending > 0 && --m_occupancyPending == 0)
+	{
+		const auto pBounds = reinterpret_cast<const XMFLOAT3*>(m_occupancyReadback->Map(nullptr));
+		m_boundsMin = pBounds[0];
+		m_boundsMax = pBounds[1];
+		m_occupancyReadback->Unmap();
+	}
+
 	// Per-object
 	{
 		const auto world = XMLoadFloat3x4(&m_volumeWorld);
 		const auto worldI = XMMatrixInverse(nullptr, world);
 		const auto worldViewProj = world * viewProj;
+		XMStoreFloat4x4(&m_worldViewProj, worldViewProj);
+		XMStoreFloat3(&m_localSpaceEyePt, XMVector3Transform(XMLoadFloat3(&eyePt), worldI));
 
 		const auto pCbData = reinterpret_cast<CBPerObject*>(m_cbPerObject->Map(frameIndex));
 		XMStoreFloat4x4(&pCbData->WorldViewProj, XMMatrixTranspose(worldViewProj));
 		XMStoreFloat4x4(&pCbData->WorldViewProjI, XMMatrixTranspose(XMMatrixInverse(nullptr, worldViewProj)));
 		XMStoreFloat3x4(&pCbData->WorldI, worldI);
 		XMStoreFloat3x4(&pCbData->World, world);
+		pCbData->BoundsMin = XMFLOAT4(m_boundsMin.x, m_boundsMin.y, m_boundsMin.z, 1.0f);
+		pCbData->BoundsMax = XMFLOAT4(m_boundsMax.x, m_boundsMax.y, m_boundsMax.z, 1.0f);
+		pCbData->Extent = m_extent;
+		pCbData->HasColorLUT = m_colorLUT ? 1 : 0;
 
 		{
 			m_raySampleCount = m_maxRaySamples;
@@ -378,14 +695,20 @@ void RayCaster::UpdateFrame(uint8_t frameIndex, CXMMATRIX viewProj, const XMFLOA
 			const auto width = static_cast<float>(depth->GetWidth());
 			const auto height = static_cast<float>(depth->GetHeight());
 			const auto viewport = XMVectorSet(width, height, 1.0f, 1.0f);
-			m_cubeMapLOD = EstimateCubeMapLOD(m_raySampleCount, numMips, cubeMapSize, worldViewProj, viewport);
+			const auto boundsMin = XMLoadFloat3(&m_boundsMin);
+			const auto boundsMax = XMLoadFloat3(&m_boundsMax);
+			const auto boundsScale = (boundsMax - boundsMin) * 0.5f;
+			const auto boundsCenter = (boundsMax + boundsMin) * 0.5f;
+			const auto boundsWorldViewProj = XMMatrixScalingFromVector(boundsScale) *
+				XMMatrixTranslationFromVector(boundsCenter) * worldViewProj;
+			m_cubeMapLOD = EstimateCubeMapLOD(m_raySampleCount, numMips, cubeMapSize, worldViewProj, boundsWorldViewProj, viewport);
 
 #if _CPU_CUBE_FACE_CULL_ == 1
-			m_visibilityMask = GenVisibilityMask(worldI, eyePt);
+			m_visibilityMask = GenVisibilityMask(worldI, eyePt, m_boundsMin, m_boundsMax);
 #elif _CPU_CUBE_FACE_CULL_ == 2
 			{
 				const auto pCbData = reinterpret_cast<CBCubeFaceList*>(m_cbCubeFaceList->Map(frameIndex));
-				m_cubeFaceCount = GenVisibleCubeFaceList(*pCbData, worldI, eyePt);
+				m_cubeFaceCount = GenVisibleCubeFaceList(*pCbData, worldI, eyePt, m_boundsMin, m_boundsMax);
 			}
 #endif
 		}
@@ -396,12 +719,15 @@ void RayCaster::Render(CommandList* pCommandList, uint8_t frameIndex, uint8_t fl
 {
 	const bool cubemapRayMarch = flags & RAY_MARCH_CUBEMAP;
 	const bool separateLightPass = flags & SEPARATE_LIGHT_PASS;
+	const bool sliceSweep = flags & SLICE_SWEEP_LIGHT;
+
+	if (m_irradianceDirty && m_coeffSH) bakeIrradiance(pCommandList, frameIndex);
 
 	if (cubemapRayMarch)
 	{
 		if (separateLightPass)
 		{
-			RayMarchL(pCommandList, frameIndex);
+			RayMarchL(pCommandList, frameIndex, sliceSweep);
 			rayMarchV(pCommandList, frameIndex);
 		}
 		else rayMarch(pCommandList, frameIndex);
@@ -413,19 +739,384 @@ void RayCaster::Render(CommandList* pCommandList, uint8_t frameIndex, uint8_t fl
 	{
 		if (separateLightPass)
 		{
-			RayMarchL(pCommandList, frameIndex);
+			RayMarchL(pCommandList, frameIndex, sliceSweep);
 			rayCastVDirect(pCommandList, frameIndex);
 		}
 		else rayCastDirect(pCommandList, frameIndex);
 	}
 }
 
-void RayCaster::RayMarchL(const CommandList* pCommandList, uint8_t frameIndex)
+void RayCaster::RayMarchL(CommandList* pCommandList, uint8_t frameIndex, bool sliceSweep)
 {
+	if (sliceSweep != m_lightMapSweep) InvalidateLightMap();
+	m_lightMapSweep = sliceSweep;
+	++m_lightFrame;
+
+	// Mark the light-map bricks of the dirty region stale
+	if (m_lightDirtyMin.x <= m_lightDirtyMax.x)
+	{
+		XMUINT3 regionMin, regionMax;
+		getLightRegion(regionMin, regionMax);
+		markLightBricks(regionMin, regionMax);
+		m_lightDirtyMin = XMFLOAT3(1.0f, 1.0f, 1.0f);
+		m_lightDirtyMax = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	}
+
+	// Skip the pass if the light map is up to date
+	if (m_staleLightBrickCount == 0) return;
+
+	// Slice sweeping carries the transmittance through all slices, so it always re-lights the whole map
+	if (sliceSweep)
+	{
+		rayMarchLSweep(pCommandList, frameIndex);
+		fill(m_lightBrickStamps.begin(), m_lightBrickStamps.end(), UINT32_MAX);
+		m_staleLightBrickCount = 0;
+		m_lightMapLit = true;
+		return;
+	}
+
+	vector<uint32_t> bricks;
+	bricks.reserve(m_staleLightBrickCount);
+	for (auto i = 0u; i < m_lightBrickStamps.size(); ++i)
+		if (m_lightBrickStamps[i] != UINT32_MAX) bricks.push_back(i);
+
+	// Without a budget, or before the map has been lit at all, re-light all stale bricks at once
+	auto numBricks = static_cast<uint32_t>(bricks.size());
+	if (m_lightMapBudget > 0 && m_lightMapLit)
+	{
+		sortLightBricks(bricks);
+
+		// The bricks at their staleness limit are due, and at least an even share of the stale
+		// bricks is re-lit every frame, so that a change is spread over the tolerated frames
+		const auto maxStale = (max)(m_maxLightStaleFrames, 1u);
+		auto numDue = 0u;
+		while (numDue < numBricks && m_lightFrame - m_lightBrickStamps[bricks[numDue]] + 1 >= maxStale) ++numDue;
+		numBricks = (min)((max)((max)(numDue, XUSG_DIV_UP(numBricks, maxStale)), m_lightMapBudget), numBricks);
+	}
+
 	// Set barrier
 	ResourceBarrier barrier;
 	m_lightMap->SetBarrier(&barrier, ResourceState::UNORDERED_ACCESS);
 
+	relightBricks(pCommandList, frameIndex, bricks.data(), numBricks);
+
+	for (auto i = 0u; i < numBricks; ++i) m_lightBrickStamps[bricks[i]] = UINT32_MAX;
+	m_staleLightBrickCount -= numBricks;
+	m_lightMapLit = true;
+}
+
+void RayCaster::SetLightMapBudget(uint32_t maxBricks, uint32_t maxStaleFrames)
+{
+	m_lightMapBudget = maxBricks;
+	m_maxLightStaleFrames = maxStaleFrames;
+}
+
+void RayCaster::SetVolumeFilter(VolumeResampler::Filter filter)
+{
+	m_volumeFilter = filter;
+}
+
+void RayCaster::InvalidateLightMap()
+{
+	m_lightDirtyMin = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	m_lightDirtyMax = XMFLOAT3(1.0f, 1.0f, 1.0f);
+}
+
+void RayCaster::InvalidateLightMap(const XMUINT3& minCorner, const XMUINT3& maxCorner)
+{
+	// Grow by the trilinear footprint of the coarsest mip, and then snap to the macro cells,
+	// whose empty-space skipping also changes the light rays crossing them
+	const auto apron = XMVectorReplicate(static_cast<float>(2 << (VOLUME_MIP_COUNT - 1)));
+	const auto cellSize = static_cast<float>(MACRO_CELL_SIZE);
+	const auto gridSize = XMLoadUInt3(&m_gridSize);
+	auto boxMin = XMVectorFloor((XMLoadUInt3(&minCorner) - apron) / cellSize) * cellSize / gridSize;
+	auto boxMax = XMVectorCeiling((XMLoadUInt3(&maxCorner) + apron) / cellSize) * cellSize / gridSize;
+	boxMin = XMVectorMin(XMVectorMax(boxMin, XMVectorZero()), XMLoadFloat3(&m_lightDirtyMin));
+	boxMax = XMVectorMax(XMVectorMin(boxMax, XMVectorSplatOne()), XMLoadFloat3(&m_lightDirtyMax));
+	XMStoreFloat3(&m_lightDirtyMin, boxMin);
+	XMStoreFloat3(&m_lightDirtyMax, boxMax);
+
+	// AO rays reach the changes from all directions
+	InvalidateIrradiance();
+}
+
+void RayCaster::InvalidateIrradiance()
+{
+	m_irradianceDirty = true;
+}
+
+void RayCaster::convertVolumeData(CommandList* pCommandList)
+{
+	// Set pipeline state
+	pCommandList->SetComputePipelineLayout(m_pipelineLayouts[LOAD_VOLUME_DATA]);
+	pCommandList->SetPipelineState(m_pipelines[LOAD_VOLUME_DATA]);
+
+	// Set descriptor tables
+	pCommandList->SetComputeDescriptorTable(0, m_srvTables[SRV_TABLE_FILE_SRC]);
+	pCommandList->SetComputeDescriptorTable(1, m_uavTable);
+
+	// Dispatch grid
+	pCommandList->Dispatch(XUSG_DIV_UP(m_gridSize.x, 4), XUSG_DIV_UP(m_gridSize.y, 4), XUSG_DIV_UP(m_gridSize.z, 4));
+
+	generateVolumeMips(pCommandList);
+	buildMacroCells(pCommandList);
+	buildOccupancy(pCommandList);
+	buildGradients(pCommandList);
+	InvalidateLightMap();
+	InvalidateIrradiance();
+}
+
+void RayCaster::generateVolumeMips(CommandList* pCommandList)
+{
+	generateVolumeMips(pCommandList, XMUINT3(0, 0, 0), m_gridSize);
+}
+
+void RayCaster::generateVolumeMips(CommandList* pCommandList, XMUINT3 minCorner, XMUINT3 maxCorner)
+{
+	// Set pipeline state
+	pCommandList->SetComputePipelineLayout(m_pipelineLayouts[GEN_VOLUME_MIPS]);
+	pCommandList->SetPipelineState(m_pipelines[GEN_VOLUME_MIPS]);
+	pCommandList->SetCompute32BitConstant(1, m_densityOnly ? 1 : 0);
+
+	// Each level is downsampled from the previous one, over the texels that filter the region of the
+	// previous one; a texel of margin covers the taps of the odd sizes
+	ResourceBarrier barriers[2];
+	const auto numMips = m_volume->GetNumMips();
+	for (uint8_t i = 1; i < numMips; ++i)
+	{
+		auto numBarriers = m_volume->SetBarrier(barriers, i - 1, ResourceState::NON_PIXEL_SHADER_RESOURCE);
+		numBarriers = m_volume->SetBarrier(barriers, i, ResourceState::UNORDERED_ACCESS, numBarriers);
+		pCommandList->Barrier(numBarriers, barriers);
+
+		// Set descriptor table
+		pCommandList->SetComputeDescriptorTable(0, m_volumeMipTables[i - 1]);
+
+		const auto width = (max)(m_gridSize.x >> i, 1u);
+		const auto height = (max)(m_gridSize.y >> i, 1u);
+		const auto depth = (max)(m_gridSize.z >> i, 1u);
+		minCorner.x = (max)(minCorner.x >> 1, 1u) - 1;
+		minCorner.y = (max)(minCorner.y >> 1, 1u) - 1;
+		minCorner.z = (max)(minCorner.z >> 1, 1u) - 1;
+		maxCorner.x = (min)(((maxCorner.x + 1) >> 1) + 1, width);
+		maxCorner.y = (min)(((maxCorner.y + 1) >> 1) + 1, height);
+		maxCorner.z = (min)(((maxCorner.z + 1) >> 1) + 1, depth);
+		pCommandList->SetCompute32BitConstants(1, 3, &minCorner, 1);
+
+		// Dispatch region
+		pCommandList->Dispatch(XUSG_DIV_UP(maxCorner.x - minCorner.x, 4), XUSG_DIV_UP(maxCorner.y - minCorner.y, 4),
+			XUSG_DIV_UP(maxCorner.z - minCorner.z, 4));
+	}
+}
+
+void RayCaster::buildMacroCells(CommandList* pCommandList)
+{
+	buildMacroCells(pCommandList, XMUINT3(0, 0, 0),
+		XMUINT3(m_macroCells->GetWidth(), m_macroCells->GetHeight(), m_macroCells->GetDepth()));
+}
+
+void RayCaster::buildMacroCells(CommandList* pCommandList, const XMUINT3& cellMin, const XMUINT3& cellMax)
+{
+	// Set barriers
+	ResourceBarrier barriers[2];
+	auto numBarriers = m_volume->SetBarrier(barriers, ResourceState::NON_PIXEL_SHADER_RESOURCE);
+	numBarriers = m_macroCells->SetBarrier(barriers, ResourceState::UNORDERED_ACCESS, numBarriers);
+	pCommandList->Barrier(numBarriers, barriers);
+
+	// Set pipeline state
+	pCommandList->SetComputePipelineLayout(m_pipelineLayouts[BUILD_MACRO_CELLS]);
+	pCommandList->SetPipelineState(m_pipelines[BUILD_MACRO_CELLS]);
+
+	// Set descriptor tables
+	pCommandList->SetComputeDescriptorTable(0, m_srvTables[SRV_TABLE_VOLUME]);
+	pCommandList->SetComputeDescriptorTable(1, m_macroCellUavTable);
+	pCommandList->SetCompute32BitConstants(2, 3, &cellMin);
+
+	// Dispatch macro cells
+	pCommandList->Dispatch(XUSG_DIV_UP(cellMax.x - cellMin.x, 4), XUSG_DIV_UP(cellMax.y - cellMin.y, 4),
+		XUSG_DIV_UP(cellMax.z - cellMin.z, 4));
+}
+
+void RayCaster::buildOccupancy(CommandList* pCommandList)
+{
+	// Set barriers
+	ResourceBarrier barriers[2];
+	auto numBarriers = m_macroCells->SetBarrier(barriers, ResourceState::NON_PIXEL_SHADER_RESOURCE);
+	numBarriers = m_occupancy->SetBarrier(barriers, ResourceState::UNORDERED_ACCESS, numBarriers);
+	pCommandList->Barrier(numBarriers, barriers);
+
+	// Set pipeline state
+	pCommandList->SetComputePipelineLayout(m_pipelineLayouts[BUILD_OCCUPANCY]);
+	pCommandList->SetPipelineState(m_pipelines[BUILD_OCCUPANCY]);
+
+	// Set descriptor tables
+	pCommandList->SetComputeDescriptorTable(0, m_srvTables[SRV_TABLE_VOLUME]);
+	pCommandList->SetComputeDescriptorTable(1, m_srvTables[SRV_TABLE_MACRO_CELLS]);
+	pCommandList->SetComputeDescriptorTable(2, m_occupancyUavTable);
+
+	// Reduce all macro cells in 1 group
+	pCommandList->Dispatch(1, 1, 1);
+
+	// The bounds are taken once the frame slot of this command list is reused, i.e. the GPU has finished it
+	m_occupancy->ReadBack(pCommandList, m_occupancyReadback.get(), sizeof(XMFLOAT3[2]));
+	m_occupancyPending = FrameCount;
+}
+
+void RayCaster::buildGradients(CommandList* pCommandList)
+{
+	buildGradients(pCommandList, XMUINT3(0, 0, 0), m_gridSize);
+}
+
+void RayCaster::buildGradients(CommandList* pCommandList, const XMUINT3& minCorner, const XMUINT3& maxCorner)
+{
+#ifdef _GRADIENT_VOLUME_
+	// Set barriers
+	ResourceBarrier barriers[2];
+	auto numBarriers = m_volume->SetBarrier(barriers, ResourceState::NON_PIXEL_SHADER_RESOURCE);
+	numBarriers = m_gradient->SetBarrier(barriers, ResourceState::UNORDERED_ACCESS, numBarriers);
+	pCommandList->Barrier(numBarriers, barriers);
+
+	// Set pipeline state
+	pCommandList->SetComputePipelineLayout(m_pipelineLayouts[BUILD_GRADIENTS]);
+	pCommandList->SetPipelineState(m_pipelines[BUILD_GRADIENTS]);
+
+	// Set descriptor tables
+	pCommandList->SetComputeDescriptorTable(0, m_srvTables[SRV_TABLE_VOLUME]);
+	pCommandList->SetComputeDescriptorTable(1, m_gradientUavTable);
+	pCommandList->SetCompute32BitConstants(2, 3, &minCorner);
+
+	// Dispatch region
+	pCommandList->Dispatch(XUSG_DIV_UP(maxCorner.x - minCorner.x, 4), XUSG_DIV_UP(maxCorner.y - minCorner.y, 4),
+		XUSG_DIV_UP(maxCorner.z - minCorner.z, 4));
+#endif
+}
+
+void RayCaster::bakeIrradiance(CommandList* pCommandList, uint8_t frameIndex)
+{
+	// Set barriers
+	ResourceBarrier barriers[2];
+	auto numBarriers = m_volume->SetBarrier(barriers, ResourceState::NON_PIXEL_SHADER_RESOURCE);
+	numBarriers = m_irradiance->SetBarrier(barriers, ResourceState::UNORDERED_ACCESS, numBarriers);
+	pCommandList->Barrier(numBarriers, barriers);
+
+	// Set pipeline state
+	pCommandList->SetComputePipelineLayout(m_pipelineLayouts[BAKE_IRRADIANCE]);
+	pCommandList->SetPipelineState(m_pipelines[BAKE_IRRADIANCE]);
+
+	// Set descriptor tables
+	pCommandList->SetComputeDescriptorTable(0, m_cbvTables[frameIndex]);
+	pCommandList->SetComputeDescriptorTable(1, m_srvTables[SRV_TABLE_VOLUME]);
+	pCommandList->SetComputeDescriptorTable(2, m_irradianceUavTable);
+	pCommandList->SetCompute32BitConstant(3, m_maxLightSamples);
+	pCommandList->SetComputeRootShaderResourceView(4, m_coeffSH.get());
+	pCommandList->SetComputeDescriptorTable(5, m_srvTables[SRV_TABLE_MACRO_CELLS]);
+#ifdef _GRADIENT_VOLUME_
+	pCommandList->SetComputeDescriptorTable(6, m_srvTables[SRV_TABLE_GRADIENT]);
+#endif
+
+	// Dispatch light grid
+	pCommandList->Dispatch(XUSG_DIV_UP(m_lightGridSize.x, 4), XUSG_DIV_UP(m_lightGridSize.y, 4), XUSG_DIV_UP(m_lightGridSize.z, 4));
+
+	// The passes of this frame read the irradiance
+	numBarriers = m_irradiance->SetBarrier(barriers, ResourceState::NON_PIXEL_SHADER_RESOURCE |
+		ResourceState::PIXEL_SHADER_RESOURCE);
+	pCommandList->Barrier(numBarriers, barriers);
+
+	m_irradianceDirty = false;
+}
+
+void RayCaster::getLightRegion(XMUINT3& regionMin, XMUINT3& regionMax) const
+{
+	auto boxMin = XMLoadFloat3(&m_lightDirtyMin);
+	auto boxMax = XMLoadFloat3(&m_lightDirtyMax);
+
+	// The changes also shadow the texels away from the (directional) light
+	const auto worldI = XMMatrixInverse(nullptr, XMLoadFloat3x4(&m_volumeWorld));
+	const auto lightDir = XMVector3TransformNormal(XMLoadFloat3(&m_lightPt), worldI);
+	boxMin = XMVectorSelect(boxMin, XMVectorZero(), XMVectorGreater(lightDir, XMVectorZero()));
+	boxMax = XMVectorSelect(boxMax, XMVectorSplatOne(), XMVectorLess(lightDir, XMVectorZero()));
+
+	// Light-map texels with the centers in the box
+	const auto gridSize = XMLoadUInt3(&m_lightGridSize);
+	const auto half = XMVectorReplicate(0.5f);
+	boxMin = XMVectorCeiling(boxMin * gridSize - half);
+	boxMax = XMVectorFloor(boxMax * gridSize - half) + XMVectorSplatOne();
+	boxMax = XMVectorClamp(boxMax, XMVectorZero(), gridSize);
+	boxMin = XMVectorClamp(boxMin, XMVectorZero(), boxMax);
+	XMStoreUInt3(&regionMin, boxMin);
+	XMStoreUInt3(&regionMax, boxMax);
+}
+
+void RayCaster::markLightBricks(const XMUINT3& regionMin, const XMUINT3& regionMax)
+{
+	const auto brickMinX = regionMin.x / g_lightBrickSize;
+	const auto brickMinY = regionMin.y / g_lightBrickSize;
+	const auto brickMinZ = regionMin.z / g_lightBrickSize;
+	const auto brickMaxX = XUSG_DIV_UP(regionMax.x, g_lightBrickSize);
+	const auto brickMaxY = XUSG_DIV_UP(regionMax.y, g_lightBrickSize);
+	const auto brickMaxZ = XUSG_DIV_UP(regionMax.z, g_lightBrickSize);
+
+	// Keep the stamps of the bricks already stale, which bound their staleness
+	for (auto z = brickMinZ; z < brickMaxZ; ++z)
+		for (auto y = brickMinY; y < brickMaxY; ++y)
+			for (auto x = brickMinX; x < brickMaxX; ++x)
+			{
+				auto& stamp = m_lightBrickStamps[(z * m_lightBrickCount.y + y) * m_lightBrickCount.x + x];
+				if (stamp == UINT32_MAX)
+				{
+					stamp = m_lightFrame;
+					++m_staleLightBrickCount;
+				}
+			}
+}
+
+void RayCaster::sortLightBricks(vector<uint32_t>& bricks) const
+{
+	struct BrickKey
+	{
+		uint32_t Stamp;
+		float Dist;
+		bool Culled;
+	};
+
+	// The view rays only sample the bricks in the view frustum, and the nearer ones
+	// are seen with the higher transmittance
+	const auto worldViewProj = XMLoadFloat4x4(&m_worldViewProj);
+	const auto localSpaceEyePt = XMLoadFloat3(&m_localSpaceEyePt);
+	const auto extent = XMLoadFloat3(&m_extent);
+	const auto brickScale = XMVectorReplicate(2.0f * g_lightBrickSize) / XMLoadUInt3(&m_lightGridSize) * extent;
+	const auto maxStale = (max)(m_maxLightStaleFrames, 1u);
+	vector<BrickKey> keys(m_lightBrickStamps.size());
+	for (const auto& i : bricks)
+	{
+		const auto x = static_cast<float>(i % m_lightBrickCount.x);
+		const auto y = static_cast<float>(i / m_lightBrickCount.x % m_lightBrickCount.y);
+		const auto z = static_cast<float>(i / (m_lightBrickCount.x * m_lightBrickCount.y));
+		const auto boxMin = XMVectorSet(x, y, z, 0.0f) * brickScale - extent;
+		const auto boxMax = XMVectorMin(boxMin + brickScale, extent);
+
+		auto& key = keys[i];
+		key.Stamp = m_lightBrickStamps[i];
+		key.Dist = XMVectorGetX(XMVector3Length((boxMin + boxMax) * 0.5f - localSpaceEyePt));
+		key.Culled = !IsBoxInFrustum(boxMin, boxMax, worldViewProj);
+
+		// All due bricks go first
+		if (m_lightFrame - key.Stamp + 1 >= maxStale) key.Stamp = 0;
+	}
+
+	sort(bricks.begin(), bricks.end(), [&keys](uint32_t a, uint32_t b)
+	{
+		const auto& keyA = keys[a];
+		const auto& keyB = keys[b];
+		if ((keyA.Stamp == 0) != (keyB.Stamp == 0)) return keyA.Stamp == 0;
+		if (keyA.Culled != keyB.Culled) return keyB.Culled;
+		if (keyA.Stamp != keyB.Stamp) return keyA.Stamp < keyB.Stamp;
+
+		return keyA.Dist < keyB.Dist;
+	});
+}
+
+void RayCaster::relightBricks(CommandList* pCommandList, uint8_t frameIndex, const uint32_t* pBricks, uint32_t numBricks)
+{
 	// Set pipeline state
 	pCommandList->SetComputePipelineLayout(m_pipelineLayouts[RAY_MARCH_L]);
 	pCommandList->SetPipelineState(m_pipelines[RAY_MARCH_L]);
@@ -436,10 +1127,76 @@ void RayCaster::RayMarchL(const CommandList* pCommandList, uint8_t frameIndex)
 	pCommandList->SetComputeDescriptorTable(2, m_srvTables[SRV_TABLE_SHADOW]);
 	pCommandList->SetCompute32BitConstant(3, m_maxLightSamples);
 	pCommandList->SetCompute32BitConstant(3, m_coeffSH ? 1 : 0, 1);
-	if (m_coeffSH) pCommandList->SetComputeRootShaderResourceView(4, m_coeffSH.get());
+	pCommandList->SetComputeDescriptorTable(4, m_srvTables[SRV_TABLE_MACRO_CELLS]);
 
-	// Dispatch grid
-	pCommandList->Dispatch(XUSG_DIV_UP(m_lightGridSize, 4), XUSG_DIV_UP(m_lightGridSize, 4), XUSG_DIV_UP(m_lightGridSize, 4));
+	// Dispatch the whole map at once if all bricks are re-lit
+	if (numBricks == m_lightBrickStamps.size())
+	{
+		const XMUINT3 regionMin(0, 0, 0);
+		pCommandList->SetCompute32BitConstants(5, 3, &regionMin);
+		pCommandList->Dispatch(XUSG_DIV_UP(m_lightGridSize.x, 4), XUSG_DIV_UP(m_lightGridSize.y, 4), XUSG_DIV_UP(m_lightGridSize.z, 4));
+		return;
+	}
+
+	// The bricks are disjoint, so the dispatches need no UAV barriers in between
+	const auto numGroups = g_lightBrickSize / 4;
+	for (auto i = 0u; i < numBricks; ++i)
+	{
+		const auto brick = pBricks[i];
+		const XMUINT3 regionMin
+		(
+			brick % m_lightBrickCount.x * g_lightBrickSize,
+			brick / m_lightBrickCount.x % m_lightBrickCount.y * g_lightBrickSize,
+			brick / (m_lightBrickCount.x * m_lightBrickCount.y) * g_lightBrickSize
+		);
+		pCommandList->SetCompute32BitConstants(5, 3, &regionMin);
+		pCommandList->Dispatch(numGroups, numGroups, numGroups);
+	}
+}
+
+void RayCaster::rayMarchLSweep(CommandList* pCommandList, uint8_t frameIndex)
+{
+	// Set barriers
+	ResourceBarrier barriers[2];
+	auto numBarriers = m_lightMap->SetBarrier(barriers, ResourceState::UNORDERED_ACCESS);
+	numBarriers = m_transm->SetBarrier(barriers, ResourceState::UNORDERED_ACCESS, numBarriers);
+	pCommandList->Barrier(numBarriers, barriers);
+
+	// Set pipeline state
+	pCommandList->SetComputePipelineLayout(m_pipelineLayouts[RAY_MARCH_L_SWEEP]);
+	pCommandList->SetPipelineState(m_pipelines[RAY_MARCH_L_SWEEP]);
+
+	// Set descriptor tables
+	pCommandList->SetComputeDescriptorTable(0, m_cbvTables[frameIndex]);
+	pCommandList->SetComputeDescriptorTable(1, m_srvUavTable);
+	pCommandList->SetComputeDescriptorTable(2, m_srvTables[SRV_TABLE_SHADOW]);
+	pCommandList->SetCompute32BitConstant(3, m_maxLightSamples);
+	pCommandList->SetCompute32BitConstant(3, m_coeffSH ? 1 : 0, 1);
+	pCommandList->SetComputeDescriptorTable(5, m_srvTables[SRV_TABLE_MACRO_CELLS]);
+
+	// Same sweep axis as CSRayMarchLSweep, the dominant axis of the light direction
+	XMFLOAT3 lightDir;
+	const auto worldI = XMMatrixInverse(nullptr, XMLoadFloat3x4(&m_volumeWorld));
+	XMStoreFloat3(&lightDir, XMVectorAbs(XMVector3TransformNormal(XMLoadFloat3(&m_lightPt), worldI)));
+	const uint8_t axis = lightDir.x >= lightDir.y ? (lightDir.x >= lightDir.z ? 0 : 2) : (lightDir.y >= lightDir.z ? 1 : 2);
+	const auto pGridSize = &m_lightGridSize.x;
+	const auto numSlices = pGridSize[axis];
+	const auto numGroupsU = XUSG_DIV_UP(pGridSize[(axis + 1) % 3], 8);
+	const auto numGroupsV = XUSG_DIV_UP(pGridSize[(axis + 2) % 3], 8);
+
+	// Sweep the slices from the light-facing side; each slice reads the transmittance
+	// written by the previous one, so the slices are serialized by UAV barriers.
+	for (auto i = 0u; i < numSlices; ++i)
+	{
+		if (i > 0)
+		{
+			numBarriers = m_transm->SetBarrier(barriers, ResourceState::UNORDERED_ACCESS);
+			pCommandList->Barrier(numBarriers, barriers);
+		}
+
+		pCommandList->SetCompute32BitConstant(4, i);
+		pCommandList->Dispatch(numGroupsU, numGroupsV, 1);
+	}
 }
 
 bool RayCaster::createPipelineLayouts()
@@ -475,6 +1232,76 @@ bool RayCaster::createPipelineLayouts()
 			PipelineLayoutFlag::NONE, L"InitGridDataLayout"), false);
 	}
 
+	// Update volume region
+	{
+		const auto pipelineLayout = Util::PipelineLayout::MakeUnique();
+		pipelineLayout->SetRootSRV(0, 0);
+		pipelineLayout->SetRange(1, DescriptorType::UAV, 1, 0, 0, DescriptorFlag::DATA_STATIC_WHILE_SET_AT_EXECUTE);
+		pipelineLayout->SetConstants(2, 7, 0);
+		XUSG_X_RETURN(m_pipelineLayouts[UPDATE_VOLUME_REGION], pipelineLayout->GetPipelineLayout(m_pipelineLayoutLib.get(),
+			PipelineLayoutFlag::NONE, L"VolumeRegionUpdateLayout"), false);
+	}
+
+	// Generate volume mips
+	{
+		const auto pipelineLayout = Util::PipelineLayout::MakeUnique();
+		pipelineLayout->SetRange(0, DescriptorType::SRV, 1, 0);
+		pipelineLayout->SetRange(0, DescriptorType::UAV, 1, 0, 0, DescriptorFlag::DATA_STATIC_WHILE_SET_AT_EXECUTE);
+		pipelineLayout->SetConstants(1, 4, 0);
+		pipelineLayout->SetStaticSamplers(pSamplers, 1, 0);
+		XUSG_X_RETURN(m_pipelineLayouts[GEN_VOLUME_MIPS], pipelineLayout->GetPipelineLayout(m_pipelineLayoutLib.get(),
+			PipelineLayoutFlag::NONE, L"VolumeMipGenerationLayout"), false);
+	}
+
+	// Build macro cells
+	{
+		const auto pipelineLayout = Util::PipelineLayout::MakeUnique();
+		pipelineLayout->SetRange(0, DescriptorType::SRV, 1, 0);
+		pipelineLayout->SetRange(1, DescriptorType::UAV, 1, 0, 0, DescriptorFlag::DATA_STATIC_WHILE_SET_AT_EXECUTE);
+		pipelineLayout->SetConstants(2, 3, 0);
+		XUSG_X_RETURN(m_pipelineLayouts[BUILD_MACRO_CELLS], pipelineLayout->GetPipelineLayout(m_pipelineLayoutLib.get(),
+			PipelineLayoutFlag::NONE, L"MacroCellBuildingLayout"), false);
+	}
+
+	// Build occupancy
+	{
+		const auto pipelineLayout = Util::PipelineLayout::MakeUnique();
+		pipelineLayout->SetRange(0, DescriptorType::SRV, 1, 0);
+		pipelineLayout->SetRange(1, DescriptorType::SRV, 1, 1);
+		pipelineLayout->SetRange(2, DescriptorType::UAV, 1, 0, 0, DescriptorFlag::DATA_STATIC_WHILE_SET_AT_EXECUTE);
+		XUSG_X_RETURN(m_pipelineLayouts[BUILD_OCCUPANCY], pipelineLayout->GetPipelineLayout(m_pipelineLayoutLib.get(),
+			PipelineLayoutFlag::NONE, L"OccupancyBuildingLayout"), false);
+	}
+
+#ifdef _GRADIENT_VOLUME_
+	// Build gradients
+	{
+		const auto pipelineLayout = Util::PipelineLayout::MakeUnique();
+		pipelineLayout->SetRange(0, DescriptorType::SRV, 1, 0);
+		pipelineLayout->SetRange(1, DescriptorType::UAV, 1, 0, 0, DescriptorFlag::DATA_STATIC_WHILE_SET_AT_EXECUTE);
+		pipelineLayout->SetConstants(2, 3, 0);
+		XUSG_X_RETURN(m_pipelineLayouts[BUILD_GRADIENTS], pipelineLayout->GetPipelineLayout(m_pipelineLayoutLib.get(),
+			PipelineLayoutFlag::NONE, L"GradientBuildingLayout"), false);
+	}
+#endif
+
+	// Bake irradiance
+	{
+		const auto pipelineLayout = Util::PipelineLayout::MakeUnique();
+		pipelineLayout->SetRange(0, DescriptorType::CBV, 1, 0, 0, DescriptorFlag::DATA_STATIC);
+		pipelineLayout->SetRange(1, DescriptorType::SRV, 1, 0);
+		pipelineLayout->SetRange(2, DescriptorType::UAV, 1, 0, 0, DescriptorFlag::DATA_STATIC_WHILE_SET_AT_EXECUTE);
+		pipelineLayout->SetConstants(3, 1, 1);
+		pipelineLayout->SetRootSRV(4, 1);
+		pipelineLayout->SetRange(5, DescriptorType::SRV, 1, 2);
+#ifdef _GRADIENT_VOLUME_
+		pipelineLayout->SetRange(6, DescriptorType::SRV, 1, 3);
+#endif
+		pipelineLayout->SetStaticSamplers(pSamplers, 1, 0);
+		XUSG_X_RETURN(m_pipelineLayouts[BAKE_IRRADIANCE], pipelineLayout->GetPipelineLayout(m_pipelineLayoutLib.get(),
+			PipelineLayoutFlag::NONE, L"IrradianceBakingLayout"), false);
+	}
+
 	// Ray marching
 	{
 		const auto pipelineLayout = Util::PipelineLayout::MakeUnique();
@@ -483,11 +1310,13 @@ bool RayCaster::createPipelineLayouts()
 		pipelineLayout->SetRange(2, DescriptorType::SRV, 1, 0);
 		pipelineLayout->SetRange(3, DescriptorType::SRV, 2, 1);
 		pipelineLayout->SetConstants(4, 3, 2);
-		pipelineLayout->SetRootSRV(5, 3);
+		pipelineLayout->SetRange(5, DescriptorType::SRV, 1, 3);
+		pipelineLayout->SetRange(6, DescriptorType::SRV, 1, 4);
+		pipelineLayout->SetRootSRV(7, 5);
 #if _CPU_CUBE_FACE_CULL_ == 1
-		pipelineLayout->SetConstants(6, 1, 3);
+		pipelineLayout->SetConstants(8, 1, 3);
 #elif _CPU_CUBE_FACE_CULL_ == 2
-		pipelineLayout->SetRootCBV(6, 3);
+		pipelineLayout->SetRootCBV(8, 3);
 #endif
 		pipelineLayout->SetStaticSamplers(pLitSamplers, static_cast<uint32_t>(size(pLitSamplers)), 0);
 		XUSG_X_RETURN(m_pipelineLayouts[RAY_MARCH], pipelineLayout->GetPipelineLayout(m_pipelineLayoutLib.get(),
@@ -502,12 +1331,28 @@ bool RayCaster::createPipelineLayouts()
 		pipelineLayout->SetRange(1, DescriptorType::UAV, 1, 0, 0, DescriptorFlag::DATA_STATIC_WHILE_SET_AT_EXECUTE);
 		pipelineLayout->SetRange(2, DescriptorType::SRV, 1, 1);
 		pipelineLayout->SetConstants(3, 2, 2);
-		pipelineLayout->SetRootSRV(4, 2);
+		pipelineLayout->SetRange(4, DescriptorType::SRV, 1, 2);
+		pipelineLayout->SetConstants(5, 3, 3);
 		pipelineLayout->SetStaticSamplers(pLitSamplers, 2, 0);
 		XUSG_X_RETURN(m_pipelineLayouts[RAY_MARCH_L], pipelineLayout->GetPipelineLayout(m_pipelineLayoutLib.get(),
 			PipelineLayoutFlag::NONE, L"LightSpaceRayMarchingLayout"), false);
 	}
 
+	// Light space slice sweeping
+	{
+		const auto pipelineLayout = Util::PipelineLayout::MakeUnique();
+		pipelineLayout->SetRange(0, DescriptorType::CBV, 2, 0, 0, DescriptorFlag::DATA_STATIC);
+		pipelineLayout->SetRange(1, DescriptorType::SRV, 1, 0);
+		pipelineLayout->SetRange(1, DescriptorType::UAV, 2, 0, 0, DescriptorFlag::DATA_VOLATILE);
+		pipelineLayout->SetRange(2, DescriptorType::SRV, 1, 1);
+		pipelineLayout->SetConstants(3, 2, 2);
+		pipelineLayout->SetConstants(4, 1, 3);
+		pipelineLayout->SetRange(5, DescriptorType::SRV, 1, 2);
+		pipelineLayout->SetStaticSamplers(pLitSamplers, 2, 0);
+		XUSG_X_RETURN(m_pipelineLayouts[RAY_MARCH_L_SWEEP], pipelineLayout->GetPipelineLayout(m_pipelineLayoutLib.get(),
+			PipelineLayoutFlag::NONE, L"LightSpaceSliceSweepingLayout"), false);
+	}
+
 	// View space ray marching
 	{
 		const auto pipelineLayout = Util::PipelineLayout::MakeUnique();
@@ -515,11 +1360,14 @@ bool RayCaster::createPipelineLayouts()
 		pipelineLayout->SetRange(1, DescriptorType::UAV, 2, 0, 0, DescriptorFlag::DATA_STATIC_WHILE_SET_AT_EXECUTE);
 		pipelineLayout->SetRange(2, DescriptorType::SRV, 2, 0);
 		pipelineLayout->SetRange(3, DescriptorType::SRV, 1, 2);
-		pipelineLayout->SetConstants(4, 1, 2);
+		pipelineLayout->SetConstants(4, 2, 2);
+		pipelineLayout->SetRange(5, DescriptorType::SRV, 1, 3);
+		pipelineLayout->SetRange(6, DescriptorType::SRV, 1, 4);
+		pipelineLayout->SetRootSRV(7, 5);
 #if _CPU_CUBE_FACE_CULL_ == 1
-		pipelineLayout->SetConstants(5, 1, 3);
+		pipelineLayout->SetConstants(8, 1, 3);
 #elif _CPU_CUBE_FACE_CULL_ == 2
-		pipelineLayout->SetRootCBV(5, 3);
+		pipelineLayout->SetRootCBV(8, 3);
 #endif
 		pipelineLayout->SetStaticSamplers(pSamplers, static_cast<uint32_t>(size(pSamplers)), 0);
 		XUSG_X_RETURN(m_pipelineLayouts[RAY_MARCH_V], pipelineLayout->GetPipelineLayout(m_pipelineLayoutLib.get(),
@@ -560,11 +1408,15 @@ bool RayCaster::createPipelineLayouts()
 		pipelineLayout->SetRange(1, DescriptorType::SRV, 1, 0);
 		pipelineLayout->SetRange(2, DescriptorType::SRV, 2, 1);
 		pipelineLayout->SetConstants(3, 3, 2, 0, Shader::Stage::PS);
-		pipelineLayout->SetRootSRV(4, 3, 0, DescriptorFlag::NONE, Shader::Stage::PS);
+		pipelineLayout->SetRange(4, DescriptorType::SRV, 1, 3);
+		pipelineLayout->SetRange(5, DescriptorType::SRV, 1, 4);
+		pipelineLayout->SetRootSRV(6, 5, 0, DescriptorFlag::NONE, Shader::Stage::PS);
 		pipelineLayout->SetStaticSamplers(pLitSamplers, 2, 0, 0, Shader::Stage::PS);
 		pipelineLayout->SetShaderStage(0, Shader::Stage::PS);
 		pipelineLayout->SetShaderStage(1, Shader::Stage::PS);
 		pipelineLayout->SetShaderStage(2, Shader::Stage::PS);
+		pipelineLayout->SetShaderStage(4, Shader::Stage::PS);
+		pipelineLayout->SetShaderStage(5, Shader::Stage::PS);
 		XUSG_X_RETURN(m_pipelineLayouts[DIRECT_RAY_CAST], pipelineLayout->GetPipelineLayout(m_pipelineLayoutLib.get(),
 			PipelineLayoutFlag::NONE, L"DirectRayCastingLayout"), false);
 	}
@@ -575,11 +1427,16 @@ bool RayCaster::createPipelineLayouts()
 		pipelineLayout->SetRange(0, DescriptorType::CBV, 2, 0, 0, DescriptorFlag::DATA_STATIC);
 		pipelineLayout->SetRange(1, DescriptorType::SRV, 2, 0);
 		pipelineLayout->SetRange(2, DescriptorType::SRV, 1, 2);
-		pipelineLayout->SetConstants(3, 1, 2, 0, Shader::Stage::PS);
+		pipelineLayout->SetConstants(3, 2, 2, 0, Shader::Stage::PS);
+		pipelineLayout->SetRange(4, DescriptorType::SRV, 1, 3);
+		pipelineLayout->SetRange(5, DescriptorType::SRV, 1, 4);
+		pipelineLayout->SetRootSRV(6, 5, 0, DescriptorFlag::NONE, Shader::Stage::PS);
 		pipelineLayout->SetStaticSamplers(pSamplers, 1, 0, 0, Shader::Stage::PS);
 		pipelineLayout->SetShaderStage(0, Shader::Stage::PS);
 		pipelineLayout->SetShaderStage(1, Shader::Stage::PS);
 		pipelineLayout->SetShaderStage(2, Shader::Stage::PS);
+		pipelineLayout->SetShaderStage(4, Shader::Stage::PS);
+		pipelineLayout->SetShaderStage(5, Shader::Stage::PS);
 		XUSG_X_RETURN(m_pipelineLayouts[DIRECT_RAY_CAST_V], pipelineLayout->GetPipelineLayout(m_pipelineLayoutLib.get(),
 			PipelineLayoutFlag::NONE, L"ViewSpaceDirectRayCastingLayout"), false);
 	}
@@ -595,7 +1452,8 @@ bool RayCaster::createPipelines(Format rtFormat)
 
 	// Load grid data
 	{
-		XUSG_N_RETURN(m_shaderLib->CreateShader(Shader::Stage::CS, csIndex, L"CSR32FToRGBA16F.cso"), false);
+		XUSG_N_RETURN(m_shaderLib->CreateShader(Shader::Stage::CS, csIndex,
+			m_densityOnly ? L"CSR32FToDensity.cso" : L"CSR32FToRGBA16F.cso"), false);
 
 		const auto state = Compute::State::MakeUnique();
 		state->SetPipelineLayout(m_pipelineLayouts[LOAD_VOLUME_DATA]);
@@ -613,6 +1471,68 @@ bool RayCaster::createPipelines(Format rtFormat)
 		XUSG_X_RETURN(m_pipelines[INIT_VOLUME_DATA], state->GetPipeline(m_computePipelineLib.get(), L"InitGridData"), false);
 	}
 
+	// Update volume region
+	{
+		XUSG_N_RETURN(m_shaderLib->CreateShader(Shader::Stage::CS, csIndex, L"CSVolumeRegion.cso"), false);
+
+		const auto state = Compute::State::MakeUnique();
+		state->SetPipelineLayout(m_pipelineLayouts[UPDATE_VOLUME_REGION]);
+		state->SetShader(m_shaderLib->GetShader(Shader::Stage::CS, csIndex++));
+		XUSG_X_RETURN(m_pipelines[UPDATE_VOLUME_REGION], state->GetPipeline(m_computePipelineLib.get(), L"UpdateVolumeRegion"), false);
+	}
+
+	// Generate volume mips
+	{
+		XUSG_N_RETURN(m_shaderLib->CreateShader(Shader::Stage::CS, csIndex, L"CSVolumeMip.cso"), false);
+
+		const auto state = Compute::State::MakeUnique();
+		state->SetPipelineLayout(m_pipelineLayouts[GEN_VOLUME_MIPS]);
+		state->SetShader(m_shaderLib->GetShader(Shader::Stage::CS, csIndex++));
+		XUSG_X_RETURN(m_pipelines[GEN_VOLUME_MIPS], state->GetPipeline(m_computePipelineLib.get(), L"GenerateVolumeMips"), false);
+	}
+
+	// Build macro cells
+	{
+		XUSG_N_RETURN(m_shaderLib->CreateShader(Shader::Stage::CS, csIndex, L"CSMacroCell.cso"), false);
+
+		const auto state = Compute::State::MakeUnique();
+		state->SetPipelineLayout(m_pipelineLayouts[BUILD_MACRO_CELLS]);
+		state->SetShader(m_shaderLib->GetShader(Shader::Stage::CS, csIndex++));
+		XUSG_X_RETURN(m_pipelines[BUILD_MACRO_CELLS], state->GetPipeline(m_computePipelineLib.get(), L"BuildMacroCells"), false);
+	}
+
+	// Build occupancy
+	{
+		XUSG_N_RETURN(m_shaderLib->CreateShader(Shader::Stage::CS, csIndex, L"CSOccupancy.cso"), false);
+
+		const auto state = Compute::State::MakeUnique();
+		state->SetPipelineLayout(m_pipelineLayouts[BUILD_OCCUPANCY]);
+		state->SetShader(m_shaderLib->GetShader(Shader::Stage::CS, csIndex++));
+		XUSG_X_RETURN(m_pipelines[BUILD_OCCUPANCY], state->GetPipeline(m_computePipelineLib.get(), L"BuildOccupancy"), false);
+	}
+
+#ifdef _GRADIENT_VOLUME_
+	// Build gradients
+	{
+		XUSG_N_RETURN(m_shaderLib->CreateShader(Shader::Stage::CS, csIndex, L"CSGradient.cso"), false);
+
+		const auto state = Compute::State::MakeUnique();
+		state->SetPipelineLayout(m_pipelineLayouts[BUILD_GRADIENTS]);
+		state->SetShader(m_shaderLib->GetShader(Shader::Stage::CS, csIndex++));
+		XUSG_X_RETURN(m_pipelines[BUILD_GRADIENTS], state->GetPipeline(m_computePipelineLib.get(), L"BuildGradients"), false);
+	}
+#endif
+
+	// Bake irradiance
+	{
+		XUSG_N_RETURN(m_shaderLib->CreateShader(Shader::Stage::CS, csIndex, L"CSIrradiance.cso"), false);
+
+		const auto state = Compute::State::MakeUnique();
+		state->SetPipelineLayout(m_pipelineLayouts[BAKE_IRRADIANCE]);
+		state->SetShader(m_shaderLib->GetShader(Shader::Stage::CS, csIndex++));
+		XUSG_X_RETURN(m_pipelines[BAKE_IRRADIANCE], state->GetPipeline(m_computePipelineLib.get(), L"BakeIrradiance"), false);
+	}
+
 	// Ray marching
 	{
 		XUSG_N_RETURN(m_shaderLib->CreateShader(Shader::Stage::CS, csIndex, L"CSRayMarch.cso"), false);
@@ -633,6 +1553,16 @@ bool RayCaster::createPipelines(Format rtFormat)
 		XUSG_X_RETURN(m_pipelines[RAY_MARCH_L], state->GetPipeline(m_computePipelineLib.get(), L"LightSpaceRayMarching"), false);
 	}
 
+	// Light space slice sweeping
+	{
+		XUSG_N_RETURN(m_shaderLib->CreateShader(Shader::Stage::CS, csIndex, L"CSRayMarchLSweep.cso"), false);
+
+		const auto state = Compute::State::MakeUnique();
+		state->SetPipelineLayout(m_pipelineLayouts[RAY_MARCH_L_SWEEP]);
+		state->SetShader(m_shaderLib->GetShader(Shader::Stage::CS, csIndex++));
+		XUSG_X_RETURN(m_pipelines[RAY_MARCH_L_SWEEP], state->GetPipeline(m_computePipelineLib.get(), L"LightSpaceSliceSweeping"), false);
+	}
+
 	// View space ray marching
 	{
 		XUSG_N_RETURN(m_shaderLib->CreateShader(Shader::Stage::CS, csIndex, L"CSRayMarchV.cso"), false);
@@ -753,13 +1683,34 @@ bool RayCaster::createDescriptorTables()
 		XUSG_X_RETURN(m_srvTables[SRV_TABLE_LIGHT_MAP], descriptorTable->GetCbvSrvUavTable(m_descriptorTableLib.get()), false);
 	}
 
+	{
+		const auto descriptorTable = Util::DescriptorTable::MakeUnique();
+		descriptorTable->SetDescriptors(0, 1, &m_macroCells->GetSRV());
+		XUSG_X_RETURN(m_srvTables[SRV_TABLE_MACRO_CELLS], descriptorTable->GetCbvSrvUavTable(m_descriptorTableLib.get()), false);
+	}
+
+#ifdef _GRADIENT_VOLUME_
+	{
+		const auto descriptorTable = Util::DescriptorTable::MakeUnique();
+		descriptorTable->SetDescriptors(0, 1, &m_gradient->GetSRV());
+		XUSG_X_RETURN(m_srvTables[SRV_TABLE_GRADIENT], descriptorTable->GetCbvSrvUavTable(m_descriptorTableLib.get()), false);
+	}
+#endif
+
+	{
+		const auto descriptorTable = Util::DescriptorTable::MakeUnique();
+		descriptorTable->SetDescriptors(0, 1, &m_irradiance->GetSRV());
+		XUSG_X_RETURN(m_srvTables[SRV_TABLE_IRRADIANCE], descriptorTable->GetCbvSrvUavTable(m_descriptorTableLib.get()), false);
+	}
+
 	// Create SRV and UAV table
 	{
 		const auto descriptorTable = Util::DescriptorTable::MakeUnique();
 		const Descriptor descriptors[] =
 		{
 			m_volume->GetSRV(),
-			m_lightMap->GetUAV()
+			m_lightMap->GetUAV(),
+			m_transm->GetUAV()
 		};
 		descriptorTable->SetDescriptors(0, static_cast<uint32_t>(size(descriptors)), descriptors);
 		XUSG_X_RETURN(m_srvUavTable, descriptorTable->GetCbvSrvUavTable(m_descriptorTableLib.get()), false);
@@ -803,6 +1754,47 @@ bool RayCaster::createDescriptorTables()
 		XUSG_X_RETURN(m_uavTable, descriptorTable->GetCbvSrvUavTable(m_descriptorTableLib.get()), false);
 	}
 
+	{
+		const auto descriptorTable = Util::DescriptorTable::MakeUnique();
+		descriptorTable->SetDescriptors(0, 1, &m_macroCells->GetUAV());
+		XUSG_X_RETURN(m_macroCellUavTable, descriptorTable->GetCbvSrvUavTable(m_descriptorTableLib.get()), false);
+	}
+
+	{
+		const auto descriptorTable = Util::DescriptorTable::MakeUnique();
+		descriptorTable->SetDescriptors(0, 1, &m_occupancy->GetUAV());
+		XUSG_X_RETURN(m_occupancyUavTable, descriptorTable->GetCbvSrvUavTable(m_descriptorTableLib.get()), false);
+	}
+
+#ifdef _GRADIENT_VOLUME_
+	{
+		const auto descriptorTable = Util::DescriptorTable::MakeUnique();
+		descriptorTable->SetDescriptors(0, 1, &m_gradient->GetUAV());
+		XUSG_X_RETURN(m_gradientUavTable, descriptorTable->GetCbvSrvUavTable(m_descriptorTableLib.get()), false);
+	}
+#endif
+
+	{
+		const auto descriptorTable = Util::DescriptorTable::MakeUnique();
+		descriptorTable->SetDescriptors(0, 1, &m_irradiance->GetUAV());
+		XUSG_X_RETURN(m_irradianceUavTable, descriptorTable->GetCbvSrvUavTable(m_descriptorTableLib.get()), false);
+	}
+
+	// Create SRV and UAV tables for the volume mip generation
+	const uint8_t numVolumeMips = m_volume->GetNumMips();
+	m_volumeMipTables.resize(numVolumeMips - 1);
+	for (uint8_t i = 1; i < numVolumeMips; ++i)
+	{
+		const auto descriptorTable = Util::DescriptorTable::MakeUnique();
+		const Descriptor descriptors[] =
+		{
+			m_volume->GetSRV(i - 1, true),
+			m_volume->GetUAV(i)
+		};
+		descriptorTable->SetDescriptors(0, static_cast<uint32_t>(size(descriptors)), descriptors);
+		XUSG_X_RETURN(m_volumeMipTables[i - 1], descriptorTable->GetCbvSrvUavTable(m_descriptorTableLib.get()), false);
+	}
+
 	return true;
 }
 
@@ -831,15 +1823,17 @@ void RayCaster::rayMarch(CommandList* pCommandList, uint8_t frameIndex)
 	pCommandList->SetCompute32BitConstant(4, m_raySampleCount);
 	pCommandList->SetCompute32BitConstant(4, m_coeffSH ? 1 : 0, 1);
 	pCommandList->SetCompute32BitConstant(4, m_maxLightSamples, 2);
-	if (m_coeffSH) pCommandList->SetComputeRootShaderResourceView(5, m_coeffSH.get());
+	pCommandList->SetComputeDescriptorTable(5, m_srvTables[SRV_TABLE_IRRADIANCE]);
+	pCommandList->SetComputeDescriptorTable(6, m_srvTables[SRV_TABLE_MACRO_CELLS]);
+	if (m_colorLUT) pCommandList->SetComputeRootShaderResourceView(7, m_colorLUT.get());
 #if _CPU_CUBE_FACE_CULL_ == 1
-	pCommandList->SetCompute32BitConstant(6, m_visibilityMask);
+	pCommandList->SetCompute32BitConstant(8, m_visibilityMask);
 #elif _CPU_CUBE_FACE_CULL_ == 2
-	pCommandList->SetComputeRootConstantBufferView(5, m_cbCubeFaceList.get(), m_cbCubeFaceList->GetCBVOffset(frameIndex));
+	pCommandList->SetComputeRootConstantBufferView(8, m_cbCubeFaceList.get(), m_cbCubeFaceList->GetCBVOffset(frameIndex));
 #endif
 
 	// Dispatch cube
-	const auto gridSize = m_gridSize >> m_cubeMapLOD;
+	const auto gridSize = m_cubeMap->GetWidth() >> m_cubeMapLOD;
 	pCommandList->Dispatch(XUSG_DIV_UP(gridSize, 8), XUSG_DIV_UP(gridSize, 8), m_cubeFaceCount);
 }
 
@@ -867,14 +1861,18 @@ void RayCaster::rayMarchV(CommandList* pCommandList, uint8_t frameIndex)
 	pCommandList->SetComputeDescriptorTable(2, m_srvTables[SRV_TABLE_VOLUME]);
 	pCommandList->SetComputeDescriptorTable(3, m_srvTables[SRV_TABLE_DEPTH]);
 	pCommandList->SetCompute32BitConstant(4, m_raySampleCount);
+	pCommandList->SetCompute32BitConstant(4, m_coeffSH ? 1 : 0, 1);
+	pCommandList->SetComputeDescriptorTable(5, m_srvTables[SRV_TABLE_IRRADIANCE]);
+	pCommandList->SetComputeDescriptorTable(6, m_srvTables[SRV_TABLE_MACRO_CELLS]);
+	if (m_colorLUT) pCommandList->SetComputeRootShaderResourceView(7, m_colorLUT.get());
 #if _CPU_CUBE_FACE_CULL_ == 1
-	pCommandList->SetCompute32BitConstant(5, m_visibilityMask);
+	pCommandList->SetCompute32BitConstant(8, m_visibilityMask);
 #elif _CPU_CUBE_FACE_CULL_ == 2
-	pCommandList->SetComputeRootConstantBufferView(5, m_cbCubeFaceList.get(), m_cbCubeFaceList->GetCBVOffset(frameIndex));
+	pCommandList->SetComputeRootConstantBufferView(8, m_cbCubeFaceList.get(), m_cbCubeFaceList->GetCBVOffset(frameIndex));
 #endif
 
 	// Dispatch cube
-	const auto gridSize = m_gridSize >> m_cubeMapLOD;
+	const auto gridSize = m_cubeMap->GetWidth() >> m_cubeMapLOD;
 	pCommandList->Dispatch(XUSG_DIV_UP(gridSize, 8), XUSG_DIV_UP(gridSize, 8), m_cubeFaceCount);
 }
 
@@ -951,7 +1949,9 @@ void RayCaster::rayCastDirect(CommandList* pCommandList, uint8_t frameIndex)
 	pCommandList->SetGraphics32BitConstant(3, m_maxRaySamples);
 	pCommandList->SetGraphics32BitConstant(3, m_coeffSH ? 1 : 0, 1);
 	pCommandList->SetGraphics32BitConstant(3, m_maxLightSamples, 2);
-	if (m_coeffSH) pCommandList->SetGraphicsRootShaderResourceView(4, m_coeffSH.get());
+	pCommandList->SetGraphicsDescriptorTable(4, m_srvTables[SRV_TABLE_IRRADIANCE]);
+	pCommandList->SetGraphicsDescriptorTable(5, m_srvTables[SRV_TABLE_MACRO_CELLS]);
+	if (m_colorLUT) pCommandList->SetGraphicsRootShaderResourceView(6, m_colorLUT.get());
 
 	pCommandList->Draw(3, 1, 0, 0);
 }
@@ -975,6 +1975,10 @@ void RayCaster::rayCastVDirect(CommandList* pCommandList, uint8_t frameIndex)
 	pCommandList->SetGraphicsDescriptorTable(1, m_srvTables[SRV_TABLE_VOLUME]);
 	pCommandList->SetGraphicsDescriptorTable(2, m_srvTables[SRV_TABLE_DEPTH]);
 	pCommandList->SetGraphics32BitConstant(3, m_maxRaySamples);
+	pCommandList->SetGraphics32BitConstant(3, m_coeffSH ? 1 : 0, 1);
+	pCommandList->SetGraphicsDescriptorTable(4, m_srvTables[SRV_TABLE_IRRADIANCE]);
+	pCommandList->SetGraphicsDescriptorTable(5, m_srvTables[SRV_TABLE_MACRO_CELLS]);
+	if (m_colorLUT) pCommandList->SetGraphicsRootShaderResourceView(6, m_colorLUT.get());
 
 	pCommandList->Draw(3, 1, 0, 0);
 }
@@ -5,6 +5,7 @@
 #pragma once
 
 #include "Core/XUSG.h"
+#include "VolumeResampler.h"
 
 class RayCaster
 {
@@ -14,16 +15,38 @@ public:
 		RAY_MARCH_DIRECT	= 0,
 		RAY_MARCH_CUBEMAP	= (1 << 0),
 		SEPARATE_LIGHT_PASS	= (1 << 1),
+		SLICE_SWEEP_LIGHT	= (1 << 2),
 		OPTIMIZED = RAY_MARCH_CUBEMAP | SEPARATE_LIGHT_PASS
 	};
 
 	RayCaster();
 	virtual ~RayCaster();
 
+	// Single-channel volume formats (R8_UNORM, R16_UNORM or R16_FLOAT) store densities only, which
+	// suits LoadVolumeData(); the colors of InitVolumeData() need R16G16B16A16_FLOAT.
+	// gridSize and lightGridSize are the resolutions of the longest axis, and the other axes follow
+	// the aspect of pVolumeSize (the size of the volume file, see GetVolumeFileSize()), or are the
+	// same if it is null; a gridSize of 0 takes pVolumeSize as it is.
 	bool Init(const XUSG::Device* pDevice, const XUSG::DescriptorTableLib::sptr& descriptorTableLib,
-		XUSG::Format rtFormat, uint32_t gridSize, uint32_t lightGridSize, const XUSG::DepthStencil::uptr* depths);
+		XUSG::Format rtFormat, uint32_t gridSize, uint32_t lightGridSize, const XUSG::DepthStencil::uptr* depths,
+		XUSG::Format volumeFormat = XUSG::Format::R16G16B16A16_FLOAT, const DirectX::XMUINT3* pVolumeSize = nullptr);
 	bool LoadVolumeData(XUSG::CommandList* pCommandList, const wchar_t* fileName, std::vector<XUSG::Resource::uptr>& uploaders);
+
+	// Replaces the volume data with the texels of another file of the same size and uncompressed format
+	// as that of LoadVolumeData() (a frame of a time series), uploaded through a buffer of frameIndex,
+	// which is released once the GPU has completed the frame; it needs no wait for the GPU, as the
+	// commands of the volume follow those of the previous frames in the queue.
+	bool UpdateVolumeData(XUSG::CommandList* pCommandList, const void* pTexels, uint8_t frameIndex);
+
+	// Replaces the densities of the voxels [minCorner, maxCorner) with pDensities, x-major in the region
+	// (e.g. of sculpting or a local simulation), uploaded through a buffer of frameIndex like those of
+	// UpdateVolumeData(); only the mips, macro cells and gradients over the region are rebuilt, and only
+	// the light map of the region and its shadow is re-lit. The colors of RGBA volumes are kept.
+	bool UpdateVolumeRegion(XUSG::CommandList* pCommandList, const DirectX::XMUINT3& minCorner,
+		const DirectX::XMUINT3& maxCorner, const float* pDensities, uint8_t frameIndex);
 	bool SetDepthMaps(const XUSG::DepthStencil::uptr* depths);
+	bool SetColorLUT(XUSG::CommandList* pCommandList, const DirectX::XMFLOAT3* pColors,
+		uint32_t numColors, std::vector<XUSG::Resource::uptr>& uploaders);
 
 	void InitVolumeData(XUSG::CommandList* pCommandList);
 	void SetSH(const XUSG::StructuredBuffer::sptr& coeffSH);
@@ -33,7 +56,31 @@ public:
 	void SetAmbient(const DirectX::XMFLOAT3& color, float intensity);
 	void UpdateFrame(uint8_t frameIndex, DirectX::CXMMATRIX viewProj, const DirectX::XMFLOAT4X4& shadowVP, const DirectX::XMFLOAT3& eyePt);
 	void Render(XUSG::CommandList* pCommandList, uint8_t frameIndex, uint8_t flags = OPTIMIZED);
-	void RayMarchL(const XUSG::CommandList* pCommandList, uint8_t frameIndex);
+	void RayMarchL(XUSG::CommandList* pCommandList, uint8_t frameIndex, bool sliceSweep = false);
+
+	// The light map is only recomputed when its inputs change. These mark the changes the ray caster
+	// cannot see: new contents of the shadow map, or a volume update within the voxels
+	// [minCorner, maxCorner), which re-lights the region and its shadow only.
+	void InvalidateLightMap();
+	void InvalidateLightMap(const DirectX::XMUINT3& minCorner, const DirectX::XMUINT3& maxCorner);
+
+	// The light-probe GI (AO-weighted SH irradiance) is baked apart from the light map, and only
+	// re-baked when the volume, its transform or the SH changes; this marks new contents of the SH buffer.
+	void InvalidateIrradiance();
+
+	// Time-slices the re-lighting of the separate light pass: at most maxBricks stale light-map bricks
+	// of 16^3 texels (0 for unlimited) are re-lit per frame, bricks in the view frustum and the longest
+	// stale first, while no brick stays stale for more than maxStaleFrames frames. GPU time is not read
+	// back within the frame, so the budget is counted in bricks, whose cost scales with the light samples.
+	void SetLightMapBudget(uint32_t maxBricks, uint32_t maxStaleFrames = 8);
+
+	// Resamples volume files to the grid with filter on the CPU instead of trilinearly with CSR32FToRGBA16F,
+	// through the cache files of VolumeResampler, from the next LoadVolumeData() on; the file source is then
+	// of the grid size, which UpdateVolumeData() cannot update with frames of the volume file size.
+	void SetVolumeFilter(VolumeResampler::Filter filter);
+
+	// Reads the grid size of a DDS volume file from its header
+	static bool GetVolumeFileSize(const wchar_t* fileName, DirectX::XMUINT3& size);
 
 	static const uint8_t FrameCount = 3;
 
@@ -42,8 +89,15 @@ protected:
 	{
 		LOAD_VOLUME_DATA,
 		INIT_VOLUME_DATA,
+		UPDATE_VOLUME_REGION,
+		GEN_VOLUME_MIPS,
+		BUILD_MACRO_CELLS,
+		BUILD_OCCUPANCY,
+		BUILD_GRADIENTS,
+		BAKE_IRRADIANCE,
 		RAY_MARCH,
 		RAY_MARCH_L,
+		RAY_MARCH_L_SWEEP,
 		RAY_MARCH_V,
 		RAY_CAST,
 		RENDER_CUBE,
@@ -60,6 +114,9 @@ protected:
 		SRV_TABLE_LIGHT_MAP,
 		SRV_TABLE_DEPTH,
 		SRV_TABLE_SHADOW,
+		SRV_TABLE_MACRO_CELLS,
+		SRV_TABLE_GRADIENT,
+		SRV_TABLE_IRRADIANCE,
 
 		NUM_SRV_TABLE
 	};
@@ -70,10 +127,35 @@ protected:
 		SHADOW_MAP
 	};
 
+	// Inputs of the light pass, compared against those of the last one
+	struct LightPassInputs
+	{
+		DirectX::XMFLOAT4X4	ShadowViewProj;
+		DirectX::XMFLOAT3X4	World;
+		DirectX::XMFLOAT4	LightColor;
+		DirectX::XMFLOAT4	Ambient;
+		DirectX::XMFLOAT3	LightPt;
+		uint32_t			NumSamples;
+	};
+
 	bool createPipelineLayouts();
 	bool createPipelines(XUSG::Format rtFormat);
 	bool createDescriptorTables();
 
+	void convertVolumeData(XUSG::CommandList* pCommandList);
+	void generateVolumeMips(XUSG::CommandList* pCommandList);
+	void generateVolumeMips(XUSG::CommandList* pCommandList, DirectX::XMUINT3 minCorner, DirectX::XMUINT3 maxCorner);
+	void buildMacroCells(XUSG::CommandList* pCommandList);
+	void buildMacroCells(XUSG::CommandList* pCommandList, const DirectX::XMUINT3& cellMin, const DirectX::XMUINT3& cellMax);
+	void buildOccupancy(XUSG::CommandList* pCommandList);
+	void buildGradients(XUSG::CommandList* pCommandList);
+	void buildGradients(XUSG::CommandList* pCommandList, const DirectX::XMUINT3& minCorner, const DirectX::XMUINT3& maxCorner);
+	void bakeIrradiance(XUSG::CommandList* pCommandList, uint8_t frameIndex);
+	void getLightRegion(DirectX::XMUINT3& regionMin, DirectX::XMUINT3& regionMax) const;
+	void markLightBricks(const DirectX::XMUINT3& regionMin, const DirectX::XMUINT3& regionMax);
+	void sortLightBricks(std::vector<uint32_t>& bricks) const;
+	void relightBricks(XUSG::CommandList* pCommandList, uint8_t frameIndex, const uint32_t* pBricks, uint32_t numBricks);
+	void rayMarchLSweep(XUSG::CommandList* pCommandList, uint8_t frameIndex);
 	void rayMarch(XUSG::CommandList* pCommandList, uint8_t frameIndex);
 	void rayMarchV(XUSG::CommandList* pCommandList, uint8_t frameIndex);
 	void renderCube(XUSG::CommandList* pCommandList, uint8_t frameIndex);
@@ -94,16 +176,27 @@ protected:
 
 	std::vector<XUSG::DescriptorTable> m_uavMipTables;
 	std::vector<XUSG::DescriptorTable> m_srvMipTables;
+	std::vector<XUSG::DescriptorTable> m_volumeMipTables;
 	XUSG::DescriptorTable	m_cbvTables[FrameCount];
 	XUSG::DescriptorTable	m_srvUavTable;
 	XUSG::DescriptorTable	m_srvTables[NUM_SRV_TABLE];
 	XUSG::DescriptorTable	m_uavTable;
+	XUSG::DescriptorTable	m_macroCellUavTable;
+	XUSG::DescriptorTable	m_occupancyUavTable;
+	XUSG::DescriptorTable	m_gradientUavTable;
+	XUSG::DescriptorTable	m_irradianceUavTable;
 
 	XUSG::Texture::sptr			m_fileSrc;
+	XUSG::Resource::uptr		m_fileUploaders[FrameCount];	// Of UpdateVolumeData()
+	std::vector<XUSG::StructuredBuffer::uptr> m_regionUploaders[FrameCount];	// Of UpdateVolumeRegion()
 	XUSG::Texture3D::uptr		m_volume;
+	XUSG::Texture3D::uptr		m_macroCells;
+	XUSG::Texture3D::uptr		m_gradient;
 	XUSG::Texture::uptr			m_cubeMap;
 	XUSG::Texture::uptr			m_cubeDepth;
 	XUSG::Texture3D::uptr		m_lightMap;
+	XUSG::Texture3D::uptr		m_irradiance;	// AO-weighted light-probe irradiance (CSIrradiance)
+	XUSG::Texture::uptr			m_transm;
 	XUSG::ConstantBuffer::uptr	m_cbPerFrame;
 	XUSG::ConstantBuffer::uptr	m_cbPerObject;
 #if _CPU_CUBE_FACE_CULL_ == 2
@@ -112,18 +205,44 @@ protected:
 
 	const XUSG::DepthStencil::uptr* m_pDepths;
 	XUSG::StructuredBuffer::sptr	m_coeffSH;
+	XUSG::StructuredBuffer::uptr	m_colorLUT;
+	XUSG::StructuredBuffer::uptr	m_occupancy;	// Local-space AABB of the occupied voxels (CSOccupancy)
+	XUSG::Buffer::uptr				m_occupancyReadback;
 
-	uint32_t				m_gridSize;
-	uint32_t				m_lightGridSize;
+	DirectX::XMUINT3		m_gridSize;
+	DirectX::XMUINT3		m_lightGridSize;
+	DirectX::XMUINT3		m_lightBrickCount;	// Light-map bricks per dimension
 	uint32_t				m_raySampleCount;
 #if _CPU_CUBE_FACE_CULL_ == 1
 	uint32_t				m_visibilityMask;
 #endif
 	uint32_t				m_maxRaySamples;
 	uint32_t				m_maxLightSamples;
+	uint32_t				m_staleLightBrickCount;
+	uint32_t				m_lightFrame;
+	uint32_t				m_lightMapBudget;	// Bricks per frame, 0 for unlimited
+	uint32_t				m_maxLightStaleFrames;
 
 	uint8_t					m_cubeFaceCount;
 	uint8_t					m_cubeMapLOD;
+	uint8_t					m_occupancyPending;	// Frames until the occupancy read back is complete, 0 if none
+	VolumeResampler::Filter	m_volumeFilter;
+
+	bool					m_densityOnly;
+	bool					m_lightMapSweep;	// Slice sweeping computed the light map
+	bool					m_lightMapLit;		// The light map has been lit once since Init()
+	bool					m_irradianceDirty;	// The volume, its transform or the SH changed since the last baking
+
+	LightPassInputs			m_lightPassInputs;
+	DirectX::XMFLOAT3		m_lightDirtyMin;	// Texture-space box of the volume changes since the last light pass,
+	DirectX::XMFLOAT3		m_lightDirtyMax;	// empty if min > max
+	std::vector<uint32_t>	m_lightBrickStamps;	// Frame since which each light-map brick is stale, or UINT32_MAX
+
+	DirectX::XMFLOAT4X4		m_worldViewProj;	// Of the last UpdateFrame(), to prioritize the light-map bricks
+	DirectX::XMFLOAT3		m_localSpaceEyePt;
+	DirectX::XMFLOAT3		m_boundsMin;		// Occupancy bounds in the local space, the volume box
+	DirectX::XMFLOAT3		m_boundsMax;		// until the read back is complete
+	DirectX::XMFLOAT3		m_extent;			// Local-space half size of the volume box, 1 on the longest axis
 
 	DirectX::XMFLOAT3		m_lightPt;
 	DirectX::XMFLOAT4		m_lightColor;
@@ -0,0 +1,41 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------------------
+// Constant buffer
+//--------------------------------------------------------------------------------------
+cbuffer cb
+{
+	uint3 g_offset;	// Of the region to update
+};
+
+//--------------------------------------------------------------------------------------
+// Textures
+//--------------------------------------------------------------------------------------
+Texture3D g_txGrid;
+RWTexture3D<float4> g_rwGradient;
+
+[numthreads(4, 4, 4)]
+void main(uint3 DTid : SV_DispatchThreadID)
+{
+	uint3 gridSize;
+	g_rwGradient.GetDimensions(gridSize.x, gridSize.y, gridSize.z);
+	const uint3 voxel = g_offset + DTid;
+	if (any(voxel >= gridSize)) return;
+
+	// Central differences at the voxel centers, clamped at the border like the
+	// 6 offset taps of GetDensityGradient()
+	const int3 last = int3(gridSize) - 1;
+	const int3 pos = voxel;
+	const float3 gradient = float3
+	(
+		g_txGrid[min(pos + int3(1, 0, 0), last)].w - g_txGrid[max(pos - int3(1, 0, 0), 0)].w,
+		g_txGrid[min(pos + int3(0, 1, 0), last)].w - g_txGrid[max(pos - int3(0, 1, 0), 0)].w,
+		g_txGrid[min(pos + int3(0, 0, 1), last)].w - g_txGrid[max(pos - int3(0, 0, 1), 0)].w
+	);
+
+	// Direction and magnitude, which keep the 8-bit precision of small gradients
+	const float magnitude = length(gradient);
+	g_rwGradient[voxel] = magnitude > 0.0 ? float4(gradient / magnitude, magnitude / sqrt(3.0)) : 0.0;
+}
@@ -0,0 +1,45 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen & ZENG, Wei. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#define _IRRADIANCE_PASS_
+
+#include "RayMarch.hlsli"
+
+//--------------------------------------------------------------------------------------
+// Unordered access texture
+//--------------------------------------------------------------------------------------
+RWTexture3D<float3> g_rwIrradiance;
+
+//--------------------------------------------------------------------------------------
+// Compute Shader
+//--------------------------------------------------------------------------------------
+[numthreads(4, 4, 4)]
+void main(uint3 DTid : SV_DispatchThreadID)
+{
+	float3 gridSize;
+	g_rwIrradiance.GetDimensions(gridSize.x, gridSize.y, gridSize.z);
+	if (any(DTid >= uint3(gridSize))) return;
+
+	// Same texels as the light map, whose space is the volume space (coupled)
+	const float3 rayOrigin = TexelToLocalSpace(DTid, gridSize);
+	const float3 uvw = LocalToTex3DSpace(rayOrigin);
+	const min16float density = GetSample(uvw).w;
+
+	// An approximation to GI effect with light probe, which depends on neither the view nor
+	// the light, so it is only baked when the volume or the SH changes
+	min16float ao = 1.0;
+	float3 irradiance = 0.0;
+	if (density >= ZERO_THRESHOLD)
+	{
+		float3 shCoeffs[SH_NUM_COEFF];
+		LoadSH(shCoeffs, g_roSHCoeffs);
+		float3 rayDir = -GetDensityGradient(uvw);
+		rayDir = any(abs(rayDir) > 0.0) ? rayDir : rayOrigin; // Avoid 0-gradient caused by uniform density field
+		irradiance = GetIrradiance(shCoeffs, normalize(mul(rayDir, (float3x3)g_world)));
+		rayDir = normalize(rayDir);
+		CastLightRay(ao, rayOrigin, rayDir, g_step, g_numSamples);
+	}
+
+	g_rwIrradiance[DTid] = ao * irradiance;
+}
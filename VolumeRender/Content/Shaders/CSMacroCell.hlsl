@@ -0,0 +1,46 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "SharedConsts.h"
+
+//--------------------------------------------------------------------------------------
+// Constant buffer
+//--------------------------------------------------------------------------------------
+cbuffer cb
+{
+	uint3 g_cellOffset;	// Of the region to update
+};
+
+//--------------------------------------------------------------------------------------
+// Textures
+//--------------------------------------------------------------------------------------
+Texture3D g_txGrid;
+RWTexture3D<float2> g_rwMacroCells;
+
+[numthreads(4, 4, 4)]
+void main(uint3 DTid : SV_DispatchThreadID)
+{
+	uint3 cellCount;
+	g_rwMacroCells.GetDimensions(cellCount.x, cellCount.y, cellCount.z);
+	const uint3 cell = g_cellOffset + DTid;
+	if (any(cell >= cellCount)) return;
+
+	uint3 gridSize;
+	g_txGrid.GetDimensions(gridSize.x, gridSize.y, gridSize.z);
+
+	// Extend the cell by the 1-voxel apron reached by trilinear filtering
+	const int3 first = max(int3(cell * MACRO_CELL_SIZE) - 1, 0);
+	const int3 last = min(int3((cell + 1) * MACRO_CELL_SIZE), int3(gridSize) - 1);
+
+	float2 minMax = g_txGrid[first].ww;
+	for (int z = first.z; z <= last.z; ++z)
+		for (int y = first.y; y <= last.y; ++y)
+			for (int x = first.x; x <= last.x; ++x)
+			{
+				const float density = g_txGrid[int3(x, y, z)].w;
+				minMax = float2(min(minMax.x, density), max(minMax.y, density));
+			}
+
+	g_rwMacroCells[cell] = minMax;
+}
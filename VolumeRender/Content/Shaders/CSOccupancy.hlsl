@@ -0,0 +1,84 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "SharedConsts.h"
+
+#define ZERO_THRESHOLD	0.01
+
+//--------------------------------------------------------------------------------------
+// Textures and buffer
+//--------------------------------------------------------------------------------------
+Texture3D g_txGrid;
+Texture3D<float2> g_txMacroCells;
+RWStructuredBuffer<float3> g_rwOccupancy;	// Local-space min and max of the occupied voxels
+
+groupshared uint g_cellMin[3];
+groupshared uint g_cellMax[3];
+
+//--------------------------------------------------------------------------------------
+// Reduce the macro cells to the AABB of the non-empty ones in 1 group
+//--------------------------------------------------------------------------------------
+[numthreads(64, 1, 1)]
+void main(uint GTid : SV_GroupIndex)
+{
+	uint3 cellCount;
+	g_txMacroCells.GetDimensions(cellCount.x, cellCount.y, cellCount.z);
+
+	if (GTid < 3)
+	{
+		g_cellMin[GTid] = cellCount[GTid];
+		g_cellMax[GTid] = 0;
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	uint3 cellMin = cellCount, cellMax = 0;
+	const uint numCells = cellCount.x * cellCount.y * cellCount.z;
+	for (uint i = GTid; i < numCells; i += 64)
+	{
+		const uint3 cell = uint3(i % cellCount.x, i / cellCount.x % cellCount.y, i / (cellCount.x * cellCount.y));
+
+		// The max densities of the macro cells cover the apron of the trilinear filtering
+		if (g_txMacroCells[cell].y >= ZERO_THRESHOLD)
+		{
+			cellMin = min(cellMin, cell);
+			cellMax = max(cellMax, cell + 1);
+		}
+	}
+
+	[unroll]
+	for (uint j = 0; j < 3; ++j)
+	{
+		InterlockedMin(g_cellMin[j], cellMin[j]);
+		InterlockedMax(g_cellMax[j], cellMax[j]);
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	if (GTid > 0) return;
+
+	cellMin = uint3(g_cellMin[0], g_cellMin[1], g_cellMin[2]);
+	cellMax = uint3(g_cellMax[0], g_cellMax[1], g_cellMax[2]);
+
+	// An empty volume keeps the whole box
+	if (any(cellMin >= cellMax))
+	{
+		cellMin = 0;
+		cellMax = cellCount;
+	}
+
+	uint3 gridSize;
+	g_txGrid.GetDimensions(gridSize.x, gridSize.y, gridSize.z);
+	float3 uvwMin = min(float3(cellMin * MACRO_CELL_SIZE) / gridSize, 1.0);
+	float3 uvwMax = min(float3(cellMax * MACRO_CELL_SIZE) / gridSize, 1.0);
+
+#ifdef _TEXCOORD_INVERT_Y_
+	const float y = uvwMin.y;
+	uvwMin.y = 1.0 - uvwMax.y;
+	uvwMax.y = 1.0 - y;
+#endif
+
+	// The local space spans the extent of the grid, which is 1 on its longest axis
+	const float3 extent = float3(gridSize) / max(max(gridSize.x, gridSize.y), gridSize.z);
+	g_rwOccupancy[0] = (uvwMin * 2.0 - 1.0) * extent;
+	g_rwOccupancy[1] = (uvwMax * 2.0 - 1.0) * extent;
+}
@@ -34,7 +34,8 @@ RWTexture2DArray<float> g_rwCubeDepth;
 SamplerState g_smpPoint;
 
 //--------------------------------------------------------------------------------------
-// Get the local-space position of the grid surface
+// Get the local-space position of the grid surface, whose faces are those of the
+// occupancy bounds
 //--------------------------------------------------------------------------------------
 float3 GetLocalPos(float2 pos, uint face, RWTexture2DArray<float4> rwCubeMap)
 {
@@ -44,23 +45,32 @@ float3 GetLocalPos(float2 pos, uint face, RWTexture2DArray<float4> rwCubeMap)
 	pos = (pos + 0.5) / gridSize.xy * 2.0 - 1.0;
 	pos.y = -pos.y;
 
+	float3 boundsPos;
 	switch (face)
 	{
 	case 0: // +X
-		return float3(1.0, pos.y, -pos.x);
+		boundsPos = float3(1.0, pos.y, -pos.x);
+		break;
 	case 1: // -X
-		return float3(-1.0, pos.y, pos.x);
+		boundsPos = float3(-1.0, pos.y, pos.x);
+		break;
 	case 2: // +Y
-		return float3(pos.x, 1.0, -pos.y);
+		boundsPos = float3(pos.x, 1.0, -pos.y);
+		break;
 	case 3: // -Y
-		return float3(pos.x, -1.0, pos.y);
+		boundsPos = float3(pos.x, -1.0, pos.y);
+		break;
 	case 4: // +Z
-		return float3(pos.x, pos.y, 1.0);
+		boundsPos = float3(pos.x, pos.y, 1.0);
+		break;
 	case 5: // -Z
-		return float3(-pos.x, pos.y, -1.0);
+		boundsPos = float3(-pos.x, pos.y, -1.0);
+		break;
 	default:
 		return 0.0;
 	}
+
+	return BoundsToLocalSpace(boundsPos);
 }
 
 //--------------------------------------------------------------------------------------
@@ -68,9 +78,10 @@ float3 GetLocalPos(float2 pos, uint face, RWTexture2DArray<float4> rwCubeMap)
 //--------------------------------------------------------------------------------------
 bool IsVisible(uint face, float3 localSpaceEyePt)
 {
-	const float viewComp = localSpaceEyePt[face >> 1];
+	const uint axis = face >> 1;
+	const float viewComp = localSpaceEyePt[axis];
 
-	return (face & 0x1) ? viewComp > -1.0 : viewComp < 1.0;
+	return (face & 0x1) ? viewComp > g_boundsMin[axis] : viewComp < g_boundsMax[axis];
 }
 
 //--------------------------------------------------------------------------------------
@@ -125,11 +136,6 @@ void main(uint3 DTid : SV_DispatchThreadID)
 	tMax = GetTMax(pos, rayOrigin, rayDir, tMax);
 #endif
 
-	float3 shCoeffs[SH_NUM_COEFF];
-#if defined(_HAS_LIGHT_PROBE_) && !defined(_LIGHT_PASS_)
-	if (g_hasLightProbes) LoadSH(shCoeffs, g_roSHCoeffs);
-#endif
-	
 #ifdef _POINT_LIGHT_
 	const float3 localSpaceLightPt = mul(float4(g_lightPt, 1.0), g_worldI);
 #else
@@ -146,16 +152,34 @@ void main(uint3 DTid : SV_DispatchThreadID)
 	for (uint i = 0; i < g_numSamples; ++i)
 	{
 		const float3 pos = rayOrigin + rayDir * t;
-		if (any(abs(pos) > 1.0)) break;
+		if (IsOutOfBounds(pos)) break;
 		const float3 uvw = LocalToTex3DSpace(pos);
 
-		// Get a sample
-		//float mip = max(0.5 - transm, 0.0) * 2.0;
-		//const float mip1 = WaveReadLaneAt(mip, couple);
-		//mip = min(mip, mip1);
-		//min16float4 color = GetSample(uvw, mip);
-		min16float4 color = GetSample(uvw);
-		min16float newStep = stepScale;
+#ifdef _EMPTY_SPACE_SKIP_
+		// Jump over the samples in the empty macro cell, which would be skipped anyway
+		const float tSkip = GetEmptySpaceSkip(uvw, rayDir);
+		if (tSkip > 0.0)
+		{
+			const uint n = max(ceil(tSkip / stepScale), 1.0);
+			step = stepScale;
+			t += float(step) * n;
+			i += n - 1;
+			if (t > tMax) break;
+			continue;
+		}
+#endif
+
+		// Get a sample; once the transmittance drops, coarser mips are sampled with proportionally longer steps
+		const min16float transm = 1.0 - scatter.w;
+#ifdef _VOLUME_LOD_
+		const float mip = GetTransmMip(transm);
+#else
+		const float mip = 0.0;
+#endif
+		const float mipScale = exp2(mip);
+		const min16float mipStep = stepScale * min16float(mipScale);
+		min16float4 color = GetSample(uvw, mip);
+		min16float newStep = mipStep;
 
 		// Skip empty space
 		if (color.w > ZERO_THRESHOLD)
@@ -164,21 +188,21 @@ void main(uint3 DTid : SV_DispatchThreadID)
 			// Point light direction in texture space
 			const float3 lightDir = normalize(localSpaceLightPt - pos);
 #endif
-			const float3 light = GetLight(pos, lightDir, shCoeffs); // Sample light
+			const float3 light = GetLight(pos, lightDir); // Sample light
 
 			// Update step
-			const min16float transm = 1.0 - scatter.w;
 			const float dDensity = color.w - prevDensity;
-			newStep = GetStep(dDensity, transm, color.w, stepScale);
+			newStep = GetStep(dDensity, transm, color.w, mipStep);
 			step = (step + newStep) * 0.5;
 			prevDensity = color.w;
 
 			// Accumulate color
+			const min16float opacityScale = GetOpacityScale(color.w, mipScale);
 #ifndef _PRE_MULTIPLIED_
 			color.xyz *= color.w;
 #endif
 			color.xyz *= min16float3(light);
-			scatter += color * ABSORPTION * transm;
+			scatter += color * ABSORPTION * transm * opacityScale;
 
 			if (transm < ZERO_THRESHOLD) break;
 		}
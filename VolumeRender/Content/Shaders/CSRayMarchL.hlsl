@@ -4,6 +4,14 @@
 
 #include "RayMarch.hlsli"
 
+//--------------------------------------------------------------------------------------
+// Constant buffer
+//--------------------------------------------------------------------------------------
+cbuffer cbRegion
+{
+	uint3 g_regionMin;	// First texel of the dirty region to re-light
+};
+
 //--------------------------------------------------------------------------------------
 // Unordered access texture
 //--------------------------------------------------------------------------------------
@@ -18,8 +26,11 @@ void main(uint3 DTid : SV_DispatchThreadID)
 	float3 gridSize;
 	g_rwLightMap.GetDimensions(gridSize.x, gridSize.y, gridSize.z);
 
+	const uint3 texel = g_regionMin + DTid;
+	if (any(texel >= uint3(gridSize))) return;
+
 	float4 rayOrigin;
-	rayOrigin.xyz = (DTid + 0.5) / gridSize * 2.0 - 1.0;
+	rayOrigin.xyz = TexelToLocalSpace(texel, gridSize);
 	rayOrigin.w = 1.0;
 
 	//rayOrigin.xyz = mul(rayOrigin, g_world);	// Light-map space to world space
@@ -36,11 +47,6 @@ void main(uint3 DTid : SV_DispatchThreadID)
 	const float3 uvw = LocalToTex3DSpace(rayOrigin.xyz);
 	const min16float density = GetSample(uvw).w;
 
-#ifdef _HAS_LIGHT_PROBE_
-	min16float ao = 1.0;
-	float3 irradiance = 0.0;
-#endif
-
 	if (density >= ZERO_THRESHOLD)
 	{
 		if (shadow >= ZERO_THRESHOLD)
@@ -54,27 +60,15 @@ void main(uint3 DTid : SV_DispatchThreadID)
 #endif
 			CastLightRay(shadow, rayOrigin.xyz, rayDir, g_step, g_numSamples);
 		}
-
-#ifdef _HAS_LIGHT_PROBE_
-		if (g_hasLightProbes) // An approximation to GI effect with light probe
-		{
-			float3 shCoeffs[SH_NUM_COEFF];
-			LoadSH(shCoeffs, g_roSHCoeffs);
-			float3 rayDir = -GetDensityGradient(uvw);
-			rayDir = any(abs(rayDir) > 0.0) ? rayDir : rayOrigin.xyz; // Avoid 0-gradient caused by uniform density field
-			irradiance = GetIrradiance(shCoeffs, normalize(mul(rayDir, (float3x3)g_world)));
-			rayDir = normalize(rayDir);
-			CastLightRay(ao, rayOrigin.xyz, rayDir, g_step, g_numSamples);
-		}
-#endif
 	}
 
 	const min16float3 lightColor = min16float3(g_lightColor.xyz * g_lightColor.w);
 	min16float3 ambient = min16float3(g_ambient.xyz * g_ambient.w);
 
 #ifdef _HAS_LIGHT_PROBE_
-	ambient = g_hasLightProbes ? ao * min16float3(irradiance) : ambient;
+	// The light-probe irradiance is baked separately by CSIrradiance
+	ambient = g_hasLightProbes ? 0.0 : ambient;
 #endif
 
-	g_rwLightMap[DTid] = shadow * lightColor + ambient;
+	g_rwLightMap[texel] = shadow * lightColor + ambient;
 }
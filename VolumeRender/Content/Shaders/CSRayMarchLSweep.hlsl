@@ -0,0 +1,130 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen & ZENG, Wei. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "RayMarch.hlsli"
+
+//--------------------------------------------------------------------------------------
+// Constant buffer
+//--------------------------------------------------------------------------------------
+cbuffer cbSweep
+{
+	uint g_sweepStep;	// Slice index in sweep order, starting from the light-facing side
+};
+
+//--------------------------------------------------------------------------------------
+// Unordered access textures
+//--------------------------------------------------------------------------------------
+RWTexture3D<float3> g_rwLightMap;
+RWTexture2DArray<float> g_rwTransm;	// Ping-pong transmittance slices carried along the sweep
+
+//--------------------------------------------------------------------------------------
+// Load the transmittance of the previous slice with bilinear filtering
+//--------------------------------------------------------------------------------------
+min16float LoadTransm(float2 pos, float2 extent, float2 gridSize, uint slice)
+{
+	const float2 xy = (pos / extent * 0.5 + 0.5) * gridSize - 0.5;
+	const float2 xyf = floor(xy);
+	const float2 w = xy - xyf;
+	const int2 last = int2(gridSize) - 1;
+	const int2 i0 = clamp(int2(xyf), 0, last);
+	const int2 i1 = clamp(int2(xyf) + 1, 0, last);
+
+	const float t00 = g_rwTransm[uint3(i0.x, i0.y, slice)];
+	const float t10 = g_rwTransm[uint3(i1.x, i0.y, slice)];
+	const float t01 = g_rwTransm[uint3(i0.x, i1.y, slice)];
+	const float t11 = g_rwTransm[uint3(i1.x, i1.y, slice)];
+
+	return min16float(lerp(lerp(t00, t10, w.x), lerp(t01, t11, w.x), w.y));
+}
+
+//--------------------------------------------------------------------------------------
+// Compute Shader
+//--------------------------------------------------------------------------------------
+[numthreads(8, 8, 1)]
+void main(uint2 DTid : SV_DispatchThreadID)
+{
+	float3 gridSize;
+	g_rwLightMap.GetDimensions(gridSize.x, gridSize.y, gridSize.z);
+
+	// Sweep along the dominant axis of the light direction
+#ifdef _POINT_LIGHT_
+	const float3 localSpaceLightPt = mul(float4(g_lightPt, 1.0), g_worldI);
+#else
+	const float3 localSpaceLightPt = mul(g_lightPt, (float3x3)g_worldI);
+#endif
+	const float3 sweepDir = normalize(localSpaceLightPt);
+	const float3 absDir = abs(sweepDir);
+	const uint axis = absDir.x >= absDir.y ? (absDir.x >= absDir.z ? 0 : 2) : (absDir.y >= absDir.z ? 1 : 2);
+	const uint axisU = (axis + 1) % 3, axisV = (axis + 2) % 3;
+	const float2 sliceSize = float2(gridSize[axisU], gridSize[axisV]);
+	if (any(DTid >= (uint2)sliceSize)) return;
+
+	uint3 index;
+	index[axis] = sweepDir[axis] > 0.0 ? (uint)gridSize[axis] - 1 - g_sweepStep : g_sweepStep;
+	index[axisU] = DTid.x;
+	index[axisV] = DTid.y;
+
+	float4 rayOrigin;
+	rayOrigin.xyz = TexelToLocalSpace(index, gridSize);
+	rayOrigin.w = 1.0;
+
+#ifdef _POINT_LIGHT_
+	const float3 lightDir = normalize(localSpaceLightPt - rayOrigin.xyz);
+#else
+	const float3 lightDir = sweepDir;
+#endif
+
+	// Light-map space same to volume space (coupled)
+	const float3 uvw = LocalToTex3DSpace(rayOrigin.xyz);
+	const min16float density = GetSample(uvw).w;
+
+	// March one slice toward the light, and carry the transmittance of the previous slice
+	const uint dst = g_sweepStep & 1;
+	min16float transm = 1.0;
+	if (g_sweepStep > 0)
+	{
+		const float3 absLightDir = abs(lightDir);
+		float dist = 2.0 * g_extent[axis] / (gridSize[axis] * max(absLightDir[axis], 1e-3));
+		const float3 prevPos = rayOrigin.xyz + lightDir * dist;
+		const float2 prevUV = float2(prevPos[axisU], prevPos[axisV]);
+		const float2 extentUV = float2(g_extent[axisU], g_extent[axisV]);
+		if (all(abs(prevUV) <= extentUV)) transm = LoadTransm(prevUV, extentUV, sliceSize, dst ^ 1);
+		else // Light enters the volume unattenuated, so clip the segment to the volume
+		{
+			const float2 uvDir = float2(absLightDir[axisU], absLightDir[axisV]);
+			const float2 uvOrigin = float2(rayOrigin[axisU], rayOrigin[axisV]) * sign(float2(lightDir[axisU], lightDir[axisV]));
+			const float2 t = (extentUV - uvOrigin) / max(uvDir, 1e-6);
+			dist = min(dist, min(t.x, t.y));
+		}
+
+		// Same attenuation per adaptive step as CastLightRay
+		const min16float midDensity = GetSample(LocalToTex3DSpace(rayOrigin.xyz + lightDir * (dist * 0.5))).w;
+		const float dDensity = (midDensity - density) * g_step / (dist * 0.5);
+		const min16float step = GetStep(dDensity, transm, midDensity, g_step);
+		transm *= min16float(pow(saturate(1.0 - midDensity * ABSORPTION), dist / step));
+	}
+	g_rwTransm[uint3(DTid, dst)] = transm;
+
+	// Transmittance
+#ifdef _HAS_SHADOW_MAP_
+	min16float shadow = ShadowTest(mul(rayOrigin, g_world), g_txDepth);
+#else
+	min16float shadow = 1.0;
+#endif
+
+	if (density >= ZERO_THRESHOLD)
+	{
+		shadow *= transm;
+	}
+
+	const min16float3 lightColor = min16float3(g_lightColor.xyz * g_lightColor.w);
+	min16float3 ambient = min16float3(g_ambient.xyz * g_ambient.w);
+
+#ifdef _HAS_LIGHT_PROBE_
+	// The light-probe irradiance is baked separately by CSIrradiance
+	ambient = g_hasLightProbes ? 0.0 : ambient;
+#endif
+
+	g_rwLightMap[index] = shadow * lightColor + ambient;
+}
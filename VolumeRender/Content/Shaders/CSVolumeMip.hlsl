@@ -0,0 +1,39 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------------------
+// Constant buffer
+//--------------------------------------------------------------------------------------
+cbuffer cb
+{
+	uint g_densityOnly;
+	uint3 g_offset;	// Of the region to update
+};
+
+//--------------------------------------------------------------------------------------
+// Textures
+//--------------------------------------------------------------------------------------
+Texture3D g_txSrc;	// The next finer level
+RWTexture3D<float4> g_rwDst;
+
+//--------------------------------------------------------------------------------------
+// Texture sampler
+//--------------------------------------------------------------------------------------
+SamplerState g_smpLinear;
+
+[numthreads(4, 4, 4)]
+void main(uint3 DTid : SV_DispatchThreadID)
+{
+	uint3 gridSize;
+	g_rwDst.GetDimensions(gridSize.x, gridSize.y, gridSize.z);
+	const uint3 pos = g_offset + DTid;
+	if (any(pos >= gridSize)) return;
+
+	// The trilinear sample at the shared corner of the 2x2x2 source texels is their box average
+	const float3 uvw = (pos + 0.5) / gridSize;
+	const float4 color = g_txSrc.SampleLevel(g_smpLinear, uvw, 0.0);
+
+	// Density-only volumes keep the density in their only channel, which reads as w
+	g_rwDst[pos] = g_densityOnly ? color.w : color;
+}
@@ -0,0 +1,31 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------------------
+// Constant buffer
+//--------------------------------------------------------------------------------------
+cbuffer cb
+{
+	uint3 g_regionMin;
+	uint g_densityOnly;
+	uint3 g_regionSize;
+};
+
+//--------------------------------------------------------------------------------------
+// Buffer and texture
+//--------------------------------------------------------------------------------------
+StructuredBuffer<float> g_roDensities;	// x-major in the region
+RWTexture3D<float4> g_rwGrid;
+
+[numthreads(4, 4, 4)]
+void main(uint3 DTid : SV_DispatchThreadID)
+{
+	if (any(DTid >= g_regionSize)) return;
+
+	const uint3 pos = g_regionMin + DTid;
+	const float a = g_roDensities[(DTid.z * g_regionSize.y + DTid.y) * g_regionSize.x + DTid.x];
+
+	// Density-only volumes keep the density in their only channel, and the others keep their colors
+	g_rwGrid[pos] = g_densityOnly ? a : float4(g_rwGrid[pos].xyz, a);
+}
@@ -5,6 +5,9 @@
 #define _HAS_DEPTH_MAP_
 #define _HAS_SHADOW_MAP_
 #define _HAS_LIGHT_PROBE_
+#define _EMPTY_SPACE_SKIP_
+#define _HAS_COLOR_LUT_
+#define _VOLUME_LOD_
 
 #define	INF		asfloat(0x7f800000)
 #define	FLT_MAX	3.402823466e+38
@@ -18,6 +21,12 @@ cbuffer cbPerObject
 	float4x4 g_worldViewProj;
 	float4x3 g_worldI;
 	float4x3 g_world;
+	float3 g_boundsMin;	// Local-space AABB of the occupied voxels (CSOccupancy), the proxy box of the ray marching
+	float3 g_boundsMax;
+	float3 g_extent;	// Local-space half size of the volume box, 1 on the longest axis of the grid
+#ifdef _HAS_COLOR_LUT_
+	uint g_hasColorLUT;
+#endif
 };
 
 cbuffer cbPerFrame
@@ -33,3 +42,25 @@ cbuffer cbPerFrame
 // Texture sampler
 //--------------------------------------------------------------------------------------
 SamplerState g_smpLinear;
+
+//--------------------------------------------------------------------------------------
+// Check if the local-space position is out of the occupancy bounds
+//--------------------------------------------------------------------------------------
+bool IsOutOfBounds(float3 pos)
+{
+	return any(pos < g_boundsMin) || any(pos > g_boundsMax);
+}
+
+//--------------------------------------------------------------------------------------
+// Local space to the bounds space, where the occupancy bounds are the unit cube [-1, 1]
+// of the cube map, and vice versa
+//--------------------------------------------------------------------------------------
+float3 LocalToBoundsSpace(float3 pos)
+{
+	return (pos * 2.0 - (g_boundsMax + g_boundsMin)) / (g_boundsMax - g_boundsMin);
+}
+
+float3 BoundsToLocalSpace(float3 pos)
+{
+	return (pos * (g_boundsMax - g_boundsMin) + (g_boundsMax + g_boundsMin)) * 0.5;
+}
@@ -20,7 +20,7 @@ struct PSIn
 min16float4 main(PSIn input) : SV_TARGET
 {
 	const float3 localSpaceEyePt = mul(float4(g_eyePt, 1.0), g_worldI);
-	const float3 rayDir = input.LPt - localSpaceEyePt;
+	const float3 rayDir = input.LPt - LocalToBoundsSpace(localSpaceEyePt);
 
 	const min16float4 result = CubeCast(input.Pos.xy, input.UVW, input.LPt, rayDir);
 	if (result.w <= 0.0) discard;
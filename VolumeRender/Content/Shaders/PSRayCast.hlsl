@@ -55,11 +55,6 @@ min16float4 main(PSIn input) : SV_TARGET
 	const float tMax = GetTMax(pos, rayOrigin, rayDir);
 #endif
 
-	float3 shCoeffs[SH_NUM_COEFF];
-#if defined(_HAS_LIGHT_PROBE_) && !defined(_LIGHT_PASS_)
-	if (g_hasLightProbes) LoadSH(shCoeffs, g_roSHCoeffs);
-#endif
-
 #ifdef _POINT_LIGHT_
 	const float3 localSpaceLightPt = mul(float4(g_lightPt, 1.0), g_worldI);
 #else
@@ -76,16 +71,36 @@ min16float4 main(PSIn input) : SV_TARGET
 	for (uint i = 0; i < g_numSamples; ++i)
 	{
 		const float3 pos = rayOrigin + rayDir * t;
-		if (any(abs(pos) > 1.0)) break;
+		if (IsOutOfBounds(pos)) break;
 		const float3 uvw = LocalToTex3DSpace(pos);
 
-		// Get a sample
-		//float mip = max(0.5 - transm, 0.0) * 2.0;
-		//const float mip1 = WaveReadLaneAt(mip, couple);
-		//mip = min(mip, mip1);
-		//min16float4 color = GetSample(uvw, mip);
-		min16float4 color = GetSample(uvw);
-		min16float newStep = g_step;
+#ifdef _EMPTY_SPACE_SKIP_
+		// Jump over the samples in the empty macro cell, which would be skipped anyway
+		const float tSkip = GetEmptySpaceSkip(uvw, rayDir);
+		if (tSkip > 0.0)
+		{
+			const uint n = max(ceil(tSkip / g_step), 1.0);
+			step = g_step;
+			t += float(step) * n;
+			i += n - 1;
+#ifdef _HAS_DEPTH_MAP_
+			if (t > tMax) break;
+#endif
+			continue;
+		}
+#endif
+
+		// Get a sample; once the transmittance drops, coarser mips are sampled with proportionally longer steps
+		const min16float transm = 1.0 - scatter.w;
+#ifdef _VOLUME_LOD_
+		const float mip = GetTransmMip(transm);
+#else
+		const float mip = 0.0;
+#endif
+		const float mipScale = exp2(mip);
+		const min16float mipStep = g_step * min16float(mipScale);
+		min16float4 color = GetSample(uvw, mip);
+		min16float newStep = mipStep;
 
 		// Skip empty space
 		if (color.w > ZERO_THRESHOLD)
@@ -94,21 +109,21 @@ min16float4 main(PSIn input) : SV_TARGET
 			// Point light direction in texture space
 			const float3 lightDir = normalize(localSpaceLightPt - pos);
 #endif
-			const float3 light = GetLight(pos, lightDir, shCoeffs); // Sample light
+			const float3 light = GetLight(pos, lightDir); // Sample light
 
 			// Update step
-			const min16float transm = 1.0 - scatter.w;
 			const float dDensity = color.w - prevDensity;
-			newStep = GetStep(dDensity, transm, color.w, g_step);
+			newStep = GetStep(dDensity, transm, color.w, mipStep);
 			step = (step + newStep) * 0.5;
 			prevDensity = color.w;
 
 			// Accumulate color
+			const min16float opacityScale = GetOpacityScale(color.w, mipScale);
 #ifndef _PRE_MULTIPLIED_
 			color.xyz *= color.w;
 #endif
 			color.xyz *= min16float3(light);
-			scatter += color * ABSORPTION * transm;
+			scatter += color * ABSORPTION * transm * opacityScale;
 
 			if (transm < ZERO_THRESHOLD) break;
 		}
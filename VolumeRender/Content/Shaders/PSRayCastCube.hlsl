@@ -97,9 +97,10 @@ float3 ComputeCubeTexcoord(float3 pos, uint hitPlane)
 //--------------------------------------------------------------------------------------
 min16float4 main(PSIn input) : SV_TARGET
 {
-	float3 pos = TexcoordToLocalPos(input.UV);	// The point on the near plane
+	// The cube map spans the occupancy bounds, so the ray is cast in the bounds space
+	float3 pos = LocalToBoundsSpace(TexcoordToLocalPos(input.UV));	// The point on the near plane
 	const float3 localSpaceEyePt = mul(float4(g_eyePt, 1.0), g_worldI);
-	const float3 rayDir = normalize(pos - localSpaceEyePt);
+	const float3 rayDir = normalize(pos - LocalToBoundsSpace(localSpaceEyePt));
 
 	const uint hitPlane = ComputeRayHit(pos, rayDir);
 	if (hitPlane > 2) discard;
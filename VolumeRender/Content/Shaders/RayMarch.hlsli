@@ -2,6 +2,7 @@
 // Copyright (c) XU, Tianchen & ZENG, Wei. All rights reserved.
 //--------------------------------------------------------------------------------------
 
+#include "SharedConsts.h"
 #include "Common.hlsli"
 #ifdef _HAS_LIGHT_PROBE_
 #define SH_ORDER 3
@@ -47,8 +48,24 @@ Texture2D<float> g_txDepth;
 Texture2D<float> g_txShadow;
 #endif
 
-#if defined(_HAS_LIGHT_PROBE_) && !defined(_LIGHT_PASS_)
+#ifdef _HAS_LIGHT_PROBE_
+#ifdef _IRRADIANCE_PASS_
 StructuredBuffer<float3> g_roSHCoeffs;
+#else
+Texture3D<float3> g_txIrradiance;	// AO-weighted light-probe irradiance in the light-map space (CSIrradiance)
+#endif
+#endif
+
+#ifdef _EMPTY_SPACE_SKIP_
+Texture3D<float2> g_txMacroCells;	// Min/max densities of the macro cells
+#endif
+
+#ifdef _HAS_COLOR_LUT_
+StructuredBuffer<float3> g_roColorLUT;	// Colors over densities [0, 1]
+#endif
+
+#ifdef _GRADIENT_VOLUME_
+Texture3D g_txGradient;	// Density-gradient directions and magnitudes (CSGradient)
 #endif
 
 
@@ -56,14 +73,36 @@ StructuredBuffer<float3> g_roSHCoeffs;
 SamplerComparisonState g_smpShadow;
 #endif
 
+#ifdef _HAS_COLOR_LUT_
+//--------------------------------------------------------------------------------------
+// Look up the color LUT with linear filtering
+//--------------------------------------------------------------------------------------
+float3 GetLUTColor(float density)
+{
+	uint numColors, stride;
+	g_roColorLUT.GetDimensions(numColors, stride);
+
+	const float x = saturate(density) * (numColors - 1);
+	const uint i0 = uint(x);
+	const uint i1 = min(i0 + 1, numColors - 1);
+
+	return lerp(g_roColorLUT[i0], g_roColorLUT[i1], x - i0);
+}
+#endif
+
 //--------------------------------------------------------------------------------------
 // Sample density field
 //--------------------------------------------------------------------------------------
 min16float4 GetSample(float3 uvw, float mip = 0.0)
 {
+	// Density-only volumes are swizzled to float4(1.0.xxx, density) by their SRVs
 	float4 color = g_txGrid.SampleLevel(g_smpLinear, uvw, mip);
 	//min16float4 color = min16float4(0.0, 0.5, 1.0, 0.5);
 
+#ifdef _HAS_COLOR_LUT_
+	if (g_hasColorLUT) color.xyz *= GetLUTColor(color.w);
+#endif
+
 	return min16float4(color);
 }
 
@@ -72,6 +111,15 @@ min16float4 GetSample(float3 uvw, float mip = 0.0)
 //--------------------------------------------------------------------------------------
 float3 GetDensityGradient(float3 uvw)
 {
+#ifdef _GRADIENT_VOLUME_
+	// The direction only; one tap instead of 6
+	float3 gradient = g_txGradient.SampleLevel(g_smpLinear, uvw, 0.0).xyz;
+#ifdef _TEXCOORD_INVERT_Y_
+	gradient.y = -gradient.y;
+#endif
+
+	return gradient;
+#else
 	static const int3 offsets[] =
 	{
 		int3(-1, 0, 0),
@@ -92,6 +140,7 @@ float3 GetDensityGradient(float3 uvw)
 	for (uint i = 0; i < 6; ++i) q[i] = g_txGrid.SampleLevel(g_smpLinear, uvw, 0.0, offsets[i]).w;
 
 	return float3(q[1] - q[0], q[3] - q[2], q[5] - q[4]);
+#endif
 }
 
 //--------------------------------------------------------------------------------------
@@ -133,7 +182,7 @@ min16float ShadowTest(float3 pos, Texture2D<float> txDepth)
 //--------------------------------------------------------------------------------------
 // Get irradiance
 //--------------------------------------------------------------------------------------
-#if defined(_HAS_LIGHT_PROBE_) && !defined(_LIGHT_PASS_)
+#if defined(_HAS_LIGHT_PROBE_) && defined(_IRRADIANCE_PASS_)
 float3 GetIrradiance(float3 shCoeffs[SH_NUM_COEFF], float3 dir)
 {
 	return EvaluateSHIrradiance(shCoeffs, normalize(dir)).xyz;
@@ -145,7 +194,8 @@ float3 GetIrradiance(float3 shCoeffs[SH_NUM_COEFF], float3 dir)
 //--------------------------------------------------------------------------------------
 bool ComputeRayOrigin(inout float3 rayOrigin, float3 rayDir)
 {
-	if (all(abs(rayOrigin) <= 1.0)) return true;
+	// The ray enters the occupancy bounds instead of the whole volume box
+	if (!IsOutOfBounds(rayOrigin)) return true;
 
 	//float U = INF;
 	float U = FLT_MAX;
@@ -154,12 +204,14 @@ bool ComputeRayOrigin(inout float3 rayOrigin, float3 rayDir)
 	[unroll]
 	for (uint i = 0; i < 3; ++i)
 	{
-		const float u = (-sign(rayDir[i]) - rayOrigin[i]) / rayDir[i];
+		const float bound = rayDir[i] > 0.0 ? g_boundsMin[i] : g_boundsMax[i];
+		const float u = (bound - rayOrigin[i]) / rayDir[i];
 		if (u < 0.0) continue;
 
 		const uint j = (i + 1) % 3, k = (i + 2) % 3;
-		if (abs(rayDir[j] * u + rayOrigin[j]) > 1.0) continue;
-		if (abs(rayDir[k] * u + rayOrigin[k]) > 1.0) continue;
+		const float2 hit = float2(rayDir[j], rayDir[k]) * u + float2(rayOrigin[j], rayOrigin[k]);
+		if (hit.x < g_boundsMin[j] || hit.x > g_boundsMax[j]) continue;
+		if (hit.y < g_boundsMin[k] || hit.y > g_boundsMax[k]) continue;
 		if (u < U)
 		{
 			U = u;
@@ -167,7 +219,7 @@ bool ComputeRayOrigin(inout float3 rayOrigin, float3 rayDir)
 		}
 	}
 
-	rayOrigin = clamp(rayDir * U + rayOrigin, -1.0, 1.0);
+	rayOrigin = clamp(rayDir * U + rayOrigin, g_boundsMin, g_boundsMax);
 
 	return isHit;
 }
@@ -187,6 +239,7 @@ float ComputeTargetHit(float3 rayOrigin, float3 target, float3 rayDir)
 //--------------------------------------------------------------------------------------
 float3 LocalToTex3DSpace(float3 pos)
 {
+	pos /= g_extent;
 #ifdef _TEXCOORD_INVERT_Y_
 	return pos * float3(0.5, -0.5, 0.5) + 0.5;
 #else
@@ -194,6 +247,38 @@ float3 LocalToTex3DSpace(float3 pos)
 #endif
 }
 
+//--------------------------------------------------------------------------------------
+// Local position of the texel center of a grid in the volume space, e.g. the light map
+//--------------------------------------------------------------------------------------
+float3 TexelToLocalSpace(float3 texel, float3 gridSize)
+{
+	return ((texel + 0.5) / gridSize * 2.0 - 1.0) * g_extent;
+}
+
+//--------------------------------------------------------------------------------------
+// Get the ray distance to the exit of the macro cell at uvw if it is empty, otherwise 0
+//--------------------------------------------------------------------------------------
+#ifdef _EMPTY_SPACE_SKIP_
+float GetEmptySpaceSkip(float3 uvw, float3 rayDir)
+{
+	float3 cellCount, gridSize;
+	g_txMacroCells.GetDimensions(cellCount.x, cellCount.y, cellCount.z);
+	g_txGrid.GetDimensions(gridSize.x, gridSize.y, gridSize.z);
+
+	// The last cells overhang the grids of the sizes not in multiples of the cells
+	const float3 cellScale = gridSize / MACRO_CELL_SIZE;
+	const float3 cell = min(floor(uvw * cellScale), cellCount - 1.0);
+	if (g_txMacroCells[uint3(cell)].y >= ZERO_THRESHOLD) return 0.0;
+
+	// The texture-space ray has the same parameter t as the local-space ray
+	const float3 uvwDir = LocalToTex3DSpace(rayDir) - 0.5;
+	const float3 bound = (cell + step(0.0, uvwDir)) / cellScale;
+	const float3 t = abs(bound - uvw) / max(abs(uvwDir), 1e-8);
+
+	return min(min(t.x, t.y), t.z);
+}
+#endif
+
 //--------------------------------------------------------------------------------------
 // Get step
 //--------------------------------------------------------------------------------------
@@ -209,35 +294,84 @@ min16float GetStep(float dDensity, min16float transm, min16float density, min16f
 	return step;
 }
 
+#ifdef _VOLUME_LOD_
+//--------------------------------------------------------------------------------------
+// Get the mip level of a view-ray sample, which goes 1 level coarser each time the
+// transmittance halves below 0.5, since the samples behind contribute little
+//--------------------------------------------------------------------------------------
+float GetTransmMip(min16float transm)
+{
+	return clamp(floor(log2(0.5 / transm)), 0.0, VOLUME_MIP_COUNT - 1.0);
+}
+
+//--------------------------------------------------------------------------------------
+// Get the mip level of a light-ray sample at the distance t from the ray origin
+//--------------------------------------------------------------------------------------
+float GetDistanceMip(float t)
+{
+	return clamp(floor(log2(t / LIGHT_MIP_DIST)) + 1.0, 0.0, VOLUME_MIP_COUNT - 1.0);
+}
+#endif
+
+//--------------------------------------------------------------------------------------
+// Get the opacity scale of a sample over n base steps, such that
+// density * ABSORPTION * scale = 1 - (1 - density * ABSORPTION)^n
+//--------------------------------------------------------------------------------------
+min16float GetOpacityScale(min16float density, float n)
+{
+	if (n <= 1.0) return 1.0;
+
+	const min16float opacity = density * ABSORPTION;
+
+	// The limit at a zero opacity is n
+	return opacity > 0.0 ? (1.0 - pow(1.0 - opacity, n)) / opacity : n;
+}
+
 //--------------------------------------------------------------------------------------
 // Cast light ray
 //--------------------------------------------------------------------------------------
 void CastLightRay(inout min16float transm, float3 rayOrigin, float3 rayDir,
-	min16float stepScale, uint numSamples, uint mipLevel = 0)
+	min16float stepScale, uint numSamples)
 {
-	const float mip = mipLevel;
-	numSamples >>= mipLevel;
-
 	float t = stepScale;
 	min16float step = stepScale;
 	float prevDensity = 0.0;
 	for (uint i = 0; i < numSamples; ++i)
 	{
 		const float3 pos = rayOrigin + rayDir * t;
-		if (any(abs(pos) > 1.0)) break;
+		if (IsOutOfBounds(pos)) break;
 		const float3 uvw = LocalToTex3DSpace(pos);
 
-		// Get a sample along light ray
+#ifdef _EMPTY_SPACE_SKIP_
+		// Jump over the empty macro cell, whose steps count against the samples as if taken
+		const float tSkip = GetEmptySpaceSkip(uvw, rayDir);
+		if (tSkip > 0.0)
+		{
+			const uint n = max(ceil(tSkip / step), 1.0);
+			t += max(tSkip, step);
+			prevDensity = 0.0;
+			i += n - 1;
+			continue;
+		}
+#endif
+
+		// Get a sample along light ray; the far segments sample coarser mips with proportionally longer steps
+#ifdef _VOLUME_LOD_
+		const float mip = GetDistanceMip(t);
+#else
+		const float mip = 0.0;
+#endif
+		const float mipScale = exp2(mip);
 		const min16float density = GetSample(uvw, mip).w;
 
 		// Update step
 		const float dDensity = density - prevDensity;
-		const min16float newStep = GetStep(dDensity, transm, density, stepScale);
+		const min16float newStep = GetStep(dDensity, transm, density, stepScale * min16float(mipScale));
 		step = (step + newStep) * 0.5;
 		prevDensity = density;
 
 		// Attenuate ray-throughput along light direction
-		transm *= 1.0 - density * ABSORPTION;
+		transm *= 1.0 - density * ABSORPTION * GetOpacityScale(density, mipScale);
 		if (transm < ZERO_THRESHOLD) break;
 
 		// Update position along light ray
@@ -250,14 +384,20 @@ void CastLightRay(inout min16float transm, float3 rayOrigin, float3 rayDir,
 // Get light
 //--------------------------------------------------------------------------------------
 #ifdef _LIGHT_PASS_
-float3 GetLight(float3 pos, float3 rayDir, float3 shCoeffs[SH_NUM_COEFF])
+float3 GetLight(float3 pos, float3 rayDir)
 {
 	const float3 uvw = pos * 0.5 + 0.5;
+	float3 light = g_txLightMap.SampleLevel(g_smpLinear, uvw, 0.0);
 
-	return g_txLightMap.SampleLevel(g_smpLinear, uvw, 0.0);
+#ifdef _HAS_LIGHT_PROBE_
+	// The light map holds the direct light only
+	if (g_hasLightProbes) light += g_txIrradiance.SampleLevel(g_smpLinear, uvw, 0.0);
+#endif
+
+	return light;
 }
 #else
-float3 GetLight(float3 pos, float3 lightDir, float3 shCoeffs[SH_NUM_COEFF])
+float3 GetLight(float3 pos, float3 lightDir)
 {
 	// Transmittance along light ray
 #if defined(_HAS_SHADOW_MAP_) && !defined(_LIGHT_PASS_)
@@ -269,25 +409,12 @@ float3 GetLight(float3 pos, float3 lightDir, float3 shCoeffs[SH_NUM_COEFF])
 	if (shadow > ZERO_THRESHOLD)
 		CastLightRay(shadow, pos, lightDir, g_lightStep, g_numLightSamples);
 
-#ifdef _HAS_LIGHT_PROBE_
-	min16float ao = 1.0;
-	float3 irradiance = 0.0;
-	if (g_hasLightProbes) // An approximation to GI effect with light probe
-	{
-		const float3 uvw = LocalToTex3DSpace(pos);
-		float3 rayDir = -GetDensityGradient(uvw);
-		rayDir = any(abs(rayDir) > 0.0) ? rayDir : pos; // Avoid 0-gradient caused by uniform density field
-		irradiance = GetIrradiance(shCoeffs, normalize(mul(rayDir, (float3x3)g_world)));
-		rayDir = normalize(rayDir);
-		CastLightRay(ao, pos, rayDir, g_lightStep, g_numLightSamples);
-	}
-#endif
-
 	const min16float3 lightColor = min16float3(g_lightColor.xyz * g_lightColor.w);
 	min16float3 ambient = min16float3(g_ambient.xyz * g_ambient.w);
 
 #ifdef _HAS_LIGHT_PROBE_
-	ambient = g_hasLightProbes ? min16float3(irradiance) * ao : ambient;
+	// An approximation to GI effect with light probe, baked by CSIrradiance
+	if (g_hasLightProbes) ambient = min16float3(g_txIrradiance.SampleLevel(g_smpLinear, pos * 0.5 + 0.5, 0.0));
 #endif
 
 	return lightColor * shadow + ambient;
@@ -45,7 +45,8 @@ VSOut main(uint vid : SV_VertexID, uint iid : SV_InstanceID)
 	float3 pos = float3(pos2D.x, -pos2D.y, 1.0);
 	pos = mul(pos, planes[planeID]);
 
-	output.Pos = mul(float4(pos, 1.0), g_worldViewProj);
+	// The cube is the occupancy bounds, and LPt stays in the bounds space for the cube-map lookup
+	output.Pos = mul(float4(BoundsToLocalSpace(pos), 1.0), g_worldViewProj);
 	output.UVW = float3(1.0 - uv.x, uv.y, planeID); // Exterior UV to interior UV
 	output.LPt = pos;
 
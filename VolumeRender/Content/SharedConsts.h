@@ -2,8 +2,23 @@
 // Copyright (c) XU, Tianchen. All rights reserved.
 //--------------------------------------------------------------------------------------
 
+#pragma once
+
 // _CPU_CUBE_FACE_CULL_: 0 - GPU culling; 1 - CPU computed visibility mask; 2 - CPU computed indexed face list
 #define _CPU_CUBE_FACE_CULL_ 1
 
+// Voxels per edge of a macro cell (brick) of the min/max density grid for empty-space skipping
+#define MACRO_CELL_SIZE 8
+
+// Mip levels of the volume for the level-of-detail sampling of the ray marching
+#define VOLUME_MIP_COUNT 4
+
+// Density gradients of the light-probe GI path from a precomputed gradient volume (1 tap) instead of 6 taps of the density;
+// comment out to trade the speed for the memory of the gradient volume
+#define _GRADIENT_VOLUME_
+
+// Local-space length of the light-ray segment sampled at mip 0; the mip increases by 1 each time the distance doubles
+#define LIGHT_MIP_DIST 0.5
+
 static const float g_zNear = 1.0f;
 static const float g_zFar = 1000.0f;
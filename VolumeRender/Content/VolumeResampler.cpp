@@ -0,0 +1,439 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "Core/XUSG.h"
+#include "VolumeResampler.h"
+#include <DirectXPackedVector.h>
+#include <atomic>
+#include <thread>
+
+using namespace std;
+using namespace DirectX;
+
+static const wchar_t* g_filterNames[] = { L"trilinear", L"box", L"tent", L"lanczos" };
+static const float g_filterRadii[] = { 1.0f, 0.5f, 1.0f, 3.0f };
+
+static uint32_t& GetAxis(XMUINT3& v, uint8_t axis) { return (&v.x)[axis]; }
+static uint32_t GetAxis(const XMUINT3& v, uint8_t axis) { return (&v.x)[axis]; }
+
+static float EvaluateFilter(float x, VolumeResampler::Filter filter)
+{
+	x = fabsf(x);
+	switch (filter)
+	{
+	case VolumeResampler::BOX:
+		return x <= 0.5f ? 1.0f : 0.0f;
+	case VolumeResampler::LANCZOS:
+	{
+		if (x < 1.0e-5f) return 1.0f;
+		if (x >= 3.0f) return 0.0f;
+		const auto px = XM_PI * x;
+
+		return 3.0f * sinf(px) * sinf(px / 3.0f) / (px * px);
+	}
+	default:
+		return (max)(1.0f - x, 0.0f);
+	}
+}
+
+// pDst[x] = sum of pWeights[k] * pSrc[stride * k + x] over the taps k
+static void FilterRow(float* pDst, const float* pSrc, size_t stride, const float* pWeights, uint32_t numTaps, uint32_t width)
+{
+	auto x = 0u;
+	for (; x + 4 <= width; x += 4)
+	{
+		auto a = XMVectorZero();
+		for (auto k = 0u; k < numTaps; ++k)
+			a = XMVectorMultiplyAdd(XMVectorReplicate(pWeights[k]),
+				XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&pSrc[stride * k + x])), a);
+		XMStoreFloat4(reinterpret_cast<XMFLOAT4*>(&pDst[x]), a);
+	}
+
+	for (; x < width; ++x)
+	{
+		auto a = 0.0f;
+		for (auto k = 0u; k < numTaps; ++k) a += pWeights[k] * pSrc[stride * k + x];
+		pDst[x] = a;
+	}
+}
+
+VolumeResampler::VolumeResampler(uint32_t numThreads) :
+	m_numThreads(numThreads > 0 ? numThreads : (max)(thread::hardware_concurrency(), 1u))
+{
+}
+
+VolumeResampler::~VolumeResampler()
+{
+}
+
+bool VolumeResampler::Resample(wstring& cacheFileName, const wchar_t* fileName, const XMUINT3& size, Filter filter)
+{
+	XUSG_N_RETURN(filter < NUM_FILTER && size.x > 0 && size.y > 0 && size.z > 0, false);
+
+	uint64_t hash;
+	XUSG_N_RETURN(HashFile(fileName, hash), false);
+
+	wstringstream name;
+	name << fileName << L"." << hex << setw(16) << setfill(L'0') << hash << dec << L"." << g_filterNames[filter]
+		<< L"." << size.x << L"x" << size.y << L"x" << size.z << L".dds";
+	cacheFileName = name.str();
+	if (ifstream(cacheFileName, ios::binary).good()) return true;
+
+	vector<float> texels;
+	{
+		vector<float> src;
+		XMUINT3 srcSize;
+		XUSG_N_RETURN(loadVolume(src, srcSize, fileName), false);
+		resample(texels, size, src, srcSize, filter);
+	}
+
+	return writeCacheFile(cacheFileName.c_str(), texels, size);
+}
+
+const wchar_t* VolumeResampler::GetFilterName(Filter filter)
+{
+	return filter < NUM_FILTER ? g_filterNames[filter] : nullptr;
+}
+
+bool VolumeResampler::HashFile(const wchar_t* fileName, uint64_t& hash)
+{
+	ifstream file(fileName, ios::binary);
+	XUSG_M_RETURN(!file, cerr, "Failed to open the volume file.", false);
+
+	// Word by word, as the chunks keep the words aligned, then the bytes of the tail
+	const uint64_t prime = 0x100000001b3;
+	hash = 0xcbf29ce484222325;
+	vector<uint64_t> chunk(1 << 17);	// 1 MiB
+	while (file)
+	{
+		file.read(reinterpret_cast<char*>(chunk.data()), sizeof(uint64_t) * chunk.size());
+		const auto numBytes = static_cast<size_t>(file.gcount());
+		const auto numWords = numBytes / sizeof(uint64_t);
+		for (size_t i = 0; i < numWords; ++i) hash = (hash ^ chunk[i]) * prime;
+
+		const auto pTail = reinterpret_cast<const uint8_t*>(&chunk[numWords]);
+		for (size_t i = 0; i < numBytes % sizeof(uint64_t); ++i) hash = (hash ^ pTail[i]) * prime;
+	}
+
+	return true;
+}
+
+void VolumeResampler::resample(vector<float>& dst, const XMUINT3& size, const vector<float>& src,
+	const XMUINT3& srcSize, Filter filter)
+{
+	dst.resize(static_cast<size_t>(size.x) * size.y * size.z);
+
+	// Filtered along z, y, then x, so the columns of x see the fewest texels when downsampling;
+	// the axes of the same size are skipped, and the last pass writes to dst
+	static const uint8_t axes[] = { 2, 1, 0 };
+	auto numPasses = 0u;
+	for (const auto axis : axes) if (GetAxis(srcSize, axis) != GetAxis(size, axis)) ++numPasses;
+	if (numPasses == 0)
+	{
+		dst = src;
+
+		return;
+	}
+
+	vector<float> buffers[2];
+	auto pSrc = src.data();
+	auto passSrcSize = srcSize;
+	for (const auto axis : axes)
+	{
+		if (GetAxis(passSrcSize, axis) == GetAxis(size, axis)) continue;
+
+		Taps taps;
+		computeTaps(taps, GetAxis(passSrcSize, axis), GetAxis(size, axis), filter);
+
+		auto passSize = passSrcSize;
+		GetAxis(passSize, axis) = GetAxis(size, axis);
+		auto pDst = dst.data();
+		if (--numPasses > 0)
+		{
+			auto& buffer = buffers[numPasses & 1];
+			buffer.resize(static_cast<size_t>(passSize.x) * passSize.y * passSize.z);
+			pDst = buffer.data();
+		}
+
+		if (axis > 0) filterRows(pDst, pSrc, passSrcSize, axis, taps);
+		else filterColumns(pDst, pSrc, passSrcSize, taps);
+
+		pSrc = pDst;
+		passSrcSize = passSize;
+	}
+
+	// Densities cannot be negative
+	if (filter == LANCZOS) for (auto& a : dst) a = (max)(a, 0.0f);
+}
+
+// Along y (axis 1) or z (axis 2), each destination row is a weighted sum of the source rows of its taps
+void VolumeResampler::filterRows(float* pDst, const float* pSrc, const XMUINT3& srcSize, uint8_t axis, const Taps& taps)
+{
+	const auto width = srcSize.x;
+	const auto height = srcSize.y;
+	const auto dstCount = static_cast<uint32_t>(taps.First.size());
+	const auto tapStride = axis == 1 ? static_cast<size_t>(width) : static_cast<size_t>(width) * height;
+	const auto dstHeight = axis == 1 ? dstCount : height;
+	const auto dstDepth = axis == 1 ? srcSize.z : dstCount;
+
+	dispatch(dstHeight * dstDepth, [&](uint32_t row)
+	{
+		const auto y = row % dstHeight;
+		const auto z = row / dstHeight;
+		const auto i = axis == 1 ? y : z;
+		const auto srcY = axis == 1 ? taps.First[i] : y;
+		const auto srcZ = axis == 1 ? z : taps.First[i];
+		FilterRow(&pDst[static_cast<size_t>(width) * row], &pSrc[(static_cast<size_t>(height) * srcZ + srcY) * width],
+			tapStride, &taps.Weights[static_cast<size_t>(taps.MaxCount) * i], taps.Count[i], width);
+	});
+}
+
+// Along x, 4 rows at a time
+void VolumeResampler::filterColumns(float* pDst, const float* pSrc, const XMUINT3& srcSize, const Taps& taps)
+{
+	const auto srcWidth = srcSize.x;
+	const auto dstWidth = static_cast<uint32_t>(taps.First.size());
+	const auto numRows = srcSize.y * srcSize.z;
+	const auto rowsPerGroup = 64u;
+
+	dispatch(XUSG_DIV_UP(numRows, rowsPerGroup), [&](uint32_t groupId)
+	{
+		const auto rowEnd = (min)(rowsPerGroup * (groupId + 1), numRows);
+		auto row = rowsPerGroup * groupId;
+		for (; row + 4 <= rowEnd; row += 4)
+		{
+			const auto pRows = &pSrc[static_cast<size_t>(srcWidth) * row];
+			for (auto i = 0u; i < dstWidth; ++i)
+			{
+				const auto pTaps = &pRows[taps.First[i]];
+				const auto pWeights = &taps.Weights[static_cast<size_t>(taps.MaxCount) * i];
+				auto a = XMVectorZero();
+				for (auto k = 0u; k < taps.Count[i]; ++k)
+				{
+					const auto pTap = &pTaps[k];
+					a = XMVectorMultiplyAdd(XMVectorReplicate(pWeights[k]),
+						XMVectorSet(pTap[0], pTap[srcWidth], pTap[2 * srcWidth], pTap[3 * srcWidth]), a);
+				}
+
+				XMFLOAT4 results;
+				XMStoreFloat4(&results, a);
+				const auto pDstRows = &pDst[static_cast<size_t>(dstWidth) * row + i];
+				pDstRows[0] = results.x;
+				pDstRows[dstWidth] = results.y;
+				pDstRows[2 * dstWidth] = results.z;
+				pDstRows[3 * dstWidth] = results.w;
+			}
+		}
+
+		for (; row < rowEnd; ++row)
+		{
+			const auto pRow = &pSrc[static_cast<size_t>(srcWidth) * row];
+			for (auto i = 0u; i < dstWidth; ++i)
+			{
+				const auto pTaps = &pRow[taps.First[i]];
+				const auto pWeights = &taps.Weights[static_cast<size_t>(taps.MaxCount) * i];
+				auto a = 0.0f;
+				for (auto k = 0u; k < taps.Count[i]; ++k) a += pWeights[k] * pTaps[k];
+				pDst[static_cast<size_t>(dstWidth) * row + i] = a;
+			}
+		}
+	});
+}
+
+// Hands out each group index exactly once to the threads, the calling thread included
+void VolumeResampler::dispatch(uint32_t numGroups, const function<void(uint32_t)>& func)
+{
+	atomic<uint32_t> nextGroup(0);
+	const auto worker = [&]()
+	{
+		for (auto i = nextGroup++; i < numGroups; i = nextGroup++) func(i);
+	};
+
+	vector<thread> threads;
+	for (auto i = 1u; i < (min)(m_numThreads, numGroups); ++i) threads.emplace_back(worker);
+	worker();
+	for (auto& workerThread : threads) workerThread.join();
+}
+
+// Decodes the first channel of the top mip to float, like the texture loader and CSR32FToRGBA16F
+bool VolumeResampler::loadVolume(vector<float>& texels, XMUINT3& size, const wchar_t* fileName)
+{
+	ifstream file(fileName, ios::binary);
+	XUSG_M_RETURN(!file, cerr, "Failed to open the volume file.", false);
+
+	// Magic number and DDS_HEADER, and then DDS_HEADER_DXT10 if the FourCC is "DX10"
+	uint32_t header[32];
+	XUSG_M_RETURN(!file.read(reinterpret_cast<char*>(header), sizeof(header)) || header[0] != 0x20534444,
+		cerr, "Invalid DDS file.", false);
+	const auto pfFlags = header[20];
+	const auto fourCC = header[21];
+	const auto bitCount = header[22];
+
+	auto format = DXGI_FORMAT_UNKNOWN;
+	auto channelOffset = 0u;
+	if (pfFlags & 0x4) // DDPF_FOURCC
+	{
+		switch (fourCC)
+		{
+		case MAKEFOURCC('D', 'X', '1', '0'):
+		{
+			uint32_t header10[5];
+			XUSG_M_RETURN(!file.read(reinterpret_cast<char*>(header10), sizeof(header10)), cerr, "Invalid DDS file.", false);
+			format = static_cast<DXGI_FORMAT>(header10[0]);
+			break;
+		}
+		case 111: // D3DFMT_R16F
+			format = DXGI_FORMAT_R16_FLOAT;
+			break;
+		case 113: // D3DFMT_A16B16G16R16F
+			format = DXGI_FORMAT_R16G16B16A16_FLOAT;
+			break;
+		case 114: // D3DFMT_R32F
+			format = DXGI_FORMAT_R32_FLOAT;
+			break;
+		case 116: // D3DFMT_A32B32G32R32F
+			format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+			break;
+		}
+	}
+	else if (bitCount == 8) format = DXGI_FORMAT_R8_UNORM; // Luminance or alpha
+	else if (bitCount == 16 && (pfFlags & 0x20000)) format = DXGI_FORMAT_R16_UNORM; // DDPF_LUMINANCE
+	else if (bitCount == 32 && (pfFlags & 0x40)) // DDPF_RGB
+	{
+		format = DXGI_FORMAT_R8G8B8A8_UNORM;
+		channelOffset = header[23] == 0x00ff0000 ? 2 : 0; // The red channel of BGRA
+	}
+
+	uint32_t stride;
+	switch (format)
+	{
+	case DXGI_FORMAT_R32G32B32A32_FLOAT:
+		stride = 16;
+		break;
+	case DXGI_FORMAT_R16G16B16A16_FLOAT:
+		stride = 8;
+		break;
+	case DXGI_FORMAT_R8G8B8A8_UNORM:
+	case DXGI_FORMAT_R32_FLOAT:
+		stride = 4;
+		break;
+	case DXGI_FORMAT_R16_FLOAT:
+	case DXGI_FORMAT_R16_UNORM:
+		stride = 2;
+		break;
+	case DXGI_FORMAT_R8_UNORM:
+	case DXGI_FORMAT_A8_UNORM:
+		stride = 1;
+		break;
+	default:
+		XUSG_M_RETURN(true, cerr, "Unsupported DDS volume format for resampling.", false);
+	}
+
+	const auto isVolume = (header[2] & 0x800000) != 0; // DDSD_DEPTH
+	size = XMUINT3(header[4], header[3], isVolume ? (max)(header[6], 1u) : 1);
+	const auto numTexels = static_cast<size_t>(size.x) * size.y * size.z;
+	vector<uint8_t> data(stride * numTexels);
+	XUSG_M_RETURN(!file.read(reinterpret_cast<char*>(data.data()), data.size()), cerr, "Truncated DDS file.", false);
+
+	texels.resize(numTexels);
+	for (size_t i = 0; i < numTexels; ++i)
+	{
+		const auto pSrc = &data[stride * i + channelOffset];
+		switch (format)
+		{
+		case DXGI_FORMAT_R32G32B32A32_FLOAT:
+		case DXGI_FORMAT_R32_FLOAT:
+			memcpy(&texels[i], pSrc, sizeof(float));
+			break;
+		case DXGI_FORMAT_R16G16B16A16_FLOAT:
+		case DXGI_FORMAT_R16_FLOAT:
+			texels[i] = PackedVector::XMConvertHalfToFloat(*reinterpret_cast<const PackedVector::HALF*>(pSrc));
+			break;
+		case DXGI_FORMAT_R16_UNORM:
+			texels[i] = *reinterpret_cast<const uint16_t*>(pSrc) / 65535.0f;
+			break;
+		default:
+			texels[i] = *pSrc / 255.0f;
+		}
+	}
+
+	return true;
+}
+
+bool VolumeResampler::writeCacheFile(const wchar_t* fileName, const vector<float>& texels, const XMUINT3& size)
+{
+	// DDS header of an R32F volume (D3DFMT_R32F in the FourCC field)
+	uint32_t header[32] = {};
+	header[0] = 0x20534444;		// "DDS "
+	header[1] = 124;			// Size of DDS_HEADER
+	header[2] = 0x1 | 0x2 | 0x4 | 0x8 | 0x1000 | 0x20000 | 0x800000;	// Caps, height, width, pitch, pixel format, mips, depth
+	header[3] = size.y;
+	header[4] = size.x;
+	header[5] = sizeof(float) * size.x;
+	header[6] = size.z;
+	header[7] = 1;				// Mip count
+	header[19] = 32;			// Size of DDS_PIXELFORMAT
+	header[20] = 0x4;			// FourCC
+	header[21] = 114;			// D3DFMT_R32F
+	header[27] = 0x8 | 0x1000;	// Complex, texture
+	header[28] = 0x200000;		// Volume
+
+	// Written to a temporary file first, so a partial cache file never exists
+	const auto tempFileName = wstring(fileName) + L".tmp";
+	{
+		ofstream file(tempFileName, ios::binary);
+		XUSG_M_RETURN(!file, cerr, "Failed to create the cache file of the resampled volume.", false);
+		file.write(reinterpret_cast<const char*>(header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(texels.data()), sizeof(float) * texels.size());
+		if (!file.flush())
+		{
+			file.close();
+			_wremove(tempFileName.c_str());
+			XUSG_M_RETURN(true, cerr, "Failed to write the cache file of the resampled volume.", false);
+		}
+	}
+
+	if (_wrename(tempFileName.c_str(), fileName) != 0)
+	{
+		// Written by another process meanwhile
+		_wremove(tempFileName.c_str());
+		XUSG_N_RETURN(ifstream(fileName, ios::binary).good(), false);
+	}
+
+	return true;
+}
+
+void VolumeResampler::computeTaps(Taps& taps, uint32_t srcSize, uint32_t dstSize, Filter filter)
+{
+	// The filter spans the texel spacing of the destination when downsampling
+	const auto ratio = static_cast<float>(srcSize) / dstSize;
+	const auto scale = filter == TRILINEAR ? 1.0f : (max)(ratio, 1.0f);
+	const auto radius = g_filterRadii[filter] * scale;
+	const auto last = static_cast<int32_t>(srcSize) - 1;
+	taps.MaxCount = static_cast<uint32_t>(ceil(2.0f * radius)) + 1;
+	taps.First.resize(dstSize);
+	taps.Count.resize(dstSize);
+	taps.Weights.assign(static_cast<size_t>(taps.MaxCount) * dstSize, 0.0f);
+
+	for (auto i = 0u; i < dstSize; ++i)
+	{
+		// The taps out of the volume are clamped to the edge texels, like a CLAMP sampler
+		const auto center = (i + 0.5f) * ratio - 0.5f;
+		const auto jMin = static_cast<int32_t>(ceil(center - radius));
+		const auto jMax = (min)(static_cast<int32_t>(floor(center + radius)), jMin + static_cast<int32_t>(taps.MaxCount) - 1);
+		const auto first = (min)((max)(jMin, 0), last);
+		const auto pWeights = &taps.Weights[static_cast<size_t>(taps.MaxCount) * i];
+		auto weightSum = 0.0f;
+		for (auto j = jMin; j <= jMax; ++j)
+		{
+			const auto w = EvaluateFilter((j - center) / scale, filter);
+			pWeights[(min)((max)(j, 0), last) - first] += w;
+			weightSum += w;
+		}
+
+		taps.First[i] = static_cast<uint32_t>(first);
+		taps.Count[i] = static_cast<uint32_t>((min)((max)(jMax, 0), last) - first + 1);
+		for (auto k = 0u; k < taps.Count[i]; ++k) pWeights[k] /= weightSum;
+	}
+}
@@ -0,0 +1,60 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+//--------------------------------------------------------------------------------------
+// Resamples volume files to the grid on the CPU with a separable filter, widened by the
+// ratio of the file size to the grid size when downsampling, in place of the trilinear
+// sample per voxel of CSR32FToRGBA16F, which aliases once the file is over twice the grid.
+// The axes are filtered in turn (z, y, then x) by the rows on all cores, 4 texels at a time.
+// The results are cached as R32_FLOAT DDS files next to the volume files, named by the hash
+// of the file contents, the filter and the grid size, and load in place of the volume files,
+// so only the first load at a grid size pays for the filtering.
+//--------------------------------------------------------------------------------------
+class VolumeResampler
+{
+public:
+	enum Filter : uint8_t
+	{
+		TRILINEAR,	// Tent of the texel spacing, i.e. CSR32FToRGBA16F
+		BOX,
+		TENT,
+		LANCZOS,	// 3 lobes; ringing below 0 is clamped
+
+		NUM_FILTER
+	};
+
+	VolumeResampler(uint32_t numThreads = 0);
+	virtual ~VolumeResampler();
+
+	// Returns the name of the cache file of the volume file resampled to size, which is written first if missing
+	bool Resample(std::wstring& cacheFileName, const wchar_t* fileName, const DirectX::XMUINT3& size, Filter filter);
+
+	static const wchar_t* GetFilterName(Filter filter);
+	static bool HashFile(const wchar_t* fileName, uint64_t& hash);	// 64-bit FNV-1a of the contents
+
+protected:
+	// Weights of the source texels [First[i], First[i] + Count[i]) for the destination texel i,
+	// stored from Weights[MaxCount * i] on
+	struct Taps
+	{
+		uint32_t MaxCount;
+		std::vector<uint32_t> First;
+		std::vector<uint32_t> Count;
+		std::vector<float> Weights;
+	};
+
+	void resample(std::vector<float>& dst, const DirectX::XMUINT3& size, const std::vector<float>& src,
+		const DirectX::XMUINT3& srcSize, Filter filter);
+	void filterRows(float* pDst, const float* pSrc, const DirectX::XMUINT3& srcSize, uint8_t axis, const Taps& taps);
+	void filterColumns(float* pDst, const float* pSrc, const DirectX::XMUINT3& srcSize, const Taps& taps);
+	void dispatch(uint32_t numGroups, const std::function<void(uint32_t)>& func);
+
+	static bool loadVolume(std::vector<float>& texels, DirectX::XMUINT3& size, const wchar_t* fileName);
+	static bool writeCacheFile(const wchar_t* fileName, const std::vector<float>& texels, const DirectX::XMUINT3& size);
+	static void computeTaps(Taps& taps, uint32_t srcSize, uint32_t dstSize, Filter filter);
+
+	uint32_t m_numThreads;
+};
@@ -0,0 +1,172 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "Core/XUSG.h"
+#include "VolumeSequence.h"
+
+using namespace std;
+
+static const size_t g_ddsHeaderSize = 4 + 124;	// Magic number and DDS_HEADER
+static const size_t g_dx10HeaderSize = 20;		// DDS_HEADER_DXT10
+static const size_t g_fourCCOffset = 4 + 80;	// DDS_HEADER::ddspf.fourCC
+
+VolumeSequence::VolumeSequence() :
+	m_fileSize(0),
+	m_numDigits(0),
+	m_firstFrame(0),
+	m_frameCount(0),
+	m_currentFrame(0),
+	m_nextFrame(0),
+	m_lateFrame(UINT32_MAX),
+	m_framesShown(0),
+	m_missedDeadlines(0),
+	m_framesRead(0),
+	m_readTime(0.0),
+	m_backReadTime(0.0),
+	m_frameRate(24.0f),
+	m_front(0)
+{
+}
+
+VolumeSequence::~VolumeSequence()
+{
+	if (m_pending.valid()) m_pending.wait();
+}
+
+bool VolumeSequence::Open(const wchar_t* pattern, float frameRate)
+{
+	XUSG_N_RETURN(frameRate > 0.0f, false);
+
+	const wstring patternStr(pattern);
+	const auto first = patternStr.find(L'#');
+	XUSG_M_RETURN(first == wstring::npos, cerr, "No '#' for the frame number in the sequence pattern.", false);
+	const auto last = patternStr.find_first_not_of(L'#', first);
+	m_prefix = patternStr.substr(0, first);
+	m_suffix = last == wstring::npos ? wstring() : patternStr.substr(last);
+	m_numDigits = static_cast<uint32_t>((last == wstring::npos ? patternStr.size() : last) - first);
+	m_frameRate = frameRate;
+
+	// Frames are numbered from 0 or 1, up to the first one missing
+	const auto exists = [this](uint32_t frame) { return ifstream(GetFileName(frame)).good(); };
+	m_firstFrame = 0;
+	if (!exists(0)) m_firstFrame = 1;
+	for (m_frameCount = 0; exists(m_frameCount); ++m_frameCount);
+	XUSG_M_RETURN(m_frameCount == 0, cerr, "No volume files of the sequence pattern.", false);
+
+	// The first frame sets the header that the others must match
+	{
+		ifstream file(GetFileName(0), ios::binary | ios::ate);
+		XUSG_N_RETURN(file, false);
+		m_fileSize = static_cast<size_t>(file.tellg());
+		XUSG_M_RETURN(m_fileSize < g_ddsHeaderSize, cerr, "Invalid DDS file.", false);
+
+		m_header.resize(g_ddsHeaderSize);
+		file.seekg(0);
+		XUSG_N_RETURN(file.read(reinterpret_cast<char*>(m_header.data()), m_header.size()), false);
+		if (memcmp(&m_header[g_fourCCOffset], "DX10", 4) == 0)
+		{
+			m_header.resize(g_ddsHeaderSize + g_dx10HeaderSize);
+			XUSG_N_RETURN(file.read(reinterpret_cast<char*>(&m_header[g_ddsHeaderSize]), g_dx10HeaderSize), false);
+		}
+	}
+
+	m_currentFrame = 0;
+	m_lateFrame = UINT32_MAX;
+	m_framesShown = 1;
+	m_missedDeadlines = 0;
+	m_framesRead = 0;
+	m_readTime = 0.0;
+	if (m_frameCount > 1) requestFrame(1);
+
+	return true;
+}
+
+const uint8_t* VolumeSequence::Acquire(double time)
+{
+	const auto dueFrame = static_cast<uint32_t>(static_cast<uint64_t>(time * m_frameRate) % m_frameCount);
+	if (dueFrame == m_currentFrame || !m_pending.valid()) return nullptr;
+
+	// The frame shown stays until the due one has been read
+	if (m_pending.wait_for(chrono::seconds(0)) != future_status::ready)
+	{
+		if (m_lateFrame != dueFrame) ++m_missedDeadlines;
+		m_lateFrame = dueFrame;
+
+		return nullptr;
+	}
+
+	const auto isRead = m_pending.get();
+	const auto frame = m_nextFrame;
+	m_readTime += m_backReadTime;
+	++m_framesRead;
+
+	// Skipped if the due frame is already past it
+	if (frame != dueFrame && m_lateFrame != dueFrame)
+	{
+		++m_missedDeadlines;
+		m_lateFrame = dueFrame;
+	}
+
+	if (isRead)
+	{
+		m_front ^= 1;
+		m_currentFrame = frame;
+		++m_framesShown;
+	}
+
+	// Reads ahead from the due frame, into the buffer shown before
+	requestFrame((dueFrame + 1) % m_frameCount);
+
+	return isRead ? &m_buffers[m_front][m_header.size()] : nullptr;
+}
+
+wstring VolumeSequence::GetFileName(uint32_t frame) const
+{
+	wstringstream fileName;
+	fileName << m_prefix << setw(m_numDigits) << setfill(L'0') << m_firstFrame + frame << m_suffix;
+
+	return fileName.str();
+}
+
+VolumeSequence::Stats VolumeSequence::GetStats() const
+{
+	Stats stats;
+	stats.FramesShown = m_framesShown;
+	stats.MissedDeadlines = m_missedDeadlines;
+	stats.ReadTime = m_framesRead > 0 ? m_readTime / m_framesRead : 0.0;
+
+	return stats;
+}
+
+bool VolumeSequence::readFrame(uint32_t frame, vector<uint8_t>& buffer) const
+{
+	ifstream file(GetFileName(frame), ios::binary | ios::ate);
+	XUSG_M_RETURN(!file, cerr, "Failed to open a volume file of the sequence.", false);
+	XUSG_M_RETURN(static_cast<size_t>(file.tellg()) != m_fileSize, cerr,
+		"The volume files of the sequence differ in size.", false);
+
+	buffer.resize(m_fileSize);
+	file.seekg(0);
+	XUSG_M_RETURN(!file.read(reinterpret_cast<char*>(buffer.data()), buffer.size()), cerr,
+		"Truncated volume file of the sequence.", false);
+	XUSG_M_RETURN(memcmp(buffer.data(), m_header.data(), m_header.size()) != 0, cerr,
+		"The volume files of the sequence differ in format.", false);
+
+	return true;
+}
+
+void VolumeSequence::requestFrame(uint32_t frame)
+{
+	// The back buffer is free once the previous request has completed
+	auto& buffer = m_buffers[m_front ^ 1];
+	m_nextFrame = frame;
+	m_pending = async(launch::async, [this, frame, &buffer]()
+	{
+		const auto timeStart = chrono::high_resolution_clock::now();
+		const auto isRead = readFrame(frame, buffer);
+		m_backReadTime = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - timeStart).count();
+
+		return isRead;
+	});
+}
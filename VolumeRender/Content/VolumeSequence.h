@@ -0,0 +1,66 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <future>
+
+//--------------------------------------------------------------------------------------
+// Time series of DDS volume files of the same size and format, named by a pattern whose
+// run of '#' is the zero-padded frame number, e.g. cloud_###.dds for cloud_000.dds (or
+// cloud_001.dds) on. The file of the next frame is read by a worker thread into the back
+// of 2 buffers while the current frame renders, and the buffers are swapped once the
+// next frame is due, so the render loop never waits for the file system.
+//--------------------------------------------------------------------------------------
+class VolumeSequence
+{
+public:
+	struct Stats
+	{
+		uint32_t FramesShown;
+		uint32_t MissedDeadlines;	// Frames still being read when due, shown late or skipped
+		double ReadTime;			// Average milliseconds of the worker to read a frame
+	};
+
+	VolumeSequence();
+	virtual ~VolumeSequence();
+
+	// Finds the frames of the pattern, played back at frameRate frames per second and looped;
+	// the first frame is loaded by the caller from GetFileName(0), and the second one is read
+	bool Open(const wchar_t* pattern, float frameRate);
+
+	// Returns the texels (after the DDS header) of the frame due at time in seconds, if it is
+	// not the frame shown and has been read, or null otherwise; they stay valid until the next call
+	const uint8_t* Acquire(double time);
+
+	std::wstring GetFileName(uint32_t frame) const;
+	uint32_t GetFrameCount() const { return m_frameCount; }
+	uint32_t GetCurrentFrame() const { return m_currentFrame; }
+	Stats GetStats() const;
+
+protected:
+	bool readFrame(uint32_t frame, std::vector<uint8_t>& buffer) const;
+	void requestFrame(uint32_t frame);
+
+	std::wstring			m_prefix;
+	std::wstring			m_suffix;
+	std::vector<uint8_t>	m_header;		// Of the first frame, which all frames must match
+	size_t					m_fileSize;
+	std::vector<uint8_t>	m_buffers[2];	// Front and back
+	std::future<bool>		m_pending;		// Reading of the back buffer
+
+	uint32_t	m_numDigits;
+	uint32_t	m_firstFrame;
+	uint32_t	m_frameCount;
+	uint32_t	m_currentFrame;
+	uint32_t	m_nextFrame;	// Frame read into the back buffer
+	uint32_t	m_lateFrame;	// Last frame counted as missed, UINT32_MAX if none
+	uint32_t	m_framesShown;
+	uint32_t	m_missedDeadlines;
+	uint32_t	m_framesRead;
+	double		m_readTime;		// Total
+	double		m_backReadTime;	// Of the back buffer, written by the worker
+	float		m_frameRate;
+	uint8_t		m_front;
+};
@@ -40,6 +40,8 @@ VolumeRender::VolumeRender(uint32_t width, uint32_t height, std::wstring name) :
 	m_deviceType(DEVICE_DISCRETE),
 	m_animate(false),
 	m_showMesh(true),
+	m_sliceSweepLight(false),
+	m_colorLUT(false),
 	m_showFPS(true),
 	m_isPaused(false),
 	m_tracking(false),
@@ -47,11 +49,17 @@ VolumeRender::VolumeRender(uint32_t width, uint32_t height, std::wstring name) :
 	m_lightGridSize(128),
 	m_maxRaySamples(256),
 	m_maxLightSamples(128),
+	m_lightBudget(0),
+	m_maxLightStaleFrames(8),
+	m_volumeFormat(Format::R16_FLOAT),
+	m_volumeFilter(VolumeResampler::TRILINEAR),
 	m_volumeFile(L"Assets/cloud2.dds"),
+	m_sequenceFrameRate(24.0f),
 	m_radianceFile(L"Assets/Beach.dds"),
 	m_meshFileName("Assets/dragon.obj"),
 	m_volPosScale(0.0f, -4.0f, 0.0f, 14.0f),
 	m_meshPosScale(0.0f, -4.0f, 0.0f, 1.4f),
+	m_pSequenceTexels(nullptr),
 	m_screenShot(0)
 {
 #if defined (_DEBUG)
@@ -195,17 +203,49 @@ void VolumeRender::LoadAssets()
 	XUSG_N_RETURN(m_objectRenderer->Init(m_commandList.get(), m_descriptorTableLib, uploaders,
 		m_meshFileName.c_str(), g_backFormat, g_rtFormat, g_dsFormat, m_meshPosScale), ThrowIfFailed(E_FAIL));
 
+	// The first frame of a time series loads as the volume file, and the others are read ahead during playback
+	if (!m_sequencePattern.empty())
+	{
+		XUSG_X_RETURN(m_volumeSequence, make_unique<VolumeSequence>(), ThrowIfFailed(E_FAIL));
+		XUSG_N_RETURN(m_volumeSequence->Open(m_sequencePattern.c_str(), m_sequenceFrameRate), ThrowIfFailed(E_FAIL));
+		m_volumeFile = m_volumeSequence->GetFileName(0);
+	}
+
+	// The grids keep the aspect of the volume file
+	XMUINT3 volumeFileSize;
+	if (!m_volumeFile.empty()) XUSG_N_RETURN(RayCaster::GetVolumeFileSize(m_volumeFile.c_str(), volumeFileSize), ThrowIfFailed(E_FAIL));
+
 	XUSG_X_RETURN(m_rayCaster, make_unique<RayCaster>(), ThrowIfFailed(E_FAIL));
 	XUSG_N_RETURN(m_rayCaster->Init(m_device.get(), m_descriptorTableLib, g_rtFormat, m_gridSize,
-		m_lightGridSize, m_objectRenderer->GetDepthMaps()), ThrowIfFailed(E_FAIL));
+		m_lightGridSize, m_objectRenderer->GetDepthMaps(), m_volumeFile.empty() ?
+		Format::R16G16B16A16_FLOAT : m_volumeFormat, m_volumeFile.empty() ? nullptr : &volumeFileSize), ThrowIfFailed(E_FAIL));
 	const auto volumeSize = m_volPosScale.w * 2.0f;
 	const auto volumePos = XMFLOAT3(m_volPosScale.x, m_volPosScale.y, m_volPosScale.z);
 	m_rayCaster->SetVolumeWorld(volumeSize, volumePos);
 	m_rayCaster->SetMaxSamples(m_maxRaySamples, m_maxLightSamples);
+	m_rayCaster->SetLightMapBudget(m_lightBudget, m_maxLightStaleFrames);
+
+	// The frames of a time series are uploaded as they are, so they are not filtered
+	if (!m_volumeSequence) m_rayCaster->SetVolumeFilter(m_volumeFilter);
 
 	if (m_volumeFile.empty()) m_rayCaster->InitVolumeData(pCommandList);
 	else m_rayCaster->LoadVolumeData(pCommandList, m_volumeFile.c_str(), uploaders);
 
+	if (m_colorLUT)
+	{
+		// Blue thin parts to orange dense parts over the density range of the cloud assets
+		const XMFLOAT3 colorThin(0.5f, 0.8f, 1.0f);
+		const XMFLOAT3 colorDense(1.0f, 0.6f, 0.0f);
+		XMFLOAT3 colors[17];
+		const auto numColors = static_cast<uint32_t>(size(colors));
+		for (auto i = 0u; i < numColors; ++i)
+		{
+			const auto t = (min)(4.0f * i / (numColors - 1), 1.0f);
+			XMStoreFloat3(&colors[i], XMVectorLerp(XMLoadFloat3(&colorThin), XMLoadFloat3(&colorDense), t));
+		}
+		XUSG_N_RETURN(m_rayCaster->SetColorLUT(pCommandList, colors, numColors, uploaders), ThrowIfFailed(E_FAIL));
+	}
+
 	// Close the command list and execute it to begin the initial GPU setup.
 	XUSG_N_RETURN(pCommandList->Close(), ThrowIfFailed(E_FAIL));
 	m_commandQueue->ExecuteCommandList(pCommandList);
@@ -318,6 +358,7 @@ void VolumeRender::OnUpdate()
 	const auto proj = XMLoadFloat4x4(&m_proj);
 	const auto viewProj = view * proj;
 	if (m_lightProbe) m_lightProbe->UpdateFrame(m_frameIndex, viewProj, m_eyePt);
+	if (m_volumeSequence) m_pSequenceTexels = m_volumeSequence->Acquire(time);
 	m_objectRenderer->UpdateFrame(m_frameIndex, viewProj, m_eyePt);
 	m_rayCaster->UpdateFrame(m_frameIndex, viewProj, m_objectRenderer->GetShadowVP(), m_eyePt);
 }
@@ -435,6 +476,10 @@ void VolumeRender::OnKeyUp(uint8_t key)
 		break;
 	case 'M':
 		m_showMesh = m_meshFileName.empty() ? false : !m_showMesh;
+		m_rayCaster->InvalidateLightMap(); // The mesh shadow changes
+		break;
+	case 'L':
+		m_sliceSweepLight = !m_sliceSweepLight;
 		break;
 	}
 }
@@ -550,6 +595,12 @@ void VolumeRender::ParseCommandLineArgs(wchar_t* argv[], int argc)
 			if (i + 1 < argc) m_volPosScale.z = stof(argv[++i]);
 			if (i + 1 < argc) m_volPosScale.w = stof(argv[++i]);
 		}
+		else if (wcsncmp(argv[i], L"-sequence", wcslen(argv[i])) == 0 ||
+			wcsncmp(argv[i], L"/sequence", wcslen(argv[i])) == 0)
+		{
+			if (i + 1 < argc) m_sequencePattern = argv[++i];
+			if (i + 1 < argc && argv[i + 1][0] != L'-' && argv[i + 1][0] != L'/') m_sequenceFrameRate = stof(argv[++i]);
+		}
 		else if (wcsncmp(argv[i], L"-maxRaySamples", wcslen(argv[i])) == 0 ||
 			wcsncmp(argv[i], L"/maxRaySamples", wcslen(argv[i])) == 0)
 		{
@@ -560,6 +611,42 @@ void VolumeRender::ParseCommandLineArgs(wchar_t* argv[], int argc)
 		{
 			if (i + 1 < argc) m_maxLightSamples = stoul(argv[++i]);
 		}
+		else if (wcsncmp(argv[i], L"-lightBudget", wcslen(argv[i])) == 0 ||
+			wcsncmp(argv[i], L"/lightBudget", wcslen(argv[i])) == 0)
+		{
+			if (i + 1 < argc) m_lightBudget = stoul(argv[++i]);
+			if (i + 1 < argc && argv[i + 1][0] != L'-' && argv[i + 1][0] != L'/') m_maxLightStaleFrames = stoul(argv[++i]);
+		}
+		else if (wcsncmp(argv[i], L"-lightSweep", wcslen(argv[i])) == 0 ||
+			wcsncmp(argv[i], L"/lightSweep", wcslen(argv[i])) == 0)
+			m_sliceSweepLight = true;
+		else if (wcsncmp(argv[i], L"-volumeFormat", wcslen(argv[i])) == 0 ||
+			wcsncmp(argv[i], L"/volumeFormat", wcslen(argv[i])) == 0)
+		{
+			if (i + 1 < argc)
+			{
+				++i;
+				if (_wcsicmp(argv[i], L"r8") == 0) m_volumeFormat = Format::R8_UNORM;
+				else if (_wcsicmp(argv[i], L"r16") == 0) m_volumeFormat = Format::R16_FLOAT;
+				else if (_wcsicmp(argv[i], L"rgba16") == 0) m_volumeFormat = Format::R16G16B16A16_FLOAT;
+			}
+		}
+		else if (wcsncmp(argv[i], L"-filter", wcslen(argv[i])) == 0 ||
+			wcsncmp(argv[i], L"/filter", wcslen(argv[i])) == 0)
+		{
+			if (i + 1 < argc)
+			{
+				++i;
+				for (uint8_t j = 0; j < VolumeResampler::NUM_FILTER; ++j)
+				{
+					const auto filter = static_cast<VolumeResampler::Filter>(j);
+					if (_wcsicmp(argv[i], VolumeResampler::GetFilterName(filter)) == 0) m_volumeFilter = filter;
+				}
+			}
+		}
+		else if (wcsncmp(argv[i], L"-colorLUT", wcslen(argv[i])) == 0 ||
+			wcsncmp(argv[i], L"/colorLUT", wcslen(argv[i])) == 0)
+			m_colorLUT = true;
 		else if (wcsncmp(argv[i], L"-radiance", wcslen(argv[i])) == 0 ||
 			wcsncmp(argv[i], L"/radiance", wcslen(argv[i])) == 0)
 		{
@@ -586,6 +673,13 @@ void VolumeRender::PopulateCommandList()
 	const auto descriptorHeap = m_descriptorTableLib->GetDescriptorHeap(CBV_SRV_UAV_HEAP);
 	pCommandList->SetDescriptorHeaps(1, &descriptorHeap);
 
+	// Next frame of the volume time series
+	if (m_pSequenceTexels)
+	{
+		XUSG_N_RETURN(m_rayCaster->UpdateVolumeData(pCommandList, m_pSequenceTexels, m_frameIndex), ThrowIfFailed(E_FAIL));
+		m_pSequenceTexels = nullptr;
+	}
+
 	if (m_lightProbe)
 	{
 		static auto isFirstFrame = true;
@@ -628,19 +722,20 @@ void VolumeRender::PopulateCommandList()
 	m_objectRenderer->Render(pCommandList, m_frameIndex, m_showMesh);
 	if (m_lightProbe) m_lightProbe->RenderEnvironment(pCommandList, m_frameIndex);
 
+	const uint8_t lightFlag = m_sliceSweepLight ? RayCaster::SLICE_SWEEP_LIGHT : 0;
 	switch (g_renderMethod)
 	{
 	case RAY_MARCH_MERGED:
 		m_rayCaster->Render(pCommandList, m_frameIndex, RayCaster::RAY_MARCH_CUBEMAP);
 		break;
 	case RAY_MARCH_SEPARATE:
-		m_rayCaster->Render(pCommandList, m_frameIndex, RayCaster::OPTIMIZED);
+		m_rayCaster->Render(pCommandList, m_frameIndex, RayCaster::OPTIMIZED | lightFlag);
 		break;
 	case RAY_MARCH_DIRECT_MERGED:
 		m_rayCaster->Render(pCommandList, m_frameIndex, RayCaster::RAY_MARCH_DIRECT);
 		break;
 	case RAY_MARCH_DIRECT_SEPARATE:
-		m_rayCaster->Render(pCommandList, m_frameIndex, RayCaster::SEPARATE_LIGHT_PASS);
+		m_rayCaster->Render(pCommandList, m_frameIndex, RayCaster::SEPARATE_LIGHT_PASS | lightFlag);
 		break;
 	default:
 		assert(!"Cannot reach here!");
@@ -777,6 +872,14 @@ double VolumeRender::CalculateFrameStats(float* pTimeStep)
 			break;
 		}
 
+		windowText << L"    [L] " << (m_sliceSweepLight ? "Slice-sweep lighting" : "Per-voxel lighting");
+		if (m_volumeSequence)
+		{
+			const auto stats = m_volumeSequence->GetStats();
+			windowText << L"    volume frame: " << m_volumeSequence->GetCurrentFrame() + 1 << L"/"
+				<< m_volumeSequence->GetFrameCount() << L" (deadlines missed: " << stats.MissedDeadlines
+				<< L" of " << stats.FramesShown << L" frames, read: " << stats.ReadTime << L" ms)";
+		}
 		windowText << L"    [F11] screen shot";
 
 		SetCustomWindowText(windowText.str().c_str());
@@ -16,6 +16,7 @@
 #include "RayCaster.h"
 #include "LightProbe.h"
 #include "ObjectRenderer.h"
+#include "VolumeSequence.h"
 
 using namespace DirectX;
 
@@ -74,6 +75,8 @@ private:
 	std::unique_ptr<RayCaster>	m_rayCaster;
 	std::unique_ptr<LightProbe>	m_lightProbe;
 	std::unique_ptr<ObjectRenderer> m_objectRenderer;
+	std::unique_ptr<VolumeSequence> m_volumeSequence;
+	const uint8_t* m_pSequenceTexels;	// Of the frame to upload in the next command list, or null
 	XMFLOAT4X4	m_proj;
 	XMFLOAT4X4	m_view;
 	XMFLOAT3	m_focusPt;
@@ -90,6 +93,8 @@ private:
 	StepTimer	m_timer;
 	bool		m_animate;
 	bool		m_showMesh;
+	bool		m_sliceSweepLight;
+	bool		m_colorLUT;
 	bool		m_showFPS;
 	bool		m_isPaused;
 	
@@ -102,7 +107,13 @@ private:
 	uint32_t m_lightGridSize;
 	uint32_t m_maxRaySamples;
 	uint32_t m_maxLightSamples;
+	uint32_t m_lightBudget;			// Light-map bricks re-lit per frame, 0 for unlimited
+	uint32_t m_maxLightStaleFrames;
+	XUSG::Format m_volumeFormat;	// Format of file volumes
+	VolumeResampler::Filter m_volumeFilter;	// Of file volumes resampled to the grid
 	std::wstring m_volumeFile;
+	std::wstring m_sequencePattern;	// Volume files of a time series, replacing m_volumeFile
+	float m_sequenceFrameRate;
 	std::wstring m_radianceFile;
 	std::string m_meshFileName;
 	XMFLOAT4 m_volPosScale;
@@ -0,0 +1,364 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "CPUBlockTexture.h"
+#include "CPUPacket.h"
+#include "CPUThreadPool.h"
+
+using namespace std;
+using namespace CPU;
+
+const uint32_t BlockTexture3D::BrickSize;
+const uint32_t BlockTexture3D::BlockSize;
+
+// Decoded bricks of the calling thread, tagged by the texture IDs and the pages; the
+// entries after CacheSize hold the bricks of a packet colliding with the others of it
+struct BlockTexture3D::Cache
+{
+	Cache() : Texels(static_cast<size_t>(CacheSize + MaxCacheLanes) * BrickTexelCount)
+	{
+		fill(Tags, Tags + CacheSize, UINT64_MAX);
+	}
+
+	vector<float> Texels;
+	uint64_t Tags[CacheSize];
+};
+
+static atomic<uint32_t> g_nextTextureId(0);
+
+static inline float DecodeLevel(float e0, float e1, uint32_t index)
+{
+	return e0 + (e1 - e0) * (1.0f / 7.0f) * static_cast<float>(index);
+}
+
+BlockTexture3D::BlockTexture3D() :
+	m_id(0),
+	m_width(0),
+	m_height(0),
+	m_depth(0),
+	m_pageTableWidth(0),
+	m_pageTableHeight(0),
+	m_pageTableDepth(0),
+	m_squaredError(0.0),
+	m_peak(0.0f)
+{
+}
+
+void BlockTexture3D::Create(uint32_t width, uint32_t height, uint32_t depth)
+{
+	m_id = g_nextTextureId.fetch_add(1, memory_order_relaxed);
+	m_width = width;
+	m_height = height;
+	m_depth = depth;
+	m_pageTableWidth = (width + BrickSize - 1) / BrickSize;
+	m_pageTableHeight = (height + BrickSize - 1) / BrickSize;
+	m_pageTableDepth = (depth + BrickSize - 1) / BrickSize;
+	m_pageTable.assign(static_cast<size_t>(m_pageTableWidth) * m_pageTableHeight * m_pageTableDepth, 0);
+	m_blocks.assign(BlocksPerBrick, Block());
+	m_blocks.shrink_to_fit();
+	m_squaredError = 0.0;
+	m_peak = 0.0f;
+}
+
+void BlockTexture3D::Create(const BrickedTexture3D<float>& src, ThreadPool& threadPool)
+{
+	static_assert(BrickedTexture3D<float>::BrickSize == BrickSize, "Brick sizes must match");
+
+	Create(src.GetWidth(), src.GetHeight(), src.GetDepth());
+
+	mutex blockMutex;
+	threadPool.Dispatch(GetPageCount(), [&](uint32_t page, uint32_t)
+	{
+		const auto srcSlot = src.GetPageTable()[page];
+		if (srcSlot == 0) return;
+
+		// Bricks whose non-zero texels are all in the apron decode it from the neighbors
+		const auto pSrc = src.GetData() + static_cast<size_t>(srcSlot) * BrickTexelCount;
+		auto isEmpty = true;
+		for (auto z = 0u; z < BrickSize && isEmpty; ++z)
+			for (auto y = 0u; y < BrickSize && isEmpty; ++y)
+				for (auto x = 0u; x < BrickSize && isEmpty; ++x)
+					isEmpty = pSrc[(PaddedBrickSize * z + y) * PaddedBrickSize + x] == 0.0f;
+		if (isEmpty) return;
+
+		// Texels within the grid, beyond which the source bricks repeat the last texels
+		const auto bx = page % m_pageTableWidth;
+		const auto by = page / m_pageTableWidth % m_pageTableHeight;
+		const auto bz = page / (m_pageTableWidth * m_pageTableHeight);
+		const uint32_t validSize[] =
+		{
+			(std::min)(m_width - bx * BrickSize, BrickSize),
+			(std::min)(m_height - by * BrickSize, BrickSize),
+			(std::min)(m_depth - bz * BrickSize, BrickSize)
+		};
+
+		Block blocks[BlocksPerBrick];
+		auto squaredError = 0.0;
+		auto peak = 0.0f;
+		for (auto i = 0u; i < BlocksPerBrick; ++i)
+		{
+			const uint32_t block[] = { i % 2 * BlockSize, i / 2 % 2 * BlockSize, i / 4 * BlockSize };
+			uint32_t validBlockSize[3];
+			for (uint8_t j = 0; j < 3; ++j) validBlockSize[j] = validSize[j] > block[j] ? (std::min)(validSize[j] - block[j], BlockSize) : 0;
+
+			const auto pTexels = pSrc + (PaddedBrickSize * block[2] + block[1]) * PaddedBrickSize + block[0];
+			squaredError += encodeBlock(blocks[i], pTexels, validBlockSize);
+			for (auto z = 0u; z < validBlockSize[2]; ++z)
+				for (auto y = 0u; y < validBlockSize[1]; ++y)
+					for (auto x = 0u; x < validBlockSize[0]; ++x)
+						peak = (std::max)(pTexels[(PaddedBrickSize * z + y) * PaddedBrickSize + x], peak);
+		}
+
+		lock_guard<mutex> lock(blockMutex);
+		m_pageTable[page] = static_cast<uint32_t>(m_blocks.size() / BlocksPerBrick);
+		m_blocks.insert(m_blocks.end(), blocks, blocks + BlocksPerBrick);
+		m_squaredError += squaredError;
+		m_peak = (std::max)(peak, m_peak);
+	});
+}
+
+float BlockTexture3D::Load(uint32_t x, uint32_t y, uint32_t z) const
+{
+	const auto slot = m_pageTable[pageIndex(x / BrickSize, y / BrickSize, z / BrickSize)];
+
+	return decodeTexel(slot, x % BrickSize, y % BrickSize, z % BrickSize);
+}
+
+float BlockTexture3D::SampleLevel(const float3& uvw) const
+{
+	const auto tx = ComputeLinearTap(uvw.x, m_width);
+	const auto ty = ComputeLinearTap(uvw.y, m_height);
+	const auto tz = ComputeLinearTap(uvw.z, m_depth);
+
+	return sample(tx, ty, tz);
+}
+
+float BlockTexture3D::SampleLevel(const float3& uvw, const int3& offset) const
+{
+	const auto tx = ComputeLinearTap(uvw.x + offset.x / static_cast<float>(m_width), m_width);
+	const auto ty = ComputeLinearTap(uvw.y + offset.y / static_cast<float>(m_height), m_height);
+	const auto tz = ComputeLinearTap(uvw.z + offset.z / static_cast<float>(m_depth), m_depth);
+
+	return sample(tx, ty, tz);
+}
+
+void BlockTexture3D::DecodeBricks(const uint32_t* pPages, uint32_t laneCount, uint32_t laneBits, int32_t* pOffsets) const
+{
+	auto& cache = getCache();
+
+	// The distinct bricks of the lanes stay pinned in their entries
+	uint64_t tags[MaxCacheLanes];
+	uint32_t entries[MaxCacheLanes];
+	uint32_t numBricks = 0, numOverflows = 0;
+	for (auto i = 0u; i < laneCount; ++i)
+	{
+		pOffsets[i] = 0;
+		if (!(laneBits & (1 << i))) continue;
+
+		const auto page = pPages[i];
+		const auto tag = (static_cast<uint64_t>(m_id) << 32) | page;
+		auto j = 0u;
+		while (j < numBricks && tags[j] != tag) ++j;
+		if (j == numBricks)
+		{
+			auto entry = (page + m_id * 37) % CacheSize;
+			if (cache.Tags[entry] != tag)
+			{
+				if (find(entries, entries + numBricks, entry) != entries + numBricks)
+					entry = CacheSize + numOverflows++;
+				else cache.Tags[entry] = tag;
+				decodeBrick(page, cache, entry);
+			}
+			tags[numBricks] = tag;
+			entries[numBricks++] = entry;
+		}
+		pOffsets[i] = static_cast<int32_t>(entries[j] * BrickTexelCount);
+	}
+}
+
+const float* BlockTexture3D::GetCacheData()
+{
+	return getCache().Texels.data();
+}
+
+double BlockTexture3D::GetPSNR() const
+{
+	if (m_squaredError <= 0.0) return HUGE_VAL;
+
+	const auto meanSquaredError = m_squaredError / (static_cast<double>(m_width) * m_height * m_depth);
+
+	return 10.0 * log10(static_cast<double>(m_peak) * m_peak / meanSquaredError);
+}
+
+BlockTexture3D::Cache& BlockTexture3D::getCache()
+{
+	static thread_local Cache cache;
+
+	return cache;
+}
+
+uint32_t BlockTexture3D::decodeBrick(uint32_t page, Cache& cache, uint32_t entry) const
+{
+	const auto pBrick = &cache.Texels[static_cast<size_t>(entry) * BrickTexelCount];
+	const auto rowPitch = PaddedBrickSize, slicePitch = PaddedBrickSize * PaddedBrickSize;
+	const auto slot = m_pageTable[page];
+
+	// The 2x2x2 blocks
+	if (slot == 0) fill(pBrick, pBrick + BrickTexelCount, 0.0f);
+	else
+	{
+		alignas(64) float texels[BlockTexelCount];
+		const auto pBlocks = &m_blocks[static_cast<size_t>(slot) * BlocksPerBrick];
+		for (auto i = 0u; i < BlocksPerBrick; ++i)
+		{
+			decodeBlock(texels, pBlocks[i]);
+			const auto pDst = pBrick + slicePitch * (i / 4 * BlockSize) + rowPitch * (i / 2 % 2 * BlockSize) + i % 2 * BlockSize;
+			for (auto z = 0u; z < BlockSize; ++z)
+				for (auto y = 0u; y < BlockSize; ++y)
+					copy_n(&texels[(BlockSize * z + y) * BlockSize], BlockSize, &pDst[slicePitch * z + rowPitch * y]);
+		}
+	}
+
+	// The high-side apron from the neighbors; the apron at the high borders of the grid is
+	// never sampled, since the taps are clamped to the grid
+	const auto bx = page % m_pageTableWidth;
+	const auto by = page / m_pageTableWidth % m_pageTableHeight;
+	const auto bz = page / (m_pageTableWidth * m_pageTableHeight);
+	for (auto z = 0u; z < PaddedBrickSize; ++z)
+		for (auto y = 0u; y < PaddedBrickSize; ++y)
+			for (auto x = z < BrickSize && y < BrickSize ? BrickSize : 0; x < PaddedBrickSize; ++x)
+			{
+				const auto nx = bx + x / BrickSize, ny = by + y / BrickSize, nz = bz + z / BrickSize;
+				auto& texel = pBrick[slicePitch * z + rowPitch * y + x];
+				if (nx < m_pageTableWidth && ny < m_pageTableHeight && nz < m_pageTableDepth)
+					texel = decodeTexel(m_pageTable[pageIndex(nx, ny, nz)], x % BrickSize, y % BrickSize, z % BrickSize);
+				else texel = pBrick[slicePitch * (std::min)(z, BrickSize - 1) + rowPitch * (std::min)(y, BrickSize - 1) + (std::min)(x, BrickSize - 1)];
+			}
+
+	return entry;
+}
+
+uint32_t BlockTexture3D::resolveBrick(uint32_t page) const
+{
+	auto& cache = getCache();
+	const auto tag = (static_cast<uint64_t>(m_id) << 32) | page;
+	const auto entry = (page + m_id * 37) % CacheSize;
+	if (cache.Tags[entry] != tag)
+	{
+		decodeBrick(page, cache, entry);
+		cache.Tags[entry] = tag;
+	}
+
+	return entry * BrickTexelCount;
+}
+
+float BlockTexture3D::decodeTexel(uint32_t slot, uint32_t x, uint32_t y, uint32_t z) const
+{
+	if (slot == 0) return 0.0f;
+
+	const auto blockIndex = (z / BlockSize * 2 + y / BlockSize) * 2 + x / BlockSize;
+	const auto& block = m_blocks[static_cast<size_t>(slot) * BlocksPerBrick + blockIndex];
+	const auto bit = 3 * ((BlockSize * (z % BlockSize) + y % BlockSize) * BlockSize + x % BlockSize);
+
+	// The word may extend into the endpoints, which are masked off
+	uint32_t word;
+	memcpy(&word, &block.Indices[bit / 8], sizeof(word));
+
+	return DecodeLevel(block.Endpoints[0], block.Endpoints[1], (word >> (bit % 8)) & 0x7);
+}
+
+// Same interpolation order as Texture3D::sample()
+float BlockTexture3D::sample(const LinearTap& tx, const LinearTap& ty, const LinearTap& tz) const
+{
+	const auto page = pageIndex(tx.i0 / BrickSize, ty.i0 / BrickSize, tz.i0 / BrickSize);
+	const auto pBrick = GetCacheData() + resolveBrick(static_cast<uint32_t>(page));
+	const auto x0 = tx.i0 % BrickSize, x1 = x0 + tx.i1 - tx.i0;
+	const auto y0 = ty.i0 % BrickSize, y1 = y0 + ty.i1 - ty.i0;
+	const auto z0 = tz.i0 % BrickSize, z1 = z0 + tz.i1 - tz.i0;
+	const auto s = [pBrick](uint32_t x, uint32_t y, uint32_t z) { return pBrick[(PaddedBrickSize * z + y) * PaddedBrickSize + x]; };
+
+	const auto c00 = lerp(s(x0, y0, z0), s(x1, y0, z0), tx.w);
+	const auto c10 = lerp(s(x0, y1, z0), s(x1, y1, z0), tx.w);
+	const auto c01 = lerp(s(x0, y0, z1), s(x1, y0, z1), tx.w);
+	const auto c11 = lerp(s(x0, y1, z1), s(x1, y1, z1), tx.w);
+
+	return lerp(lerp(c00, c10, ty.w), lerp(c01, c11, ty.w), tz.w);
+}
+
+// Fits the endpoints to the range of the texels, which keeps the zeros and the max
+// densities of the macro cells exact, and returns the squared error of the valid texels
+double BlockTexture3D::encodeBlock(Block& block, const float* pTexels, const uint32_t* validSize)
+{
+	const auto rowPitch = PaddedBrickSize, slicePitch = PaddedBrickSize * PaddedBrickSize;
+	float texels[BlockTexelCount];
+	auto e0 = FLT_MAX_VALUE, e1 = -FLT_MAX_VALUE;
+	for (auto i = 0u; i < BlockTexelCount; ++i)
+	{
+		const auto x = i % BlockSize, y = i / BlockSize % BlockSize, z = i / (BlockSize * BlockSize);
+		texels[i] = pTexels[slicePitch * z + rowPitch * y + x];
+		e0 = (std::min)(texels[i], e0);
+		e1 = (std::max)(texels[i], e1);
+	}
+	block.Endpoints[0] = e0;
+	block.Endpoints[1] = e1;
+
+	const auto scale = e1 > e0 ? 7.0f / (e1 - e0) : 0.0f;
+	auto squaredError = 0.0;
+	memset(block.Indices, 0, sizeof(block.Indices));
+	for (auto i = 0u; i < BlockTexelCount; ++i)
+	{
+		const auto index = (std::min)(static_cast<uint32_t>((texels[i] - e0) * scale + 0.5f), 7u);
+		const auto bit = 3 * i;
+		block.Indices[bit / 8] |= static_cast<uint8_t>(index << (bit % 8));
+		if (bit % 8 > 5) block.Indices[bit / 8 + 1] |= static_cast<uint8_t>(index >> (8 - bit % 8));
+
+		const auto x = i % BlockSize, y = i / BlockSize % BlockSize, z = i / (BlockSize * BlockSize);
+		if (x < validSize[0] && y < validSize[1] && z < validSize[2])
+		{
+			const double error = DecodeLevel(e0, e1, index) - texels[i];
+			squaredError += error * error;
+		}
+	}
+
+	return squaredError;
+}
+
+void BlockTexture3D::decodeBlock(float* pTexels, const Block& block)
+{
+	const auto e0 = block.Endpoints[0], e1 = block.Endpoints[1];
+#if CPU_PACKET_WIDTH
+	// The byte offsets and the bit shifts of the indices of the lanes
+	struct IndexLayout
+	{
+		IndexLayout()
+		{
+			for (auto i = 0u; i < BlockTexelCount; ++i)
+			{
+				ByteOffsets[i] = 3 * i / 8;
+				Shifts[i] = 3 * i % 8;
+			}
+		}
+
+		alignas(64) int32_t ByteOffsets[BlockTexelCount];
+		alignas(64) int32_t Shifts[BlockTexelCount];
+	};
+	static const IndexLayout layout;
+
+	const floatP base = e0, range = (e1 - e0) * (1.0f / 7.0f);
+	for (auto i = 0u; i < BlockTexelCount; i += CPU_PACKET_WIDTH)
+	{
+		const auto words = GatherBytes(block.Indices, intP::Load(&layout.ByteOffsets[i]));
+		const auto indices = (words >> intP::Load(&layout.Shifts[i])) & 0x7;
+		(base + range * ToFloat(indices)).Store(&pTexels[i]);
+	}
+#else
+	for (auto i = 0u; i < BlockTexelCount; ++i)
+	{
+		const auto bit = 3 * i;
+		uint32_t word;
+		memcpy(&word, &block.Indices[bit / 8], sizeof(word));
+		pTexels[i] = DecodeLevel(e0, e1, (word >> (bit % 8)) & 0x7);
+	}
+#endif
+}
@@ -0,0 +1,101 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "CPUTexture.h"
+
+namespace CPU
+{
+	class ThreadPool;
+
+	//--------------------------------------------------------------------------------------
+	// Block-compressed sparse 3D texture of densities: the same page table of 8^3 bricks as
+	// BrickedTexture3D, but each brick is stored as 2x2x2 blocks of 4^3 texels in a
+	// BC4-style format, i.e. 2 float endpoints and a 3-bit index per texel to the 8 levels
+	// between them, 32 bytes per block. Only the bricks with non-zero texels take blocks.
+	// Trilinear samples read the bricks decoded with the high-side apron into a small
+	// direct-mapped cache of the calling thread.
+	//--------------------------------------------------------------------------------------
+	class BlockTexture3D
+	{
+	public:
+		static const uint32_t BrickSize = 8;
+		static const uint32_t PaddedBrickSize = BrickSize + 1;
+		static const uint32_t BrickTexelCount = PaddedBrickSize * PaddedBrickSize * PaddedBrickSize;
+		static const uint32_t BlockSize = 4;
+		static const uint32_t BlockTexelCount = BlockSize * BlockSize * BlockSize;
+		static const uint32_t BlocksPerBrick = (BrickSize / BlockSize) * (BrickSize / BlockSize) * (BrickSize / BlockSize);
+		static const uint32_t CacheSize = 512;	// Decoded bricks per thread, 1.4 MiB
+		static const uint32_t MaxCacheLanes = 16;	// Bricks of a packet resolved at once
+
+		struct Block
+		{
+			uint8_t Indices[24];	// 3 bits per texel in x-major order, from the low bits
+			float Endpoints[2];		// Min and max
+		};
+
+		BlockTexture3D();
+
+		// Encodes the bricks of src in parallel
+		void Create(const BrickedTexture3D<float>& src, ThreadPool& threadPool);
+		void Create(uint32_t width, uint32_t height, uint32_t depth);
+
+		float Load(uint32_t x, uint32_t y, uint32_t z) const;
+		float SampleLevel(const float3& uvw) const;
+
+		// Equivalent to SampleLevel() with an integer texel offset
+		float SampleLevel(const float3& uvw, const int3& offset) const;
+
+		// Decodes the bricks of the pages of the lanes set in laneBits into the cache of the
+		// calling thread, and returns their offsets in GetCacheData() (0 for the other of the
+		// laneCount lanes, at most MaxCacheLanes), which stay valid until the next call on this
+		// thread
+		void DecodeBricks(const uint32_t* pPages, uint32_t laneCount, uint32_t laneBits, int32_t* pOffsets) const;
+		static const float* GetCacheData();
+
+		uint32_t GetWidth() const { return m_width; }
+		uint32_t GetHeight() const { return m_height; }
+		uint32_t GetDepth() const { return m_depth; }
+		uint32_t GetPageTableWidth() const { return m_pageTableWidth; }
+		uint32_t GetPageTableHeight() const { return m_pageTableHeight; }
+		uint32_t GetPageCount() const { return static_cast<uint32_t>(m_pageTable.size()); }
+		uint32_t GetBrickCount() const { return static_cast<uint32_t>(m_blocks.size() / BlocksPerBrick) - 1; }
+		size_t GetMemorySize() const { return sizeof(Block) * m_blocks.size() + sizeof(uint32_t) * m_pageTable.size(); }
+
+		// Of the encoding against the source texels, with the peak of the source as the signal;
+		// infinite if lossless
+		double GetPSNR() const;
+
+	protected:
+		struct Cache;
+
+		static Cache& getCache();
+
+		size_t pageIndex(uint32_t bx, uint32_t by, uint32_t bz) const
+		{
+			return (static_cast<size_t>(m_pageTableHeight) * bz + by) * m_pageTableWidth + bx;
+		}
+
+		uint32_t decodeBrick(uint32_t page, Cache& cache, uint32_t entry) const;
+		uint32_t resolveBrick(uint32_t page) const;
+		float decodeTexel(uint32_t slot, uint32_t x, uint32_t y, uint32_t z) const;
+		float sample(const LinearTap& tx, const LinearTap& ty, const LinearTap& tz) const;
+
+		static double encodeBlock(Block& block, const float* pTexels, const uint32_t* validSize);
+		static void decodeBlock(float* pTexels, const Block& block);
+
+		std::vector<uint32_t> m_pageTable;
+		std::vector<Block> m_blocks;
+		uint32_t m_id;	// Tags the decoded bricks of this texture in the caches
+		uint32_t m_width;
+		uint32_t m_height;
+		uint32_t m_depth;
+		uint32_t m_pageTableWidth;
+		uint32_t m_pageTableHeight;
+		uint32_t m_pageTableDepth;
+		double m_squaredError;
+		float m_peak;
+	};
+}
@@ -0,0 +1,276 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "CPUCloudGenerator.h"
+#include "CPUDDSLoader.h"
+#include "CPUPacket.h"
+#include "CPUThreadPool.h"
+
+using namespace std;
+using namespace CPU;
+
+// Bumped whenever the noise changes, which invalidates the cache files
+static const uint32_t g_generatorVersion = 1;
+
+static const uint32_t g_worleyOctaves = 3;
+static const float g_worleyWeights[] = { 0.625f, 0.25f, 0.125f };
+
+// Per-volume constants of CloudDensity()
+struct CloudParams
+{
+	float NoiseScale;	// Noise cells per texel in the first octave
+	float3 MaskScale;	// Texel to the [-1, 1] box of the shape mask
+	const CloudGenerator::Desc* pDesc;
+};
+
+//--------------------------------------------------------------------------------------
+// Scalar counterparts of the packet conversions, so the noise below is written once
+// for floats and uint32_ts, and for floatPs and intPs
+//--------------------------------------------------------------------------------------
+static inline uint32_t ToInt(float a)
+{
+	return static_cast<uint32_t>(static_cast<int32_t>(a));
+}
+
+static inline float ToFloat(uint32_t a)
+{
+	return static_cast<float>(a);
+}
+
+//--------------------------------------------------------------------------------------
+// Hash of a lattice point to 32 bits
+//--------------------------------------------------------------------------------------
+template<typename I>
+static inline I Hash(const I& x, const I& y, const I& z, const I& seed)
+{
+	auto h = seed + x * static_cast<int32_t>(0x8da6b343) + y * static_cast<int32_t>(0xd8163841) + z * static_cast<int32_t>(0xcb1ab31f);
+	h = h ^ (h >> 15);
+	h = h * static_cast<int32_t>(0x2c1b3c6d);
+	h = h ^ (h >> 12);
+	h = h * static_cast<int32_t>(0x297a2d39);
+
+	return h ^ (h >> 15);
+}
+
+// 10 bits of the hash from bit n on, to [0, 1]
+template<typename F, typename I>
+static inline F HashToUnit(const I& h, uint32_t n)
+{
+	return ToFloat((h >> n) & 0x3ff) * (1.0f / 1023.0f);
+}
+
+//--------------------------------------------------------------------------------------
+// Gradient (Perlin) noise, about [-1, 1]
+//--------------------------------------------------------------------------------------
+template<typename F, typename I>
+static F GradientNoise(const F& x, const F& y, const F& z, const I& seed)
+{
+	const auto xf = floor(x), yf = floor(y), zf = floor(z);
+	const I xi = ToInt(xf), yi = ToInt(yf), zi = ToInt(zf);
+	const F fx = x - xf, fy = y - yf, fz = z - zf;
+
+	// Dot products of the random gradients of the cell corners with the offsets to them
+	F dots[8];
+	for (uint8_t i = 0; i < 8; ++i)
+	{
+		const uint32_t cx = i & 1, cy = (i >> 1) & 1, cz = i >> 2;
+		const auto h = Hash<I>(xi + static_cast<int32_t>(cx), yi + static_cast<int32_t>(cy), zi + static_cast<int32_t>(cz), seed);
+		const auto gx = HashToUnit<F>(h, 0) * 2.0f - 1.0f;
+		const auto gy = HashToUnit<F>(h, 10) * 2.0f - 1.0f;
+		const auto gz = HashToUnit<F>(h, 20) * 2.0f - 1.0f;
+		dots[i] = gx * (fx - static_cast<float>(cx)) + gy * (fy - static_cast<float>(cy)) + gz * (fz - static_cast<float>(cz));
+	}
+
+	// Quintic fade
+	const auto fade = [](const F& t) { return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f); };
+	const auto u = fade(fx), v = fade(fy), w = fade(fz);
+	const auto d0 = lerp(lerp(dots[0], dots[1], u), lerp(dots[2], dots[3], u), v);
+	const auto d1 = lerp(lerp(dots[4], dots[5], u), lerp(dots[6], dots[7], u), v);
+
+	return lerp(d0, d1, w) * 2.0f;
+}
+
+//--------------------------------------------------------------------------------------
+// Cellular (Worley) noise: 1 - the squared distance to the nearest feature point of the
+// cell and its neighbors, 1 on the points
+//--------------------------------------------------------------------------------------
+template<typename F, typename I>
+static F WorleyNoise(const F& x, const F& y, const F& z, const I& seed)
+{
+	const auto xf = floor(x), yf = floor(y), zf = floor(z);
+	const I xi = ToInt(xf), yi = ToInt(yf), zi = ToInt(zf);
+	const F fx = x - xf, fy = y - yf, fz = z - zf;
+
+	F minDistSq = 1.0f;
+	for (auto k = -1; k <= 1; ++k)
+		for (auto j = -1; j <= 1; ++j)
+			for (auto i = -1; i <= 1; ++i)
+			{
+				const auto h = Hash<I>(xi + i, yi + j, zi + k, seed);
+				const auto dx = HashToUnit<F>(h, 0) + static_cast<float>(i) - fx;
+				const auto dy = HashToUnit<F>(h, 10) + static_cast<float>(j) - fy;
+				const auto dz = HashToUnit<F>(h, 20) + static_cast<float>(k) - fz;
+				minDistSq = (min)(minDistSq, dx * dx + dy * dy + dz * dz);
+			}
+
+	return 1.0f - minDistSq;
+}
+
+//--------------------------------------------------------------------------------------
+// Density of the texel (x, y, z)
+//--------------------------------------------------------------------------------------
+template<typename F, typename I>
+static F CloudDensity(const F& x, const F& y, const F& z, const CloudParams& params)
+{
+	const auto& desc = *params.pDesc;
+	const I seed = static_cast<int32_t>(desc.Seed);
+
+	// Fractal gradient noise to [0, 1]
+	const auto nx = (x + 0.5f) * params.NoiseScale;
+	const auto ny = (y + 0.5f) * params.NoiseScale;
+	const auto nz = (z + 0.5f) * params.NoiseScale;
+	F perlin = 0.0f;
+	auto frequency = 1.0f, amplitude = 1.0f, amplitudeSum = 0.0f;
+	for (auto i = 0u; i < desc.Octaves; ++i)
+	{
+		const I octaveSeed = seed + static_cast<int32_t>(0x9e3779b9 * i);
+		perlin += GradientNoise(nx * frequency, ny * frequency, nz * frequency, octaveSeed) * amplitude;
+		amplitudeSum += amplitude;
+		frequency *= desc.Lacunarity;
+		amplitude *= desc.Gain;
+	}
+	perlin = saturate(perlin * (0.5f / (max)(amplitudeSum, 1.0e-5f)) + 0.5f);
+
+	// Fractal Worley noise, an octave up
+	F worley = 0.0f;
+	for (auto i = 0u; i < g_worleyOctaves; ++i)
+	{
+		const I octaveSeed = seed + static_cast<int32_t>(0x85ebca6b * (i + 1));
+		const auto f = static_cast<float>(2 << i);
+		worley += saturate(WorleyNoise(nx * f, ny * f, nz * f, octaveSeed)) * g_worleyWeights[i];
+	}
+
+	// The Worley noise carves the billows of the gradient noise
+	const auto low = (worley - 1.0f) * desc.Erosion;
+	const auto base = (perlin - low) / (1.0f - low);
+
+	// Ellipsoid mask, flattened at the bottom, whose coverage thresholds the base
+	const auto qx = (x + 0.5f) * params.MaskScale.x - 1.0f;
+	const auto qy = (y + 0.5f) * params.MaskScale.y - 1.0f;
+	const auto qz = (z + 0.5f) * params.MaskScale.z - 1.0f;
+	const auto mask = saturate(1.0f - (qx * qx + qy * qy + qz * qz)) * saturate((qy + 0.7f) * 4.0f);
+	const auto coverage = mask * desc.Coverage;
+
+	return saturate((base + coverage - 1.0f) * desc.Density);
+}
+
+//--------------------------------------------------------------------------------------
+// Generates the texels [x0, x1) of the row (y, z)
+//--------------------------------------------------------------------------------------
+static void GenerateRow(float* pDst, uint32_t x0, uint32_t x1, uint32_t y, uint32_t z, const CloudParams& params)
+{
+	const auto fy = static_cast<float>(y);
+	const auto fz = static_cast<float>(z);
+
+	auto x = x0;
+#if CPU_PACKET_WIDTH
+	alignas(64) static const float laneOffsets[] = { 0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f,
+		8.0f, 9.0f, 10.0f, 11.0f, 12.0f, 13.0f, 14.0f, 15.0f };
+	const auto lanes = floatP::Load(laneOffsets);
+	for (; x + CPU_PACKET_WIDTH <= x1; x += CPU_PACKET_WIDTH)
+		CloudDensity<floatP, intP>(lanes + static_cast<float>(x), fy, fz, params).StoreUnaligned(&pDst[x - x0]);
+#endif
+
+	for (; x < x1; ++x) pDst[x - x0] = CloudDensity<float, uint32_t>(static_cast<float>(x), fy, fz, params);
+}
+
+CloudGenerator::CloudGenerator(ThreadPool& threadPool) :
+	m_threadPool(threadPool),
+	m_stats()
+{
+}
+
+CloudGenerator::~CloudGenerator()
+{
+}
+
+bool CloudGenerator::Generate(string& cacheFileName, const char* cacheDir, const uint3& size,
+	const Desc& desc, Texture3D<float>* pVolume)
+{
+	XUSG_N_RETURN(size.x > 0 && size.y > 0 && size.z > 0, false);
+
+	stringstream name;
+	const string dir = cacheDir ? cacheDir : "";
+	if (!dir.empty()) name << dir << (dir.back() == '/' || dir.back() == '\\' ? "" : "/");
+	name << "cloud." << hex << setw(16) << setfill('0') << HashDesc(desc, size) << dec << "."
+		<< size.x << "x" << size.y << "x" << size.z << ".dds";
+	cacheFileName = name.str();
+
+	if (pVolume) pVolume->Create(0, 0, 0);
+	m_stats.GenerateTime = 0.0;
+	m_stats.CacheHit = ifstream(cacheFileName, ios::binary).good();
+	if (m_stats.CacheHit) return true;
+
+	const auto timeStart = chrono::high_resolution_clock::now();
+	Texture3D<float> volume;
+	auto& dst = pVolume ? *pVolume : volume;
+	Generate(dst, size, desc);
+
+	XUSG_N_RETURN(DDS::SaveTextureToFile(cacheFileName.c_str(), dst), false);
+	m_stats.GenerateTime = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - timeStart).count();
+
+	return true;
+}
+
+void CloudGenerator::Generate(Texture3D<float>& volume, const uint3& size, const Desc& desc)
+{
+	volume.Create(size.x, size.y, size.z);
+
+	CloudParams params;
+	params.NoiseScale = desc.Frequency / (std::max)((std::max)(size.x, size.y), size.z);
+	for (uint8_t i = 0; i < 3; ++i) params.MaskScale[i] = 2.0f / size[i];
+	params.pDesc = &desc;
+
+	const uint3 brickCount(XUSG_DIV_UP(size.x, BrickSize), XUSG_DIV_UP(size.y, BrickSize), XUSG_DIV_UP(size.z, BrickSize));
+	m_threadPool.Dispatch(brickCount.x * brickCount.y * brickCount.z, [&](uint32_t i, uint32_t)
+	{
+		const uint3 brick(i % brickCount.x, (i / brickCount.x) % brickCount.y, i / (brickCount.x * brickCount.y));
+		const auto x0 = brick.x * BrickSize;
+		const auto x1 = (std::min)(x0 + BrickSize, size.x);
+		const auto yEnd = (std::min)((brick.y + 1) * BrickSize, size.y);
+		const auto zEnd = (std::min)((brick.z + 1) * BrickSize, size.z);
+		for (auto z = brick.z * BrickSize; z < zEnd; ++z)
+			for (auto y = brick.y * BrickSize; y < yEnd; ++y)
+				GenerateRow(&volume(x0, y, z), x0, x1, y, z, params);
+	});
+}
+
+CloudGenerator::Desc CloudGenerator::GetDefaultDesc(uint32_t seed)
+{
+	Desc desc;
+	desc.Seed = seed;
+	desc.Octaves = 5;
+	desc.Frequency = 4.0f;
+	desc.Lacunarity = 2.0f;
+	desc.Gain = 0.5f;
+	desc.Erosion = 0.7f;
+	desc.Coverage = 0.8f;
+	desc.Density = 2.0f;
+
+	return desc;
+}
+
+uint64_t CloudGenerator::HashDesc(const Desc& desc, const uint3& size)
+{
+	// Field by field, as the padding of Desc is undefined
+	const float floats[] = { desc.Frequency, desc.Lacunarity, desc.Gain, desc.Erosion, desc.Coverage, desc.Density };
+	uint32_t words[6 + sizeof(floats) / sizeof(float)] = { g_generatorVersion, desc.Seed, desc.Octaves, size.x, size.y, size.z };
+	memcpy(&words[6], floats, sizeof(floats));
+
+	const uint64_t prime = 0x100000001b3;
+	uint64_t hash = 0xcbf29ce484222325;
+	for (const auto& word : words) hash = (hash ^ word) * prime;
+
+	return hash;
+}
@@ -0,0 +1,66 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "CPUTexture.h"
+
+namespace CPU
+{
+	class ThreadPool;
+
+	//--------------------------------------------------------------------------------------
+	// Generates cloud volumes procedurally, for reproducible test volumes of any size in place
+	// of the smooth blob of CSInitGridData and without shipping volume files. The densities are
+	// Perlin-Worley noise, i.e. fractal gradient noise eroded by fractal cellular (Worley) noise,
+	// over a coverage threshold that follows a shape mask (an ellipsoid filling the box, flat at
+	// the bottom). The bricks are generated in parallel with SIMD across the rows of each brick.
+	// The results are cached as R32_FLOAT DDS files named by the hash of the parameters and the
+	// size, so only the first run of a cloud pays for the noise; the demo loads them with -volume.
+	//--------------------------------------------------------------------------------------
+	class CloudGenerator
+	{
+	public:
+		struct Desc
+		{
+			uint32_t Seed;
+			uint32_t Octaves;	// Of the gradient noise; the Worley noise has 3
+			float Frequency;	// Noise cells over the longest axis in the first octave
+			float Lacunarity;	// Frequency ratio of the consecutive octaves
+			float Gain;			// Amplitude ratio of the consecutive octaves
+			float Erosion;		// [0, 1], how much the Worley noise carves the gradient noise
+			float Coverage;		// [0, 1], the mask is empty at 0 and full at 1
+			float Density;		// Scale of the densities, which are clamped to 1
+		};
+
+		struct Stats
+		{
+			bool CacheHit;
+			double GenerateTime;	// Milliseconds to generate and cache the volume, 0 on a cache hit
+		};
+
+		CloudGenerator(ThreadPool& threadPool);
+		virtual ~CloudGenerator();
+
+		// Returns the name of the cache file of the cloud of desc at size in the directory cacheDir
+		// (the current one if empty), which is written first if missing; pVolume, if not null, then
+		// receives the generated volume (else it is left empty), which saves reading it back
+		bool Generate(std::string& cacheFileName, const char* cacheDir, const uint3& size,
+			const Desc& desc, Texture3D<float>* pVolume = nullptr);
+
+		// Generates in memory, without caching
+		void Generate(Texture3D<float>& volume, const uint3& size, const Desc& desc);
+
+		const Stats& GetStats() const { return m_stats; }
+
+		static Desc GetDefaultDesc(uint32_t seed = 0);
+		static uint64_t HashDesc(const Desc& desc, const uint3& size);	// 64-bit FNV-1a of the fields
+
+		static const uint32_t BrickSize = 16;	// Texels per dimension of the bricks dispatched
+
+	protected:
+		ThreadPool& m_threadPool;
+		Stats m_stats;
+	};
+}
@@ -0,0 +1,314 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "CPUDDSLoader.h"
+
+using namespace std;
+using namespace CPU;
+
+#define DDS_MAGIC		0x20534444 // "DDS "
+#define DDS_FOURCC		0x00000004
+#define DDS_LUMINANCE	0x00020000
+#define DDS_ALPHA		0x00000002
+#define DDS_RGB			0x00000040
+#define DDS_HEADER_FLAGS_VOLUME	0x00800000
+
+#define MAKEFOURCC_DDS(a, b, c, d) \
+	(static_cast<uint32_t>(a) | (static_cast<uint32_t>(b) << 8) | \
+	(static_cast<uint32_t>(c) << 16) | (static_cast<uint32_t>(d) << 24))
+
+struct DDSPixelFormat
+{
+	uint32_t Size;
+	uint32_t Flags;
+	uint32_t FourCC;
+	uint32_t RGBBitCount;
+	uint32_t RBitMask;
+	uint32_t GBitMask;
+	uint32_t BBitMask;
+	uint32_t ABitMask;
+};
+
+struct DDSHeader
+{
+	uint32_t Size;
+	uint32_t Flags;
+	uint32_t Height;
+	uint32_t Width;
+	uint32_t PitchOrLinearSize;
+	uint32_t Depth;
+	uint32_t MipMapCount;
+	uint32_t Reserved1[11];
+	DDSPixelFormat PixelFormat;
+	uint32_t Caps;
+	uint32_t Caps2;
+	uint32_t Caps3;
+	uint32_t Caps4;
+	uint32_t Reserved2;
+};
+
+struct DDSHeaderDXT10
+{
+	uint32_t DXGIFormat;
+	uint32_t ResourceDimension;
+	uint32_t MiscFlag;
+	uint32_t ArraySize;
+	uint32_t MiscFlags2;
+};
+
+// Subset of DXGI_FORMAT values used by scalar volume assets
+enum DXGIFormat : uint32_t
+{
+	DXGI_R32G32B32A32_FLOAT = 2,
+	DXGI_R16G16B16A16_FLOAT = 10,
+	DXGI_R8G8B8A8_UNORM = 28,
+	DXGI_R32_FLOAT = 41,
+	DXGI_R16_FLOAT = 54,
+	DXGI_R16_UNORM = 56,
+	DXGI_R8_UNORM = 61,
+	DXGI_A8_UNORM = 65
+};
+
+enum class SourceType : uint8_t
+{
+	UNKNOWN,
+	FLOAT32,
+	FLOAT16,
+	UNORM16,
+	UNORM8
+};
+
+static bool GetSourceType(const DDSHeader& header, const DDSHeaderDXT10* pHeader10,
+	SourceType& type, uint32_t& stride, uint32_t& channelOffset)
+{
+	type = SourceType::UNKNOWN;
+	channelOffset = 0;
+
+	if (pHeader10)
+	{
+		switch (pHeader10->DXGIFormat)
+		{
+		case DXGI_R32G32B32A32_FLOAT:
+			type = SourceType::FLOAT32;
+			stride = 16;
+			break;
+		case DXGI_R16G16B16A16_FLOAT:
+			type = SourceType::FLOAT16;
+			stride = 8;
+			break;
+		case DXGI_R8G8B8A8_UNORM:
+			type = SourceType::UNORM8;
+			stride = 4;
+			break;
+		case DXGI_R32_FLOAT:
+			type = SourceType::FLOAT32;
+			stride = 4;
+			break;
+		case DXGI_R16_FLOAT:
+			type = SourceType::FLOAT16;
+			stride = 2;
+			break;
+		case DXGI_R16_UNORM:
+			type = SourceType::UNORM16;
+			stride = 2;
+			break;
+		case DXGI_R8_UNORM:
+		case DXGI_A8_UNORM:
+			type = SourceType::UNORM8;
+			stride = 1;
+			break;
+		}
+	}
+	else
+	{
+		const auto& pf = header.PixelFormat;
+		if (pf.Flags & DDS_FOURCC)
+		{
+			// D3DFMT codes stored in the FourCC field
+			switch (pf.FourCC)
+			{
+			case 111: // D3DFMT_R16F
+				type = SourceType::FLOAT16;
+				stride = 2;
+				break;
+			case 113: // D3DFMT_A16B16G16R16F
+				type = SourceType::FLOAT16;
+				stride = 8;
+				break;
+			case 114: // D3DFMT_R32F
+				type = SourceType::FLOAT32;
+				stride = 4;
+				break;
+			case 116: // D3DFMT_A32B32G32R32F
+				type = SourceType::FLOAT32;
+				stride = 16;
+				break;
+			}
+		}
+		else if (pf.Flags & (DDS_LUMINANCE | DDS_ALPHA | DDS_RGB))
+		{
+			if (pf.RGBBitCount == 8)
+			{
+				type = SourceType::UNORM8;
+				stride = 1;
+			}
+			else if (pf.RGBBitCount == 16 && (pf.Flags & DDS_LUMINANCE))
+			{
+				type = SourceType::UNORM16;
+				stride = 2;
+			}
+			else if (pf.RGBBitCount == 32 && (pf.Flags & DDS_RGB))
+			{
+				// Pick the red channel
+				type = SourceType::UNORM8;
+				stride = 4;
+				channelOffset = pf.RBitMask == 0x00ff0000 ? 2 : 0;
+			}
+		}
+	}
+
+	return type != SourceType::UNKNOWN;
+}
+
+DDS::Loader::Loader()
+{
+}
+
+DDS::Loader::~Loader()
+{
+}
+
+bool DDS::Loader::GetTextureSize(const char* fileName, uint3& size)
+{
+	ifstream file(fileName, ios::binary);
+	XUSG_M_RETURN(!file, cerr, "Failed to open DDS file.", false);
+
+	uint32_t magic = 0;
+	DDSHeader header = {};
+	file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+	file.read(reinterpret_cast<char*>(&header), sizeof(header));
+	XUSG_M_RETURN(!file || magic != DDS_MAGIC || header.Size != sizeof(DDSHeader), cerr, "Invalid DDS file.", false);
+
+	size.x = header.Width;
+	size.y = header.Height;
+	size.z = (header.Flags & DDS_HEADER_FLAGS_VOLUME) ? (std::max)(header.Depth, 1u) : 1u;
+
+	return size.x > 0 && size.y > 0;
+}
+
+bool DDS::Loader::CreateTextureFromFile(const char* fileName, Texture3D<float>& texture)
+{
+	return CreateTextureFromFile(fileName, texture, 0, UINT32_MAX);
+}
+
+bool DDS::Loader::CreateTextureFromFile(const char* fileName, Texture3D<float>& texture,
+	uint32_t firstSlice, uint32_t numSlices)
+{
+	ifstream file(fileName, ios::binary);
+	XUSG_M_RETURN(!file, cerr, "Failed to open DDS file.", false);
+
+	uint32_t magic = 0;
+	DDSHeader header = {};
+	file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+	file.read(reinterpret_cast<char*>(&header), sizeof(header));
+	XUSG_M_RETURN(!file || magic != DDS_MAGIC || header.Size != sizeof(DDSHeader), cerr, "Invalid DDS file.", false);
+
+	DDSHeaderDXT10 header10 = {};
+	const auto hasHeader10 = (header.PixelFormat.Flags & DDS_FOURCC) &&
+		header.PixelFormat.FourCC == MAKEFOURCC_DDS('D', 'X', '1', '0');
+	if (hasHeader10) file.read(reinterpret_cast<char*>(&header10), sizeof(header10));
+
+	SourceType type;
+	uint32_t stride, channelOffset;
+	XUSG_M_RETURN(!GetSourceType(header, hasHeader10 ? &header10 : nullptr, type, stride, channelOffset),
+		cerr, "Unsupported DDS volume format.", false);
+
+	const auto width = header.Width;
+	const auto height = header.Height;
+	const auto fileDepth = (header.Flags & DDS_HEADER_FLAGS_VOLUME) ? (std::max)(header.Depth, 1u) : 1u;
+	XUSG_M_RETURN(firstSlice >= fileDepth, cerr, "DDS slices out of range.", false);
+	const auto depth = (std::min)(numSlices, fileDepth - firstSlice);
+	const auto sliceTexels = static_cast<size_t>(width) * height;
+	const auto numTexels = sliceTexels * depth;
+
+	vector<uint8_t> data(numTexels * stride);
+	file.seekg(static_cast<streamoff>(sliceTexels * stride * firstSlice), ios::cur);
+	file.read(reinterpret_cast<char*>(data.data()), data.size());
+	XUSG_M_RETURN(!file, cerr, "Truncated DDS file.", false);
+
+	texture.Create(width, height, depth);
+	const auto pDst = texture.GetData();
+	for (size_t i = 0; i < numTexels; ++i)
+	{
+		const auto pSrc = &data[stride * i + channelOffset];
+		switch (type)
+		{
+		case SourceType::FLOAT32:
+			memcpy(&pDst[i], pSrc, sizeof(float));
+			break;
+		case SourceType::FLOAT16:
+		{
+			uint16_t h;
+			memcpy(&h, pSrc, sizeof(h));
+			pDst[i] = HalfToFloat(h);
+			break;
+		}
+		case SourceType::UNORM16:
+		{
+			uint16_t u;
+			memcpy(&u, pSrc, sizeof(u));
+			pDst[i] = u / 65535.0f;
+			break;
+		}
+		default:
+			pDst[i] = *pSrc / 255.0f;
+		}
+	}
+
+	return true;
+}
+
+bool DDS::SaveTextureToFile(const char* fileName, const Texture3D<float>& texture)
+{
+	// DDS header of an R32F volume (D3DFMT_R32F in the FourCC field)
+	uint32_t header[32] = {};
+	header[0] = DDS_MAGIC;
+	header[1] = 124;			// Size of DDS_HEADER
+	header[2] = 0x1 | 0x2 | 0x4 | 0x8 | 0x1000 | 0x20000 | DDS_HEADER_FLAGS_VOLUME;	// Caps, height, width, pitch, pixel format, mips, depth
+	header[3] = texture.GetHeight();
+	header[4] = texture.GetWidth();
+	header[5] = sizeof(float) * texture.GetWidth();
+	header[6] = texture.GetDepth();
+	header[7] = 1;				// Mip count
+	header[19] = 32;			// Size of DDS_PIXELFORMAT
+	header[20] = DDS_FOURCC;
+	header[21] = 114;			// D3DFMT_R32F
+	header[27] = 0x8 | 0x1000;	// Complex, texture
+	header[28] = 0x200000;		// Volume
+
+	// Written to a temporary file first, so a partial file never exists
+	const auto tempFileName = string(fileName) + ".tmp";
+	{
+		ofstream file(tempFileName, ios::binary);
+		XUSG_M_RETURN(!file, cerr, "Failed to create the volume file.", false);
+		file.write(reinterpret_cast<const char*>(header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(texture.GetData()),
+			sizeof(float) * texture.GetWidth() * texture.GetHeight() * texture.GetDepth());
+		if (!file.flush())
+		{
+			file.close();
+			remove(tempFileName.c_str());
+			XUSG_M_RETURN(true, cerr, "Failed to write the volume file.", false);
+		}
+	}
+
+	if (rename(tempFileName.c_str(), fileName) != 0)
+	{
+		// Written by another process meanwhile
+		remove(tempFileName.c_str());
+		XUSG_N_RETURN(ifstream(fileName, ios::binary).good(), false);
+	}
+
+	return true;
+}
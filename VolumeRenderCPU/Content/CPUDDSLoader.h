@@ -0,0 +1,32 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "CPUTexture.h"
+
+namespace CPU
+{
+	namespace DDS
+	{
+		// Minimal DDS reader for scalar volume data. Reads the first mip of a 3D texture
+		// (or a 2D texture as a single slice) and converts the first channel to float.
+		class Loader
+		{
+		public:
+			Loader();
+			virtual ~Loader();
+
+			bool CreateTextureFromFile(const char* fileName, Texture3D<float>& texture);
+
+			// Reads the slices [firstSlice, firstSlice + numSlices) only, clamped to the depth
+			bool CreateTextureFromFile(const char* fileName, Texture3D<float>& texture,
+				uint32_t firstSlice, uint32_t numSlices);
+			bool GetTextureSize(const char* fileName, uint3& size);	// Reads the header only
+		};
+
+		// Writes an R32F volume (D3DFMT_R32F in the FourCC field), which Loader reads back
+		bool SaveTextureToFile(const char* fileName, const Texture3D<float>& texture);
+	}
+}
@@ -0,0 +1,330 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+// HLSL-style vector and matrix types, so that the CPU kernels read like the shaders
+// they are ported from. min()/max() return the non-NaN operand like their HLSL
+// counterparts. Matrices follow the DirectXMath row-vector convention, i.e.
+// mul(v, M) == v * M, which is also what the shaders see after the transposed upload.
+
+namespace CPU
+{
+	static const float FLT_MAX_VALUE = 3.402823466e+38f;
+	static const float PI = 3.1415926535897f;
+
+	struct float2
+	{
+		float x, y;
+
+		float2() = default;
+		constexpr float2(float s) : x(s), y(s) {}
+		constexpr float2(float x, float y) : x(x), y(y) {}
+
+		float& operator[](uint32_t i) { return (&x)[i]; }
+		const float& operator[](uint32_t i) const { return (&x)[i]; }
+	};
+
+	struct float3
+	{
+		float x, y, z;
+
+		float3() = default;
+		constexpr float3(float s) : x(s), y(s), z(s) {}
+		constexpr float3(float x, float y, float z) : x(x), y(y), z(z) {}
+
+		float& operator[](uint32_t i) { return (&x)[i]; }
+		const float& operator[](uint32_t i) const { return (&x)[i]; }
+	};
+
+	struct float4
+	{
+		float x, y, z, w;
+
+		float4() = default;
+		constexpr float4(float s) : x(s), y(s), z(s), w(s) {}
+		constexpr float4(float x, float y, float z, float w) : x(x), y(y), z(z), w(w) {}
+		constexpr float4(const float3& v, float w) : x(v.x), y(v.y), z(v.z), w(w) {}
+
+		float3 xyz() const { return float3(x, y, z); }
+		float& operator[](uint32_t i) { return (&x)[i]; }
+		const float& operator[](uint32_t i) const { return (&x)[i]; }
+	};
+
+	struct int3
+	{
+		int32_t x, y, z;
+
+		int3() = default;
+		constexpr int3(int32_t x, int32_t y, int32_t z) : x(x), y(y), z(z) {}
+	};
+
+	struct uint3
+	{
+		uint32_t x, y, z;
+
+		uint3() = default;
+		constexpr uint3(uint32_t x, uint32_t y, uint32_t z) : x(x), y(y), z(z) {}
+
+		uint32_t& operator[](uint32_t i) { return (&x)[i]; }
+		const uint32_t& operator[](uint32_t i) const { return (&x)[i]; }
+	};
+
+	// 4 signed normalized 8-bit components, stored like R8G8B8A8_SNORM texels
+	struct snorm4
+	{
+		int8_t x, y, z, w;
+
+		snorm4() = default;
+		snorm4(const float4& v) :
+			x(encode(v.x)), y(encode(v.y)), z(encode(v.z)), w(encode(v.w)) {}
+		snorm4(float s) : snorm4(float4(s)) {}
+
+		operator float4() const { return float4(decode(x), decode(y), decode(z), decode(w)); }
+
+		static int8_t encode(float f) { return static_cast<int8_t>(std::round((std::min)((std::max)(f, -1.0f), 1.0f) * 127.0f)); }
+		static float decode(int8_t i) { return (std::max)(i / 127.0f, -1.0f); }
+	};
+
+	// Row-major 4x4 matrix, m[row][col]
+	struct float4x4
+	{
+		float m[4][4];
+
+		float4x4() = default;
+		float4x4(float m00, float m01, float m02, float m03,
+			float m10, float m11, float m12, float m13,
+			float m20, float m21, float m22, float m23,
+			float m30, float m31, float m32, float m33)
+		{
+			m[0][0] = m00; m[0][1] = m01; m[0][2] = m02; m[0][3] = m03;
+			m[1][0] = m10; m[1][1] = m11; m[1][2] = m12; m[1][3] = m13;
+			m[2][0] = m20; m[2][1] = m21; m[2][2] = m22; m[2][3] = m23;
+			m[3][0] = m30; m[3][1] = m31; m[3][2] = m32; m[3][3] = m33;
+		}
+	};
+
+	//--------------------------------------------------------------------------------------
+	// Component-wise operators
+	//--------------------------------------------------------------------------------------
+#define CPU_VECTOR_OPERATORS(T, N) \
+	inline T operator+(const T& a, const T& b) { T r; for (uint32_t i = 0; i < N; ++i) r[i] = a[i] + b[i]; return r; } \
+	inline T operator-(const T& a, const T& b) { T r; for (uint32_t i = 0; i < N; ++i) r[i] = a[i] - b[i]; return r; } \
+	inline T operator*(const T& a, const T& b) { T r; for (uint32_t i = 0; i < N; ++i) r[i] = a[i] * b[i]; return r; } \
+	inline T operator/(const T& a, const T& b) { T r; for (uint32_t i = 0; i < N; ++i) r[i] = a[i] / b[i]; return r; } \
+	inline T operator*(const T& a, float s) { T r; for (uint32_t i = 0; i < N; ++i) r[i] = a[i] * s; return r; } \
+	inline T operator*(float s, const T& a) { return a * s; } \
+	inline T operator/(const T& a, float s) { return a * (1.0f / s); } \
+	inline T operator+(const T& a, float s) { T r; for (uint32_t i = 0; i < N; ++i) r[i] = a[i] + s; return r; } \
+	inline T operator-(const T& a, float s) { T r; for (uint32_t i = 0; i < N; ++i) r[i] = a[i] - s; return r; } \
+	inline T operator-(const T& a) { T r; for (uint32_t i = 0; i < N; ++i) r[i] = -a[i]; return r; } \
+	inline T& operator+=(T& a, const T& b) { return a = a + b; } \
+	inline T& operator-=(T& a, const T& b) { return a = a - b; } \
+	inline T& operator*=(T& a, const T& b) { return a = a * b; } \
+	inline T& operator*=(T& a, float s) { return a = a * s; } \
+	inline T& operator/=(T& a, float s) { return a = a / s; } \
+	inline T abs(const T& a) { T r; for (uint32_t i = 0; i < N; ++i) r[i] = std::abs(a[i]); return r; } \
+	inline T floor(const T& a) { T r; for (uint32_t i = 0; i < N; ++i) r[i] = std::floor(a[i]); return r; } \
+	inline T min(const T& a, const T& b) { T r; for (uint32_t i = 0; i < N; ++i) r[i] = std::fmin(a[i], b[i]); return r; } \
+	inline T max(const T& a, const T& b) { T r; for (uint32_t i = 0; i < N; ++i) r[i] = std::fmax(a[i], b[i]); return r; } \
+	inline T clamp(const T& a, float lo, float hi) { T r; for (uint32_t i = 0; i < N; ++i) r[i] = (std::min)((std::max)(a[i], lo), hi); return r; } \
+	inline T lerp(const T& a, const T& b, float t) { return a + (b - a) * t; } \
+	inline float dot(const T& a, const T& b) { auto s = 0.0f; for (uint32_t i = 0; i < N; ++i) s += a[i] * b[i]; return s; } \
+	inline float length(const T& a) { return std::sqrt(dot(a, a)); } \
+	inline T normalize(const T& a) { return a / length(a); }
+
+	CPU_VECTOR_OPERATORS(float2, 2)
+	CPU_VECTOR_OPERATORS(float3, 3)
+	CPU_VECTOR_OPERATORS(float4, 4)
+#undef CPU_VECTOR_OPERATORS
+
+	inline float saturate(float x) { return (std::min)((std::max)(x, 0.0f), 1.0f); }
+	inline float lerp(float a, float b, float t) { return a + (b - a) * t; }
+	inline float4 lerp(const snorm4& a, const snorm4& b, float t) { return lerp(float4(a), float4(b), t); }
+	inline float sign(float x) { return x > 0.0f ? 1.0f : (x < 0.0f ? -1.0f : 0.0f); }
+
+	inline float3 cross(const float3& a, const float3& b)
+	{
+		return float3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+	}
+
+	inline bool AnyGreater(const float3& a, float s) { return a.x > s || a.y > s || a.z > s; }
+	inline bool AllLessEqual(const float3& a, float s) { return a.x <= s && a.y <= s && a.z <= s; }
+
+	// IEEE 754 binary16 to binary32
+	inline float HalfToFloat(uint16_t h)
+	{
+		const uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+		uint32_t exponent = (h >> 10) & 0x1f;
+		uint32_t mantissa = h & 0x3ff;
+
+		uint32_t bits;
+		if (exponent == 0x1f) bits = sign | 0x7f800000 | (mantissa << 13);	// Inf/NaN
+		else if (exponent) bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+		else if (mantissa)
+		{
+			// Denormal: renormalize
+			exponent = 113;
+			while (!(mantissa & 0x400))
+			{
+				mantissa <<= 1;
+				--exponent;
+			}
+			bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+		}
+		else bits = sign;
+
+		float f;
+		memcpy(&f, &bits, sizeof(f));
+
+		return f;
+	}
+
+	//--------------------------------------------------------------------------------------
+	// Matrix operations
+	//--------------------------------------------------------------------------------------
+	inline float4 mul(const float4& v, const float4x4& m)
+	{
+		float4 r;
+		for (uint32_t j = 0; j < 4; ++j)
+			r[j] = v.x * m.m[0][j] + v.y * m.m[1][j] + v.z * m.m[2][j] + v.w * m.m[3][j];
+
+		return r;
+	}
+
+	// Transforms a point (w = 1) without the perspective divide
+	inline float3 mulPoint(const float3& v, const float4x4& m)
+	{
+		return mul(float4(v, 1.0f), m).xyz();
+	}
+
+	// Transforms a direction with the upper 3x3 block, i.e. mul(v, (float3x3)m)
+	inline float3 mulDir(const float3& v, const float4x4& m)
+	{
+		float3 r;
+		for (uint32_t j = 0; j < 3; ++j)
+			r[j] = v.x * m.m[0][j] + v.y * m.m[1][j] + v.z * m.m[2][j];
+
+		return r;
+	}
+
+	inline float4x4 operator*(const float4x4& a, const float4x4& b)
+	{
+		float4x4 r;
+		for (uint32_t i = 0; i < 4; ++i)
+			for (uint32_t j = 0; j < 4; ++j)
+				r.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j] + a.m[i][3] * b.m[3][j];
+
+		return r;
+	}
+
+	inline float4x4 MatrixIdentity()
+	{
+		return float4x4(
+			1.0f, 0.0f, 0.0f, 0.0f,
+			0.0f, 1.0f, 0.0f, 0.0f,
+			0.0f, 0.0f, 1.0f, 0.0f,
+			0.0f, 0.0f, 0.0f, 1.0f);
+	}
+
+	inline float4x4 MatrixScaling(float x, float y, float z)
+	{
+		auto r = MatrixIdentity();
+		r.m[0][0] = x;
+		r.m[1][1] = y;
+		r.m[2][2] = z;
+
+		return r;
+	}
+
+	inline float4x4 MatrixTranslation(float x, float y, float z)
+	{
+		auto r = MatrixIdentity();
+		r.m[3][0] = x;
+		r.m[3][1] = y;
+		r.m[3][2] = z;
+
+		return r;
+	}
+
+	// Same rotation order as XMMatrixRotationRollPitchYaw: roll (Z), then pitch (X), then yaw (Y)
+	inline float4x4 MatrixRotationRollPitchYaw(float pitch, float yaw, float roll)
+	{
+		const auto cp = std::cos(pitch), sp = std::sin(pitch);
+		const auto cy = std::cos(yaw), sy = std::sin(yaw);
+		const auto cr = std::cos(roll), sr = std::sin(roll);
+
+		return float4x4(
+			cr * cy + sr * sp * sy, sr * cp, sr * sp * cy - cr * sy, 0.0f,
+			cr * sp * sy - sr * cy, cr * cp, sr * sy + cr * sp * cy, 0.0f,
+			cp * sy, -sp, cp * cy, 0.0f,
+			0.0f, 0.0f, 0.0f, 1.0f);
+	}
+
+	inline float4x4 MatrixLookAtLH(const float3& eyePt, const float3& focusPt, const float3& up)
+	{
+		const auto zAxis = normalize(focusPt - eyePt);
+		const auto xAxis = normalize(cross(up, zAxis));
+		const auto yAxis = cross(zAxis, xAxis);
+
+		return float4x4(
+			xAxis.x, yAxis.x, zAxis.x, 0.0f,
+			xAxis.y, yAxis.y, zAxis.y, 0.0f,
+			xAxis.z, yAxis.z, zAxis.z, 0.0f,
+			-dot(xAxis, eyePt), -dot(yAxis, eyePt), -dot(zAxis, eyePt), 1.0f);
+	}
+
+	inline float4x4 MatrixPerspectiveFovLH(float fovAngleY, float aspectRatio, float nearZ, float farZ)
+	{
+		const auto h = 1.0f / std::tan(fovAngleY * 0.5f);
+		const auto w = h / aspectRatio;
+		const auto range = farZ / (farZ - nearZ);
+
+		return float4x4(
+			w, 0.0f, 0.0f, 0.0f,
+			0.0f, h, 0.0f, 0.0f,
+			0.0f, 0.0f, range, 1.0f,
+			0.0f, 0.0f, -range * nearZ, 0.0f);
+	}
+
+	inline float4x4 MatrixInverse(const float4x4& a)
+	{
+		// Gauss-Jordan elimination with partial pivoting
+		float4x4 m = a;
+		auto r = MatrixIdentity();
+		for (uint32_t c = 0; c < 4; ++c)
+		{
+			auto p = c;
+			for (auto i = c + 1; i < 4; ++i)
+				if (std::abs(m.m[i][c]) > std::abs(m.m[p][c])) p = i;
+			if (p != c)
+			{
+				std::swap(m.m[p], m.m[c]);
+				std::swap(r.m[p], r.m[c]);
+			}
+
+			const auto d = m.m[c][c];
+			if (d == 0.0f) return MatrixIdentity();
+			const auto s = 1.0f / d;
+			for (uint32_t j = 0; j < 4; ++j)
+			{
+				m.m[c][j] *= s;
+				r.m[c][j] *= s;
+			}
+
+			for (uint32_t i = 0; i < 4; ++i)
+			{
+				if (i == c) continue;
+				const auto f = m.m[i][c];
+				for (uint32_t j = 0; j < 4; ++j)
+				{
+					m.m[i][j] -= f * m.m[c][j];
+					r.m[i][j] -= f * r.m[c][j];
+				}
+			}
+		}
+
+		return r;
+	}
+}
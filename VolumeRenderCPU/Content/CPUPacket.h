@@ -0,0 +1,265 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "CPUMath.h"
+
+// SoA packets of CPU_PACKET_WIDTH lanes for marching several rays at once: 16 lanes
+// with AVX-512, 8 lanes with AVX2, and 0 (packets disabled, scalar kernels only)
+// otherwise. Only the operations needed by the ray-marching kernels are provided.
+#if defined(__AVX512F__)
+#define CPU_PACKET_WIDTH 16
+#elif defined(__AVX2__)
+#define CPU_PACKET_WIDTH 8
+#else
+#define CPU_PACKET_WIDTH 0
+#endif
+
+#if CPU_PACKET_WIDTH
+namespace CPU
+{
+#if CPU_PACKET_WIDTH == 16
+	//--------------------------------------------------------------------------------------
+	// AVX-512
+	//--------------------------------------------------------------------------------------
+	struct maskP
+	{
+		__mmask16 m;
+
+		maskP() = default;
+		maskP(__mmask16 m) : m(m) {}
+
+		static maskP FromBits(uint32_t bits) { return static_cast<__mmask16>(bits); }
+		uint32_t Bits() const { return m; }
+		bool Any() const { return m != 0; }
+	};
+
+	inline maskP operator&(const maskP& a, const maskP& b) { return static_cast<__mmask16>(a.m & b.m); }
+	inline maskP operator|(const maskP& a, const maskP& b) { return static_cast<__mmask16>(a.m | b.m); }
+	inline maskP AndNot(const maskP& a, const maskP& b) { return static_cast<__mmask16>(~a.m & b.m); }
+
+	struct intP
+	{
+		__m512i v;
+
+		intP() = default;
+		intP(__m512i v) : v(v) {}
+		intP(int32_t s) : v(_mm512_set1_epi32(s)) {}
+
+		static intP Load(const int32_t* p) { return _mm512_load_si512(p); }
+		void Store(int32_t* p) const { _mm512_store_si512(p, v); }
+	};
+
+	inline intP operator+(const intP& a, const intP& b) { return _mm512_add_epi32(a.v, b.v); }
+	inline intP operator-(const intP& a, const intP& b) { return _mm512_sub_epi32(a.v, b.v); }
+	inline intP operator*(const intP& a, const intP& b) { return _mm512_mullo_epi32(a.v, b.v); }
+	inline intP operator&(const intP& a, const intP& b) { return _mm512_and_si512(a.v, b.v); }
+	inline intP operator^(const intP& a, const intP& b) { return _mm512_xor_si512(a.v, b.v); }
+	inline intP operator>>(const intP& a, uint32_t n) { return _mm512_srli_epi32(a.v, n); }
+	inline intP operator>>(const intP& a, const intP& n) { return _mm512_srlv_epi32(a.v, n.v); }
+	inline intP min(const intP& a, const intP& b) { return _mm512_min_epi32(a.v, b.v); }
+	inline intP max(const intP& a, const intP& b) { return _mm512_max_epi32(a.v, b.v); }
+
+	struct floatP
+	{
+		__m512 v;
+
+		floatP() = default;
+		floatP(__m512 v) : v(v) {}
+		floatP(float s) : v(_mm512_set1_ps(s)) {}
+
+		static floatP Load(const float* p) { return _mm512_load_ps(p); }
+		void Store(float* p) const { _mm512_store_ps(p, v); }
+		static floatP LoadUnaligned(const float* p) { return _mm512_loadu_ps(p); }
+		void StoreUnaligned(float* p) const { _mm512_storeu_ps(p, v); }
+	};
+
+	inline floatP operator+(const floatP& a, const floatP& b) { return _mm512_add_ps(a.v, b.v); }
+	inline floatP operator-(const floatP& a, const floatP& b) { return _mm512_sub_ps(a.v, b.v); }
+	inline floatP operator*(const floatP& a, const floatP& b) { return _mm512_mul_ps(a.v, b.v); }
+	inline floatP operator/(const floatP& a, const floatP& b) { return _mm512_div_ps(a.v, b.v); }
+	inline floatP min(const floatP& a, const floatP& b) { return _mm512_min_ps(a.v, b.v); }
+	inline floatP max(const floatP& a, const floatP& b) { return _mm512_max_ps(a.v, b.v); }
+	inline floatP abs(const floatP& a) { return _mm512_abs_ps(a.v); }
+	inline floatP floor(const floatP& a) { return _mm512_roundscale_ps(a.v, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+	inline floatP ceil(const floatP& a) { return _mm512_roundscale_ps(a.v, _MM_FROUND_TO_POS_INF | _MM_FROUND_NO_EXC); }
+
+	inline maskP operator<(const floatP& a, const floatP& b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ); }
+	inline maskP operator>(const floatP& a, const floatP& b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_GT_OQ); }
+	inline maskP operator<=(const floatP& a, const floatP& b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_LE_OQ); }
+
+	// m ? a : b
+	inline floatP Select(const maskP& m, const floatP& a, const floatP& b) { return _mm512_mask_blend_ps(m.m, b.v, a.v); }
+
+	inline intP ToInt(const floatP& a) { return _mm512_cvttps_epi32(a.v); }
+	inline floatP ToFloat(const intP& a) { return _mm512_cvtepi32_ps(a.v); }
+
+	// Gathers p[idx * SCALE / sizeof(float)]
+	template<int SCALE>
+	inline floatP Gather(const float* p, const intP& idx) { return _mm512_i32gather_ps(idx.v, p, SCALE); }
+
+	// Gathers p[idx]
+	inline intP Gather(const uint32_t* p, const intP& idx) { return _mm512_i32gather_epi32(idx.v, p, 4); }
+
+	// Gathers the unaligned 32-bit words at the byte offsets of p
+	inline intP GatherBytes(const void* p, const intP& offset) { return _mm512_i32gather_epi32(offset.v, p, 1); }
+#else
+	//--------------------------------------------------------------------------------------
+	// AVX2
+	//--------------------------------------------------------------------------------------
+	struct maskP
+	{
+		__m256 m;
+
+		maskP() = default;
+		maskP(__m256 m) : m(m) {}
+
+		static maskP FromBits(uint32_t bits)
+		{
+			const auto lanes = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+			const auto b = _mm256_and_si256(_mm256_set1_epi32(bits), lanes);
+
+			return _mm256_castsi256_ps(_mm256_cmpeq_epi32(b, lanes));
+		}
+
+		uint32_t Bits() const { return static_cast<uint32_t>(_mm256_movemask_ps(m)); }
+		bool Any() const { return !_mm256_testz_ps(m, m); }
+	};
+
+	inline maskP operator&(const maskP& a, const maskP& b) { return _mm256_and_ps(a.m, b.m); }
+	inline maskP operator|(const maskP& a, const maskP& b) { return _mm256_or_ps(a.m, b.m); }
+	inline maskP AndNot(const maskP& a, const maskP& b) { return _mm256_andnot_ps(a.m, b.m); }
+
+	struct intP
+	{
+		__m256i v;
+
+		intP() = default;
+		intP(__m256i v) : v(v) {}
+		intP(int32_t s) : v(_mm256_set1_epi32(s)) {}
+
+		static intP Load(const int32_t* p) { return _mm256_load_si256(reinterpret_cast<const __m256i*>(p)); }
+		void Store(int32_t* p) const { _mm256_store_si256(reinterpret_cast<__m256i*>(p), v); }
+	};
+
+	inline intP operator+(const intP& a, const intP& b) { return _mm256_add_epi32(a.v, b.v); }
+	inline intP operator-(const intP& a, const intP& b) { return _mm256_sub_epi32(a.v, b.v); }
+	inline intP operator*(const intP& a, const intP& b) { return _mm256_mullo_epi32(a.v, b.v); }
+	inline intP operator&(const intP& a, const intP& b) { return _mm256_and_si256(a.v, b.v); }
+	inline intP operator^(const intP& a, const intP& b) { return _mm256_xor_si256(a.v, b.v); }
+	inline intP operator>>(const intP& a, uint32_t n) { return _mm256_srli_epi32(a.v, n); }
+	inline intP operator>>(const intP& a, const intP& n) { return _mm256_srlv_epi32(a.v, n.v); }
+	inline intP min(const intP& a, const intP& b) { return _mm256_min_epi32(a.v, b.v); }
+	inline intP max(const intP& a, const intP& b) { return _mm256_max_epi32(a.v, b.v); }
+
+	struct floatP
+	{
+		__m256 v;
+
+		floatP() = default;
+		floatP(__m256 v) : v(v) {}
+		floatP(float s) : v(_mm256_set1_ps(s)) {}
+
+		static floatP Load(const float* p) { return _mm256_load_ps(p); }
+		void Store(float* p) const { _mm256_store_ps(p, v); }
+		static floatP LoadUnaligned(const float* p) { return _mm256_loadu_ps(p); }
+		void StoreUnaligned(float* p) const { _mm256_storeu_ps(p, v); }
+	};
+
+	inline floatP operator+(const floatP& a, const floatP& b) { return _mm256_add_ps(a.v, b.v); }
+	inline floatP operator-(const floatP& a, const floatP& b) { return _mm256_sub_ps(a.v, b.v); }
+	inline floatP operator*(const floatP& a, const floatP& b) { return _mm256_mul_ps(a.v, b.v); }
+	inline floatP operator/(const floatP& a, const floatP& b) { return _mm256_div_ps(a.v, b.v); }
+	inline floatP min(const floatP& a, const floatP& b) { return _mm256_min_ps(a.v, b.v); }
+	inline floatP max(const floatP& a, const floatP& b) { return _mm256_max_ps(a.v, b.v); }
+	inline floatP abs(const floatP& a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+	inline floatP floor(const floatP& a) { return _mm256_floor_ps(a.v); }
+	inline floatP ceil(const floatP& a) { return _mm256_ceil_ps(a.v); }
+
+	inline maskP operator<(const floatP& a, const floatP& b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+	inline maskP operator>(const floatP& a, const floatP& b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+	inline maskP operator<=(const floatP& a, const floatP& b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+
+	// m ? a : b
+	inline floatP Select(const maskP& m, const floatP& a, const floatP& b) { return _mm256_blendv_ps(b.v, a.v, m.m); }
+
+	inline intP ToInt(const floatP& a) { return _mm256_cvttps_epi32(a.v); }
+	inline floatP ToFloat(const intP& a) { return _mm256_cvtepi32_ps(a.v); }
+
+	// Gathers p[idx * SCALE / sizeof(float)]
+	template<int SCALE>
+	inline floatP Gather(const float* p, const intP& idx) { return _mm256_i32gather_ps(p, idx.v, SCALE); }
+
+	// Gathers p[idx]
+	inline intP Gather(const uint32_t* p, const intP& idx) { return _mm256_i32gather_epi32(reinterpret_cast<const int*>(p), idx.v, 4); }
+
+	// Gathers the unaligned 32-bit words at the byte offsets of p
+	inline intP GatherBytes(const void* p, const intP& offset) { return _mm256_i32gather_epi32(static_cast<const int*>(p), offset.v, 1); }
+#endif
+
+	//--------------------------------------------------------------------------------------
+	// Width-independent helpers
+	//--------------------------------------------------------------------------------------
+	inline floatP& operator+=(floatP& a, const floatP& b) { return a = a + b; }
+
+	struct float3P
+	{
+		floatP x, y, z;
+	};
+
+	struct float4P
+	{
+		floatP x, y, z, w;
+	};
+
+	// Texel addressing for LINEAR_CLAMP sampling, same as ComputeLinearTap()
+	struct LinearTapP
+	{
+		intP i0, i1;
+		floatP w;
+	};
+
+	inline LinearTapP ComputeLinearTap(const floatP& u, uint32_t size)
+	{
+		const auto x = u * static_cast<float>(size) - 0.5f;
+		const auto xf = floor(x);
+		const intP last = static_cast<int32_t>(size) - 1;
+		const auto i = ToInt(xf);
+
+		LinearTapP tap;
+		tap.i0 = min(max(i, 0), last);
+		tap.i1 = min(max(i + 1, 0), last);
+		tap.w = x - xf;
+
+		return tap;
+	}
+
+	inline floatP lerp(const floatP& a, const floatP& b, const floatP& t) { return a + (b - a) * t; }
+	inline floatP saturate(const floatP& a) { return min(max(a, 0.0f), 1.0f); }
+
+	// Index of the lowest set lane bit
+	inline uint32_t CountTrailingZeros(uint32_t bits)
+	{
+#if defined(_MSC_VER)
+		unsigned long i;
+		_BitScanForward(&i, bits);
+
+		return i;
+#else
+		return __builtin_ctz(bits);
+#endif
+	}
+
+	// Number of set lane bits
+	inline uint32_t CountBits(uint32_t bits)
+	{
+#if defined(_MSC_VER)
+		return __popcnt(bits);
+#else
+		return __builtin_popcount(bits);
+#endif
+	}
+}
+#endif
@@ -0,0 +1,3576 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "CPURayCaster.h"
+#include "CPUDDSLoader.h"
+
+using namespace std;
+using namespace CPU;
+
+#define ABSORPTION		0.8f
+#define ZERO_THRESHOLD	0.01f
+
+static const float g_zNear = 1.0f;
+static const float g_zFar = 1000.0f;
+static const float g_maxDist = 2.0f * sqrtf(3.0f);
+
+static const uint8_t g_cubeMapNumMips = 5;
+static const uint32_t g_cubeTileSize = 8;	// [numthreads(8, 8, 1)]
+static const uint32_t g_lightTileSize = 4;	// [numthreads(4, 4, 4)]
+static const uint32_t g_lightBrickSize = 16;	// Unit of the time-sliced light-map updates
+static const uint32_t g_screenTileSize = 8;
+static const uint32_t g_packetRowSize = 8;	// Lanes per tile row in a packet
+static const uint32_t g_wavefrontTileSize = 32;	// Cube-map texels per dimension of the ray queue of a wavefront
+static const uint32_t g_macroCellSize = 8;	// MACRO_CELL_SIZE
+static const float g_lightMipDist = 0.5f;	// LIGHT_MIP_DIST
+
+static inline bool IsCubeFaceVisible(uint8_t face, const float3& localSpaceEyePt,
+	const float3& boundsMin, const float3& boundsMax)
+{
+	const auto axis = face >> 1;
+	const auto& viewComp = localSpaceEyePt[axis];
+
+	return (face & 0x1) ? viewComp > boundsMin[axis] : viewComp < boundsMax[axis];
+}
+
+static inline uint32_t GenVisibilityMask(const float4x4& worldI, const float3& eyePt,
+	const float3& boundsMin, const float3& boundsMax)
+{
+	const auto localSpaceEyePt = mulPoint(eyePt, worldI);
+
+	auto mask = 0u;
+	for (uint8_t i = 0; i < 6; ++i)
+	{
+		const auto isVisible = IsCubeFaceVisible(i, localSpaceEyePt, boundsMin, boundsMax);
+		mask |= (isVisible ? 1 : 0) << i;
+	}
+
+	return mask;
+}
+
+// Conservative test of a local-space box against the clip volume
+static inline bool IsBoxInFrustum(const float3& boxMin, const float3& boxMax, const float4x4& worldViewProj)
+{
+	uint8_t outsideMask = 0x3f;
+	for (uint8_t i = 0; i < 8; ++i)
+	{
+		const float3 corner((i & 1) ? boxMax.x : boxMin.x, (i & 2) ? boxMax.y : boxMin.y, (i & 4) ? boxMax.z : boxMin.z);
+		const auto pos = mul(float4(corner, 1.0f), worldViewProj);
+		uint8_t mask = 0;
+		mask |= pos.x < -pos.w ? 0x01 : 0;
+		mask |= pos.x > pos.w ? 0x02 : 0;
+		mask |= pos.y < -pos.w ? 0x04 : 0;
+		mask |= pos.y > pos.w ? 0x08 : 0;
+		mask |= pos.z < 0.0f ? 0x10 : 0;
+		mask |= pos.z > pos.w ? 0x20 : 0;
+		outsideMask &= mask;
+	}
+
+	return outsideMask == 0;
+}
+
+static inline float3 ProjectToViewport(uint32_t i, const float4x4& worldViewProj, const float2& viewport)
+{
+	static const float3 v[] =
+	{
+		float3(1.0f, 1.0f, 1.0f),
+		float3(-1.0f, 1.0f, 1.0f),
+		float3(1.0f, -1.0f, 1.0f),
+		float3(-1.0f, -1.0f, 1.0f),
+
+		float3(-1.0f, 1.0f, -1.0f),
+		float3(1.0f, 1.0f, -1.0f),
+		float3(-1.0f, -1.0f, -1.0f),
+		float3(1.0f, -1.0f, -1.0f),
+	};
+
+	const auto h = mul(float4(v[i], 1.0f), worldViewProj);
+	auto p = h.xyz() / h.w;
+	p = p * float3(0.5f, -0.5f, 1.0f) + float3(0.5f, 0.5f, 0.0f);
+
+	return p * float3(viewport.x, viewport.y, 1.0f);
+}
+
+static inline float EstimateCubeEdgePixelSize(const float3 v[8])
+{
+	static const uint8_t ei[][2] =
+	{
+		{ 0, 1 },
+		{ 3, 2 },
+
+		{ 1, 3 },
+		{ 2, 0 },
+
+		{ 4, 5 },
+		{ 7, 6 },
+
+		{ 5, 7 },
+		{ 6, 4 },
+
+		{ 1, 4 },
+		{ 6, 3 },
+
+		{ 5, 0 },
+		{ 2, 7 }
+	};
+
+	auto s = 0.0f;
+	for (uint8_t i = 0; i < 12; ++i)
+	{
+		const auto e = v[ei[i][1]] - v[ei[i][0]];
+		s = (max)(length(float2(e.x, e.y)), s);
+	}
+
+	return s;
+}
+
+// Screen area of a cube face in pixels, or -1 if it is not all in front of the eye
+static inline float EstimateCubeFacePixelArea(const float3 v[8], uint8_t face)
+{
+	// Corners of the faces in the order of GetLocalPos(), going round
+	static const uint8_t fi[][4] =
+	{
+		{ 0, 2, 7, 5 },	// +X
+		{ 1, 3, 6, 4 },	// -X
+		{ 0, 1, 4, 5 },	// +Y
+		{ 2, 3, 6, 7 },	// -Y
+		{ 0, 1, 3, 2 },	// +Z
+		{ 4, 5, 7, 6 }	// -Z
+	};
+
+	auto a = 0.0f;
+	for (uint8_t i = 0; i < 4; ++i)
+	{
+		const auto& p = v[fi[face][i]];
+		const auto& q = v[fi[face][(i + 1) % 4]];
+		if (p.z < 0.0f || p.z > 1.0f) return -1.0f;
+		a += p.x * q.y - q.x * p.y;
+	}
+
+	return fabsf(a) * 0.5f;
+}
+
+// Returns the level of the cube map, and the levels per face in faceLODs, which can be coarser
+// by the footprints of the faces: the faces seen obliquely take fewer texels than those facing
+// the eye, while the resolution of a face facing the eye is that of the whole cube map
+static inline uint8_t EstimateCubeMapLOD(uint32_t& raySampleCount, uint8_t numMips, float cubeMapSize,
+	const float4x4& worldViewProj, const float4x4& boundsWorldViewProj, const float2& viewport,
+	uint8_t faceLODs[6], float upscale = 2.0f, float raySampleCountScale = 2.0f)
+{
+	float3 v[8];
+	for (uint8_t i = 0; i < 8; ++i) v[i] = ProjectToViewport(i, worldViewProj, viewport);
+
+	// Calulate the ideal cube-map resolution
+	const auto edgeSize = EstimateCubeEdgePixelSize(v);
+	auto s = edgeSize / upscale;
+
+	// Get the ideal ray sample amount
+	auto raySampleAmt = raySampleCountScale * s / sqrtf(3.0f);
+
+	// Clamp the ideal ray sample amount using the user-specified upper bound of ray sample count
+	const auto raySampleCnt = static_cast<uint32_t>(ceilf(raySampleAmt));
+	raySampleCount = (min)(raySampleCnt, raySampleCount);
+
+	// Inversely derive the cube-map resolution from the clamped ray sample amount
+	raySampleAmt = (min)(raySampleAmt, static_cast<float>(raySampleCount));
+	s = raySampleAmt / raySampleCountScale * sqrtf(3.0f);
+
+	// The cube map only spans the occupancy bounds, so tight bounds take fewer texels at the same sampling rate
+	for (uint8_t i = 0; i < 8; ++i) v[i] = ProjectToViewport(i, boundsWorldViewProj, viewport);
+	const auto boundsEdgeSize = EstimateCubeEdgePixelSize(v);
+	s *= edgeSize > 0.0f ? boundsEdgeSize / edgeSize : 1.0f;
+
+	// Use the more detailed integer level for conservation
+	const auto level = min<uint8_t>(static_cast<uint8_t>((max)(log2f(cubeMapSize / s), 0.0f)), numMips - 1);
+
+	// Scale the resolution per face by the side of a square of its area against the longest edge
+	for (uint8_t i = 0; i < 6; ++i)
+	{
+		const auto area = EstimateCubeFacePixelArea(v, i);
+		const auto faceSize = area >= 0.0f && boundsEdgeSize > 0.0f ? s * sqrtf(area) / boundsEdgeSize : s;
+		const auto faceLevel = static_cast<uint8_t>((min)((max)(log2f(cubeMapSize / faceSize), 0.0f), 255.0f));
+		faceLODs[i] = (min)((max)(faceLevel, level), static_cast<uint8_t>(numMips - 1));
+	}
+
+	return level;
+}
+
+//--------------------------------------------------------------------------------------
+// Occupancy bounds
+//--------------------------------------------------------------------------------------
+static inline bool IsOutOfBounds(const float3& pos, const float3& boundsMin, const float3& boundsMax)
+{
+	return pos.x < boundsMin.x || pos.y < boundsMin.y || pos.z < boundsMin.z ||
+		pos.x > boundsMax.x || pos.y > boundsMax.y || pos.z > boundsMax.z;
+}
+
+// The proxy box [-1, 1] of the cube map, stretched over the bounds
+static inline float3 LocalToBoundsSpace(const float3& pos, const float3& boundsMin, const float3& boundsMax)
+{
+	return (pos * 2.0f - (boundsMax + boundsMin)) / (boundsMax - boundsMin);
+}
+
+static inline float3 BoundsToLocalSpace(const float3& pos, const float3& boundsMin, const float3& boundsMax)
+{
+	return (pos * (boundsMax - boundsMin) + (boundsMax + boundsMin)) * 0.5f;
+}
+
+//--------------------------------------------------------------------------------------
+// Compute start point of the ray
+//--------------------------------------------------------------------------------------
+static inline bool ComputeRayOrigin(float3& rayOrigin, const float3& rayDir,
+	const float3& boundsMin, const float3& boundsMax)
+{
+	if (!IsOutOfBounds(rayOrigin, boundsMin, boundsMax)) return true;
+
+	auto U = FLT_MAX_VALUE;
+	auto isHit = false;
+
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		const auto bound = rayDir[i] > 0.0f ? boundsMin[i] : boundsMax[i];
+		const auto u = (bound - rayOrigin[i]) / rayDir[i];
+		if (u < 0.0f) continue;
+
+		const uint8_t j = (i + 1) % 3, k = (i + 2) % 3;
+		const auto hitJ = rayDir[j] * u + rayOrigin[j];
+		const auto hitK = rayDir[k] * u + rayOrigin[k];
+		if (hitJ < boundsMin[j] || hitJ > boundsMax[j]) continue;
+		if (hitK < boundsMin[k] || hitK > boundsMax[k]) continue;
+		if (u < U)
+		{
+			U = u;
+			isHit = true;
+		}
+	}
+
+	rayOrigin = rayDir * U + rayOrigin;
+	for (uint8_t i = 0; i < 3; ++i) rayOrigin[i] = (min)((max)(rayOrigin[i], boundsMin[i]), boundsMax[i]);
+
+	return isHit;
+}
+
+//--------------------------------------------------------------------------------------
+// Compute the end point of the ray
+//--------------------------------------------------------------------------------------
+static inline float ComputeTargetHit(const float3& rayOrigin, const float3& target, const float3& rayDir)
+{
+	const auto u = (target - rayOrigin) / rayDir;
+
+	return fmaxf(fmaxf(u.x, u.y), u.z);
+}
+
+//--------------------------------------------------------------------------------------
+// Local position to texture space
+//--------------------------------------------------------------------------------------
+static inline float3 LocalToTex3DSpace(const float3& pos, const float3& extent)
+{
+	return pos / extent * 0.5f + 0.5f;
+}
+
+//--------------------------------------------------------------------------------------
+// Texel center of a grid to local position
+//--------------------------------------------------------------------------------------
+static inline float3 TexelToLocalSpace(uint32_t x, uint32_t y, uint32_t z, const uint3& gridSize, const float3& extent)
+{
+	const float3 texel(static_cast<float>(x), static_cast<float>(y), static_cast<float>(z));
+	const float3 size(static_cast<float>(gridSize.x), static_cast<float>(gridSize.y), static_cast<float>(gridSize.z));
+
+	return ((texel + 0.5f) / size * 2.0f - 1.0f) * extent;
+}
+
+//--------------------------------------------------------------------------------------
+// Per-axis grid size with the aspect of the volume, whose longest axis is of the size
+//--------------------------------------------------------------------------------------
+static inline uint3 GetGridSize(uint32_t size, const uint3* pVolumeSize)
+{
+	if (!pVolumeSize) return uint3(size, size, size);
+	if (size == 0) return *pVolumeSize;
+
+	const auto scale = static_cast<float>(size) / (max)((max)(pVolumeSize->x, pVolumeSize->y), pVolumeSize->z);
+	const auto x = static_cast<uint32_t>(pVolumeSize->x * scale + 0.5f);
+	const auto y = static_cast<uint32_t>(pVolumeSize->y * scale + 0.5f);
+	const auto z = static_cast<uint32_t>(pVolumeSize->z * scale + 0.5f);
+
+	return uint3((max)(x, 1u), (max)(y, 1u), (max)(z, 1u));
+}
+
+static inline uint32_t GetMaxSize(const uint3& size)
+{
+	return (max)((max)(size.x, size.y), size.z);
+}
+
+//--------------------------------------------------------------------------------------
+// Get step
+//--------------------------------------------------------------------------------------
+static inline float GetStep(float dDensity, float transm, float density, float step)
+{
+	const auto factorEv = fminf(1.0f / 256.0f / fabsf(dDensity), 2.0f);
+	const auto factorUi = fminf(1.0f - density, 1.0f);
+	const auto factorTh = 1.0f - transm;
+	step *= fmaxf(1.5f * factorEv * factorUi * factorTh, 1.0f);
+
+	return step;
+}
+
+//--------------------------------------------------------------------------------------
+// Get the mip level of a view-ray sample, which goes 1 level coarser each time the
+// transmittance halves below 0.5, i.e. floor(log2(0.5 / transm))
+//--------------------------------------------------------------------------------------
+static inline uint8_t GetTransmMip(float transm, uint8_t maxMip)
+{
+	uint8_t mip = 0;
+	while (mip < maxMip && transm <= 0.25f / (1 << mip)) ++mip;
+
+	return mip;
+}
+
+//--------------------------------------------------------------------------------------
+// Get the mip level of a light-ray sample at the distance t from the ray origin
+//--------------------------------------------------------------------------------------
+static inline uint8_t GetDistanceMip(float t, uint8_t maxMip)
+{
+	uint8_t mip = 0;
+	while (mip < maxMip && t >= g_lightMipDist * (1 << mip)) ++mip;
+
+	return mip;
+}
+
+//--------------------------------------------------------------------------------------
+// Get the opacity scale of a sample over 2^mip base steps, such that
+// density * ABSORPTION * scale = 1 - (1 - density * ABSORPTION)^(2^mip)
+//--------------------------------------------------------------------------------------
+static inline float GetOpacityScale(float density, uint8_t mip)
+{
+	if (mip == 0) return 1.0f;
+
+	const auto opacity = density * ABSORPTION;
+	if (opacity <= 0.0f) return static_cast<float>(1 << mip); // The limit at a zero opacity
+
+	auto transm = 1.0f - opacity;
+	for (uint8_t i = 0; i < mip; ++i) transm *= transm;
+
+	return (1.0f - transm) / opacity;
+}
+
+//--------------------------------------------------------------------------------------
+// Get the local-space position of the grid surface
+//--------------------------------------------------------------------------------------
+static inline float3 GetLocalPos(uint32_t x, uint32_t y, uint8_t face, uint32_t gridSize,
+	const float3& boundsMin, const float3& boundsMax)
+{
+	auto pos = (float2(static_cast<float>(x), static_cast<float>(y)) + 0.5f) / static_cast<float>(gridSize) * 2.0f - 1.0f;
+	pos.y = -pos.y;
+
+	float3 boundsPos;
+	switch (face)
+	{
+	case 0: // +X
+		boundsPos = float3(1.0f, pos.y, -pos.x);
+		break;
+	case 1: // -X
+		boundsPos = float3(-1.0f, pos.y, pos.x);
+		break;
+	case 2: // +Y
+		boundsPos = float3(pos.x, 1.0f, -pos.y);
+		break;
+	case 3: // -Y
+		boundsPos = float3(pos.x, -1.0f, pos.y);
+		break;
+	case 4: // +Z
+		boundsPos = float3(pos.x, pos.y, 1.0f);
+		break;
+	case 5: // -Z
+		boundsPos = float3(-pos.x, pos.y, -1.0f);
+		break;
+	default:
+		return 0.0f;
+	}
+
+	return BoundsToLocalSpace(boundsPos, boundsMin, boundsMax);
+}
+
+//--------------------------------------------------------------------------------------
+// Inverse of GetLocalPos(): cube face and face UV of a local-space direction
+//--------------------------------------------------------------------------------------
+static inline uint8_t GetCubeFaceUV(float2& uv, const float3& dir)
+{
+	const auto a = abs(dir);
+	uint8_t face;
+	float2 pos;
+	if (a.x >= a.y && a.x >= a.z)
+	{
+		face = dir.x > 0.0f ? 0 : 1;
+		pos = float2(dir.x > 0.0f ? -dir.z : dir.z, dir.y) / a.x;
+	}
+	else if (a.y >= a.z)
+	{
+		face = dir.y > 0.0f ? 2 : 3;
+		pos = float2(dir.x, dir.y > 0.0f ? -dir.z : dir.z) / a.y;
+	}
+	else
+	{
+		face = dir.z > 0.0f ? 4 : 5;
+		pos = float2(dir.z > 0.0f ? dir.x : -dir.x, dir.y) / a.z;
+	}
+
+	uv = float2(pos.x * 0.5f + 0.5f, 0.5f - pos.y * 0.5f);
+
+	return face;
+}
+
+//--------------------------------------------------------------------------------------
+// Unproject and return z in viewing space
+//--------------------------------------------------------------------------------------
+static inline float UnprojectZ(float depth)
+{
+	static const float3 unproj = { g_zNear - g_zFar, g_zFar, g_zNear * g_zFar };
+
+	return unproj.z / (depth * unproj.x + unproj.y);
+}
+
+//--------------------------------------------------------------------------------------
+// SH irradiance evaluation using normal (SHIrradianceTypeless.hlsli)
+//--------------------------------------------------------------------------------------
+static inline float3 EvaluateSHIrradiance(const float3* shCoeffs, const float3& norm)
+{
+	const auto c1 = 0.42904276540489171563379376569857f;
+	const auto c2 = 0.51166335397324424423977581244463f;
+	const auto c3 = 0.24770795610037568833406429782001f;
+	const auto c4 = 0.88622692545275801364908374167057f;
+
+	const auto x = -norm.x;
+	const auto y = -norm.y;
+	const auto z = norm.z;
+
+	return max(float3(0.0f),
+		(c1 * (x * x - y * y)) * shCoeffs[8]
+		+ (c3 * (3.0f * z * z - 1.0f)) * shCoeffs[6]
+		+ c4 * shCoeffs[0]
+		+ 2.0f * c1 * (shCoeffs[4] * x * y + shCoeffs[7] * x * z + shCoeffs[5] * y * z)
+		+ 2.0f * c2 * (shCoeffs[3] * x + shCoeffs[1] * y + shCoeffs[2] * z));
+}
+
+#if CPU_PACKET_WIDTH
+//--------------------------------------------------------------------------------------
+// Trilinear LINEAR_CLAMP sampling of packets with gathers
+//--------------------------------------------------------------------------------------
+struct TrilinearTapsP
+{
+	intP Idx[8];	// Float offsets of the corner texels
+	floatP W[3];
+};
+
+static inline void ComputeTrilinearTaps(TrilinearTapsP& taps, const float3P& uvw,
+	uint32_t width, uint32_t height, uint32_t depth, uint32_t stride)
+{
+	const auto tx = ComputeLinearTap(uvw.x, width);
+	const auto ty = ComputeLinearTap(uvw.y, height);
+	const auto tz = ComputeLinearTap(uvw.z, depth);
+
+	const intP w = static_cast<int32_t>(width), h = static_cast<int32_t>(height), s = static_cast<int32_t>(stride);
+	const intP z0 = tz.i0 * h, z1 = tz.i1 * h;
+	const intP y00 = (z0 + ty.i0) * w, y10 = (z0 + ty.i1) * w;
+	const intP y01 = (z1 + ty.i0) * w, y11 = (z1 + ty.i1) * w;
+	taps.Idx[0] = (y00 + tx.i0) * s;
+	taps.Idx[1] = (y00 + tx.i1) * s;
+	taps.Idx[2] = (y10 + tx.i0) * s;
+	taps.Idx[3] = (y10 + tx.i1) * s;
+	taps.Idx[4] = (y01 + tx.i0) * s;
+	taps.Idx[5] = (y01 + tx.i1) * s;
+	taps.Idx[6] = (y11 + tx.i0) * s;
+	taps.Idx[7] = (y11 + tx.i1) * s;
+	taps.W[0] = tx.w;
+	taps.W[1] = ty.w;
+	taps.W[2] = tz.w;
+}
+
+// Same as above for a BrickedTexture3D, with the float offsets of the corners in its
+// brick pool (the 8 taps always lie in the brick of the lower taps)
+template<typename T, uint32_t BRICK_SIZE>
+static inline void ComputeTrilinearTaps(TrilinearTapsP& taps, const float3P& uvw,
+	const BrickedTexture3D<T, BRICK_SIZE>& texture)
+{
+	static_assert((BRICK_SIZE & (BRICK_SIZE - 1)) == 0, "Brick size must be a power of 2");
+	const auto tx = ComputeLinearTap(uvw.x, texture.GetWidth());
+	const auto ty = ComputeLinearTap(uvw.y, texture.GetHeight());
+	const auto tz = ComputeLinearTap(uvw.z, texture.GetDepth());
+
+	// Look up the brick slots in the page table
+	const auto shift = CountTrailingZeros(BRICK_SIZE);
+	const intP pw = static_cast<int32_t>(texture.GetPageTableWidth());
+	const intP ph = static_cast<int32_t>(texture.GetPageTableHeight());
+	const auto page = ((tz.i0 >> shift) * ph + (ty.i0 >> shift)) * pw + (tx.i0 >> shift);
+	const auto base = Gather(texture.GetPageTable(), page) * intP(BrickedTexture3D<T, BRICK_SIZE>::BrickTexelCount);
+	const intP s = static_cast<int32_t>(sizeof(T) / sizeof(float));
+
+	// Texel coordinates in the padded brick
+	const intP mask = BRICK_SIZE - 1, p = BrickedTexture3D<T, BRICK_SIZE>::PaddedBrickSize;
+	const auto x0 = tx.i0 & mask, x1 = x0 + (tx.i1 - tx.i0);
+	const auto y0 = ty.i0 & mask, y1 = y0 + (ty.i1 - ty.i0);
+	const auto z0 = (tz.i0 & mask) * p, z1 = z0 + (tz.i1 - tz.i0) * p;
+	const auto y00 = (z0 + y0) * p + base, y10 = (z0 + y1) * p + base;
+	const auto y01 = (z1 + y0) * p + base, y11 = (z1 + y1) * p + base;
+	taps.Idx[0] = (y00 + x0) * s;
+	taps.Idx[1] = (y00 + x1) * s;
+	taps.Idx[2] = (y10 + x0) * s;
+	taps.Idx[3] = (y10 + x1) * s;
+	taps.Idx[4] = (y01 + x0) * s;
+	taps.Idx[5] = (y01 + x1) * s;
+	taps.Idx[6] = (y11 + x0) * s;
+	taps.Idx[7] = (y11 + x1) * s;
+	taps.W[0] = tx.w;
+	taps.W[1] = ty.w;
+	taps.W[2] = tz.w;
+}
+
+// Same as above for a BlockTexture3D, with the float offsets of the corners in the brick
+// cache of the calling thread, into which the bricks of the lanes set in lanes are decoded
+static inline void ComputeTrilinearTaps(TrilinearTapsP& taps, const float3P& uvw,
+	const BlockTexture3D& texture, const maskP& lanes)
+{
+	const auto tx = ComputeLinearTap(uvw.x, texture.GetWidth());
+	const auto ty = ComputeLinearTap(uvw.y, texture.GetHeight());
+	const auto tz = ComputeLinearTap(uvw.z, texture.GetDepth());
+
+	// Resolve the bricks in the cache
+	static_assert(CPU_PACKET_WIDTH <= BlockTexture3D::MaxCacheLanes, "Packet lanes must fit in the brick cache");
+	const auto shift = CountTrailingZeros(BlockTexture3D::BrickSize);
+	const intP pw = static_cast<int32_t>(texture.GetPageTableWidth());
+	const intP ph = static_cast<int32_t>(texture.GetPageTableHeight());
+	const auto page = ((tz.i0 >> shift) * ph + (ty.i0 >> shift)) * pw + (tx.i0 >> shift);
+	alignas(64) int32_t pages[CPU_PACKET_WIDTH], offsets[CPU_PACKET_WIDTH];
+	page.Store(pages);
+	texture.DecodeBricks(reinterpret_cast<const uint32_t*>(pages), CPU_PACKET_WIDTH, lanes.Bits(), offsets);
+	const auto base = intP::Load(offsets);
+
+	// Texel coordinates in the padded brick
+	const intP mask = BlockTexture3D::BrickSize - 1, p = BlockTexture3D::PaddedBrickSize;
+	const auto x0 = tx.i0 & mask, x1 = x0 + (tx.i1 - tx.i0);
+	const auto y0 = ty.i0 & mask, y1 = y0 + (ty.i1 - ty.i0);
+	const auto z0 = (tz.i0 & mask) * p, z1 = z0 + (tz.i1 - tz.i0) * p;
+	const auto y00 = (z0 + y0) * p + base, y10 = (z0 + y1) * p + base;
+	const auto y01 = (z1 + y0) * p + base, y11 = (z1 + y1) * p + base;
+	taps.Idx[0] = y00 + x0;
+	taps.Idx[1] = y00 + x1;
+	taps.Idx[2] = y10 + x0;
+	taps.Idx[3] = y10 + x1;
+	taps.Idx[4] = y01 + x0;
+	taps.Idx[5] = y01 + x1;
+	taps.Idx[6] = y11 + x0;
+	taps.Idx[7] = y11 + x1;
+	taps.W[0] = tx.w;
+	taps.W[1] = ty.w;
+	taps.W[2] = tz.w;
+}
+
+// Same as above for a StreamedTexture3D, with the float offsets of the corners in its brick
+// cache; returns the lanes whose bricks are not in the cache
+static inline uint32_t ComputeTrilinearTaps(TrilinearTapsP& taps, const float3P& uvw,
+	const StreamedTexture3D& texture, const maskP& lanes)
+{
+	const auto tx = ComputeLinearTap(uvw.x, texture.GetWidth());
+	const auto ty = ComputeLinearTap(uvw.y, texture.GetHeight());
+	const auto tz = ComputeLinearTap(uvw.z, texture.GetDepth());
+
+	// Resolve the bricks in the cache
+	const auto shift = CountTrailingZeros(StreamedTexture3D::BrickSize);
+	const intP pw = static_cast<int32_t>(texture.GetPageTableWidth());
+	const intP ph = static_cast<int32_t>(texture.GetPageTableHeight());
+	const auto page = ((tz.i0 >> shift) * ph + (ty.i0 >> shift)) * pw + (tx.i0 >> shift);
+	alignas(64) int32_t pages[CPU_PACKET_WIDTH], offsets[CPU_PACKET_WIDTH];
+	page.Store(pages);
+	const auto fallbackBits = texture.ResolveBricks(reinterpret_cast<const uint32_t*>(pages), CPU_PACKET_WIDTH, lanes.Bits(), offsets);
+	const auto base = intP::Load(offsets);
+
+	// Texel coordinates in the padded brick
+	const intP mask = StreamedTexture3D::BrickSize - 1, p = StreamedTexture3D::PaddedBrickSize;
+	const auto x0 = tx.i0 & mask, x1 = x0 + (tx.i1 - tx.i0);
+	const auto y0 = ty.i0 & mask, y1 = y0 + (ty.i1 - ty.i0);
+	const auto z0 = (tz.i0 & mask) * p, z1 = z0 + (tz.i1 - tz.i0) * p;
+	const auto y00 = (z0 + y0) * p + base, y10 = (z0 + y1) * p + base;
+	const auto y01 = (z1 + y0) * p + base, y11 = (z1 + y1) * p + base;
+	taps.Idx[0] = y00 + x0;
+	taps.Idx[1] = y00 + x1;
+	taps.Idx[2] = y10 + x0;
+	taps.Idx[3] = y10 + x1;
+	taps.Idx[4] = y01 + x0;
+	taps.Idx[5] = y01 + x1;
+	taps.Idx[6] = y11 + x0;
+	taps.Idx[7] = y11 + x1;
+	taps.W[0] = tx.w;
+	taps.W[1] = ty.w;
+	taps.W[2] = tz.w;
+
+	return fallbackBits;
+}
+
+// Same interpolation order as Texture3D::SampleLevel()
+static inline floatP SampleTrilinear(const float* pData, const TrilinearTapsP& taps)
+{
+	floatP s[8];
+	for (uint8_t i = 0; i < 8; ++i) s[i] = Gather<4>(pData, taps.Idx[i]);
+
+	const auto c00 = lerp(s[0], s[1], taps.W[0]);
+	const auto c10 = lerp(s[2], s[3], taps.W[0]);
+	const auto c01 = lerp(s[4], s[5], taps.W[0]);
+	const auto c11 = lerp(s[6], s[7], taps.W[0]);
+
+	return lerp(lerp(c00, c10, taps.W[1]), lerp(c01, c11, taps.W[1]), taps.W[2]);
+}
+
+// Packet version of getLUTColor()
+static inline float3P GetLUTColor(const vector<float3>& colorLUT, const floatP& density)
+{
+	const auto last = static_cast<int32_t>(colorLUT.size()) - 1;
+	const auto x = min(max(density, 0.0f), 1.0f) * static_cast<float>(last);
+	const auto i0 = ToInt(x);
+	const auto i1 = min(i0 + 1, last);
+	const auto w = x - floor(x);
+
+	const auto pLUT = reinterpret_cast<const float*>(colorLUT.data());
+	const auto idx0 = i0 * 3, idx1 = i1 * 3;
+
+	float3P color;
+	color.x = lerp(Gather<4>(pLUT, idx0), Gather<4>(pLUT, idx1), w);
+	color.y = lerp(Gather<4>(pLUT + 1, idx0), Gather<4>(pLUT + 1, idx1), w);
+	color.z = lerp(Gather<4>(pLUT + 2, idx0), Gather<4>(pLUT + 2, idx1), w);
+
+	return color;
+}
+
+//--------------------------------------------------------------------------------------
+// Packet version of getEmptySpaceSkip(): masks the lanes in empty macro cells, and
+// returns the ray distances to the cell exits
+//--------------------------------------------------------------------------------------
+static inline maskP GetEmptySpaceSkip(floatP& tSkip, const Texture3D<float2>& macroCells,
+	const float3& cellScale, const float3& extent, const float3P& uvw, const float3P& rayDir)
+{
+	const auto countX = macroCells.GetWidth(), countY = macroCells.GetHeight();
+	const auto getCell = [](const floatP& uvw, float scale, uint32_t count)
+	{
+		// Clamped for the inactive lanes outside the volume, whose cells are gathered as well
+		return max(min(floor(uvw * scale), static_cast<float>(count) - 1.0f), 0.0f);
+	};
+	const float3P cell =
+	{
+		getCell(uvw.x, cellScale.x, countX),
+		getCell(uvw.y, cellScale.y, countY),
+		getCell(uvw.z, cellScale.z, macroCells.GetDepth())
+	};
+
+	const intP cx = static_cast<int32_t>(countX), cy = static_cast<int32_t>(countY);
+	const auto idx = ((ToInt(cell.z) * cy + ToInt(cell.y)) * cx + ToInt(cell.x)) * 2;
+	const auto maxDensity = Gather<4>(reinterpret_cast<const float*>(macroCells.GetData()) + 1, idx);
+
+	// The texture-space ray has the same parameter t as the local-space ray
+	const auto getAxisSkip = [](const floatP& cell, const floatP& uvw, const floatP& rayDir, float scale, float extent)
+	{
+		const auto uvwDir = rayDir * (0.5f / extent);
+		const auto bound = (cell + Select(uvwDir < 0.0f, 0.0f, 1.0f)) / scale;
+
+		return abs(bound - uvw) / max(abs(uvwDir), 1e-8f);
+	};
+	tSkip = min(min(getAxisSkip(cell.x, uvw.x, rayDir.x, cellScale.x, extent.x),
+		getAxisSkip(cell.y, uvw.y, rayDir.y, cellScale.y, extent.y)),
+		getAxisSkip(cell.z, uvw.z, rayDir.z, cellScale.z, extent.z));
+
+	return (maxDensity < ZERO_THRESHOLD) & (tSkip > 0.0f);
+}
+#endif
+
+CPURayCaster::CPURayCaster() :
+	m_pDepths(),
+	m_hasSH(false),
+	m_densityOnly(false),
+	m_emptySpaceSkip(true),
+	m_volumeLOD(true),
+	m_gradientVolume(true),
+	m_volumeCompression(false),
+	m_streamCacheSize(0),
+	m_volumeFilter(VolumeResampler::TRILINEAR),
+	m_wavefrontSteps(0),
+	m_lightMapSweep(false),
+	m_lightMapLit(false),
+	m_irradianceDirty(true),
+	m_lightPassInputs(),
+	m_lightDirtyMin(0.0f),
+	m_lightDirtyMax(1.0f),
+	m_gridSize(0, 0, 0),
+	m_lightGridSize(0, 0, 0),
+	m_lightBrickCount(0, 0, 0),
+	m_maxRaySamples(256),
+	m_maxLightSamples(64),
+	m_relitTexelCount(0),
+	m_bakedTexelCount(0),
+	m_staleLightBrickCount(0),
+	m_lightFrame(0),
+	m_lightMapBudget(0),
+	m_maxLightStaleFrames(8),
+	m_cubeMapLOD(0),
+	m_cubeFaceLODs(),
+	m_cubeFaceLOD(true),
+	m_numVolumeMips(1),
+	m_skipStats(),
+	m_laneStats(),
+	m_tileLayout(0),
+	m_reuseTolerance(0.0f),
+	m_reuseRefreshFrames(8),
+	m_reusedTileCount(0),
+	m_cubeFrame(0),
+	m_cubeMapDirty(true),
+	m_cubeMapInputs(),
+	m_cubeTileLODs(),
+	m_cubeCacheBudget(0),
+	m_cubeCacheCellSize(2.0f),
+	m_cubeCacheHits(0),
+	m_cubeCacheMisses(0),
+	m_boundsMin(-1.0f),
+	m_boundsMax(1.0f),
+	m_densityStats(),
+	m_densityStatsDirty(false),
+	m_extent(1.0f),
+	m_lightPt(75.0f, 75.0f, -75.0f),
+	m_lightColor(1.0f, 0.7f, 0.3f, 1.0f),
+	m_ambient(0.0f, 0.3f, 1.0f, 0.4f)
+{
+	m_volumeWorld = MatrixScaling(10.0f, 10.0f, 10.0f);
+}
+
+CPURayCaster::~CPURayCaster()
+{
+}
+
+bool CPURayCaster::Init(uint32_t gridSize, uint32_t lightGridSize, uint32_t numThreads, bool densityOnly,
+	const uint3* pVolumeSize)
+{
+	XUSG_N_RETURN((gridSize > 0 && lightGridSize > 0) || pVolumeSize, false);
+
+	// Non-cubic grids keep the aspect of the volume, whose local space spans the extent
+	// of 1 on the longest axis, so that the voxels stay cubic in all spaces
+	m_gridSize = GetGridSize(gridSize, pVolumeSize);
+	m_lightGridSize = GetGridSize(lightGridSize, pVolumeSize);
+	const auto maxGridSize = GetMaxSize(m_gridSize);
+	for (uint8_t i = 0; i < 3; ++i) m_extent[i] = static_cast<float>(m_gridSize[i]) / maxGridSize;
+	m_boundsMin = -m_extent;
+	m_boundsMax = m_extent;
+	m_densityOnly = densityOnly;
+	m_threadPool = make_unique<ThreadPool>(numThreads);
+	m_resampler = make_unique<VolumeResampler>(*m_threadPool);
+	m_cloudGenerator = make_unique<CloudGenerator>(*m_threadPool);
+
+	// Create resources
+	if (densityOnly) m_density[0].Create(m_gridSize.x, m_gridSize.y, m_gridSize.z);
+	else m_volume[0].Create(m_gridSize.x, m_gridSize.y, m_gridSize.z);
+	for (auto& mip : m_densityBC) mip.Create(0, 0, 0);
+	m_densityStream.Close();
+	m_numVolumeMips = 1;
+	while (m_numVolumeMips < VolumeMipCount && (maxGridSize >> m_numVolumeMips) > 0) ++m_numVolumeMips;
+	m_macroCells.Create(XUSG_DIV_UP(m_gridSize.x, g_macroCellSize), XUSG_DIV_UP(m_gridSize.y, g_macroCellSize),
+		XUSG_DIV_UP(m_gridSize.z, g_macroCellSize));
+
+	// The cube map spans the occupancy bounds at the resolution of the longest axis
+	m_cubeMap.Create(maxGridSize, maxGridSize, 6, g_cubeMapNumMips);
+	m_cubeDepth.Create(maxGridSize, maxGridSize, 6, g_cubeMapNumMips);
+
+	m_lightMap.Create(m_lightGridSize.x, m_lightGridSize.y, m_lightGridSize.z);
+	for (uint8_t i = 0; i < 3; ++i) m_lightBrickCount[i] = XUSG_DIV_UP(m_lightGridSize[i], g_lightBrickSize);
+	m_lightBrickStamps.assign(m_lightBrickCount.x * m_lightBrickCount.y * m_lightBrickCount.z, UINT32_MAX);
+	m_staleLightBrickCount = 0;
+	m_lightMapLit = false;
+	InvalidateLightMap();
+	m_irradiance.Create(m_lightGridSize.x, m_lightGridSize.y, m_lightGridSize.z);
+	m_irradianceDirty = true;
+
+	return SetViewport(1280, 800);
+}
+
+static inline float GetDensity(float texel) { return texel; }
+static inline float GetDensity(const float4& texel) { return texel.w; }
+static inline float GetDensity(const snorm4& texel) { return (texel.x | texel.y | texel.z | texel.w) ? 1.0f : 0.0f; }
+
+// Fills the padded texels of brick (bx, by, bz), including the high-side apron clamped to
+// the grid, with texelFunc(x, y, z), and returns whether all of them are empty
+template<typename T, typename FUNC>
+static bool FillBrick(T* pTexels, uint32_t bx, uint32_t by, uint32_t bz, const uint3& gridSize, const FUNC& texelFunc)
+{
+	const auto brickSize = BrickedTexture3D<T>::BrickSize, paddedSize = BrickedTexture3D<T>::PaddedBrickSize;
+	const uint3 last(gridSize.x - 1, gridSize.y - 1, gridSize.z - 1);
+
+	auto isEmpty = true;
+	for (auto z = 0u; z < paddedSize; ++z)
+		for (auto y = 0u; y < paddedSize; ++y)
+			for (auto x = 0u; x < paddedSize; ++x)
+			{
+				*pTexels = texelFunc((min)(bx * brickSize + x, last.x), (min)(by * brickSize + y, last.y), (min)(bz * brickSize + z, last.z));
+				isEmpty = isEmpty && GetDensity(*pTexels) == 0.0f;
+				++pTexels;
+			}
+
+	return isEmpty;
+}
+
+// Fills a volume brick by brick with texelFunc(x, y, z), and stores only the bricks
+// with non-zero densities
+template<typename T, typename FUNC>
+static void SetBricks(BrickedTexture3D<T>& volume, ThreadPool& threadPool, const uint3& gridSize, const FUNC& texelFunc)
+{
+	const auto brickSize = BrickedTexture3D<T>::BrickSize;
+	const uint3 brickCount(XUSG_DIV_UP(gridSize.x, brickSize), XUSG_DIV_UP(gridSize.y, brickSize), XUSG_DIV_UP(gridSize.z, brickSize));
+
+	volume.Create(gridSize.x, gridSize.y, gridSize.z);
+	threadPool.Dispatch(brickCount.x * brickCount.y * brickCount.z, [&](uint32_t i, uint32_t)
+	{
+		const auto bx = i % brickCount.x, by = i / brickCount.x % brickCount.y, bz = i / (brickCount.x * brickCount.y);
+
+		T texels[BrickedTexture3D<T>::BrickTexelCount];
+		if (!FillBrick(texels, bx, by, bz, gridSize, texelFunc)) volume.SetBrick(bx, by, bz, texels);
+	});
+}
+
+// Refills the bricks holding any of the texels [minCorner, maxCorner), also in their aprons, with
+// texelFunc(x, y, z), which may load the volume itself: all bricks are filled before any is stored.
+// The stored bricks left empty are zeroed in place, and the other empty ones stay unstored.
+template<typename T, typename FUNC>
+static void SetBricks(BrickedTexture3D<T>& volume, ThreadPool& threadPool, const uint3& gridSize,
+	const uint3& minCorner, const uint3& maxCorner, const FUNC& texelFunc)
+{
+	const auto brickSize = BrickedTexture3D<T>::BrickSize, texelCount = BrickedTexture3D<T>::BrickTexelCount;
+	uint3 brickMin, brickCount;
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		brickMin[i] = ((max)(minCorner[i], 1u) - 1) / brickSize;	// The apron of the brick below
+		brickCount[i] = (maxCorner[i] - 1) / brickSize + 1 - brickMin[i];
+	}
+
+	const auto numBricks = brickCount.x * brickCount.y * brickCount.z;
+	vector<T> texels(static_cast<size_t>(numBricks) * texelCount);
+	vector<uint8_t> isEmpty(numBricks);
+	const auto getBrick = [&](uint32_t i)
+	{
+		return uint3(brickMin.x + i % brickCount.x, brickMin.y + i / brickCount.x % brickCount.y,
+			brickMin.z + i / (brickCount.x * brickCount.y));
+	};
+
+	threadPool.Dispatch(numBricks, [&](uint32_t i, uint32_t)
+	{
+		const auto brick = getBrick(i);
+		isEmpty[i] = FillBrick(&texels[static_cast<size_t>(i) * texelCount], brick.x, brick.y, brick.z, gridSize, texelFunc);
+	});
+
+	threadPool.Dispatch(numBricks, [&](uint32_t i, uint32_t)
+	{
+		const auto brick = getBrick(i);
+		if (!isEmpty[i] || volume.HasBrick(brick.x, brick.y, brick.z))
+			volume.SetBrick(brick.x, brick.y, brick.z, &texels[static_cast<size_t>(i) * texelCount]);
+	});
+}
+
+static inline uint3 GetMipSize(const uint3& gridSize, uint8_t i)
+{
+	return uint3((max)(gridSize.x >> i, 1u), (max)(gridSize.y >> i, 1u), (max)(gridSize.z >> i, 1u));
+}
+
+// Texels of a mip from src, the previous one (CSVolumeMip)
+template<typename SRC>
+static auto GetMipTexelFunc(const SRC& src, const uint3& mipSize)
+{
+	const auto size = float3(static_cast<float>(mipSize.x), static_cast<float>(mipSize.y), static_cast<float>(mipSize.z));
+
+	// The trilinear sample at the shared corner of the 2x2x2 source texels is their box average
+	return [&src, size](uint32_t x, uint32_t y, uint32_t z)
+	{
+		const auto uvw = (float3(static_cast<float>(x), static_cast<float>(y), static_cast<float>(z)) + 0.5f) / size;
+
+		return src.SampleLevel(uvw);
+	};
+}
+
+// Downsamples mip level i from src, the previous one
+template<typename T, typename SRC>
+static void GenerateMip(BrickedTexture3D<T>& mip, const SRC& src, uint8_t i, ThreadPool& threadPool, const uint3& gridSize)
+{
+	const auto mipSize = GetMipSize(gridSize, i);
+	SetBricks(mip, threadPool, mipSize, GetMipTexelFunc(src, mipSize));
+}
+
+// Downsamples each mip from the previous one
+template<typename T>
+static void GenerateMips(BrickedTexture3D<T>* mips, uint8_t numMips, ThreadPool& threadPool, const uint3& gridSize)
+{
+	for (uint8_t i = 1; i < numMips; ++i) GenerateMip(mips[i], mips[i - 1], i, threadPool, gridSize);
+}
+
+// Downsamples the texels of each mip that filter the texels [minCorner, maxCorner) of the finest one
+// from the previous mip; a texel of margin covers the taps of the odd sizes
+template<typename T>
+static void UpdateMips(BrickedTexture3D<T>* mips, uint8_t numMips, ThreadPool& threadPool, const uint3& gridSize,
+	uint3 minCorner, uint3 maxCorner)
+{
+	for (uint8_t i = 1; i < numMips; ++i)
+	{
+		const auto mipSize = GetMipSize(gridSize, i);
+		for (uint8_t j = 0; j < 3; ++j)
+		{
+			minCorner[j] = (max)(minCorner[j] >> 1, 1u) - 1;
+			maxCorner[j] = (min)(((maxCorner[j] + 1) >> 1) + 1, mipSize[j]);
+		}
+		SetBricks(mips[i], threadPool, mipSize, minCorner, maxCorner, GetMipTexelFunc(mips[i - 1], mipSize));
+	}
+}
+
+template<typename FUNC>
+void CPURayCaster::setVolumeData(const FUNC& texelFunc)
+{
+	if (m_densityOnly)
+	{
+		m_densityStream.Close();
+		SetBricks(m_density[0], *m_threadPool, m_gridSize,
+			[&texelFunc](uint32_t x, uint32_t y, uint32_t z) { return texelFunc(x, y, z).w; });
+		GenerateMips(m_density, m_numVolumeMips, *m_threadPool, m_gridSize);
+
+		// The blocks replace the bricks, which are refilled by the next volume data
+		for (uint8_t i = 0; i < m_numVolumeMips; ++i)
+		{
+			if (m_volumeCompression)
+			{
+				m_densityBC[i].Create(m_density[i], *m_threadPool);
+				m_density[i].Create(0, 0, 0);
+			}
+			else m_densityBC[i].Create(0, 0, 0);
+		}
+	}
+	else
+	{
+		SetBricks(m_volume[0], *m_threadPool, m_gridSize, texelFunc);
+		GenerateMips(m_volume, m_numVolumeMips, *m_threadPool, m_gridSize);
+	}
+
+	InvalidateLightMap();
+	m_irradianceDirty = true;
+}
+
+//--------------------------------------------------------------------------------------
+// Streams the finest mip from a brick file of the grid next to the volume file, which is
+// converted from it layer by layer of bricks on the first load; the coarser mips are in core
+//--------------------------------------------------------------------------------------
+bool CPURayCaster::loadVolumeData(const char* fileName, Texture3D<float>& fileSrc)
+{
+	if (m_densityOnly && m_streamCacheSize > 0)
+	{
+		XUSG_N_RETURN(loadVolumeStream(fileName), false);
+	}
+	else
+	{
+		// Load input image, unless already decoded
+		if (fileSrc.GetWidth() == 0)
+		{
+			DDS::Loader textureLoader;
+			XUSG_N_RETURN(textureLoader.CreateTextureFromFile(fileName, fileSrc), false);
+		}
+
+		resampleVolumeData(fileSrc);
+	}
+
+	buildMacroCells();
+	buildOccupancy();
+	buildDensityStats();
+	buildGradients();
+
+	return true;
+}
+
+bool CPURayCaster::loadVolumeStream(const char* fileName)
+{
+	stringstream brickFileName;
+	brickFileName << fileName << "." << m_gridSize.x << "x" << m_gridSize.y << "x" << m_gridSize.z << ".bricks";
+	const auto cacheSize = static_cast<size_t>(m_streamCacheSize) << 20;
+	if (!m_densityStream.Open(brickFileName.str().c_str(), cacheSize))
+	{
+		DDS::Loader textureLoader;
+		uint3 fileSize;
+		XUSG_N_RETURN(textureLoader.GetTextureSize(fileName, fileSize), false);
+
+		// Resample to the grid (CSR32FToRGBA16F) from the file slices of each layer
+		const float3 gridSize(static_cast<float>(m_gridSize.x), static_cast<float>(m_gridSize.y), static_cast<float>(m_gridSize.z));
+		Texture3D<float> slab;
+		auto firstSlice = 0u;
+		const auto loadSlab = [&](uint32_t zBegin, uint32_t zEnd)
+		{
+			firstSlice = ComputeLinearTap((zBegin + 0.5f) / gridSize.z, fileSize.z).i0;
+			const auto lastSlice = ComputeLinearTap((zEnd + 0.5f) / gridSize.z, fileSize.z).i1;
+
+			return textureLoader.CreateTextureFromFile(fileName, slab, firstSlice, lastSlice - firstSlice + 1);
+		};
+
+		// Same interpolation order as Texture3D::SampleLevel()
+		const auto texelFunc = [&](uint32_t x, uint32_t y, uint32_t z)
+		{
+			const auto uvw = (float3(static_cast<float>(x), static_cast<float>(y), static_cast<float>(z)) + 0.5f) / gridSize;
+			const auto tx = ComputeLinearTap(uvw.x, fileSize.x);
+			const auto ty = ComputeLinearTap(uvw.y, fileSize.y);
+			const auto tz = ComputeLinearTap(uvw.z, fileSize.z);
+			const auto z0 = tz.i0 - firstSlice, z1 = tz.i1 - firstSlice;
+			const auto c00 = lerp(slab(tx.i0, ty.i0, z0), slab(tx.i1, ty.i0, z0), tx.w);
+			const auto c10 = lerp(slab(tx.i0, ty.i1, z0), slab(tx.i1, ty.i1, z0), tx.w);
+			const auto c01 = lerp(slab(tx.i0, ty.i0, z1), slab(tx.i1, ty.i0, z1), tx.w);
+			const auto c11 = lerp(slab(tx.i0, ty.i1, z1), slab(tx.i1, ty.i1, z1), tx.w);
+			const auto a = lerp(lerp(c00, c10, ty.w), lerp(c01, c11, ty.w), tz.w);
+
+			return a * 0.25f;
+		};
+
+		XUSG_N_RETURN(DensityStreamTexture::WriteBrickFile(brickFileName.str().c_str(), m_gridSize,
+			*m_threadPool, loadSlab, texelFunc), false);
+		XUSG_M_RETURN(!m_densityStream.Open(brickFileName.str().c_str(), cacheSize), cerr,
+			"Failed to open the brick file.", false);
+	}
+
+	// The coarser mips in core
+	for (auto& mip : m_densityBC) mip.Create(0, 0, 0);
+	m_density[0].Create(0, 0, 0);
+	if (m_numVolumeMips > 1) GenerateMip(m_density[1], m_densityStream, 1, *m_threadPool, m_gridSize);
+	for (uint8_t i = 2; i < m_numVolumeMips; ++i) GenerateMip(m_density[i], m_density[i - 1], i, *m_threadPool, m_gridSize);
+
+	InvalidateLightMap();
+	m_irradianceDirty = true;
+
+	return true;
+}
+
+void CPURayCaster::resampleVolumeData(const Texture3D<float>& fileSrc)
+{
+	// Volumes of the grid size, e.g. filtered by the resampler, load as they are
+	if (fileSrc.GetWidth() == m_gridSize.x && fileSrc.GetHeight() == m_gridSize.y && fileSrc.GetDepth() == m_gridSize.z)
+	{
+		setVolumeData([&](uint32_t x, uint32_t y, uint32_t z) { return float4(1.0f, 1.0f, 1.0f, fileSrc(x, y, z) * 0.25f); });
+
+		return;
+	}
+
+	// Resample to the grid (CSR32FToRGBA16F)
+	const float3 gridSize(static_cast<float>(m_gridSize.x), static_cast<float>(m_gridSize.y), static_cast<float>(m_gridSize.z));
+	setVolumeData([&](uint32_t x, uint32_t y, uint32_t z)
+	{
+		const auto uvw = (float3(static_cast<float>(x), static_cast<float>(y), static_cast<float>(z)) + 0.5f) / gridSize;
+		const auto a = fileSrc.SampleLevel(uvw);
+
+		return float4(1.0f, 1.0f, 1.0f, a * 0.25f);
+	});
+}
+
+bool CPURayCaster::isCompressed() const
+{
+	return m_densityOnly && m_densityBC[0].GetWidth() > 0;
+}
+
+bool CPURayCaster::isStreamed() const
+{
+	return m_densityOnly && m_densityStream.IsOpen();
+}
+
+// Requests the brick a brick ahead of pos along the ray from the streaming
+void CPURayCaster::prefetchVolume(const float3& pos, const float3& rayDir) const
+{
+	if (!isStreamed()) return;
+
+	const auto& cbo = m_cbPerObject;
+	const auto brickDist = 2.0f * DensityStreamTexture::BrickSize / static_cast<float>(GetMaxSize(m_gridSize));
+	const auto uvw = LocalToTex3DSpace(pos + rayDir * brickDist, cbo.Extent);
+	m_densityStream.Prefetch(uvw);
+}
+
+#if CPU_PACKET_WIDTH
+void CPURayCaster::prefetchVolume(const float3P& pos, const float3P& rayDir, const maskP& lanes) const
+{
+	alignas(64) float ahead[3][CPU_PACKET_WIDTH];
+	const floatP brickDist = 2.0f * DensityStreamTexture::BrickSize / static_cast<float>(GetMaxSize(m_gridSize));
+	(pos.x + rayDir.x * brickDist).Store(ahead[0]);
+	(pos.y + rayDir.y * brickDist).Store(ahead[1]);
+	(pos.z + rayDir.z * brickDist).Store(ahead[2]);
+	for (auto bits = lanes.Bits(); bits; bits &= bits - 1)
+	{
+		const auto i = CountTrailingZeros(bits);
+		const float3 aheadPos(ahead[0][i], ahead[1][i], ahead[2][i]);
+		m_densityStream.Prefetch(LocalToTex3DSpace(aheadPos, m_cbPerObject.Extent));
+	}
+}
+#endif
+
+uint8_t CPURayCaster::getMaxVolumeMip() const
+{
+	return m_volumeLOD ? m_numVolumeMips - 1 : 0;
+}
+
+bool CPURayCaster::LoadVolumeData(const char* fileName)
+{
+	// A filtered volume file loads from its cache file of the grid size, or as it has just been resampled
+	string cacheFileName;
+	Texture3D<float> fileSrc;
+	if (m_volumeFilter != VolumeResampler::TRILINEAR)
+	{
+		XUSG_N_RETURN(m_resampler->Resample(cacheFileName, fileName, m_gridSize, m_volumeFilter, &fileSrc), false);
+		fileName = cacheFileName.c_str();
+	}
+
+	return loadVolumeData(fileName, fileSrc);
+}
+
+bool CPURayCaster::GenerateVolumeData(const CloudGenerator::Desc& desc, const char* cacheDir)
+{
+	// The cloud loads from its cache file like a volume file of the grid size, or as it has just been generated
+	string cacheFileName;
+	Texture3D<float> fileSrc;
+	XUSG_N_RETURN(m_cloudGenerator->Generate(cacheFileName, cacheDir, m_gridSize, desc, &fileSrc), false);
+
+	return loadVolumeData(cacheFileName.c_str(), fileSrc);
+}
+
+void CPURayCaster::UpdateVolumeData(const Texture3D<float>& fileSrc)
+{
+	if (m_volumeFilter != VolumeResampler::TRILINEAR)
+	{
+		Texture3D<float> resampled;
+		m_resampler->Resample(resampled, fileSrc, m_gridSize, m_volumeFilter);
+		resampleVolumeData(resampled);
+	}
+	else resampleVolumeData(fileSrc);
+	buildMacroCells();
+	buildOccupancy();
+	buildGradients();
+	m_densityStatsDirty = true;
+}
+
+bool CPURayCaster::UpdateVolumeRegion(const uint3& minCorner, const uint3& maxCorner, const float* pDensities)
+{
+	for (uint8_t i = 0; i < 3; ++i) XUSG_N_RETURN(minCorner[i] < maxCorner[i] && maxCorner[i] <= m_gridSize[i], false);
+	XUSG_M_RETURN(isCompressed() || isStreamed(), cerr, "Volume regions cannot update compressed or streamed volumes.", false);
+
+	const uint3 regionSize(maxCorner.x - minCorner.x, maxCorner.y - minCorner.y, maxCorner.z - minCorner.z);
+	const auto isInRegion = [&](uint32_t x, uint32_t y, uint32_t z)
+	{
+		return x >= minCorner.x && x < maxCorner.x && y >= minCorner.y && y < maxCorner.y && z >= minCorner.z && z < maxCorner.z;
+	};
+	const auto getDensity = [&](uint32_t x, uint32_t y, uint32_t z)
+	{
+		return pDensities[(static_cast<size_t>(z - minCorner.z) * regionSize.y + y - minCorner.y) * regionSize.x + x - minCorner.x];
+	};
+
+	// The bricks of the region also hold texels around it in their aprons, which keep their values
+	if (m_densityOnly)
+	{
+		SetBricks(m_density[0], *m_threadPool, m_gridSize, minCorner, maxCorner, [&](uint32_t x, uint32_t y, uint32_t z)
+		{
+			return isInRegion(x, y, z) ? getDensity(x, y, z) : m_density[0].Load(x, y, z);
+		});
+		UpdateMips(m_density, m_numVolumeMips, *m_threadPool, m_gridSize, minCorner, maxCorner);
+	}
+	else
+	{
+		SetBricks(m_volume[0], *m_threadPool, m_gridSize, minCorner, maxCorner, [&](uint32_t x, uint32_t y, uint32_t z)
+		{
+			const auto texel = m_volume[0].Load(x, y, z);
+			if (!isInRegion(x, y, z)) return texel;
+
+			// The stored colors are kept, and the texels of the unstored empty bricks, which read as
+			// 0, take white like the volume files
+			const auto brickSize = VolumeTexture::BrickSize;
+			const auto isStored = m_volume[0].HasBrick(x / brickSize, y / brickSize, z / brickSize);
+
+			return float4(isStored ? texel.xyz() : float3(1.0f), getDensity(x, y, z));
+		});
+		UpdateMips(m_volume, m_numVolumeMips, *m_threadPool, m_gridSize, minCorner, maxCorner);
+	}
+
+	// The macro cells extended by the 1-voxel apron over the region
+	uint3 cellMin, cellMax;
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		cellMin[i] = ((max)(minCorner[i], 1u) - 1) / g_macroCellSize;
+		cellMax[i] = (min)(maxCorner[i] / g_macroCellSize + 1, XUSG_DIV_UP(m_gridSize[i], g_macroCellSize));
+	}
+	buildMacroCells(cellMin, cellMax);
+	buildOccupancy();
+	updateGradients(minCorner, maxCorner);
+	m_densityStatsDirty = true;
+	InvalidateLightMap(minCorner, maxCorner);
+
+	return true;
+}
+
+bool CPURayCaster::SetViewport(uint32_t width, uint32_t height)
+{
+	XUSG_N_RETURN(width > 0 && height > 0, false);
+	m_renderTarget.Create(width, height);
+
+	return true;
+}
+
+void CPURayCaster::SetDepthMaps(const Texture2D<float>* const* depths)
+{
+	for (uint8_t i = 0; i < NUM_DEPTH; ++i) m_pDepths[i] = depths ? depths[i] : nullptr;
+	InvalidateLightMap();
+}
+
+void CPURayCaster::InitVolumeData()
+{
+	// CSInitGridData
+	setVolumeData([&](uint32_t x, uint32_t y, uint32_t z)
+	{
+		const auto pos = TexelToLocalSpace(x, y, z, m_gridSize, m_extent);
+		const auto r_sq = dot(pos, pos);
+		auto a = 1.0f - r_sq;
+		a *= a;
+		a = saturate(a * a * 0.2f);
+
+		const float3 colorU(1.0f, 0.6f, 0.0f);
+		const float3 colorD(0.5f, 0.8f, 1.0f);
+		const auto color = lerp(colorD, colorU, saturate(pos.y * 0.5f + 0.2f));
+
+		return float4(color, a);
+	});
+
+	buildMacroCells();
+	buildOccupancy();
+	buildDensityStats();
+	buildGradients();
+}
+
+void CPURayCaster::SetSH(const float3* coeffSH)
+{
+	// The light map holds the constant ambient only without the SH
+	if ((coeffSH != nullptr) != m_hasSH) InvalidateLightMap();
+	m_hasSH = coeffSH != nullptr;
+	if (m_hasSH) copy(coeffSH, coeffSH + SHNumCoeffs, m_coeffSH);
+	m_irradianceDirty = true;
+}
+
+void CPURayCaster::SetColorLUT(const float3* pColors, uint32_t numColors)
+{
+	m_colorLUT.assign(pColors, pColors + (pColors ? numColors : 0));
+	m_cubeMapDirty = true;
+}
+
+void CPURayCaster::SetMaxSamples(uint32_t maxRaySamples, uint32_t maxLightSamples)
+{
+	m_maxRaySamples = maxRaySamples;
+	m_maxLightSamples = maxLightSamples;
+}
+
+void CPURayCaster::SetEmptySpaceSkip(bool enable)
+{
+	if (enable != m_emptySpaceSkip)
+	{
+		InvalidateLightMap();
+		m_irradianceDirty = true;
+	}
+	m_emptySpaceSkip = enable;
+}
+
+void CPURayCaster::SetVolumeLOD(bool enable)
+{
+	if (enable != m_volumeLOD)
+	{
+		InvalidateLightMap();
+		m_irradianceDirty = true;
+	}
+	m_volumeLOD = enable;
+}
+
+void CPURayCaster::SetCubeFaceLOD(bool enable)
+{
+	m_cubeFaceLOD = enable;
+}
+
+void CPURayCaster::SetGradientVolume(bool enable)
+{
+	if (enable == m_gradientVolume) return;
+	m_gradientVolume = enable;
+	if (m_threadPool) buildGradients();
+	m_irradianceDirty = true;
+}
+
+void CPURayCaster::SetVolumeCompression(bool enable)
+{
+	m_volumeCompression = enable;
+}
+
+void CPURayCaster::SetVolumeStreaming(uint32_t cacheSizeMB)
+{
+	m_streamCacheSize = cacheSizeMB;
+}
+
+void CPURayCaster::SetVolumeFilter(VolumeResampler::Filter filter)
+{
+	m_volumeFilter = filter;
+}
+
+void CPURayCaster::SetWavefront(uint32_t batchSteps)
+{
+	m_wavefrontSteps = batchSteps;
+}
+
+void CPURayCaster::SetCubeMapReuse(float tolerance, uint32_t refreshFrames)
+{
+	m_reuseTolerance = tolerance;
+	m_reuseRefreshFrames = refreshFrames;
+	m_cubeMapDirty = true;
+}
+
+void CPURayCaster::SetCubeMapCache(uint32_t budgetMB, float cellSize)
+{
+	m_cubeCacheBudget = static_cast<size_t>(budgetMB) << 20;
+	m_cubeCacheCellSize = cellSize;
+	m_cubeCacheHits = 0;
+	m_cubeCacheMisses = 0;
+	m_cubeMapDirty = true;
+}
+
+void CPURayCaster::SetVolumeWorld(float size, const float3& pos, const float3* pPitchYawRoll)
+{
+	size *= 0.5f;
+	auto world = MatrixScaling(size, size, size);
+	if (pPitchYawRoll) world = world * MatrixRotationRollPitchYaw(pPitchYawRoll->x, pPitchYawRoll->y, pPitchYawRoll->z);
+	m_volumeWorld = world * MatrixTranslation(pos.x, pos.y, pos.z);
+}
+
+void CPURayCaster::SetLight(const float3& pos, const float3& color, float intensity)
+{
+	m_lightPt = pos;
+	m_lightColor = float4(color, intensity);
+}
+
+void CPURayCaster::SetAmbient(const float3& color, float intensity)
+{
+	m_ambient = float4(color, intensity);
+}
+
+void CPURayCaster::UpdateFrame(const float4x4& viewProj, const float4x4& shadowVP, const float3& eyePt)
+{
+	// Per-frame
+	m_cbPerFrame.EyePos = eyePt;
+	m_cbPerFrame.ShadowViewProj = shadowVP;
+	m_cbPerFrame.LightPos = m_lightPt;
+	m_cbPerFrame.LightColor = m_lightColor;
+	m_cbPerFrame.Ambient = m_ambient;
+
+	// Light-pass inputs
+	LightPassInputs inputs;
+	inputs.ShadowViewProj = shadowVP;
+	inputs.World = m_volumeWorld;
+	inputs.LightColor = m_lightColor;
+	inputs.Ambient = m_ambient;
+	inputs.LightPt = m_lightPt;
+	inputs.NumSamples = m_maxLightSamples;
+	if (memcmp(&inputs, &m_lightPassInputs, sizeof(LightPassInputs)) != 0)
+	{
+		// The irradiance turns with the volume, and its AO rays take the light samples
+		if (memcmp(&inputs.World, &m_lightPassInputs.World, sizeof(inputs.World)) != 0 ||
+			inputs.NumSamples != m_lightPassInputs.NumSamples) m_irradianceDirty = true;
+		m_lightPassInputs = inputs;
+		InvalidateLightMap();
+	}
+
+	// Per-object
+	const auto& world = m_volumeWorld;
+	const auto worldI = MatrixInverse(world);
+	const auto worldViewProj = world * viewProj;
+	m_cbPerObject.WorldViewProj = worldViewProj;
+	m_cbPerObject.WorldViewProjI = MatrixInverse(worldViewProj);
+	m_cbPerObject.WorldI = worldI;
+	m_cbPerObject.World = world;
+	m_cbPerObject.BoundsMin = m_boundsMin;
+	m_cbPerObject.BoundsMax = m_boundsMax;
+	m_cbPerObject.Extent = m_extent;
+
+	m_raySampleCount = m_maxRaySamples;
+	const auto numMips = m_cubeMap.GetNumMips();
+	const auto cubeMapSize = static_cast<float>(m_cubeMap.GetWidth());
+	const auto viewport = float2(static_cast<float>(m_renderTarget.GetWidth()), static_cast<float>(m_renderTarget.GetHeight()));
+	const auto boundsExtent = (m_boundsMax - m_boundsMin) * 0.5f;
+	const auto boundsCenter = (m_boundsMax + m_boundsMin) * 0.5f;
+	const auto boundsWorldViewProj = MatrixScaling(boundsExtent.x, boundsExtent.y, boundsExtent.z) *
+		MatrixTranslation(boundsCenter.x, boundsCenter.y, boundsCenter.z) * worldViewProj;
+	m_cubeMapLOD = EstimateCubeMapLOD(m_raySampleCount, numMips, cubeMapSize, worldViewProj, boundsWorldViewProj,
+		viewport, m_cubeFaceLODs);
+	if (!m_cubeFaceLOD) for (auto& lod : m_cubeFaceLODs) lod = m_cubeMapLOD;
+	m_visibilityMask = GenVisibilityMask(worldI, eyePt, m_boundsMin, m_boundsMax);
+}
+
+void CPURayCaster::Render(uint8_t flags)
+{
+	const bool cubemapRayMarch = flags & RAY_MARCH_CUBEMAP;
+	const bool separateLightPass = flags & SEPARATE_LIGHT_PASS;
+	const bool sliceSweep = flags & SLICE_SWEEP_LIGHT;
+
+	m_renderTarget.Clear(0.0f);
+	resetSkipStats();
+	for (auto& stat : m_laneStats) stat = 0;
+	m_liveRays.clear();
+	m_tileStats.clear();
+	if (isStreamed())
+	{
+		m_densityStream.Update();
+		m_densityStream.ResetStats();
+	}
+	m_relitTexelCount = 0;
+	m_bakedTexelCount = 0;
+	m_reusedTileCount = 0;
+
+	if (m_irradianceDirty && m_hasSH) bakeIrradiance();
+
+	if (cubemapRayMarch)
+	{
+		if (separateLightPass)
+		{
+			RayMarchL(sliceSweep);
+			rayMarchV();
+		}
+		else rayMarch();
+
+		renderCube();
+	}
+	else
+	{
+		if (separateLightPass)
+		{
+			RayMarchL(sliceSweep);
+			rayCastVDirect();
+		}
+		else rayCastDirect();
+	}
+}
+
+void CPURayCaster::RayMarchL(bool sliceSweep)
+{
+	const auto timeStart = chrono::high_resolution_clock::now();
+	if (sliceSweep != m_lightMapSweep) InvalidateLightMap();
+	m_lightMapSweep = sliceSweep;
+	++m_lightFrame;
+
+	// Mark the light-map bricks of the dirty region stale
+	if (m_lightDirtyMin.x <= m_lightDirtyMax.x)
+	{
+		uint3 regionMin, regionMax;
+		getLightRegion(regionMin, regionMax);
+		markLightBricks(regionMin, regionMax);
+		m_lightDirtyMin = 1.0f;
+		m_lightDirtyMax = 0.0f;
+	}
+
+	// Skip the pass if the light map is up to date
+	if (m_staleLightBrickCount == 0) return;
+
+	// Slice sweeping carries the transmittance through all slices, so it always re-lights the whole map
+	if (sliceSweep)
+	{
+		rayMarchLSweep();
+		fill(m_lightBrickStamps.begin(), m_lightBrickStamps.end(), UINT32_MAX);
+		m_staleLightBrickCount = 0;
+		m_relitTexelCount = m_lightGridSize.x * m_lightGridSize.y * m_lightGridSize.z;
+		m_lightMapLit = true;
+		return;
+	}
+
+	vector<uint32_t> bricks;
+	bricks.reserve(m_staleLightBrickCount);
+	for (auto i = 0u; i < m_lightBrickStamps.size(); ++i)
+		if (m_lightBrickStamps[i] != UINT32_MAX) bricks.push_back(i);
+
+	// Without a budget, or before the map has been lit at all, re-light all stale bricks at once
+	auto numBricks = static_cast<uint32_t>(bricks.size());
+	if (m_lightMapBudget > 0 && m_lightMapLit)
+	{
+		sortLightBricks(bricks);
+
+		// The bricks at their staleness limit are due, and at least an even share of the stale
+		// bricks is re-lit every frame, so that a change is spread over the tolerated frames
+		const auto maxStale = (max)(m_maxLightStaleFrames, 1u);
+		auto numDue = 0u;
+		while (numDue < numBricks && m_lightFrame - m_lightBrickStamps[bricks[numDue]] + 1 >= maxStale) ++numDue;
+		auto numRelit = (max)(numDue, XUSG_DIV_UP(numBricks, maxStale));
+		m_relitTexelCount += relightBricks(bricks.data(), numRelit);
+
+		// Then fill the rest of the budget a batch at a time, if the next batch is expected to fit
+		const auto budget = chrono::microseconds(m_lightMapBudget);
+		const auto batchSize = m_threadPool->GetNumThreads();
+		auto elapsed = chrono::high_resolution_clock::now() - timeStart;
+		auto batchTime = elapsed * batchSize / numRelit;
+		while (numRelit < numBricks && elapsed + batchTime <= budget)
+		{
+			const auto batchStart = chrono::high_resolution_clock::now();
+			const auto numBatch = (min)(batchSize, numBricks - numRelit);
+			m_relitTexelCount += relightBricks(&bricks[numRelit], numBatch);
+			numRelit += numBatch;
+
+			const auto timeNow = chrono::high_resolution_clock::now();
+			batchTime = (timeNow - batchStart) * batchSize / numBatch;
+			elapsed = timeNow - timeStart;
+		}
+
+		numBricks = numRelit;
+	}
+	else m_relitTexelCount += relightBricks(bricks.data(), numBricks);
+
+	for (auto i = 0u; i < numBricks; ++i) m_lightBrickStamps[bricks[i]] = UINT32_MAX;
+	m_staleLightBrickCount -= numBricks;
+	m_lightMapLit = true;
+}
+
+void CPURayCaster::SetLightMapBudget(uint32_t budgetUs, uint32_t maxStaleFrames)
+{
+	m_lightMapBudget = budgetUs;
+	m_maxLightStaleFrames = maxStaleFrames;
+}
+
+void CPURayCaster::InvalidateLightMap()
+{
+	m_lightDirtyMin = 0.0f;
+	m_lightDirtyMax = 1.0f;
+	m_cubeMapDirty = true;
+}
+
+void CPURayCaster::InvalidateLightMap(const uint3& minCorner, const uint3& maxCorner)
+{
+	// Grow by the trilinear footprint of the coarsest mip, and then snap to the macro cells,
+	// whose empty-space skipping also changes the light rays crossing them
+	const auto apron = static_cast<float>(2 << (VolumeMipCount - 1));
+	const auto cellSize = static_cast<float>(g_macroCellSize);
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		const auto gridSize = static_cast<float>(m_gridSize[i]);
+		const auto boxMin = floorf((static_cast<float>(minCorner[i]) - apron) / cellSize) * cellSize / gridSize;
+		const auto boxMax = ceilf((static_cast<float>(maxCorner[i]) + apron) / cellSize) * cellSize / gridSize;
+		m_lightDirtyMin[i] = (min)((max)(boxMin, 0.0f), m_lightDirtyMin[i]);
+		m_lightDirtyMax[i] = (max)((min)(boxMax, 1.0f), m_lightDirtyMax[i]);
+	}
+
+	// AO rays reach the changes from all directions
+	m_irradianceDirty = true;
+	m_cubeMapDirty = true;
+}
+
+void CPURayCaster::getLightRegion(uint3& regionMin, uint3& regionMax) const
+{
+	auto boxMin = m_lightDirtyMin;
+	auto boxMax = m_lightDirtyMax;
+
+	// The changes also shadow the texels away from the (directional) light
+	const auto lightDir = mulDir(m_lightPt, MatrixInverse(m_volumeWorld));
+
+	// Light-map texels with the centers in the box
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		const auto gridSize = static_cast<float>(m_lightGridSize[i]);
+		if (lightDir[i] > 0.0f) boxMin[i] = 0.0f;
+		if (lightDir[i] < 0.0f) boxMax[i] = 1.0f;
+		const auto last = (min)((max)(floorf(boxMax[i] * gridSize - 0.5f) + 1.0f, 0.0f), gridSize);
+		const auto first = (min)((max)(ceilf(boxMin[i] * gridSize - 0.5f), 0.0f), last);
+		regionMin[i] = static_cast<uint32_t>(first);
+		regionMax[i] = static_cast<uint32_t>(last);
+	}
+}
+
+void CPURayCaster::markLightBricks(const uint3& regionMin, const uint3& regionMax)
+{
+	uint3 brickMin, brickMax;
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		brickMin[i] = regionMin[i] / g_lightBrickSize;
+		brickMax[i] = XUSG_DIV_UP(regionMax[i], g_lightBrickSize);
+	}
+
+	// Keep the stamps of the bricks already stale, which bound their staleness
+	for (auto z = brickMin.z; z < brickMax.z; ++z)
+		for (auto y = brickMin.y; y < brickMax.y; ++y)
+			for (auto x = brickMin.x; x < brickMax.x; ++x)
+			{
+				auto& stamp = m_lightBrickStamps[(z * m_lightBrickCount.y + y) * m_lightBrickCount.x + x];
+				if (stamp == UINT32_MAX)
+				{
+					stamp = m_lightFrame;
+					++m_staleLightBrickCount;
+				}
+			}
+}
+
+void CPURayCaster::sortLightBricks(vector<uint32_t>& bricks) const
+{
+	struct BrickKey
+	{
+		uint32_t Stamp;
+		float Dist;
+		bool Culled;
+	};
+
+	// The view rays only sample the bricks in the view frustum, and the nearer ones
+	// are seen with the higher transmittance
+	const auto& cbo = m_cbPerObject;
+	const auto localSpaceEyePt = mulPoint(m_cbPerFrame.EyePos, cbo.WorldI);
+	const auto& cnt = m_lightBrickCount;
+	const auto brickScale = float3(2.0f * g_lightBrickSize) / float3(static_cast<float>(m_lightGridSize.x),
+		static_cast<float>(m_lightGridSize.y), static_cast<float>(m_lightGridSize.z)) * m_extent;
+	const auto maxStale = (max)(m_maxLightStaleFrames, 1u);
+	vector<BrickKey> keys(m_lightBrickStamps.size());
+	for (const auto& i : bricks)
+	{
+		const auto x = i % cnt.x;
+		const auto y = i / cnt.x % cnt.y;
+		const auto z = i / (cnt.x * cnt.y);
+		const auto boxMin = float3(static_cast<float>(x), static_cast<float>(y), static_cast<float>(z)) * brickScale - m_extent;
+		const auto boxMax = min(boxMin + brickScale, m_extent);
+
+		auto& key = keys[i];
+		key.Stamp = m_lightBrickStamps[i];
+		key.Dist = length((boxMin + boxMax) * 0.5f - localSpaceEyePt);
+		key.Culled = !IsBoxInFrustum(boxMin, boxMax, cbo.WorldViewProj);
+
+		// All due bricks go first
+		if (m_lightFrame - key.Stamp + 1 >= maxStale) key.Stamp = 0;
+	}
+
+	sort(bricks.begin(), bricks.end(), [&keys](uint32_t a, uint32_t b)
+	{
+		const auto& keyA = keys[a];
+		const auto& keyB = keys[b];
+		if ((keyA.Stamp == 0) != (keyB.Stamp == 0)) return keyA.Stamp == 0;
+		if (keyA.Culled != keyB.Culled) return keyB.Culled;
+		if (keyA.Stamp != keyB.Stamp) return keyA.Stamp < keyB.Stamp;
+
+		return keyA.Dist < keyB.Dist;
+	});
+}
+
+uint32_t CPURayCaster::relightBricks(const uint32_t* pBricks, uint32_t numBricks)
+{
+	const auto cb = getSampleRes(m_maxLightSamples, m_maxLightSamples);
+	const auto tileCount = g_lightBrickSize / g_lightTileSize;
+	const auto tilesPerBrick = tileCount * tileCount * tileCount;
+
+	const auto& cnt = m_lightBrickCount;
+
+	// Dispatch the 4^3 tiles of the bricks
+	m_threadPool->Dispatch(numBricks * tilesPerBrick, [&](uint32_t groupId, uint32_t)
+	{
+		const auto brick = pBricks[groupId / tilesPerBrick];
+		const auto tile = groupId % tilesPerBrick;
+		const auto x0 = (brick % cnt.x * tileCount + tile % tileCount) * g_lightTileSize;
+		const auto y0 = (brick / cnt.x % cnt.y * tileCount + tile / tileCount % tileCount) * g_lightTileSize;
+		const auto z0 = (brick / (cnt.x * cnt.y) * tileCount + tile / (tileCount * tileCount)) * g_lightTileSize;
+		const auto xEnd = (min)(x0 + g_lightTileSize, m_lightGridSize.x);
+		const auto yEnd = (min)(y0 + g_lightTileSize, m_lightGridSize.y);
+		const auto zEnd = (min)(z0 + g_lightTileSize, m_lightGridSize.z);
+
+		SkipStats stats = {};
+		for (auto z = z0; z < zEnd; ++z)
+			for (auto y = y0; y < yEnd; ++y)
+				for (auto x = x0; x < xEnd; ++x)
+					rayMarchLKernel(cb, x, y, z, stats);
+		addSkipStats(stats);
+	});
+
+	// Texels re-lit
+	auto texelCount = 0u;
+	for (auto i = 0u; i < numBricks; ++i)
+	{
+		const auto brick = pBricks[i];
+		const auto x = brick % cnt.x * g_lightBrickSize;
+		const auto y = brick / cnt.x % cnt.y * g_lightBrickSize;
+		const auto z = brick / (cnt.x * cnt.y) * g_lightBrickSize;
+		texelCount += ((min)(x + g_lightBrickSize, m_lightGridSize.x) - x) *
+			((min)(y + g_lightBrickSize, m_lightGridSize.y) - y) *
+			((min)(z + g_lightBrickSize, m_lightGridSize.z) - z);
+	}
+
+	return texelCount;
+}
+
+void CPURayCaster::rayMarchLSweep()
+{
+	const auto cb = getSampleRes(m_maxLightSamples, m_maxLightSamples);
+
+	// Same sweep axis as rayMarchLSweepKernel(), the dominant axis of the light direction
+	const auto lightDir = abs(mulDir(m_cbPerFrame.LightPos, m_cbPerObject.WorldI));
+	const uint8_t axis = lightDir.x >= lightDir.y ? (lightDir.x >= lightDir.z ? 0 : 2) : (lightDir.y >= lightDir.z ? 1 : 2);
+	const auto sizeU = m_lightGridSize[(axis + 1) % 3], sizeV = m_lightGridSize[(axis + 2) % 3];
+	const auto numGroupsU = XUSG_DIV_UP(sizeU, g_cubeTileSize);
+	const auto numGroupsV = XUSG_DIV_UP(sizeV, g_cubeTileSize);
+	for (auto& transm : m_transm) transm.Create(sizeU, sizeV);
+
+	// Each slice reads the transmittance of the previous one, so only the texels within
+	// a slice run in parallel
+	for (auto i = 0u; i < m_lightGridSize[axis]; ++i)
+		m_threadPool->Dispatch(numGroupsU * numGroupsV, [&](uint32_t groupId, uint32_t)
+		{
+			const auto gx = groupId % numGroupsU;
+			const auto gy = groupId / numGroupsU;
+			const auto xEnd = (min)((gx + 1) * g_cubeTileSize, sizeU);
+			const auto yEnd = (min)((gy + 1) * g_cubeTileSize, sizeV);
+
+			for (auto y = gy * g_cubeTileSize; y < yEnd; ++y)
+				for (auto x = gx * g_cubeTileSize; x < xEnd; ++x)
+					rayMarchLSweepKernel(cb, x, y, i);
+		});
+}
+
+void CPURayCaster::bakeIrradiance()
+{
+	const auto cb = getSampleRes(m_maxLightSamples, m_maxLightSamples);
+	const uint3 numGroups(XUSG_DIV_UP(m_lightGridSize.x, g_lightTileSize), XUSG_DIV_UP(m_lightGridSize.y, g_lightTileSize),
+		XUSG_DIV_UP(m_lightGridSize.z, g_lightTileSize));
+
+	// Dispatch the 4^3 tiles of the light grid
+	m_threadPool->Dispatch(numGroups.x * numGroups.y * numGroups.z, [&](uint32_t groupId, uint32_t)
+	{
+		const auto x0 = groupId % numGroups.x * g_lightTileSize;
+		const auto y0 = groupId / numGroups.x % numGroups.y * g_lightTileSize;
+		const auto z0 = groupId / (numGroups.x * numGroups.y) * g_lightTileSize;
+		const auto xEnd = (min)(x0 + g_lightTileSize, m_lightGridSize.x);
+		const auto yEnd = (min)(y0 + g_lightTileSize, m_lightGridSize.y);
+		const auto zEnd = (min)(z0 + g_lightTileSize, m_lightGridSize.z);
+
+		SkipStats stats = {};
+		for (auto z = z0; z < zEnd; ++z)
+			for (auto y = y0; y < yEnd; ++y)
+				for (auto x = x0; x < xEnd; ++x)
+					irradianceKernel(cb, x, y, z, stats);
+		addSkipStats(stats);
+	});
+
+	m_bakedTexelCount = m_lightGridSize.x * m_lightGridSize.y * m_lightGridSize.z;
+	m_irradianceDirty = false;
+}
+
+const Texture2D<float4>& CPURayCaster::GetRenderTarget() const
+{
+	return m_renderTarget;
+}
+
+const Texture2DArray<float4>& CPURayCaster::GetCubeMap() const
+{
+	return m_cubeMap;
+}
+
+const Texture3D<float3>& CPURayCaster::GetLightMap() const
+{
+	return m_lightMap;
+}
+
+CPURayCaster::VolumeStats CPURayCaster::GetVolumeStats() const
+{
+	VolumeStats stats;
+	const auto streamed = isStreamed();
+	const auto compressed = isCompressed();
+	stats.BrickCount = streamed ? m_densityStream.GetBrickCount() : compressed ? m_densityBC[0].GetBrickCount() :
+		m_densityOnly ? m_density[0].GetBrickCount() : m_volume[0].GetBrickCount();
+	stats.PageCount = streamed ? m_densityStream.GetPageCount() : compressed ? m_densityBC[0].GetPageCount() :
+		m_densityOnly ? m_density[0].GetPageCount() : m_volume[0].GetPageCount();
+	stats.MemorySize = streamed ? m_densityStream.GetMemorySize() : 0;
+	for (uint8_t i = 0; i < m_numVolumeMips; ++i)
+		stats.MemorySize += compressed ? m_densityBC[i].GetMemorySize() :
+			m_densityOnly ? m_density[i].GetMemorySize() : m_volume[i].GetMemorySize();
+	stats.DenseMemorySize = sizeof(float4) * m_gridSize.x * m_gridSize.y * m_gridSize.z;
+	stats.GradientMemorySize = m_gradientVolume ? m_gradient.GetMemorySize() : 0;
+	stats.PSNR = compressed ? m_densityBC[0].GetPSNR() : 0.0;
+	stats.BoundsMin = m_boundsMin;
+	stats.BoundsMax = m_boundsMax;
+	stats.GridSize = m_gridSize;
+	stats.LightGridSize = m_lightGridSize;
+
+	return stats;
+}
+
+CPURayCaster::DensityStats CPURayCaster::GetDensityStats()
+{
+	// Gathered on demand after the volume updates, which would rescan the grid each frame
+	if (m_densityStatsDirty) buildDensityStats();
+
+	// The view rays step by getSampleRes() through the local space, where a voxel spans 2 / the longest axis
+	auto stats = m_densityStats;
+	const auto voxelSize = 2.0f / GetMaxSize(m_gridSize);
+	stats.UsefulRaySamples = stats.OccupiedRayLength * voxelSize / getSampleRes(m_maxRaySamples, m_maxLightSamples).Step;
+
+	return stats;
+}
+
+uint32_t CPURayCaster::GetRaySampleCount() const
+{
+	return m_raySampleCount;
+}
+
+uint32_t CPURayCaster::GetRelitTexelCount() const
+{
+	return m_relitTexelCount;
+}
+
+uint32_t CPURayCaster::GetBakedTexelCount() const
+{
+	return m_bakedTexelCount;
+}
+
+uint32_t CPURayCaster::GetStaleLightBrickCount() const
+{
+	return m_staleLightBrickCount;
+}
+
+CPURayCaster::StreamStats CPURayCaster::GetStreamStats() const
+{
+	if (isStreamed()) return m_densityStream.GetStats();
+
+	StreamStats stats = {};
+
+	return stats;
+}
+
+VolumeResampler::Stats CPURayCaster::GetResampleStats() const
+{
+	if (m_resampler) return m_resampler->GetStats();
+
+	VolumeResampler::Stats stats = {};
+
+	return stats;
+}
+
+CloudGenerator::Stats CPURayCaster::GetCloudStats() const
+{
+	if (m_cloudGenerator) return m_cloudGenerator->GetStats();
+
+	CloudGenerator::Stats stats = {};
+
+	return stats;
+}
+
+CPURayCaster::SkipStats CPURayCaster::GetSkipStats() const
+{
+	SkipStats stats;
+	stats.RaySamples = m_skipStats[0];
+	stats.RaySamplesSkipped = m_skipStats[1];
+	stats.LightSamples = m_skipStats[2];
+	stats.LightSamplesSkipped = m_skipStats[3];
+
+	return stats;
+}
+
+CPURayCaster::LaneStats CPURayCaster::GetLaneStats() const
+{
+	LaneStats stats;
+	stats.LaneSteps = m_laneStats[0];
+	stats.ActiveLaneSteps = m_laneStats[1];
+	stats.LiveRays = m_liveRays;
+
+	return stats;
+}
+
+vector<CPURayCaster::ThreadStats> CPURayCaster::GetTileStats() const
+{
+	return m_tileStats;
+}
+
+uint32_t CPURayCaster::GetReusedTileCount() const
+{
+	return m_reusedTileCount;
+}
+
+CPURayCaster::CubeCacheStats CPURayCaster::GetCubeCacheStats() const
+{
+	CubeCacheStats stats;
+	stats.Hits = m_cubeCacheHits;
+	stats.Misses = m_cubeCacheMisses;
+	stats.EntryCount = static_cast<uint32_t>(m_cubeMapCache.size());
+	stats.MemorySize = 0;
+	for (const auto& entry : m_cubeMapCache) stats.MemorySize += entry.Texels.size() * (sizeof(float4) + sizeof(float));
+
+	return stats;
+}
+
+uint32_t CPURayCaster::GetNumThreads() const
+{
+	return m_threadPool->GetNumThreads();
+}
+
+uint8_t CPURayCaster::GetCubeMapLOD() const
+{
+	return m_cubeMapLOD;
+}
+
+uint8_t CPURayCaster::GetCubeMapLOD(uint8_t face) const
+{
+	return m_cubeFaceLODs[face];
+}
+
+CPURayCaster::CBSampleRes CPURayCaster::getSampleRes(uint32_t numSamples, uint32_t numLightSamples) const
+{
+	CBSampleRes cb;
+	cb.NumSamples = numSamples;
+	cb.HasLightProbes = m_hasSH;
+	cb.NumLightSamples = numLightSamples;
+	cb.Step = g_maxDist / static_cast<float>(numSamples);
+	cb.LightStep = g_maxDist / static_cast<float>(numLightSamples);
+
+	return cb;
+}
+
+void CPURayCaster::resetSkipStats()
+{
+	for (auto& stat : m_skipStats) stat = 0;
+}
+
+// Flushes the statistics gathered by a kernel or a group of light-map texels, so only one atomic add
+// per counter is issued per ray or per group
+void CPURayCaster::addSkipStats(const SkipStats& stats) const
+{
+	m_skipStats[0].fetch_add(stats.RaySamples, memory_order_relaxed);
+	m_skipStats[1].fetch_add(stats.RaySamplesSkipped, memory_order_relaxed);
+	m_skipStats[2].fetch_add(stats.LightSamples, memory_order_relaxed);
+	m_skipStats[3].fetch_add(stats.LightSamplesSkipped, memory_order_relaxed);
+}
+
+void CPURayCaster::addLaneStats(uint64_t laneSteps, uint64_t activeLaneSteps) const
+{
+	m_laneStats[0].fetch_add(laneSteps, memory_order_relaxed);
+	m_laneStats[1].fetch_add(activeLaneSteps, memory_order_relaxed);
+}
+
+//--------------------------------------------------------------------------------------
+// CSMacroCell.hlsl
+//--------------------------------------------------------------------------------------
+void CPURayCaster::buildMacroCells()
+{
+	buildMacroCells(uint3(0, 0, 0), uint3(m_macroCells.GetWidth(), m_macroCells.GetHeight(), m_macroCells.GetDepth()));
+}
+
+void CPURayCaster::buildMacroCells(const uint3& cellMin, const uint3& cellMax)
+{
+	m_threadPool->Dispatch(cellMax.z - cellMin.z, [&](uint32_t i, uint32_t)
+	{
+		const auto cz = cellMin.z + i;
+		for (auto cy = cellMin.y; cy < cellMax.y; ++cy)
+			for (auto cx = cellMin.x; cx < cellMax.x; ++cx)
+			{
+				// Extend the cell by the 1-voxel apron reached by trilinear filtering
+				const uint32_t cell[] = { cx, cy, cz };
+				uint32_t first[3], last[3];
+				for (uint8_t i = 0; i < 3; ++i)
+				{
+					first[i] = (max)(cell[i] * g_macroCellSize, 1u) - 1;
+					last[i] = (min)((cell[i] + 1) * g_macroCellSize, m_gridSize[i] - 1);
+				}
+
+				float2 minMax(loadDensity(first[0], first[1], first[2]));
+				for (auto z = first[2]; z <= last[2]; ++z)
+					for (auto y = first[1]; y <= last[1]; ++y)
+						for (auto x = first[0]; x <= last[0]; ++x)
+						{
+							const auto density = loadDensity(x, y, z);
+							minMax = float2(fminf(minMax.x, density), fmaxf(minMax.y, density));
+						}
+
+				m_macroCells(cx, cy, cz) = minMax;
+			}
+	});
+}
+
+//--------------------------------------------------------------------------------------
+// CSOccupancy.hlsl
+//--------------------------------------------------------------------------------------
+void CPURayCaster::buildOccupancy()
+{
+	const uint3 cellCount(m_macroCells.GetWidth(), m_macroCells.GetHeight(), m_macroCells.GetDepth());
+	auto cellMin = cellCount;
+	uint3 cellMax(0, 0, 0);
+	for (auto cz = 0u; cz < cellCount.z; ++cz)
+		for (auto cy = 0u; cy < cellCount.y; ++cy)
+			for (auto cx = 0u; cx < cellCount.x; ++cx)
+			{
+				// The max densities of the macro cells cover the apron of the trilinear filtering
+				if (m_macroCells(cx, cy, cz).y >= ZERO_THRESHOLD)
+				{
+					const uint32_t cell[] = { cx, cy, cz };
+					for (uint8_t i = 0; i < 3; ++i)
+					{
+						cellMin[i] = (min)(cellMin[i], cell[i]);
+						cellMax[i] = (max)(cellMax[i], cell[i] + 1);
+					}
+				}
+			}
+
+	// An empty volume keeps the whole box
+	if (cellMin.x >= cellMax.x)
+	{
+		cellMin = uint3(0, 0, 0);
+		cellMax = cellCount;
+	}
+
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		const auto gridSize = static_cast<float>(m_gridSize[i]);
+		m_boundsMin[i] = ((min)(static_cast<float>(cellMin[i] * g_macroCellSize) / gridSize, 1.0f) * 2.0f - 1.0f) * m_extent[i];
+		m_boundsMax[i] = ((min)(static_cast<float>(cellMax[i] * g_macroCellSize) / gridSize, 1.0f) * 2.0f - 1.0f) * m_extent[i];
+	}
+}
+
+void CPURayCaster::buildDensityStats()
+{
+	// Per slice: the density range, the occupied voxels and the voxels of the x and y rows they occupy
+	struct SliceStats
+	{
+		float MinDensity;
+		float MaxDensity;
+		uint64_t OccupiedCount;
+		uint3 OccupiedMin;
+		uint3 OccupiedMax;
+		uint64_t LineVoxels;	// Occupied voxels of the rows along x and y that hit any
+		uint32_t HitLines;
+	};
+
+	m_densityStatsDirty = false;
+
+	const auto& gridSize = m_gridSize;
+	const auto numTexels = static_cast<uint64_t>(gridSize.x) * gridSize.y * gridSize.z;
+	vector<SliceStats> sliceStats(gridSize.z);
+	unique_ptr<atomic<uint32_t>[]> zLineCounts(new atomic<uint32_t>[gridSize.x * gridSize.y]());
+	m_threadPool->Dispatch(gridSize.z, [&](uint32_t z, uint32_t)
+	{
+		auto& stats = sliceStats[z];
+		stats.MinDensity = FLT_MAX_VALUE;
+		stats.MaxDensity = -FLT_MAX_VALUE;
+		stats.OccupiedCount = 0;
+		stats.OccupiedMin = gridSize;
+		stats.OccupiedMax = uint3(0, 0, 0);
+		stats.LineVoxels = 0;
+		stats.HitLines = 0;
+
+		vector<uint32_t> yLineCounts(gridSize.x, 0);
+		for (auto y = 0u; y < gridSize.y; ++y)
+		{
+			auto xLineCount = 0u;
+			for (auto x = 0u; x < gridSize.x; ++x)
+			{
+				const auto a = loadDensity(x, y, z);
+				stats.MinDensity = (min)(stats.MinDensity, a);
+				stats.MaxDensity = (max)(stats.MaxDensity, a);
+				if (a >= ZERO_THRESHOLD)
+				{
+					const uint32_t voxel[] = { x, y, z };
+					for (uint8_t i = 0; i < 3; ++i)
+					{
+						stats.OccupiedMin[i] = (min)(stats.OccupiedMin[i], voxel[i]);
+						stats.OccupiedMax[i] = (max)(stats.OccupiedMax[i], voxel[i] + 1);
+					}
+					++stats.OccupiedCount;
+					++xLineCount;
+					++yLineCounts[x];
+					zLineCounts[gridSize.x * y + x].fetch_add(1, memory_order_relaxed);
+				}
+			}
+
+			stats.LineVoxels += xLineCount;
+			stats.HitLines += xLineCount > 0 ? 1 : 0;
+		}
+
+		for (const auto& count : yLineCounts)
+		{
+			stats.LineVoxels += count;
+			stats.HitLines += count > 0 ? 1 : 0;
+		}
+	});
+
+	auto& densityStats = m_densityStats;
+	densityStats.MinDensity = FLT_MAX_VALUE;
+	densityStats.MaxDensity = -FLT_MAX_VALUE;
+	densityStats.OccupiedMin = gridSize;
+	densityStats.OccupiedMax = uint3(0, 0, 0);
+	auto occupiedCount = 0ull;
+	auto lineVoxels = 0ull;
+	auto hitLines = 0ull;
+	for (const auto& stats : sliceStats)
+	{
+		densityStats.MinDensity = (min)(densityStats.MinDensity, stats.MinDensity);
+		densityStats.MaxDensity = (max)(densityStats.MaxDensity, stats.MaxDensity);
+		for (uint8_t i = 0; i < 3; ++i)
+		{
+			densityStats.OccupiedMin[i] = (min)(densityStats.OccupiedMin[i], stats.OccupiedMin[i]);
+			densityStats.OccupiedMax[i] = (max)(densityStats.OccupiedMax[i], stats.OccupiedMax[i]);
+		}
+		occupiedCount += stats.OccupiedCount;
+		lineVoxels += stats.LineVoxels;
+		hitLines += stats.HitLines;
+	}
+
+	for (auto i = 0u; i < gridSize.x * gridSize.y; ++i)
+	{
+		const auto count = zLineCounts[i].load(memory_order_relaxed);
+		lineVoxels += count;
+		hitLines += count > 0 ? 1 : 0;
+	}
+
+	if (occupiedCount == 0) densityStats.OccupiedMin = densityStats.OccupiedMax = uint3(0, 0, 0);
+	densityStats.OccupiedFraction = static_cast<float>(static_cast<double>(occupiedCount) / numTexels);
+	densityStats.OccupiedRayLength = hitLines > 0 ? static_cast<float>(static_cast<double>(lineVoxels) / hitLines) : 0.0f;
+
+	// The histogram over the density range
+	const auto binCount = DensityStats::HistogramBinCount;
+	const auto minDensity = densityStats.MinDensity;
+	const auto densityRange = densityStats.MaxDensity - minDensity;
+	const auto binScale = densityRange > 0.0f ? binCount / densityRange : 0.0f;
+	vector<uint64_t> sliceHistograms(static_cast<size_t>(binCount) * gridSize.z, 0);
+	m_threadPool->Dispatch(gridSize.z, [&](uint32_t z, uint32_t)
+	{
+		const auto pHistogram = &sliceHistograms[static_cast<size_t>(binCount) * z];
+		for (auto y = 0u; y < gridSize.y; ++y)
+			for (auto x = 0u; x < gridSize.x; ++x)
+			{
+				const auto bin = static_cast<uint32_t>((loadDensity(x, y, z) - minDensity) * binScale);
+				++pHistogram[(min)(bin, binCount - 1)];
+			}
+	});
+
+	for (auto i = 0u; i < binCount; ++i)
+	{
+		densityStats.Histogram[i] = 0;
+		for (auto z = 0u; z < gridSize.z; ++z) densityStats.Histogram[i] += sliceHistograms[static_cast<size_t>(binCount) * z + i];
+	}
+}
+
+// CSGradient.hlsl
+void CPURayCaster::buildGradients()
+{
+	// Release the bricks if disabled
+	if (!m_gradientVolume)
+	{
+		m_gradient.Create(0, 0, 0);
+		return;
+	}
+
+	SetBricks(m_gradient, *m_threadPool, m_gridSize,
+		[this](uint32_t x, uint32_t y, uint32_t z) { return computeGradient(x, y, z); });
+}
+
+void CPURayCaster::updateGradients(const uint3& minCorner, const uint3& maxCorner)
+{
+	if (!m_gradientVolume) return;
+
+	// The central differences reach 1 voxel on each side
+	uint3 gradientMin, gradientMax;
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		gradientMin[i] = (max)(minCorner[i], 1u) - 1;
+		gradientMax[i] = (min)(maxCorner[i] + 1, m_gridSize[i]);
+	}
+
+	SetBricks(m_gradient, *m_threadPool, m_gridSize, gradientMin, gradientMax,
+		[this](uint32_t x, uint32_t y, uint32_t z) { return computeGradient(x, y, z); });
+}
+
+snorm4 CPURayCaster::computeGradient(uint32_t x, uint32_t y, uint32_t z) const
+{
+	// Central differences at the voxel centers, clamped at the border like the
+	// 6 offset taps of getDensityGradient()
+	const uint3 last(m_gridSize.x - 1, m_gridSize.y - 1, m_gridSize.z - 1);
+	const float3 gradient
+	(
+		loadDensity((min)(x + 1, last.x), y, z) - loadDensity((max)(x, 1u) - 1, y, z),
+		loadDensity(x, (min)(y + 1, last.y), z) - loadDensity(x, (max)(y, 1u) - 1, z),
+		loadDensity(x, y, (min)(z + 1, last.z)) - loadDensity(x, y, (max)(z, 1u) - 1)
+	);
+
+	// Direction and magnitude, which keep the 8-bit precision of small gradients
+	const auto magnitude = length(gradient);
+
+	return snorm4(magnitude > 0.0f ? float4(gradient / magnitude, magnitude / sqrtf(3.0f)) : float4(0.0f));
+}
+
+void CPURayCaster::rayMarch()
+{
+	rayMarchTiles<false>(getSampleRes(m_raySampleCount, m_maxLightSamples));
+}
+
+void CPURayCaster::rayMarchV()
+{
+	rayMarchTiles<true>(getSampleRes(m_raySampleCount, m_maxLightSamples));
+}
+
+//--------------------------------------------------------------------------------------
+// Tiles of the visible cube-map faces, work stolen across the threads the most expensive first
+//--------------------------------------------------------------------------------------
+template<bool LIGHT_PASS>
+void CPURayCaster::rayMarchTiles(const CBSampleRes& cb)
+{
+	CubeTiles tiles;
+#if CPU_PACKET_WIDTH
+	const auto wavefront = m_wavefrontSteps > 0;
+	if (wavefront) m_rayQueues.resize(m_threadPool->GetNumThreads());
+	tiles.TileSize = wavefront ? g_wavefrontTileSize : g_cubeTileSize;
+#else
+	tiles.TileSize = g_cubeTileSize;
+#endif
+
+	// Only the visible faces are dispatched, each at its own level
+	tiles.FaceCount = 0;
+	tiles.FirstTiles[0] = 0;
+	for (uint8_t i = 0; i < 6; ++i)
+	{
+		if (!(m_visibilityMask & (1 << i))) continue;
+		const auto numGroups = XUSG_DIV_UP(m_cubeMap.GetWidth(m_cubeFaceLODs[i]), tiles.TileSize);
+		tiles.Faces[tiles.FaceCount] = i;
+		tiles.GroupCounts[tiles.FaceCount] = numGroups;
+		tiles.FirstTiles[tiles.FaceCount + 1] = tiles.FirstTiles[tiles.FaceCount] + numGroups * numGroups;
+		++tiles.FaceCount;
+	}
+
+	updateCubeMapInputs(tiles.TileSize, LIGHT_PASS);
+	if (fetchCubeMap(tiles, LIGHT_PASS)) return;
+
+	sortCubeTiles(tiles);
+	selectCubeTiles(tiles);
+
+	const auto tileSize = tiles.TileSize;
+	m_threadPool->DispatchStealing(static_cast<uint32_t>(m_tileOrder.size()), [&](uint32_t groupId, uint32_t threadId)
+	{
+		const auto timeStart = chrono::high_resolution_clock::now();
+		uint32_t x, y;
+		const auto face = getCubeTile(tiles, groupId, x, y);
+		const auto gridSize = m_cubeMap.GetWidth(m_cubeFaceLODs[face]);
+		const auto yEnd = (min)(y + tileSize, gridSize);
+
+#if CPU_PACKET_WIDTH
+		if (wavefront) rayMarchWavefront<LIGHT_PASS>(cb, x, y, face, m_rayQueues[threadId]);
+		else for (auto yi = y; yi < yEnd; yi += CPU_PACKET_WIDTH / g_packetRowSize)
+			rayMarchPacket<LIGHT_PASS>(cb, x, yi, face);
+#else
+		(void)threadId;	// The ray queues are for the packets only
+		const auto xEnd = (min)(x + tileSize, gridSize);
+		for (auto yi = y; yi < yEnd; ++yi)
+			for (auto xi = x; xi < xEnd; ++xi)
+				rayMarchKernel<LIGHT_PASS>(cb, xi, yi, face);
+#endif
+
+		// The costs of the next frame
+		m_tileCosts[groupId] = chrono::duration<float, micro>(chrono::high_resolution_clock::now() - timeStart).count();
+	}, m_tileOrder.data());
+
+	m_tileStats = m_threadPool->GetThreadStats();
+
+	// Only the face sets marched in whole are cached
+	if (m_reusedTileCount == 0) storeCubeMap(tiles, LIGHT_PASS);
+}
+
+// Orders the tiles by their costs in the last frame if it had the same tiles, else by the lengths
+// of the rays through their centers, which the view rays of the tiles roughly march
+void CPURayCaster::sortCubeTiles(const CubeTiles& tiles)
+{
+	const auto& cbo = m_cbPerObject;
+	const auto numTiles = tiles.FirstTiles[tiles.FaceCount];
+	auto layout = (static_cast<uint64_t>(m_cubeMap.GetWidth()) << 40) |
+		(static_cast<uint64_t>(tiles.TileSize) << 32) | (m_visibilityMask << 24);
+	for (uint8_t i = 0; i < 6; ++i) layout |= static_cast<uint64_t>(m_cubeFaceLODs[i] & 0xf) << (4 * i);
+
+	if (layout != m_tileLayout || m_tileCosts.size() != numTiles)
+	{
+		const auto eyePos = mulPoint(m_cbPerFrame.EyePos, cbo.WorldI);
+		m_tileCosts.resize(numTiles);
+		for (auto i = 0u; i < numTiles; ++i)
+		{
+			uint32_t x, y;
+			const auto face = getCubeTile(tiles, i, x, y);
+			const auto gridSize = m_cubeMap.GetWidth(m_cubeFaceLODs[face]);
+			x = (min)(x + tiles.TileSize / 2, gridSize - 1);
+			y = (min)(y + tiles.TileSize / 2, gridSize - 1);
+			const auto target = GetLocalPos(x, y, face, gridSize, cbo.BoundsMin, cbo.BoundsMax);
+			const auto rayDir = normalize(target - eyePos);
+			auto rayOrigin = eyePos;
+			m_tileCosts[i] = ComputeRayOrigin(rayOrigin, rayDir, cbo.BoundsMin, cbo.BoundsMax) ?
+				ComputeTargetHit(rayOrigin, target, rayDir) : 0.0f;
+		}
+		m_tileLayout = layout;
+	}
+
+	m_tileOrder.resize(numTiles);
+	for (auto i = 0u; i < numTiles; ++i) m_tileOrder[i] = i;
+	stable_sort(m_tileOrder.begin(), m_tileOrder.end(),
+		[this](uint32_t a, uint32_t b) { return m_tileCosts[a] > m_tileCosts[b]; });
+}
+
+// Marks the tiles to reuse stale on changes of their inputs, and drops the cached face sets on
+// changes of the volume, the lighting or the world
+void CPURayCaster::updateCubeMapInputs(uint32_t tileSize, bool lightPass)
+{
+	CubeMapInputs inputs;
+	inputs.World = m_cbPerObject.World;
+	inputs.NumSamples = m_raySampleCount;
+	inputs.TileSize = tileSize;
+	inputs.LightPass = lightPass ? 1 : 0;
+
+	// The light map and the irradiance re-lit by this Render() change the radiance too
+	if (m_relitTexelCount > 0 || m_bakedTexelCount > 0 ||
+		memcmp(&inputs.World, &m_cubeMapInputs.World, sizeof(inputs.World)) != 0) m_cubeMapDirty = true;
+	if (m_cubeMapDirty) m_cubeMapCache.clear();
+	// The tiles clipped by a depth map are not reused, like the cached face sets
+	if (m_cubeMapDirty || m_pDepths[DEPTH_MAP] || memcmp(&inputs, &m_cubeMapInputs, sizeof(CubeMapInputs)) != 0)
+		for (auto& eyes : m_cubeTileEyes) eyes.clear();
+	m_cubeMapInputs = inputs;
+	m_cubeMapDirty = false;
+	++m_cubeFrame;
+}
+
+// Drops the tiles to reuse from m_tileOrder: those whose view rays have moved within the tolerance
+// since their last march, unless their inputs have changed or they are due for a refresh
+void CPURayCaster::selectCubeTiles(const CubeTiles& tiles)
+{
+	if (m_reuseTolerance <= 0.0f || m_pDepths[DEPTH_MAP]) return;
+
+	const auto& cbo = m_cbPerObject;
+	for (uint8_t i = 0; i < tiles.FaceCount; ++i)
+	{
+		const auto face = tiles.Faces[i];
+		const auto numTiles = tiles.GroupCounts[i] * tiles.GroupCounts[i];
+		auto& eyes = m_cubeTileEyes[face];
+		if (m_cubeTileLODs[face] != m_cubeFaceLODs[face] || eyes.size() != numTiles) eyes.assign(numTiles, float4(0.0f));
+		m_cubeTileLODs[face] = m_cubeFaceLODs[face];
+	}
+
+	// Lateral offset in voxels of the view ray of a texel from its last march, across the bounds
+	const auto eyePos = mulPoint(m_cbPerFrame.EyePos, cbo.WorldI);
+	const auto voxelScale = 0.5f * GetMaxSize(m_gridSize);
+	const auto getError = [&](uint32_t x, uint32_t y, uint8_t face, uint32_t gridSize, const float3& lastEyePos)
+	{
+		const auto target = GetLocalPos(x, y, face, gridSize, cbo.BoundsMin, cbo.BoundsMax);
+		const auto rayDir = normalize(target - eyePos);
+		auto rayOrigin = eyePos;
+		if (!ComputeRayOrigin(rayOrigin, rayDir, cbo.BoundsMin, cbo.BoundsMax)) return 0.0f;
+
+		return ComputeTargetHit(rayOrigin, target, rayDir) * length(cross(rayDir, normalize(target - lastEyePos))) * voxelScale;
+	};
+
+	const auto tileEnd = remove_if(m_tileOrder.begin(), m_tileOrder.end(), [&](uint32_t tileId)
+	{
+		uint32_t x, y;
+		const auto face = getCubeTile(tiles, tileId, x, y);
+		const auto gridSize = m_cubeMap.GetWidth(m_cubeFaceLODs[face]);
+		const auto i = y / tiles.TileSize * XUSG_DIV_UP(gridSize, tiles.TileSize) + x / tiles.TileSize;
+		auto& eye = m_cubeTileEyes[face][i];
+
+		auto reuse = eye.w > 0.0f && (m_reuseRefreshFrames == 0 || (i + m_cubeFrame) % m_reuseRefreshFrames != 0);
+		if (reuse)
+		{
+			const auto lastEyePos = eye.xyz();
+			const uint32_t xs[] = { x, (min)(x + tiles.TileSize, gridSize) - 1 };
+			const uint32_t ys[] = { y, (min)(y + tiles.TileSize, gridSize) - 1 };
+			for (uint8_t j = 0; j < 4 && reuse; ++j)
+				reuse = getError(xs[j & 1], ys[j >> 1], face, gridSize, lastEyePos) <= m_reuseTolerance;
+		}
+
+		if (!reuse) eye = float4(eyePos, 1.0f);
+
+		return reuse;
+	});
+	m_reusedTileCount = static_cast<uint32_t>(m_tileOrder.end() - tileEnd);
+	m_tileOrder.erase(tileEnd, m_tileOrder.end());
+}
+
+// Key of the face set of the current frame, without the texels
+void CPURayCaster::getCubeMapKey(CubeMapEntry& entry, bool lightPass) const
+{
+	const auto cellSize = 2.0f * m_cubeCacheCellSize / GetMaxSize(m_gridSize);
+	entry.EyePos = mulPoint(m_cbPerFrame.EyePos, m_cbPerObject.WorldI);
+	for (uint8_t i = 0; i < 3; ++i) entry.Cell[i] = static_cast<int32_t>(floorf(entry.EyePos[i] / cellSize));
+
+	entry.Layout = (lightPass ? 1u : 0u) << 30 | m_visibilityMask << 24;
+	for (uint8_t i = 0; i < 6; ++i)
+		if (m_visibilityMask & (1 << i)) entry.Layout |= (m_cubeFaceLODs[i] & 0xfu) << (4 * i);
+	entry.NumSamples = m_raySampleCount;
+	entry.LastUse = m_cubeFrame;
+}
+
+// Copies the visible faces of the face set cached for the viewpoint, if any, into the cube map
+bool CPURayCaster::fetchCubeMap(const CubeTiles& tiles, bool lightPass)
+{
+	if (m_cubeCacheBudget == 0 || m_pDepths[DEPTH_MAP]) return false;
+
+	CubeMapEntry key;
+	getCubeMapKey(key, lightPass);
+	const auto it = find_if(m_cubeMapCache.begin(), m_cubeMapCache.end(), [&key](const CubeMapEntry& entry)
+	{
+		return memcmp(entry.Cell, key.Cell, sizeof(key.Cell)) == 0 && entry.Layout == key.Layout &&
+			entry.NumSamples == key.NumSamples;
+	});
+	if (it == m_cubeMapCache.end())
+	{
+		++m_cubeCacheMisses;
+
+		return false;
+	}
+
+	size_t offset = 0;
+	for (uint8_t i = 0; i < tiles.FaceCount; ++i)
+	{
+		const auto face = tiles.Faces[i];
+		const auto lod = m_cubeFaceLODs[face];
+		const auto gridSize = m_cubeMap.GetWidth(lod);
+		const auto numTexels = static_cast<size_t>(gridSize) * gridSize;
+		copy_n(&it->Texels[offset], numTexels, &m_cubeMap(0, 0, face, lod));
+		copy_n(&it->Depths[offset], numTexels, &m_cubeDepth(0, 0, face, lod));
+		offset += numTexels;
+
+		// The tiles to reuse from here on were marched from the eye of the face set
+		m_cubeTileEyes[face].assign(tiles.GroupCounts[i] * tiles.GroupCounts[i], float4(it->EyePos, 1.0f));
+		m_cubeTileLODs[face] = lod;
+	}
+	it->LastUse = m_cubeFrame;
+	++m_cubeCacheHits;
+
+	return true;
+}
+
+// Caches the visible faces of the cube map, evicting the least recently used face sets beyond the budget
+void CPURayCaster::storeCubeMap(const CubeTiles& tiles, bool lightPass)
+{
+	if (m_cubeCacheBudget == 0 || m_pDepths[DEPTH_MAP]) return;
+
+	size_t numTexels = 0;
+	for (uint8_t i = 0; i < tiles.FaceCount; ++i)
+	{
+		const auto gridSize = m_cubeMap.GetWidth(m_cubeFaceLODs[tiles.Faces[i]]);
+		numTexels += static_cast<size_t>(gridSize) * gridSize;
+	}
+	const auto entrySize = numTexels * (sizeof(float4) + sizeof(float));
+	if (entrySize > m_cubeCacheBudget) return;
+
+	auto memorySize = GetCubeCacheStats().MemorySize;
+	while (memorySize + entrySize > m_cubeCacheBudget)
+	{
+		const auto lru = min_element(m_cubeMapCache.begin(), m_cubeMapCache.end(),
+			[](const CubeMapEntry& a, const CubeMapEntry& b) { return a.LastUse < b.LastUse; });
+		memorySize -= lru->Texels.size() * (sizeof(float4) + sizeof(float));
+		m_cubeMapCache.erase(lru);
+	}
+
+	CubeMapEntry entry;
+	getCubeMapKey(entry, lightPass);
+	entry.Texels.reserve(numTexels);
+	entry.Depths.reserve(numTexels);
+	for (uint8_t i = 0; i < tiles.FaceCount; ++i)
+	{
+		const auto face = tiles.Faces[i];
+		const auto lod = m_cubeFaceLODs[face];
+		const auto gridSize = m_cubeMap.GetWidth(lod);
+		const auto pTexels = &m_cubeMap(0, 0, face, lod);
+		const auto pDepths = &m_cubeDepth(0, 0, face, lod);
+		entry.Texels.insert(entry.Texels.end(), pTexels, pTexels + gridSize * gridSize);
+		entry.Depths.insert(entry.Depths.end(), pDepths, pDepths + gridSize * gridSize);
+	}
+	m_cubeMapCache.push_back(move(entry));
+}
+
+// Returns the face of the tile, and its first texel in x and y
+uint8_t CPURayCaster::getCubeTile(const CubeTiles& tiles, uint32_t tileId, uint32_t& x, uint32_t& y) const
+{
+	uint8_t i = 0;
+	while (tileId >= tiles.FirstTiles[i + 1]) ++i;
+	tileId -= tiles.FirstTiles[i];
+	x = tileId % tiles.GroupCounts[i] * tiles.TileSize;
+	y = tileId / tiles.GroupCounts[i] * tiles.TileSize;
+
+	return tiles.Faces[i];
+}
+
+void CPURayCaster::renderCube()
+{
+	const auto width = m_renderTarget.GetWidth();
+	const auto height = m_renderTarget.GetHeight();
+	const auto numGroupsX = XUSG_DIV_UP(width, g_screenTileSize);
+	const auto numGroupsY = XUSG_DIV_UP(height, g_screenTileSize);
+
+	m_threadPool->Dispatch(numGroupsX * numGroupsY, [&](uint32_t groupId, uint32_t)
+	{
+		const auto gx = groupId % numGroupsX;
+		const auto gy = groupId / numGroupsX;
+		const auto xEnd = (min)((gx + 1) * g_screenTileSize, width);
+		const auto yEnd = (min)((gy + 1) * g_screenTileSize, height);
+
+		for (auto y = gy * g_screenTileSize; y < yEnd; ++y)
+			for (auto x = gx * g_screenTileSize; x < xEnd; ++x)
+			{
+				// Premultiplied blending
+				const auto src = renderCubeKernel(x, y);
+				auto& dst = m_renderTarget(x, y);
+				dst = src + dst * (1.0f - src.w);
+			}
+	});
+}
+
+void CPURayCaster::rayCastDirect()
+{
+	const auto cb = getSampleRes(m_maxRaySamples, m_maxLightSamples);
+	const auto width = m_renderTarget.GetWidth();
+	const auto height = m_renderTarget.GetHeight();
+	const auto numGroupsX = XUSG_DIV_UP(width, g_screenTileSize);
+	const auto numGroupsY = XUSG_DIV_UP(height, g_screenTileSize);
+
+	m_threadPool->Dispatch(numGroupsX * numGroupsY, [&](uint32_t groupId, uint32_t)
+	{
+		const auto gx = groupId % numGroupsX;
+		const auto gy = groupId / numGroupsX;
+		const auto xEnd = (min)((gx + 1) * g_screenTileSize, width);
+		const auto yEnd = (min)((gy + 1) * g_screenTileSize, height);
+
+		for (auto y = gy * g_screenTileSize; y < yEnd; ++y)
+			for (auto x = gx * g_screenTileSize; x < xEnd; ++x)
+			{
+				const auto src = rayCastKernel<false>(cb, x, y);
+				auto& dst = m_renderTarget(x, y);
+				dst = src + dst * (1.0f - src.w);
+			}
+	});
+}
+
+void CPURayCaster::rayCastVDirect()
+{
+	const auto cb = getSampleRes(m_maxRaySamples, m_maxLightSamples);
+	const auto width = m_renderTarget.GetWidth();
+	const auto height = m_renderTarget.GetHeight();
+	const auto numGroupsX = XUSG_DIV_UP(width, g_screenTileSize);
+	const auto numGroupsY = XUSG_DIV_UP(height, g_screenTileSize);
+
+	m_threadPool->Dispatch(numGroupsX * numGroupsY, [&](uint32_t groupId, uint32_t)
+	{
+		const auto gx = groupId % numGroupsX;
+		const auto gy = groupId / numGroupsX;
+		const auto xEnd = (min)((gx + 1) * g_screenTileSize, width);
+		const auto yEnd = (min)((gy + 1) * g_screenTileSize, height);
+
+		for (auto y = gy * g_screenTileSize; y < yEnd; ++y)
+			for (auto x = gx * g_screenTileSize; x < xEnd; ++x)
+			{
+				const auto src = rayCastKernel<true>(cb, x, y);
+				auto& dst = m_renderTarget(x, y);
+				dst = src + dst * (1.0f - src.w);
+			}
+	});
+}
+
+//--------------------------------------------------------------------------------------
+// Ray setup of CSRayMarch.hlsl and CSRayMarchV.hlsl
+//--------------------------------------------------------------------------------------
+bool CPURayCaster::initCubeRay(float3& rayOrigin, float3& rayDir, float& tMax, uint32_t x, uint32_t y, uint8_t face)
+{
+	const auto& cbo = m_cbPerObject;
+	const auto lod = m_cubeFaceLODs[face];
+	const auto gridSize = m_cubeMap.GetWidth(lod);
+
+	// Unlike the GPU, which leaves missed texels untouched, clear them for determinism
+	m_cubeMap(x, y, face, lod) = 0.0f;
+
+	rayOrigin = mulPoint(m_cbPerFrame.EyePos, cbo.WorldI);
+
+	const auto target = GetLocalPos(x, y, face, gridSize, cbo.BoundsMin, cbo.BoundsMax);
+	rayDir = normalize(target - rayOrigin);
+	if (!ComputeRayOrigin(rayOrigin, rayDir, cbo.BoundsMin, cbo.BoundsMax)) return false;
+
+	tMax = ComputeTargetHit(rayOrigin, target, rayDir);
+
+	// Calculate occluded end point
+	const auto hPos = mul(float4(rayOrigin + 0.01f * rayDir, 1.0f), cbo.WorldViewProj);
+	const auto xy = float2(hPos.x, hPos.y) / hPos.w;
+	auto z = 1.0f;
+	const auto pDepth = m_pDepths[DEPTH_MAP];
+	if (pDepth)
+	{
+		// Point sampling
+		const auto u = saturate(xy.x * 0.5f + 0.5f), v = saturate(0.5f - xy.y * 0.5f);
+		const auto px = (min)(static_cast<uint32_t>(u * pDepth->GetWidth()), pDepth->GetWidth() - 1);
+		const auto py = (min)(static_cast<uint32_t>(v * pDepth->GetHeight()), pDepth->GetHeight() - 1);
+		z = (*pDepth)(px, py);
+	}
+	m_cubeDepth(x, y, face, m_cubeFaceLODs[face]) = z;
+	tMax = fminf(getTMax(float3(xy.x, xy.y, z), rayOrigin, rayDir), tMax);
+
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// CSRayMarch.hlsl (LIGHT_PASS == false) and CSRayMarchV.hlsl (LIGHT_PASS == true)
+//--------------------------------------------------------------------------------------
+template<bool LIGHT_PASS>
+void CPURayCaster::rayMarchKernel(const CBSampleRes& cb, uint32_t x, uint32_t y, uint8_t face)
+{
+	const auto& cbo = m_cbPerObject;
+
+	float3 rayOrigin, rayDir;
+	float tMax;
+	if (!initCubeRay(rayOrigin, rayDir, tMax, x, y, face)) return;
+
+	const auto stepScale = cb.Step;
+
+	const auto localSpaceLightPt = mulDir(m_cbPerFrame.LightPos, cbo.WorldI);
+	const auto lightDir = normalize(localSpaceLightPt);
+
+	// In-scattered radiance with inverted transmittance
+	float4 scatter = 0.0f;
+	SkipStats stats = {};
+	const auto maxMip = getMaxVolumeMip();
+
+	auto t = 0.0f;
+	auto step = stepScale;
+	auto prevDensity = 0.0f;
+	for (auto i = 0u; i < cb.NumSamples; ++i)
+	{
+		const auto pos = rayOrigin + rayDir * t;
+		if (IsOutOfBounds(pos, cbo.BoundsMin, cbo.BoundsMax)) break;
+		const auto uvw = LocalToTex3DSpace(pos, cbo.Extent);
+
+		// Jump over the samples in the empty macro cell, which would be skipped anyway
+		const auto tSkip = getEmptySpaceSkip(uvw, rayDir);
+		if (tSkip > 0.0f)
+		{
+			const auto n = (max)(static_cast<uint32_t>(ceilf(tSkip / stepScale)), 1u);
+			step = stepScale;
+			t += step * n;
+			stats.RaySamplesSkipped += (min)(n, cb.NumSamples - i);
+			i += n - 1;
+			if (t > tMax) break;
+			continue;
+		}
+
+		// Get a sample; once the transmittance drops, coarser mips are sampled with proportionally longer steps
+		const auto transm = 1.0f - scatter.w;
+		const auto mip = GetTransmMip(transm, maxMip);
+		const auto mipStep = stepScale * static_cast<float>(1 << mip);
+		if (mip == 0) prefetchVolume(pos, rayDir);
+		auto color = getSample(uvw, mip);
+		auto newStep = mipStep;
+		++stats.RaySamples;
+
+		// Skip empty space
+		if (color.w > ZERO_THRESHOLD)
+		{
+			const auto light = getLight<LIGHT_PASS>(cb, pos, lightDir, stats); // Sample light
+
+			// Update step
+			const auto dDensity = color.w - prevDensity;
+			newStep = GetStep(dDensity, transm, color.w, mipStep);
+			step = (step + newStep) * 0.5f;
+			prevDensity = color.w;
+
+			// Accumulate color
+			const auto opacityScale = GetOpacityScale(color.w, mip);
+			const auto rgb = color.xyz() * color.w * light;
+			color = float4(rgb, color.w);
+			scatter += color * (ABSORPTION * opacityScale) * transm;
+
+			if (transm < ZERO_THRESHOLD) break;
+		}
+
+		// Update position along ray
+		step = newStep;
+		t += step;
+		if (t > tMax) break;
+	}
+
+	scatter = float4(scatter.xyz() / (2.0f * PI), scatter.w);
+
+	m_cubeMap(x, y, face, m_cubeFaceLODs[face]) = scatter;
+	addSkipStats(stats);
+}
+
+#if CPU_PACKET_WIDTH
+//--------------------------------------------------------------------------------------
+// Packet version of rayMarchKernel(): marches the rays of CPU_PACKET_WIDTH neighboring
+// texels (rows of 8 in the 8x8 tile) together, with per-lane masks for the exits
+//--------------------------------------------------------------------------------------
+template<bool LIGHT_PASS>
+void CPURayCaster::rayMarchPacket(const CBSampleRes& cb, uint32_t x, uint32_t y, uint8_t face)
+{
+	const auto gridSize = m_cubeMap.GetWidth(m_cubeFaceLODs[face]);
+
+	// Set up the rays per lane, and load them into SoA registers
+	alignas(64) float rays[7][CPU_PACKET_WIDTH];
+	auto laneBits = 0u;
+	for (uint8_t i = 0; i < CPU_PACKET_WIDTH; ++i)
+	{
+		const auto xi = x + i % g_packetRowSize, yi = y + i / g_packetRowSize;
+		float3 rayOrigin(0.0f), rayDir(1.0f);
+		auto tMax = 0.0f;
+		if (xi < gridSize && yi < gridSize && initCubeRay(rayOrigin, rayDir, tMax, xi, yi, face))
+			laneBits |= 1 << i;
+
+		for (uint8_t j = 0; j < 3; ++j)
+		{
+			rays[j][i] = rayOrigin[j];
+			rays[j + 3][i] = rayDir[j];
+		}
+		rays[6][i] = tMax;
+	}
+
+	if (!laneBits) return;
+
+	RayPacket packet;
+	packet.Origin = { floatP::Load(rays[0]), floatP::Load(rays[1]), floatP::Load(rays[2]) };
+	packet.Dir = { floatP::Load(rays[3]), floatP::Load(rays[4]), floatP::Load(rays[5]) };
+	packet.TMax = floatP::Load(rays[6]);
+	packet.T = 0.0f;
+	packet.PrevDensity = 0.0f;
+	packet.SampleCount = 0.0f;
+	packet.Scatter = { 0.0f, 0.0f, 0.0f, 0.0f };
+	packet.Active = maskP::FromBits(laneBits);
+
+	SkipStats stats = {};
+	uint64_t activeLaneSteps = 0;
+	const auto numSteps = marchRayPacket<LIGHT_PASS>(packet, cb, cb.NumSamples, stats, activeLaneSteps);
+
+	const auto& scatter = packet.Scatter;
+	alignas(64) float results[4][CPU_PACKET_WIDTH];
+	scatter.x.Store(results[0]);
+	scatter.y.Store(results[1]);
+	scatter.z.Store(results[2]);
+	scatter.w.Store(results[3]);
+	for (auto bits = laneBits; bits; bits &= bits - 1)
+	{
+		const auto i = CountTrailingZeros(bits);
+		const auto xi = x + i % g_packetRowSize, yi = y + i / g_packetRowSize;
+		m_cubeMap(xi, yi, face, m_cubeFaceLODs[face]) = float4(float3(results[0][i], results[1][i], results[2][i]) / (2.0f * PI), results[3][i]);
+	}
+
+	addSkipStats(stats);
+	addLaneStats(static_cast<uint64_t>(numSteps) * CPU_PACKET_WIDTH, activeLaneSteps);
+}
+
+//--------------------------------------------------------------------------------------
+// Wavefront version of rayMarchPacket() over a 32x32 tile, whose stages run over the
+// SoA ray queue in turn: the entry (ray setup and clipping against the bounds), the
+// march (with the light lookups) of batches of m_wavefrontSteps steps per packet, and
+// the resolve of the exited rays, which compacts the live ones into full packets
+//--------------------------------------------------------------------------------------
+template<bool LIGHT_PASS>
+void CPURayCaster::rayMarchWavefront(const CBSampleRes& cb, uint32_t x, uint32_t y, uint8_t face, RayQueue& queue)
+{
+	const auto gridSize = m_cubeMap.GetWidth(m_cubeFaceLODs[face]);
+	const auto xEnd = (min)(x + g_wavefrontTileSize, gridSize);
+	const auto yEnd = (min)(y + g_wavefrontTileSize, gridSize);
+
+	queue.Capacity = g_wavefrontTileSize * g_wavefrontTileSize;
+	queue.Channels.resize(static_cast<size_t>(RayQueue::NumChannels) * queue.Capacity);
+	queue.Texels.resize(queue.Capacity);
+	queue.PacketBits.resize(queue.Capacity / CPU_PACKET_WIDTH);
+	const auto channel = [&](uint8_t i) { return &queue.Channels[static_cast<size_t>(queue.Capacity) * i]; };
+
+	// Entry: the rays hitting the bounds are queued
+	auto numRays = 0u;
+	for (auto yi = y; yi < yEnd; ++yi)
+		for (auto xi = x; xi < xEnd; ++xi)
+		{
+			float3 rayOrigin, rayDir;
+			float tMax;
+			if (!initCubeRay(rayOrigin, rayDir, tMax, xi, yi, face)) continue;
+
+			for (uint8_t j = 0; j < 3; ++j)
+			{
+				channel(j)[numRays] = rayOrigin[j];
+				channel(j + 3)[numRays] = rayDir[j];
+			}
+			channel(6)[numRays] = tMax;
+			for (uint8_t j = 7; j < RayQueue::NumChannels; ++j) channel(j)[numRays] = 0.0f;
+			queue.Texels[numRays++] = gridSize * yi + xi;
+		}
+
+	// The idle lanes of the last packet hold copies of the first ray, so they sample within the volume
+	const auto padQueue = [&]()
+	{
+		for (auto i = numRays; i % CPU_PACKET_WIDTH; ++i)
+			for (uint8_t j = 0; j < RayQueue::NumChannels; ++j) channel(j)[i] = channel(j)[0];
+	};
+	padQueue();
+
+	SkipStats stats = {};
+	uint64_t laneSteps = 0, activeLaneSteps = 0;
+	vector<uint64_t> liveRays;
+	while (numRays > 0)
+	{
+		liveRays.push_back(numRays);
+
+		// March
+		const auto numPackets = XUSG_DIV_UP(numRays, CPU_PACKET_WIDTH);
+		for (auto i = 0u; i < numPackets; ++i)
+		{
+			const auto first = CPU_PACKET_WIDTH * i;
+			const auto load = [&](uint8_t j) { return floatP::LoadUnaligned(&channel(j)[first]); };
+			const auto numLanes = (min)(numRays - first, static_cast<uint32_t>(CPU_PACKET_WIDTH));
+
+			RayPacket packet;
+			packet.Origin = { load(0), load(1), load(2) };
+			packet.Dir = { load(3), load(4), load(5) };
+			packet.TMax = load(6);
+			packet.T = load(7);
+			packet.PrevDensity = load(8);
+			packet.SampleCount = load(9);
+			packet.Scatter = { load(10), load(11), load(12), load(13) };
+			packet.Active = maskP::FromBits((1u << numLanes) - 1);
+
+			const auto numSteps = marchRayPacket<LIGHT_PASS>(packet, cb, m_wavefrontSteps, stats, activeLaneSteps);
+			laneSteps += static_cast<uint64_t>(numSteps) * CPU_PACKET_WIDTH;
+
+			packet.T.StoreUnaligned(&channel(7)[first]);
+			packet.PrevDensity.StoreUnaligned(&channel(8)[first]);
+			packet.SampleCount.StoreUnaligned(&channel(9)[first]);
+			packet.Scatter.x.StoreUnaligned(&channel(10)[first]);
+			packet.Scatter.y.StoreUnaligned(&channel(11)[first]);
+			packet.Scatter.z.StoreUnaligned(&channel(12)[first]);
+			packet.Scatter.w.StoreUnaligned(&channel(13)[first]);
+			queue.PacketBits[i] = packet.Active.Bits();
+		}
+
+		// Resolve: the exited rays are written out, and the live ones compacted in order
+		auto numLive = 0u;
+		for (auto i = 0u; i < numRays; ++i)
+		{
+			if (queue.PacketBits[i / CPU_PACKET_WIDTH] & (1 << (i % CPU_PACKET_WIDTH)))
+			{
+				if (numLive < i)
+				{
+					for (uint8_t j = 0; j < RayQueue::NumChannels; ++j) channel(j)[numLive] = channel(j)[i];
+					queue.Texels[numLive] = queue.Texels[i];
+				}
+				++numLive;
+			}
+			else
+			{
+				const auto texel = queue.Texels[i];
+				const float3 scatter(channel(10)[i], channel(11)[i], channel(12)[i]);
+				m_cubeMap(texel % gridSize, texel / gridSize, face, m_cubeFaceLODs[face]) = float4(scatter / (2.0f * PI), channel(13)[i]);
+			}
+		}
+		numRays = numLive;
+		padQueue();
+	}
+
+	addSkipStats(stats);
+	addLaneStats(laneSteps, activeLaneSteps);
+
+	lock_guard<mutex> lock(m_liveRayMutex);
+	if (m_liveRays.size() < liveRays.size()) m_liveRays.resize(liveRays.size(), 0);
+	for (size_t i = 0; i < liveRays.size(); ++i) m_liveRays[i] += liveRays[i];
+}
+
+//--------------------------------------------------------------------------------------
+// Marches the live rays of a packet for up to maxSteps steps, or until all of them exit,
+// and returns the steps taken; shared by rayMarchPacket() and rayMarchWavefront()
+//--------------------------------------------------------------------------------------
+template<bool LIGHT_PASS>
+uint32_t CPURayCaster::marchRayPacket(RayPacket& packet, const CBSampleRes& cb, uint32_t maxSteps, SkipStats& stats,
+	uint64_t& activeLaneSteps)
+{
+	const auto& cbo = m_cbPerObject;
+	const auto& rayOrigin = packet.Origin;
+	const auto& rayDir = packet.Dir;
+	const auto& tMax = packet.TMax;
+	const floatP stepScale = cb.Step;
+	const float3P boundsMin = { cbo.BoundsMin.x, cbo.BoundsMin.y, cbo.BoundsMin.z };
+	const float3P boundsMax = { cbo.BoundsMax.x, cbo.BoundsMax.y, cbo.BoundsMax.z };
+	const auto uvwScale = float3(0.5f) / cbo.Extent;
+	float3 cellScale;
+	for (uint8_t i = 0; i < 3; ++i) cellScale[i] = static_cast<float>(m_gridSize[i]) / g_macroCellSize;
+
+	const auto localSpaceLightPt = mulDir(m_cbPerFrame.LightPos, cbo.WorldI);
+	const auto lightDir = normalize(localSpaceLightPt);
+
+	const auto maxMip = getMaxVolumeMip();
+	const auto compressed = isCompressed();
+	const auto streamed = isStreamed();
+
+	auto& t = packet.T;
+	auto& prevDensity = packet.PrevDensity;
+	auto& sampleCount = packet.SampleCount;
+	auto& scatter = packet.Scatter;
+	auto& active = packet.Active;
+	const floatP numSamples = static_cast<float>(cb.NumSamples);
+	active = AndNot(numSamples <= sampleCount, active);
+
+	auto i = 0u;
+	for (; i < maxSteps; ++i)
+	{
+		const float3P pos = { rayOrigin.x + rayDir.x * t, rayOrigin.y + rayDir.y * t, rayOrigin.z + rayDir.z * t };
+		active = active & (boundsMin.x <= pos.x) & (boundsMin.y <= pos.y) & (boundsMin.z <= pos.z) &
+			(pos.x <= boundsMax.x) & (pos.y <= boundsMax.y) & (pos.z <= boundsMax.z);
+		if (!active.Any()) break;
+		activeLaneSteps += CountBits(active.Bits());
+		const float3P uvw = { pos.x * uvwScale.x + 0.5f, pos.y * uvwScale.y + 0.5f, pos.z * uvwScale.z + 0.5f };
+
+		// Jump over the samples in the empty macro cells, which would be skipped anyway
+		floatP tSkip;
+		const auto skip = m_emptySpaceSkip ? active & GetEmptySpaceSkip(tSkip, m_macroCells, cellScale, cbo.Extent, uvw, rayDir) :
+			maskP::FromBits(0);
+		const auto sampling = AndNot(skip, active);
+		if (skip.Any())
+		{
+			const auto n = Select(skip, min(max(ceil(tSkip / stepScale), 1.0f), numSamples - sampleCount), 0.0f);
+			t += stepScale * n;
+			sampleCount += n;
+			active = AndNot(skip & ((t > tMax) | (numSamples <= sampleCount)), active);
+
+			alignas(64) float lanes[CPU_PACKET_WIDTH];
+			n.Store(lanes);
+			for (auto bits = skip.Bits(); bits; bits &= bits - 1)
+				stats.RaySamplesSkipped += static_cast<uint64_t>(lanes[CountTrailingZeros(bits)]);
+
+			if (!sampling.Any()) continue;
+		}
+
+		// Mips per lane as GetTransmMip(); once the transmittance drops, coarser mips are
+		// sampled with proportionally longer steps
+		const auto transm = 1.0f - scatter.w;
+		maskP mipLanes[VolumeMipCount];
+		floatP mipScale = 1.0f;
+		uint8_t numMips = 0;
+		for (auto lanes = sampling; lanes.Any();)
+		{
+			const auto coarser = numMips < maxMip ? lanes & (transm <= 0.25f / (1 << numMips)) : maskP::FromBits(0);
+			mipLanes[numMips++] = AndNot(coarser, lanes);
+			mipScale = Select(coarser, mipScale * 2.0f, mipScale);
+			lanes = coarser;
+		}
+		const auto mipStep = stepScale * mipScale;
+
+		// Get a sample, starting with the density only
+		TrilinearTapsP taps[VolumeMipCount];
+		const float* pVolumes[VolumeMipCount];
+		floatP density = 0.0f;
+		for (uint8_t j = 0; j < numMips; ++j)
+		{
+			if (!mipLanes[j].Any()) continue;
+			auto fallbackBits = 0u;
+			if (j == 0 && streamed)
+			{
+				prefetchVolume(pos, rayDir, mipLanes[j]);
+				fallbackBits = ComputeTrilinearTaps(taps[j], uvw, m_densityStream, mipLanes[j]);
+				pVolumes[j] = m_densityStream.GetData();
+			}
+			else if (compressed)
+			{
+				ComputeTrilinearTaps(taps[j], uvw, m_densityBC[j], mipLanes[j]);
+				pVolumes[j] = BlockTexture3D::GetCacheData();
+			}
+			else if (m_densityOnly)
+			{
+				ComputeTrilinearTaps(taps[j], uvw, m_density[j]);
+				pVolumes[j] = m_density[j].GetData();
+			}
+			else
+			{
+				ComputeTrilinearTaps(taps[j], uvw, m_volume[j]);
+				pVolumes[j] = reinterpret_cast<const float*>(m_volume[j].GetData()) + 3;
+			}
+			density = Select(mipLanes[j], SampleTrilinear(pVolumes[j], taps[j]), density);
+
+			// The lanes of the bricks not in the cache sample the mapping
+			if (fallbackBits)
+			{
+				alignas(64) float lanes[4][CPU_PACKET_WIDTH];
+				uvw.x.Store(lanes[0]);
+				uvw.y.Store(lanes[1]);
+				uvw.z.Store(lanes[2]);
+				density.Store(lanes[3]);
+				for (auto bits = fallbackBits; bits; bits &= bits - 1)
+				{
+					const auto k = CountTrailingZeros(bits);
+					lanes[3][k] = m_densityStream.SampleLevel(float3(lanes[0][k], lanes[1][k], lanes[2][k]));
+				}
+				density = floatP::Load(lanes[3]);
+			}
+		}
+		auto newStep = mipStep;
+		stats.RaySamples += CountBits(sampling.Bits());
+
+		// Skip empty space
+		const auto dense = sampling & (density > ZERO_THRESHOLD);
+		if (dense.Any())
+		{
+			float3P color = { 1.0f, 1.0f, 1.0f };
+			if (!m_densityOnly)
+			{
+				for (uint8_t j = 0; j < numMips; ++j)
+				{
+					if (!mipLanes[j].Any()) continue;
+					const auto pVolume = pVolumes[j];
+					color.x = Select(mipLanes[j], SampleTrilinear(pVolume - 3, taps[j]), color.x);
+					color.y = Select(mipLanes[j], SampleTrilinear(pVolume - 2, taps[j]), color.y);
+					color.z = Select(mipLanes[j], SampleTrilinear(pVolume - 1, taps[j]), color.z);
+				}
+			}
+
+			if (!m_colorLUT.empty())
+			{
+				const auto lutColor = GetLUTColor(m_colorLUT, density);
+				color = { color.x * lutColor.x, color.y * lutColor.y, color.z * lutColor.z };
+			}
+
+			// Sample light
+			float3P light;
+			if (LIGHT_PASS)
+			{
+				TrilinearTapsP lightTaps;
+				ComputeTrilinearTaps(lightTaps, uvw, m_lightMap.GetWidth(), m_lightMap.GetHeight(), m_lightMap.GetDepth(), 3);
+				const auto pLightMap = reinterpret_cast<const float*>(m_lightMap.GetData());
+				light.x = SampleTrilinear(pLightMap, lightTaps);
+				light.y = SampleTrilinear(pLightMap + 1, lightTaps);
+				light.z = SampleTrilinear(pLightMap + 2, lightTaps);
+
+				// The light map holds the direct light only; the irradiance shares its taps
+				if (cb.HasLightProbes)
+				{
+					const auto pIrradiance = reinterpret_cast<const float*>(m_irradiance.GetData());
+					light.x += SampleTrilinear(pIrradiance, lightTaps);
+					light.y += SampleTrilinear(pIrradiance + 1, lightTaps);
+					light.z += SampleTrilinear(pIrradiance + 2, lightTaps);
+				}
+			}
+			else
+			{
+				// The light rays diverge, so they are cast per lane
+				alignas(64) float lanes[6][CPU_PACKET_WIDTH];
+				pos.x.Store(lanes[0]);
+				pos.y.Store(lanes[1]);
+				pos.z.Store(lanes[2]);
+				for (auto bits = dense.Bits(); bits; bits &= bits - 1)
+				{
+					const auto j = CountTrailingZeros(bits);
+					const auto l = getLight<false>(cb, float3(lanes[0][j], lanes[1][j], lanes[2][j]), lightDir, stats);
+					for (uint8_t k = 0; k < 3; ++k) lanes[k + 3][j] = l[k];
+				}
+				light.x = floatP::Load(lanes[3]);
+				light.y = floatP::Load(lanes[4]);
+				light.z = floatP::Load(lanes[5]);
+			}
+
+			// Update step
+			const auto dDensity = density - prevDensity;
+			const auto factorEv = min(1.0f / 256.0f / abs(dDensity), 2.0f);
+			const auto factorUi = min(1.0f - density, 1.0f);
+			const auto factorTh = 1.0f - transm;
+			newStep = Select(dense, mipStep * max(1.5f * factorEv * factorUi * factorTh, 1.0f), mipStep);
+			prevDensity = Select(dense, density, prevDensity);
+
+			// Opacity scales of the coarser mips as GetOpacityScale()
+			floatP opacityScale = 1.0f;
+			if (numMips > 1)
+			{
+				auto transmMip = 1.0f - density * ABSORPTION;
+				for (uint8_t j = 1; j < numMips; ++j)
+					transmMip = Select(static_cast<float>(1 << j) <= mipScale, transmMip * transmMip, transmMip);
+				const auto opacity = density * ABSORPTION;
+				opacityScale = Select(opacity > 0.0f, (1.0f - transmMip) / opacity, mipScale);
+				opacityScale = Select(mipScale > 1.0f, opacityScale, 1.0f);
+			}
+
+			// Accumulate color
+			const auto opacity = Select(dense, density * (ABSORPTION * opacityScale) * transm, 0.0f);
+			scatter.x += color.x * light.x * opacity;
+			scatter.y += color.y * light.y * opacity;
+			scatter.z += color.z * light.z * opacity;
+			scatter.w += opacity;
+
+			active = AndNot(dense & (transm < ZERO_THRESHOLD), active);
+		}
+
+		// Update position along ray
+		t += Select(sampling, newStep, 0.0f);
+		sampleCount += Select(sampling, 1.0f, 0.0f);
+		active = AndNot((t > tMax) | (numSamples <= sampleCount), active);
+	}
+
+	return i;
+}
+#endif
+
+//--------------------------------------------------------------------------------------
+// CSRayMarchL.hlsl
+//--------------------------------------------------------------------------------------
+void CPURayCaster::rayMarchLKernel(const CBSampleRes& cb, uint32_t x, uint32_t y, uint32_t z, SkipStats& stats)
+{
+	const auto& cbo = m_cbPerObject;
+	const auto rayOrigin = TexelToLocalSpace(x, y, z, m_lightGridSize, cbo.Extent);
+
+	// Transmittance
+	auto shadow = shadowTest(mulPoint(rayOrigin, cbo.World));
+
+	// Light-map space same to volume space (coupled)
+	const auto uvw = LocalToTex3DSpace(rayOrigin, cbo.Extent);
+	const auto density = getSample(uvw).w;
+
+	if (density >= ZERO_THRESHOLD)
+	{
+		if (shadow >= ZERO_THRESHOLD)
+		{
+			const auto localSpaceLightPt = mulDir(m_cbPerFrame.LightPos, cbo.WorldI);
+			const auto rayDir = normalize(localSpaceLightPt);
+			castLightRay(shadow, rayOrigin, rayDir, cb.Step, cb.NumSamples, stats);
+		}
+	}
+
+	const auto lightColor = m_cbPerFrame.LightColor.xyz() * m_cbPerFrame.LightColor.w;
+	auto ambient = m_cbPerFrame.Ambient.xyz() * m_cbPerFrame.Ambient.w;
+	ambient = cb.HasLightProbes ? 0.0f : ambient;	// The light-probe irradiance is baked separately
+
+	m_lightMap(x, y, z) = shadow * lightColor + ambient;
+}
+
+//--------------------------------------------------------------------------------------
+// CSRayMarchLSweep.hlsl
+//--------------------------------------------------------------------------------------
+void CPURayCaster::rayMarchLSweepKernel(const CBSampleRes& cb, uint32_t u, uint32_t v, uint32_t sweepStep)
+{
+	const auto& cbo = m_cbPerObject;
+
+	// Sweep along the dominant axis of the light direction
+	const auto localSpaceLightPt = mulDir(m_cbPerFrame.LightPos, cbo.WorldI);
+	const auto lightDir = normalize(localSpaceLightPt);
+	const auto absDir = abs(lightDir);
+	const uint8_t axis = absDir.x >= absDir.y ? (absDir.x >= absDir.z ? 0 : 2) : (absDir.y >= absDir.z ? 1 : 2);
+	const uint8_t axisU = (axis + 1) % 3, axisV = (axis + 2) % 3;
+
+	uint3 index;
+	index[axis] = lightDir[axis] > 0.0f ? m_lightGridSize[axis] - 1 - sweepStep : sweepStep;
+	index[axisU] = u;
+	index[axisV] = v;
+
+	const auto rayOrigin = TexelToLocalSpace(index.x, index.y, index.z, m_lightGridSize, cbo.Extent);
+
+	// Light-map space same to volume space (coupled)
+	const auto uvw = LocalToTex3DSpace(rayOrigin, cbo.Extent);
+	const auto density = getSample(uvw).w;
+
+	// March one slice toward the light, and carry the transmittance of the previous slice
+	const auto dst = sweepStep & 1;
+	auto transm = 1.0f;
+	if (sweepStep > 0)
+	{
+		auto dist = 2.0f * cbo.Extent[axis] / (m_lightGridSize[axis] * (max)(absDir[axis], 1e-3f));
+		const auto prevPos = rayOrigin + lightDir * dist;
+		const float2 prevUV(prevPos[axisU], prevPos[axisV]);
+		const float2 extentUV(cbo.Extent[axisU], cbo.Extent[axisV]);
+		if (std::abs(prevUV.x) <= extentUV.x && std::abs(prevUV.y) <= extentUV.y)
+			transm = m_transm[dst ^ 1].SampleLevel(prevUV / extentUV * 0.5f + 0.5f);
+		else // Light enters the volume unattenuated, so clip the segment to the volume
+			for (const auto i : { axisU, axisV })
+				if (absDir[i] > 0.0f) dist = (min)(dist, (cbo.Extent[i] - rayOrigin[i] * copysignf(1.0f, lightDir[i])) / absDir[i]);
+
+		// Same attenuation per adaptive step as castLightRay()
+		const auto midDensity = getSample(LocalToTex3DSpace(rayOrigin + lightDir * (dist * 0.5f), cbo.Extent)).w;
+		const auto dDensity = (midDensity - density) * cb.Step / (dist * 0.5f);
+		const auto step = GetStep(dDensity, transm, midDensity, cb.Step);
+		transm *= powf(saturate(1.0f - midDensity * ABSORPTION), dist / step);
+	}
+	m_transm[dst](u, v) = transm;
+
+	// Transmittance
+	auto shadow = shadowTest(mulPoint(rayOrigin, cbo.World));
+	if (density >= ZERO_THRESHOLD) shadow *= transm;
+
+	const auto lightColor = m_cbPerFrame.LightColor.xyz() * m_cbPerFrame.LightColor.w;
+	auto ambient = m_cbPerFrame.Ambient.xyz() * m_cbPerFrame.Ambient.w;
+	ambient = cb.HasLightProbes ? 0.0f : ambient;	// The light-probe irradiance is baked separately
+
+	m_lightMap(index.x, index.y, index.z) = shadow * lightColor + ambient;
+}
+
+//--------------------------------------------------------------------------------------
+// CSIrradiance.hlsl
+//--------------------------------------------------------------------------------------
+void CPURayCaster::irradianceKernel(const CBSampleRes& cb, uint32_t x, uint32_t y, uint32_t z, SkipStats& stats)
+{
+	const auto& cbo = m_cbPerObject;
+
+	// Same texels as the light map, whose space is the volume space (coupled)
+	const auto rayOrigin = TexelToLocalSpace(x, y, z, m_lightGridSize, cbo.Extent);
+	const auto uvw = LocalToTex3DSpace(rayOrigin, cbo.Extent);
+	const auto density = getSample(uvw).w;
+
+	// An approximation to GI effect with light probe, which depends on neither the view nor
+	// the light, so it is only baked when the volume or the SH changes
+	auto ao = 1.0f;
+	float3 irradiance = 0.0f;
+	if (density >= ZERO_THRESHOLD)
+	{
+		auto rayDir = -getDensityGradient(uvw);
+		rayDir = AnyGreater(abs(rayDir), 0.0f) ? rayDir : rayOrigin; // Avoid 0-gradient caused by uniform density field
+		irradiance = getIrradiance(normalize(mulDir(rayDir, cbo.World)));
+		rayDir = normalize(rayDir);
+		castLightRay(ao, rayOrigin, rayDir, cb.Step, cb.NumSamples, stats);
+	}
+
+	m_irradiance(x, y, z) = ao * irradiance;
+}
+
+//--------------------------------------------------------------------------------------
+// PSRayCast.hlsl (LIGHT_PASS == false) and PSRayCastV.hlsl (LIGHT_PASS == true)
+//--------------------------------------------------------------------------------------
+template<bool LIGHT_PASS>
+float4 CPURayCaster::rayCastKernel(const CBSampleRes& cb, uint32_t x, uint32_t y) const
+{
+	const auto& cbo = m_cbPerObject;
+	const auto uv = float2((x + 0.5f) / m_renderTarget.GetWidth(), (y + 0.5f) / m_renderTarget.GetHeight());
+
+	// The point on the near plane
+	float3 rayOrigin;
+	{
+		const auto hPos = mul(float4(uv.x * 2.0f - 1.0f, 1.0f - uv.y * 2.0f, 0.0f, 1.0f), cbo.WorldViewProjI);
+		rayOrigin = hPos.xyz() / hPos.w;
+	}
+	const auto localSpaceEyePt = mulPoint(m_cbPerFrame.EyePos, cbo.WorldI);
+
+	const auto rayDir = normalize(rayOrigin - localSpaceEyePt);
+	if (!ComputeRayOrigin(rayOrigin, rayDir, cbo.BoundsMin, cbo.BoundsMax)) return 0.0f; // Discard
+
+	// Calculate occluded end point
+	const auto pDepth = m_pDepths[DEPTH_MAP];
+	const auto z = pDepth && pDepth->GetWidth() == m_renderTarget.GetWidth() &&
+		pDepth->GetHeight() == m_renderTarget.GetHeight() ? (*pDepth)(x, y) : 1.0f;
+	const auto tMax = getTMax(float3(uv.x * 2.0f - 1.0f, 1.0f - uv.y * 2.0f, z), rayOrigin, rayDir);
+
+	const auto localSpaceLightPt = mulDir(m_cbPerFrame.LightPos, cbo.WorldI);
+	const auto lightDir = normalize(localSpaceLightPt);
+
+	// In-scattered radiance with inverted transmittance
+	float4 scatter = 0.0f;
+
+	SkipStats stats = {};
+	const auto maxMip = getMaxVolumeMip();
+
+	auto t = 0.0f;
+	auto step = cb.Step;
+	auto prevDensity = 0.0f;
+	for (auto i = 0u; i < cb.NumSamples; ++i)
+	{
+		const auto pos = rayOrigin + rayDir * t;
+		if (IsOutOfBounds(pos, cbo.BoundsMin, cbo.BoundsMax)) break;
+		const auto uvw = LocalToTex3DSpace(pos, cbo.Extent);
+
+		// Jump over the samples in the empty macro cell, which would be skipped anyway
+		const auto tSkip = getEmptySpaceSkip(uvw, rayDir);
+		if (tSkip > 0.0f)
+		{
+			const auto n = (max)(static_cast<uint32_t>(ceilf(tSkip / cb.Step)), 1u);
+			step = cb.Step;
+			t += step * n;
+			stats.RaySamplesSkipped += (min)(n, cb.NumSamples - i);
+			i += n - 1;
+			if (t > tMax) break;
+			continue;
+		}
+
+		// Get a sample; once the transmittance drops, coarser mips are sampled with proportionally longer steps
+		const auto transm = 1.0f - scatter.w;
+		const auto mip = GetTransmMip(transm, maxMip);
+		const auto mipStep = cb.Step * static_cast<float>(1 << mip);
+		if (mip == 0) prefetchVolume(pos, rayDir);
+		auto color = getSample(uvw, mip);
+		auto newStep = mipStep;
+		++stats.RaySamples;
+
+		// Skip empty space
+		if (color.w > ZERO_THRESHOLD)
+		{
+			const auto light = getLight<LIGHT_PASS>(cb, pos, lightDir, stats); // Sample light
+
+			// Update step
+			const auto dDensity = color.w - prevDensity;
+			newStep = GetStep(dDensity, transm, color.w, mipStep);
+			step = (step + newStep) * 0.5f;
+			prevDensity = color.w;
+
+			// Accumulate color
+			const auto opacityScale = GetOpacityScale(color.w, mip);
+			const auto rgb = color.xyz() * color.w * light;
+			color = float4(rgb, color.w);
+			scatter += color * (ABSORPTION * opacityScale) * transm;
+
+			if (transm < ZERO_THRESHOLD) break;
+		}
+
+		// Update position along ray
+		step = newStep;
+		t += step;
+		if (t > tMax) break;
+	}
+
+	addSkipStats(stats);
+
+	return float4(scatter.xyz() / (2.0f * PI), scatter.w);
+}
+
+//--------------------------------------------------------------------------------------
+// VSCube.hlsl + PSCube.hlsl: samples the interior faces hit by the pixel ray
+//--------------------------------------------------------------------------------------
+float4 CPURayCaster::renderCubeKernel(uint32_t x, uint32_t y) const
+{
+	const auto& cbo = m_cbPerObject;
+	const auto uv = float2((x + 0.5f) / m_renderTarget.GetWidth(), (y + 0.5f) / m_renderTarget.GetHeight());
+
+	float3 nearPt;
+	{
+		const auto hPos = mul(float4(uv.x * 2.0f - 1.0f, 1.0f - uv.y * 2.0f, 0.0f, 1.0f), cbo.WorldViewProjI);
+		nearPt = hPos.xyz() / hPos.w;
+	}
+	const auto localSpaceEyePt = mulPoint(m_cbPerFrame.EyePos, cbo.WorldI);
+	const auto rayDir = normalize(nearPt - localSpaceEyePt);
+
+	// Front-face culling: the exit point of the bounds is the rasterized interior surface
+	auto tNear = -FLT_MAX_VALUE, tFar = FLT_MAX_VALUE;
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		const auto t0 = (cbo.BoundsMin[i] - localSpaceEyePt[i]) / rayDir[i];
+		const auto t1 = (cbo.BoundsMax[i] - localSpaceEyePt[i]) / rayDir[i];
+		tNear = (max)(tNear, (min)(t0, t1));
+		tFar = (min)(tFar, (max)(t0, t1));
+	}
+	if (tFar < (max)(tNear, 0.0f)) return 0.0f;
+	const auto pos = localSpaceEyePt + rayDir * tFar;
+
+	// CubeCast
+	float2 faceUV;
+	const auto face = GetCubeFaceUV(faceUV, LocalToBoundsSpace(pos, cbo.BoundsMin, cbo.BoundsMax));
+	if (!(m_visibilityMask & (1 << face))) return 0.0f;
+
+	const auto gridSize = m_cubeMap.GetWidth(m_cubeFaceLODs[face]);
+	const auto tx = ComputeLinearTap(faceUV.x, gridSize);
+	const auto ty = ComputeLinearTap(faceUV.y, gridSize);
+	const uint32_t xs[] = { tx.i0, tx.i1, tx.i0, tx.i1 };
+	const uint32_t ys[] = { ty.i0, ty.i0, ty.i1, ty.i1 };
+	const float wb[] = { (1.0f - tx.w) * (1.0f - ty.w), tx.w * (1.0f - ty.w), (1.0f - tx.w) * ty.w, tx.w * ty.w };
+
+	const auto pDepth = m_pDepths[DEPTH_MAP];
+	const auto hasDepth = pDepth && pDepth->GetWidth() == m_renderTarget.GetWidth() &&
+		pDepth->GetHeight() == m_renderTarget.GetHeight();
+	const auto depth = hasDepth ? UnprojectZ((*pDepth)(x, y)) : 0.0f;
+
+	float4 result = 0.0f, color = 0.0f;
+	auto ws = 0.0f;
+	for (uint8_t i = 0; i < 4; ++i)
+	{
+		const auto& sample = m_cubeMap(xs[i], ys[i], face, m_cubeFaceLODs[face]);
+		auto w = wb[i];
+		if (hasDepth)
+		{
+			const auto zi = UnprojectZ(m_cubeDepth(xs[i], ys[i], face, m_cubeFaceLODs[face]));
+			w *= (max)(1.0f - 0.5f * fabsf(depth - zi), 0.0f);
+		}
+
+		result += sample * w;
+		color += sample * wb[i];
+		ws += w;
+	}
+
+	result = ws > 0.0f ? result / ws : color;
+
+	return result.w > 0.0f ? result : 0.0f;
+}
+
+float CPURayCaster::loadDensity(uint32_t x, uint32_t y, uint32_t z) const
+{
+	if (isStreamed()) return m_densityStream.Load(x, y, z);
+	if (isCompressed()) return m_densityBC[0].Load(x, y, z);
+
+	return m_densityOnly ? m_density[0].Load(x, y, z) : m_volume[0].Load(x, y, z).w;
+}
+
+//--------------------------------------------------------------------------------------
+// Look up the color LUT with linear filtering
+//--------------------------------------------------------------------------------------
+float3 CPURayCaster::getLUTColor(float density) const
+{
+	const auto numColors = static_cast<uint32_t>(m_colorLUT.size());
+	const auto x = saturate(density) * (numColors - 1);
+	const auto i0 = static_cast<uint32_t>(x);
+	const auto i1 = (min)(i0 + 1, numColors - 1);
+
+	return lerp(m_colorLUT[i0], m_colorLUT[i1], x - i0);
+}
+
+//--------------------------------------------------------------------------------------
+// Sample density field
+//--------------------------------------------------------------------------------------
+float4 CPURayCaster::getSample(const float3& uvw, uint8_t mip) const
+{
+	auto color = mip == 0 && isStreamed() ? float4(1.0f, 1.0f, 1.0f, m_densityStream.SampleLevel(uvw)) :
+		isCompressed() ? float4(1.0f, 1.0f, 1.0f, m_densityBC[mip].SampleLevel(uvw)) :
+		m_densityOnly ? float4(1.0f, 1.0f, 1.0f, m_density[mip].SampleLevel(uvw)) : m_volume[mip].SampleLevel(uvw);
+	if (!m_colorLUT.empty()) color = float4(color.xyz() * getLUTColor(color.w), color.w);
+
+	return color;
+}
+
+//--------------------------------------------------------------------------------------
+// Get the ray distance to the exit of the macro cell at uvw if it is empty, otherwise 0
+//--------------------------------------------------------------------------------------
+float CPURayCaster::getEmptySpaceSkip(const float3& uvw, const float3& rayDir) const
+{
+	if (!m_emptySpaceSkip) return 0.0f;
+
+	// The last cells overhang the grids of the sizes not in multiples of the cells
+	const uint32_t cellCount[] = { m_macroCells.GetWidth(), m_macroCells.GetHeight(), m_macroCells.GetDepth() };
+	float3 cell, cellScale;
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		cellScale[i] = static_cast<float>(m_gridSize[i]) / g_macroCellSize;
+		cell[i] = fminf(floorf(uvw[i] * cellScale[i]), static_cast<float>(cellCount[i]) - 1.0f);
+	}
+	const auto& minMax = m_macroCells(static_cast<uint32_t>(cell.x), static_cast<uint32_t>(cell.y), static_cast<uint32_t>(cell.z));
+	if (minMax.y >= ZERO_THRESHOLD) return 0.0f;
+
+	// The texture-space ray has the same parameter t as the local-space ray
+	auto t = FLT_MAX_VALUE;
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		const auto uvwDir = rayDir[i] * 0.5f / m_extent[i];
+		const auto bound = (cell[i] + (uvwDir < 0.0f ? 0.0f : 1.0f)) / cellScale[i];
+		t = fminf(fabsf(bound - uvw[i]) / fmaxf(fabsf(uvwDir), 1e-8f), t);
+	}
+
+	return t;
+}
+
+//--------------------------------------------------------------------------------------
+// Sample density field
+//--------------------------------------------------------------------------------------
+float3 CPURayCaster::getDensityGradient(const float3& uvw) const
+{
+	// The direction only; one tap instead of 6
+	if (m_gradientVolume) return m_gradient.SampleLevel(uvw).xyz();
+
+	static const int3 offsets[] =
+	{
+		int3(-1, 0, 0),
+		int3(1, 0, 0),
+		int3(0, -1, 0),
+		int3(0, 1, 0),
+		int3(0, 0, -1),
+		int3(0, 0, 1)
+	};
+
+	const auto streamed = isStreamed();
+	const auto compressed = isCompressed();
+	float q[6];
+	for (uint8_t i = 0; i < 6; ++i)
+		q[i] = streamed ? m_densityStream.SampleLevel(uvw, offsets[i]) :
+			compressed ? m_densityBC[0].SampleLevel(uvw, offsets[i]) :
+			m_densityOnly ? m_density[0].SampleLevel(uvw, offsets[i]) : m_volume[0].SampleLevel(uvw, offsets[i]).w;
+
+	return float3(q[1] - q[0], q[3] - q[2], q[5] - q[4]);
+}
+
+//--------------------------------------------------------------------------------------
+// Get occluded end point
+//--------------------------------------------------------------------------------------
+float CPURayCaster::getTMax(const float3& pos, const float3& rayOrigin, const float3& rayDir) const
+{
+	if (pos.z >= 1.0f) return FLT_MAX_VALUE;
+
+	const auto hpos = mul(float4(pos, 1.0f), m_cbPerObject.WorldViewProjI);
+	const auto t = (hpos.xyz() / hpos.w - rayOrigin) / rayDir;
+
+	return fmaxf(fmaxf(t.x, t.y), t.z);
+}
+
+//--------------------------------------------------------------------------------------
+// Shadow-map test
+//--------------------------------------------------------------------------------------
+float CPURayCaster::shadowTest(const float3& pos) const
+{
+	const auto pShadow = m_pDepths[SHADOW_MAP];
+	if (!pShadow) return 1.0f;
+
+	const auto lsPos = mulPoint(pos, m_cbPerFrame.ShadowViewProj);
+	auto shadowUV = float2(lsPos.x, lsPos.y) * 0.5f + 0.5f;
+	shadowUV.y = 1.0f - shadowUV.y;
+
+	return pShadow->SampleCmpLevelZero(shadowUV, lsPos.z - 0.0027f);
+}
+
+//--------------------------------------------------------------------------------------
+// Get irradiance
+//--------------------------------------------------------------------------------------
+float3 CPURayCaster::getIrradiance(const float3& dir) const
+{
+	return EvaluateSHIrradiance(m_coeffSH, normalize(dir));
+}
+
+//--------------------------------------------------------------------------------------
+// Cast light ray
+//--------------------------------------------------------------------------------------
+void CPURayCaster::castLightRay(float& transm, const float3& rayOrigin, const float3& rayDir,
+	float stepScale, uint32_t numSamples, SkipStats& stats) const
+{
+	const auto maxMip = getMaxVolumeMip();
+
+	auto t = stepScale;
+	auto step = stepScale;
+	auto prevDensity = 0.0f;
+	for (auto i = 0u; i < numSamples; ++i)
+	{
+		const auto pos = rayOrigin + rayDir * t;
+		if (IsOutOfBounds(pos, m_cbPerObject.BoundsMin, m_cbPerObject.BoundsMax)) break;
+		const auto uvw = LocalToTex3DSpace(pos, m_cbPerObject.Extent);
+
+		// Jump over the empty macro cell, whose steps count against the samples as if taken
+		const auto tSkip = getEmptySpaceSkip(uvw, rayDir);
+		if (tSkip > 0.0f)
+		{
+			const auto n = (max)(static_cast<uint32_t>(ceilf(tSkip / step)), 1u);
+			t += (max)(tSkip, step);
+			prevDensity = 0.0f;
+			stats.LightSamplesSkipped += (min)(n, numSamples - i);
+			i += n - 1;
+			continue;
+		}
+
+		// Get a sample along light ray; the far segments sample coarser mips with proportionally longer steps
+		const auto mip = GetDistanceMip(t, maxMip);
+		const auto density = getSample(uvw, mip).w;
+		++stats.LightSamples;
+
+		// Update step
+		const auto dDensity = density - prevDensity;
+		const auto newStep = GetStep(dDensity, transm, density, stepScale * static_cast<float>(1 << mip));
+		step = (step + newStep) * 0.5f;
+		prevDensity = density;
+
+		// Attenuate ray-throughput along light direction
+		transm *= 1.0f - density * (ABSORPTION * GetOpacityScale(density, mip));
+		if (transm < ZERO_THRESHOLD) break;
+
+		// Update position along light ray
+		step = newStep;
+		t += step;
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Get light
+//--------------------------------------------------------------------------------------
+template<bool LIGHT_PASS>
+float3 CPURayCaster::getLight(const CBSampleRes& cb, const float3& pos, const float3& lightDir, SkipStats& stats) const
+{
+	if (LIGHT_PASS)
+	{
+		// The light map holds the direct light only
+		const auto uvw = LocalToTex3DSpace(pos, m_cbPerObject.Extent);
+		auto light = m_lightMap.SampleLevel(uvw);
+		if (cb.HasLightProbes) light += m_irradiance.SampleLevel(uvw);
+
+		return light;
+	}
+
+	const auto& cbo = m_cbPerObject;
+
+	// Transmittance along light ray
+	auto shadow = shadowTest(mulPoint(pos, cbo.World));
+	if (shadow > ZERO_THRESHOLD)
+		castLightRay(shadow, pos, lightDir, cb.LightStep, cb.NumLightSamples, stats);
+
+	// An approximation to GI effect with light probe, baked by bakeIrradiance()
+	const auto lightColor = m_cbPerFrame.LightColor.xyz() * m_cbPerFrame.LightColor.w;
+	auto ambient = m_cbPerFrame.Ambient.xyz() * m_cbPerFrame.Ambient.w;
+	if (cb.HasLightProbes) ambient = m_irradiance.SampleLevel(LocalToTex3DSpace(pos, cbo.Extent));
+
+	return lightColor * shadow + ambient;
+}
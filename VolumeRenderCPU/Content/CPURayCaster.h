@@ -0,0 +1,493 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "CPUTexture.h"
+#include "CPUBlockTexture.h"
+#include "CPUStreamedTexture.h"
+#include "CPUPacket.h"
+#include "CPUThreadPool.h"
+#include "CPUVolumeResampler.h"
+#include "CPUCloudGenerator.h"
+
+// Headless CPU counterpart of RayCaster. It executes the same four render methods
+// (rayMarch, RayMarchL + rayMarchV, rayCastDirect and rayCastVDirect) following the
+// math of RayMarch.hlsli, CSRayMarch.hlsl, CSRayMarchL(Sweep).hlsl and PSRayCast.hlsl, with
+// the thread groups of each dispatch spread over all cores.
+class CPURayCaster
+{
+public:
+	enum RenderFlags : uint8_t
+	{
+		RAY_MARCH_DIRECT	= 0,
+		RAY_MARCH_CUBEMAP	= (1 << 0),
+		SEPARATE_LIGHT_PASS	= (1 << 1),
+		SLICE_SWEEP_LIGHT	= (1 << 2),
+		OPTIMIZED = RAY_MARCH_CUBEMAP | SEPARATE_LIGHT_PASS
+	};
+
+	enum DepthIndex : uint8_t
+	{
+		DEPTH_MAP,
+		SHADOW_MAP,
+
+		NUM_DEPTH
+	};
+
+	// Empty-space skipping statistics of the last Render()
+	struct SkipStats
+	{
+		uint64_t RaySamples;			// View-ray samples taken
+		uint64_t RaySamplesSkipped;		// View-ray samples jumped over in empty macro cells
+		uint64_t LightSamples;			// Light-ray samples taken
+		uint64_t LightSamplesSkipped;	// Base light steps jumped over in empty macro cells
+	};
+
+	// SIMD lane utilization of the packet view-ray marching of the cube map by the last Render(),
+	// all 0 without packets
+	struct LaneStats
+	{
+		uint64_t LaneSteps;			// Packet steps taken times CPU_PACKET_WIDTH
+		uint64_t ActiveLaneSteps;	// Lanes of the steps taken with live rays
+		std::vector<uint64_t> LiveRays;	// Live rays entering each step batch, summed over the wavefront tiles; empty if disabled
+	};
+
+	// Load balance of the work stealing over the cube-map tiles: busy time, tiles and steals per thread
+	using ThreadStats = CPU::ThreadPool::ThreadStats;
+
+	// Viewpoint-keyed cube-map cache, with its hits and misses since SetCubeMapCache()
+	struct CubeCacheStats
+	{
+		uint64_t Hits;		// Frames whose cube map was served from the cache
+		uint64_t Misses;	// Frames whose cube map was marched
+		uint32_t EntryCount;
+		size_t MemorySize;	// Bytes of the face sets cached
+	};
+
+	// Sparse volumes: only the bricks with non-zero densities are stored
+	using VolumeTexture = CPU::BrickedTexture3D<CPU::float4>;
+	using DensityTexture = CPU::BrickedTexture3D<float>;
+	using DensityBCTexture = CPU::BlockTexture3D;	// Block-compressed densities
+	using DensityStreamTexture = CPU::StreamedTexture3D;	// Out-of-core densities
+	using StreamStats = CPU::StreamedTexture3D::Stats;
+	using GradientTexture = CPU::BrickedTexture3D<CPU::snorm4>;	// Gradient directions and magnitudes
+
+	// Memory of the volume bricks
+	struct VolumeStats
+	{
+		uint32_t BrickCount;	// Bricks stored
+		uint32_t PageCount;		// Bricks of the grid
+		size_t MemorySize;		// Bytes of the brick pools (or blocks, or the brick cache) and the page tables of all mips
+		size_t DenseMemorySize;	// Bytes of a dense RGBA volume
+		size_t GradientMemorySize;	// Bytes of the gradient volume, 0 if disabled
+		double PSNR;			// Of the block compression of the finest mip, 0 if uncompressed
+		CPU::uint3 GridSize;
+		CPU::uint3 LightGridSize;
+		CPU::float3 BoundsMin;	// Local-space AABB of the occupied voxels,
+		CPU::float3 BoundsMax;	// the proxy box of the ray marching
+	};
+
+	// Distribution of the densities over the voxels of the grid, gathered by LoadVolumeData() and
+	// InitVolumeData(), or by GetDensityStats() after the volume updates, to tune the ray samples,
+	// the grid size and the zero threshold per asset
+	struct DensityStats
+	{
+		static const uint32_t HistogramBinCount = 16;
+
+		float MinDensity;
+		float MaxDensity;
+		float OccupiedFraction;		// Of the voxels at or above the zero threshold
+		CPU::uint3 OccupiedMin;		// Voxel extents [min, max) of the occupied voxels,
+		CPU::uint3 OccupiedMax;		// both 0 if none
+		float OccupiedRayLength;	// Average occupied voxels along the axis-aligned rays that hit any
+		float UsefulRaySamples;		// Of the view rays over OccupiedRayLength at the current max ray samples
+		uint64_t Histogram[HistogramBinCount];	// Voxels per bin of [MinDensity, MaxDensity]
+	};
+
+	CPURayCaster();
+	virtual ~CPURayCaster();
+
+	// A density-only volume stores 1 channel instead of RGBA and reads as float4(1.0, density),
+	// which suits LoadVolumeData(); InitVolumeData() then drops its colors.
+	// gridSize and lightGridSize are the resolutions of the longest axis, and the other axes follow
+	// the aspect of pVolumeSize (the size of the volume file), or are the same if it is null;
+	// a gridSize of 0 takes pVolumeSize as it is.
+	bool Init(uint32_t gridSize, uint32_t lightGridSize, uint32_t numThreads = 0, bool densityOnly = false,
+		const CPU::uint3* pVolumeSize = nullptr);
+	bool LoadVolumeData(const char* fileName);
+
+	// Replaces the volume data with a procedural cloud of the grid size, read from its cache file in
+	// cacheDir (the current directory if null) if generated before; see CPU::CloudGenerator
+	bool GenerateVolumeData(const CPU::CloudGenerator::Desc& desc, const char* cacheDir = nullptr);
+
+	// Replaces the volume data with another decoded volume file (a frame of a time series),
+	// resampled to the grid; always in core, even if the volume files are streamed
+	void UpdateVolumeData(const CPU::Texture3D<float>& fileSrc);
+
+	// Replaces the densities of the voxels [minCorner, maxCorner) with pDensities, x-major in the
+	// region, e.g. for sculpting or a local simulation; only the mips, macro cells and gradients
+	// over the region are rebuilt, and only the light map of the region and its shadow is re-lit;
+	// GetDensityStats() gathers the statistics of the whole grid again. The colors of RGBA volumes
+	// are kept. Compressed or streamed volumes cannot be updated.
+	bool UpdateVolumeRegion(const CPU::uint3& minCorner, const CPU::uint3& maxCorner, const float* pDensities);
+	bool SetViewport(uint32_t width, uint32_t height);
+	void SetDepthMaps(const CPU::Texture2D<float>* const* depths);
+
+	void InitVolumeData();
+	void SetSH(const CPU::float3* coeffSH);	// Light probe, whose GI is baked apart from the light map
+	void SetColorLUT(const CPU::float3* pColors, uint32_t numColors);
+	void SetMaxSamples(uint32_t maxRaySamples, uint32_t maxLightSamples);
+	void SetEmptySpaceSkip(bool enable);
+	void SetVolumeLOD(bool enable);
+	void SetCubeFaceLOD(bool enable);	// Coarser cube-map levels for the faces seen obliquely
+	void SetGradientVolume(bool enable);	// Gradients of the irradiance baking from 1 tap instead of 6
+	void SetVolumeCompression(bool enable);	// Block-compresses density-only volumes from the next volume data on
+
+	// Streams the finest mip of density-only volume files out of core, through a brick cache of
+	// cacheSizeMB MiB, from the next LoadVolumeData() on; 0 disables it
+	void SetVolumeStreaming(uint32_t cacheSizeMB);
+
+	// Resamples volume files to the grid with filter instead of trilinearly, through the cache files
+	// of CPU::VolumeResampler, from the next LoadVolumeData() on; the frames of UpdateVolumeData()
+	// are filtered in memory, without caching
+	void SetVolumeFilter(CPU::VolumeResampler::Filter filter);
+
+	// Marches the view rays of the cube map as wavefronts instead of fixed packets: the rays of
+	// 32x32-texel tiles are queued in SoA, marched batchSteps steps at a time, and the live ones
+	// are compacted between the batches, so the packets stay full as the rays exit; 0 disables it,
+	// and it has no effect without packets
+	void SetWavefront(uint32_t batchSteps);
+
+	// Reuses the cube-map tiles of the previous frames under small camera motion: a tile is marched
+	// again only if the view rays of its corners have moved by more than tolerance voxels across the
+	// volume since its last march, or in turn every refreshFrames frames (0 for never); changes of
+	// the volume, the lighting or the sampling mark all tiles stale. A tolerance of 0 disables it, and
+	// it is bypassed with a scene depth map, whose contents may change between the frames.
+	void SetCubeMapReuse(float tolerance, uint32_t refreshFrames = 8);
+
+	// Caches the face sets of the cube map marched in whole, keyed by the local-space eye quantized to
+	// cells of cellSize voxels, the visible faces and their levels, the ray samples and the light-pass
+	// mode, so revisited viewpoints are served without marching; the least recently used face sets are
+	// evicted beyond budgetMB MiB, and changes of the volume, the lighting or the world drop them all.
+	// A budget of 0 disables it, and it is bypassed with a scene depth map, which depends on the view.
+	void SetCubeMapCache(uint32_t budgetMB, float cellSize = 2.0f);
+	void SetVolumeWorld(float size, const CPU::float3& pos, const CPU::float3* pPitchYawRoll = nullptr);
+	void SetLight(const CPU::float3& pos, const CPU::float3& color, float intensity);
+	void SetAmbient(const CPU::float3& color, float intensity);
+	void UpdateFrame(const CPU::float4x4& viewProj, const CPU::float4x4& shadowVP, const CPU::float3& eyePt);
+	void Render(uint8_t flags = OPTIMIZED);
+	void RayMarchL(bool sliceSweep = false);
+
+	// The light map is only recomputed when its inputs change. These mark the changes the ray caster
+	// cannot see: new shadow-map contents, or a volume update within the voxels [minCorner, maxCorner),
+	// which re-lights the region and its shadow only.
+	void InvalidateLightMap();
+	void InvalidateLightMap(const CPU::uint3& minCorner, const CPU::uint3& maxCorner);
+
+	// Time-slices the re-lighting of the separate light pass: the stale light-map bricks are refreshed
+	// within budgetUs microseconds per frame (0 for unlimited), bricks in the view frustum and the
+	// longest stale first, while no brick stays stale for more than maxStaleFrames frames.
+	void SetLightMapBudget(uint32_t budgetUs, uint32_t maxStaleFrames = 8);
+
+	const CPU::Texture2D<CPU::float4>& GetRenderTarget() const;
+	const CPU::Texture2DArray<CPU::float4>& GetCubeMap() const;
+	const CPU::Texture3D<CPU::float3>& GetLightMap() const;
+	VolumeStats GetVolumeStats() const;
+	DensityStats GetDensityStats();
+	uint32_t GetRaySampleCount() const;
+	SkipStats GetSkipStats() const;
+	LaneStats GetLaneStats() const;
+	std::vector<ThreadStats> GetTileStats() const;	// Of the last Render(), empty without the cube map
+	StreamStats GetStreamStats() const;	// Of the last Render(), all 0 if not streaming
+	CPU::VolumeResampler::Stats GetResampleStats() const;	// Of the last LoadVolumeData()
+	CPU::CloudGenerator::Stats GetCloudStats() const;		// Of the last GenerateVolumeData()
+	uint32_t GetRelitTexelCount() const;	// Light-map texels re-lit by the last Render()
+	uint32_t GetStaleLightBrickCount() const;	// Light-map bricks still stale after the last Render()
+	uint32_t GetBakedTexelCount() const;	// Irradiance texels baked by the last Render()
+	uint32_t GetReusedTileCount() const;	// Cube-map tiles reused by the last Render()
+	CubeCacheStats GetCubeCacheStats() const;
+	uint32_t GetNumThreads() const;
+	uint8_t GetCubeMapLOD() const;				// Of the whole cube map, which the faces can coarsen
+	uint8_t GetCubeMapLOD(uint8_t face) const;	// Of the face, +X, -X, +Y, -Y, +Z or -Z
+
+	static const uint8_t SHNumCoeffs = 9;
+	static const uint8_t VolumeMipCount = 4;	// VOLUME_MIP_COUNT
+
+protected:
+	struct CBPerFrame
+	{
+		CPU::float3 EyePos;
+		CPU::float4x4 ShadowViewProj;
+		CPU::float3 LightPos;
+		CPU::float4 LightColor;
+		CPU::float4 Ambient;
+	};
+
+	struct CBPerObject
+	{
+		CPU::float4x4 WorldViewProjI;
+		CPU::float4x4 WorldViewProj;
+		CPU::float4x4 WorldI;
+		CPU::float4x4 World;
+		CPU::float3 BoundsMin;	// Local-space AABB of the occupied voxels (CSOccupancy)
+		CPU::float3 BoundsMax;
+		CPU::float3 Extent;	// Local-space half size of the volume box, 1 on the longest axis of the grid
+	};
+
+	// Root constants of the ray-marching passes (cbSampleRes)
+	struct CBSampleRes
+	{
+		uint32_t NumSamples;
+		bool HasLightProbes;
+		uint32_t NumLightSamples;
+		float Step;
+		float LightStep;
+	};
+
+#if CPU_PACKET_WIDTH
+	// SoA state of the view rays of a packet
+	struct RayPacket
+	{
+		CPU::float3P Origin;
+		CPU::float3P Dir;
+		CPU::floatP TMax;
+		CPU::floatP T;
+		CPU::floatP PrevDensity;
+		CPU::floatP SampleCount;	// Samples taken or jumped over
+		CPU::float4P Scatter;		// In-scattered radiance with inverted transmittance
+		CPU::maskP Active;
+	};
+#endif
+
+	// Inputs of the cube-map tiles besides the eye, compared against those of the last frame
+	struct CubeMapInputs
+	{
+		CPU::float4x4	World;
+		uint32_t		NumSamples;
+		uint32_t		TileSize;
+		uint32_t		LightPass;
+	};
+
+	// Face set of the cube map in the viewpoint-keyed cache
+	struct CubeMapEntry
+	{
+		int32_t			Cell[3];		// Of the local-space eye
+		uint32_t		Layout;			// Light-pass mode, visible faces and their levels
+		uint32_t		NumSamples;
+		uint32_t		LastUse;		// m_cubeFrame of the last store or hit
+		CPU::float3		EyePos;			// Local space, of the store
+		std::vector<CPU::float4> Texels;	// Of the visible faces in turn, at their levels
+		std::vector<float> Depths;
+	};
+
+	// Tiles of the visible cube-map faces, face by face in rows
+	struct CubeTiles
+	{
+		uint32_t TileSize;
+		uint8_t FaceCount;
+		uint8_t Faces[6];
+		uint32_t GroupCounts[6];	// Tiles per row of each face
+		uint32_t FirstTiles[7];		// Of each face, and the total at FaceCount
+	};
+
+	// SoA queue of the view rays of a wavefront tile, in the order of RayPacket (without Active)
+	struct RayQueue
+	{
+		static const uint8_t NumChannels = 14;
+
+		uint32_t Capacity;
+		std::vector<float> Channels;		// Channel i of ray j at Channels[Capacity * i + j]
+		std::vector<uint32_t> Texels;		// Cube-map texel (y * size + x) of each ray
+		std::vector<uint32_t> PacketBits;	// Live lanes of each packet after the last batch
+	};
+
+	// Inputs of the light pass, compared against those of the last one
+	struct LightPassInputs
+	{
+		CPU::float4x4	ShadowViewProj;
+		CPU::float4x4	World;
+		CPU::float4		LightColor;
+		CPU::float4		Ambient;
+		CPU::float3		LightPt;
+		uint32_t		NumSamples;
+	};
+
+	CBSampleRes getSampleRes(uint32_t numSamples, uint32_t numLightSamples) const;
+	void resetSkipStats();
+	void addSkipStats(const SkipStats& stats) const;
+	void addLaneStats(uint64_t laneSteps, uint64_t activeLaneSteps) const;
+
+	template<typename FUNC>
+	void setVolumeData(const FUNC& texelFunc);
+	void resampleVolumeData(const CPU::Texture3D<float>& fileSrc);
+	bool loadVolumeData(const char* fileName, CPU::Texture3D<float>& fileSrc);
+	bool loadVolumeStream(const char* fileName);
+	bool isCompressed() const;
+	bool isStreamed() const;
+	void prefetchVolume(const CPU::float3& pos, const CPU::float3& rayDir) const;
+#if CPU_PACKET_WIDTH
+	void prefetchVolume(const CPU::float3P& pos, const CPU::float3P& rayDir, const CPU::maskP& lanes) const;
+#endif
+	uint8_t getMaxVolumeMip() const;
+	void buildMacroCells();
+	void buildMacroCells(const CPU::uint3& cellMin, const CPU::uint3& cellMax);
+	void buildOccupancy();
+	void buildDensityStats();
+	void buildGradients();
+	void updateGradients(const CPU::uint3& minCorner, const CPU::uint3& maxCorner);
+	void bakeIrradiance();
+	void getLightRegion(CPU::uint3& regionMin, CPU::uint3& regionMax) const;
+	void markLightBricks(const CPU::uint3& regionMin, const CPU::uint3& regionMax);
+	void sortLightBricks(std::vector<uint32_t>& bricks) const;
+	uint32_t relightBricks(const uint32_t* pBricks, uint32_t numBricks);
+	void rayMarchLSweep();
+	void rayMarch();
+	void rayMarchV();
+	template<bool LIGHT_PASS>
+	void rayMarchTiles(const CBSampleRes& cb);
+	void sortCubeTiles(const CubeTiles& tiles);
+	uint8_t getCubeTile(const CubeTiles& tiles, uint32_t tileId, uint32_t& x, uint32_t& y) const;
+	void updateCubeMapInputs(uint32_t tileSize, bool lightPass);
+	void selectCubeTiles(const CubeTiles& tiles);
+	void getCubeMapKey(CubeMapEntry& entry, bool lightPass) const;
+	bool fetchCubeMap(const CubeTiles& tiles, bool lightPass);
+	void storeCubeMap(const CubeTiles& tiles, bool lightPass);
+	void renderCube();
+	void rayCastDirect();
+	void rayCastVDirect();
+
+	bool initCubeRay(CPU::float3& rayOrigin, CPU::float3& rayDir, float& tMax, uint32_t x, uint32_t y, uint8_t face);
+
+	// Per-thread kernels
+	template<bool LIGHT_PASS>
+	void rayMarchKernel(const CBSampleRes& cb, uint32_t x, uint32_t y, uint8_t face);
+#if CPU_PACKET_WIDTH
+	template<bool LIGHT_PASS>
+	void rayMarchPacket(const CBSampleRes& cb, uint32_t x, uint32_t y, uint8_t face);
+	template<bool LIGHT_PASS>
+	void rayMarchWavefront(const CBSampleRes& cb, uint32_t x, uint32_t y, uint8_t face, RayQueue& queue);
+	template<bool LIGHT_PASS>
+	uint32_t marchRayPacket(RayPacket& packet, const CBSampleRes& cb, uint32_t maxSteps, SkipStats& stats,
+		uint64_t& activeLaneSteps);
+#endif
+	void rayMarchLKernel(const CBSampleRes& cb, uint32_t x, uint32_t y, uint32_t z, SkipStats& stats);
+	void rayMarchLSweepKernel(const CBSampleRes& cb, uint32_t u, uint32_t v, uint32_t sweepStep);
+	void irradianceKernel(const CBSampleRes& cb, uint32_t x, uint32_t y, uint32_t z, SkipStats& stats);
+	template<bool LIGHT_PASS>
+	CPU::float4 rayCastKernel(const CBSampleRes& cb, uint32_t x, uint32_t y) const;
+	CPU::float4 renderCubeKernel(uint32_t x, uint32_t y) const;
+
+	float loadDensity(uint32_t x, uint32_t y, uint32_t z) const;
+	CPU::snorm4 computeGradient(uint32_t x, uint32_t y, uint32_t z) const;
+
+	// Ported from RayMarch.hlsli
+	CPU::float3 getLUTColor(float density) const;
+	CPU::float4 getSample(const CPU::float3& uvw, uint8_t mip = 0) const;
+	float getEmptySpaceSkip(const CPU::float3& uvw, const CPU::float3& rayDir) const;
+	CPU::float3 getDensityGradient(const CPU::float3& uvw) const;
+	float getTMax(const CPU::float3& pos, const CPU::float3& rayOrigin, const CPU::float3& rayDir) const;
+	float shadowTest(const CPU::float3& pos) const;
+	CPU::float3 getIrradiance(const CPU::float3& dir) const;
+	void castLightRay(float& transm, const CPU::float3& rayOrigin, const CPU::float3& rayDir,
+		float stepScale, uint32_t numSamples, SkipStats& stats) const;
+	template<bool LIGHT_PASS>
+	CPU::float3 getLight(const CBSampleRes& cb, const CPU::float3& pos, const CPU::float3& lightDir, SkipStats& stats) const;
+
+	std::unique_ptr<CPU::ThreadPool> m_threadPool;
+	std::unique_ptr<CPU::VolumeResampler> m_resampler;
+	std::unique_ptr<CPU::CloudGenerator> m_cloudGenerator;
+
+	VolumeTexture						m_volume[VolumeMipCount];
+	DensityTexture						m_density[VolumeMipCount];	// Replaces m_volume if density only
+	DensityBCTexture					m_densityBC[VolumeMipCount];	// Replaces m_density if compressed
+	DensityStreamTexture				m_densityStream;	// Replaces m_density[0] if streamed
+	CPU::Texture3D<CPU::float2>			m_macroCells;	// Min/max densities per macro cell
+	GradientTexture						m_gradient;		// CSGradient
+	CPU::Texture2DArray<CPU::float4>	m_cubeMap;
+	CPU::Texture2DArray<float>			m_cubeDepth;
+	CPU::Texture3D<CPU::float3>			m_lightMap;
+	CPU::Texture3D<CPU::float3>			m_irradiance;	// AO-weighted light-probe irradiance (CSIrradiance)
+	CPU::Texture2D<float>				m_transm[2];
+	CPU::Texture2D<CPU::float4>			m_renderTarget;
+
+	const CPU::Texture2D<float>* m_pDepths[NUM_DEPTH];
+	CPU::float3				m_coeffSH[SHNumCoeffs];
+	std::vector<CPU::float3> m_colorLUT;
+	bool					m_hasSH;
+	bool					m_densityOnly;
+	bool					m_emptySpaceSkip;
+	bool					m_volumeLOD;
+	bool					m_gradientVolume;
+	bool					m_volumeCompression;
+	uint32_t				m_streamCacheSize;	// MiB, 0 if not streaming
+	CPU::VolumeResampler::Filter m_volumeFilter;
+	uint32_t				m_wavefrontSteps;	// Steps per batch, 0 if disabled
+	bool					m_lightMapSweep;	// Slice sweeping computed the light map
+	bool					m_lightMapLit;		// The light map has been lit once since Init()
+	bool					m_irradianceDirty;	// The volume, its transform or the SH changed since the last baking
+
+	LightPassInputs			m_lightPassInputs;
+	CPU::float3				m_lightDirtyMin;	// Texture-space box of the volume changes since the last light pass,
+	CPU::float3				m_lightDirtyMax;	// empty if min > max
+	std::vector<uint32_t>	m_lightBrickStamps;	// Frame since which each light-map brick is stale, or UINT32_MAX
+
+	CBPerFrame				m_cbPerFrame;
+	CBPerObject				m_cbPerObject;
+
+	CPU::uint3				m_gridSize;
+	CPU::uint3				m_lightGridSize;
+	CPU::uint3				m_lightBrickCount;	// Light-map bricks per dimension
+	uint32_t				m_raySampleCount;
+	uint32_t				m_visibilityMask;
+	uint32_t				m_maxRaySamples;
+	uint32_t				m_maxLightSamples;
+	uint32_t				m_relitTexelCount;
+	uint32_t				m_bakedTexelCount;
+	uint32_t				m_staleLightBrickCount;
+	uint32_t				m_lightFrame;
+	uint32_t				m_lightMapBudget;	// Microseconds per frame, 0 for unlimited
+	uint32_t				m_maxLightStaleFrames;
+
+	uint8_t					m_cubeMapLOD;
+	uint8_t					m_cubeFaceLODs[6];
+	bool					m_cubeFaceLOD;		// Per-face levels by the footprints of the faces
+	uint8_t					m_numVolumeMips;
+
+	mutable std::atomic<uint64_t> m_skipStats[4];	// Same order as SkipStats
+	mutable std::atomic<uint64_t> m_laneStats[2];	// Same order as LaneStats
+	std::vector<uint64_t>	m_liveRays;
+	std::mutex				m_liveRayMutex;
+	std::vector<RayQueue>	m_rayQueues;	// Per thread
+	std::vector<uint32_t>	m_tileOrder;	// Cube-map tiles of the last ray marching, the most expensive first
+	std::vector<float>		m_tileCosts;	// Microseconds of each tile in the last ray marching, or its estimate
+	uint64_t				m_tileLayout;	// Grid size, tile size and visible faces of m_tileCosts
+	std::vector<ThreadStats> m_tileStats;
+
+	float					m_reuseTolerance;	// Voxels, 0 if the cube-map tiles are not reused
+	uint32_t				m_reuseRefreshFrames;
+	uint32_t				m_reusedTileCount;
+	uint32_t				m_cubeFrame;
+	bool					m_cubeMapDirty;		// All cube-map tiles are stale
+	CubeMapInputs			m_cubeMapInputs;
+	uint8_t					m_cubeTileLODs[6];	// Levels of m_cubeTileEyes per face
+	std::vector<CPU::float4> m_cubeTileEyes[6];	// Local-space eye of the last march of each tile, w = 0 if none
+
+	size_t					m_cubeCacheBudget;		// Bytes, 0 if the cube maps are not cached
+	float					m_cubeCacheCellSize;	// Voxels
+	std::vector<CubeMapEntry> m_cubeMapCache;
+	uint64_t				m_cubeCacheHits;
+	uint64_t				m_cubeCacheMisses;
+
+	CPU::float3				m_boundsMin;	// Occupancy bounds in the local space
+	CPU::float3				m_boundsMax;
+	DensityStats			m_densityStats;
+	bool					m_densityStatsDirty;	// The volume has been updated since the last gathering
+	CPU::float3				m_extent;		// Local-space half size of the volume box, 1 on the longest axis
+
+	CPU::float3				m_lightPt;
+	CPU::float4				m_lightColor;
+	CPU::float4				m_ambient;
+	CPU::float4x4			m_volumeWorld;
+};
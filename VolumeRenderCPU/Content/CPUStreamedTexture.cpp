@@ -0,0 +1,534 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "CPUStreamedTexture.h"
+#include "CPUThreadPool.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace CPU;
+
+#define BRICK_FILE_MAGIC	0x4b524256 // "VBRK"
+#define BRICK_FILE_VERSION	1
+
+// The page table follows the header, and the bricks of the slots 1 to BrickCount follow
+// at DataOffset, aligned to the pages of the mapping
+struct BrickFileHeader
+{
+	uint32_t Magic;
+	uint32_t Version;
+	uint32_t Width;
+	uint32_t Height;
+	uint32_t Depth;
+	uint32_t BrickSize;
+	uint32_t BrickCount;
+	uint32_t Reserved;
+	uint64_t DataOffset;
+};
+
+enum PageState : uint8_t
+{
+	PAGE_IDLE,
+	PAGE_REQUESTED,	// Queued for the background thread
+	PAGE_LOADING
+};
+
+static const size_t g_brickBytes = sizeof(float) * StreamedTexture3D::BrickTexelCount;
+static const uint64_t g_dataAlignment = 65536;
+
+StreamedTexture3D::StreamedTexture3D() :
+	m_quit(false),
+	m_hits(),
+	m_misses(0),
+	m_prefetches(0),
+	m_stallTime(0),
+	m_pMapping(nullptr),
+	m_mappingSize(0),
+	m_dataOffset(0),
+#ifdef _WIN32
+	m_hFile(INVALID_HANDLE_VALUE),
+	m_hMapping(nullptr),
+#else
+	m_file(-1),
+#endif
+	m_frame(0),
+	m_brickCount(0),
+	m_width(0),
+	m_height(0),
+	m_depth(0),
+	m_pageTableWidth(0),
+	m_pageTableHeight(0),
+	m_pageTableDepth(0)
+{
+}
+
+StreamedTexture3D::~StreamedTexture3D()
+{
+	Close();
+}
+
+bool StreamedTexture3D::WriteBrickFile(const char* fileName, const uint3& size, ThreadPool& threadPool,
+	const SlabFunc& loadSlab, const TexelFunc& texelFunc)
+{
+	ofstream file(fileName, ios::binary | ios::trunc);
+	XUSG_M_RETURN(!file, cerr, "Failed to create the brick file.", false);
+
+	const uint3 pageTableSize(XUSG_DIV_UP(size.x, BrickSize), XUSG_DIV_UP(size.y, BrickSize), XUSG_DIV_UP(size.z, BrickSize));
+	const auto layerPageCount = pageTableSize.x * pageTableSize.y;
+	vector<uint32_t> pageTable(static_cast<size_t>(layerPageCount) * pageTableSize.z, 0);
+
+	BrickFileHeader header = {};
+	header.Magic = BRICK_FILE_MAGIC;
+	header.Version = BRICK_FILE_VERSION;
+	header.Width = size.x;
+	header.Height = size.y;
+	header.Depth = size.z;
+	header.BrickSize = BrickSize;
+	header.DataOffset = XUSG_DIV_UP(sizeof(header) + sizeof(uint32_t) * pageTable.size(), g_dataAlignment) * g_dataAlignment;
+	file.seekp(static_cast<streamoff>(header.DataOffset));
+
+	// Including the high-side apron, clamped to the grid
+	const uint3 last(size.x - 1, size.y - 1, size.z - 1);
+	vector<vector<float>> bricks(layerPageCount);
+	for (auto bz = 0u; bz < pageTableSize.z; ++bz)
+	{
+		XUSG_N_RETURN(loadSlab(bz * BrickSize, (std::min)(bz * BrickSize + BrickSize, last.z)), false);
+		threadPool.Dispatch(layerPageCount, [&](uint32_t i, uint32_t)
+		{
+			const auto bx = i % pageTableSize.x, by = i / pageTableSize.x;
+			auto& brick = bricks[i];
+			brick.resize(BrickTexelCount);
+			auto isEmpty = true;
+			auto pTexel = brick.data();
+			for (auto z = 0u; z < PaddedBrickSize; ++z)
+				for (auto y = 0u; y < PaddedBrickSize; ++y)
+					for (auto x = 0u; x < PaddedBrickSize; ++x)
+					{
+						*pTexel = texelFunc((std::min)(bx * BrickSize + x, last.x), (std::min)(by * BrickSize + y, last.y),
+							(std::min)(bz * BrickSize + z, last.z));
+						isEmpty = isEmpty && *pTexel == 0.0f;
+						++pTexel;
+					}
+
+			if (isEmpty) brick.clear();
+		});
+
+		// In the order of the pages
+		for (auto i = 0u; i < layerPageCount; ++i)
+		{
+			if (bricks[i].empty()) continue;
+			pageTable[static_cast<size_t>(layerPageCount) * bz + i] = ++header.BrickCount;
+			file.write(reinterpret_cast<const char*>(bricks[i].data()), g_brickBytes);
+		}
+	}
+
+	file.seekp(0);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(pageTable.data()), sizeof(uint32_t) * pageTable.size());
+	XUSG_M_RETURN(!file, cerr, "Failed to write the brick file.", false);
+
+	return true;
+}
+
+bool StreamedTexture3D::Open(const char* fileName, size_t cacheSize)
+{
+	Close();
+
+	if (!mapFile(fileName))
+	{
+		Close();
+		return false;
+	}
+
+	BrickFileHeader header;
+	memcpy(&header, m_pMapping, sizeof(header));
+	m_width = header.Width;
+	m_height = header.Height;
+	m_depth = header.Depth;
+	m_pageTableWidth = XUSG_DIV_UP(m_width, BrickSize);
+	m_pageTableHeight = XUSG_DIV_UP(m_height, BrickSize);
+	m_pageTableDepth = XUSG_DIV_UP(m_depth, BrickSize);
+	m_brickCount = header.BrickCount;
+	m_dataOffset = header.DataOffset;
+	const auto pageCount = static_cast<size_t>(m_pageTableWidth) * m_pageTableHeight * m_pageTableDepth;
+	if (header.Magic != BRICK_FILE_MAGIC || header.Version != BRICK_FILE_VERSION || header.BrickSize != BrickSize ||
+		pageCount == 0 || sizeof(header) + sizeof(uint32_t) * pageCount > m_dataOffset ||
+		m_dataOffset + g_brickBytes * m_brickCount > m_mappingSize)
+	{
+		Close();
+		return false;
+	}
+
+	const auto pPageTable = reinterpret_cast<const uint32_t*>(m_pMapping + sizeof(header));
+	m_pageTable.assign(pPageTable, pPageTable + pageCount);
+	m_residency.reset(new atomic<uint32_t>[pageCount]);
+	m_pageStates.reset(new atomic<uint8_t>[pageCount]);
+	for (size_t i = 0; i < pageCount; ++i)
+	{
+		m_residency[i].store(0, memory_order_relaxed);
+		m_pageStates[i].store(PAGE_IDLE, memory_order_relaxed);
+	}
+
+	// Slot 0 is the zero brick of the empty pages
+	const auto slotCount = static_cast<uint32_t>((std::max)(cacheSize / g_brickBytes, static_cast<size_t>(1)));
+	m_pool.assign(static_cast<size_t>(slotCount + 1) * BrickTexelCount, 0.0f);
+	m_slotPages.assign(slotCount + 1, UINT32_MAX);
+	m_lastUse.reset(new atomic<uint32_t>[slotCount + 1]);
+	m_freeSlots.resize(slotCount);
+	for (auto i = 0u; i < slotCount; ++i)
+	{
+		m_lastUse[i + 1].store(0, memory_order_relaxed);
+		m_freeSlots[i] = slotCount - i;
+	}
+	m_frame = 0;
+	ResetStats();
+
+	m_quit = false;
+	m_loader = thread(&StreamedTexture3D::loaderMain, this);
+
+	return true;
+}
+
+// Maps the whole file read-only
+bool StreamedTexture3D::mapFile(const char* fileName)
+{
+#ifdef _WIN32
+	m_hFile = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+	XUSG_N_RETURN(m_hFile != INVALID_HANDLE_VALUE, false);
+	LARGE_INTEGER fileSize;
+	XUSG_N_RETURN(GetFileSizeEx(m_hFile, &fileSize) && fileSize.QuadPart >= static_cast<LONGLONG>(sizeof(BrickFileHeader)), false);
+	m_hMapping = CreateFileMappingA(m_hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	XUSG_N_RETURN(m_hMapping, false);
+	m_pMapping = static_cast<const uint8_t*>(MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0));
+	XUSG_N_RETURN(m_pMapping, false);
+	m_mappingSize = static_cast<size_t>(fileSize.QuadPart);
+#else
+	m_file = open(fileName, O_RDONLY);
+	XUSG_N_RETURN(m_file >= 0, false);
+	struct stat fileStat;
+	XUSG_N_RETURN(fstat(m_file, &fileStat) == 0 && fileStat.st_size >= static_cast<off_t>(sizeof(BrickFileHeader)), false);
+	const auto pMapping = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_SHARED, m_file, 0);
+	XUSG_N_RETURN(pMapping != MAP_FAILED, false);
+	madvise(pMapping, static_cast<size_t>(fileStat.st_size), MADV_RANDOM);
+	m_pMapping = static_cast<const uint8_t*>(pMapping);
+	m_mappingSize = static_cast<size_t>(fileStat.st_size);
+#endif
+
+	return true;
+}
+
+void StreamedTexture3D::Close()
+{
+	if (m_loader.joinable())
+	{
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_quit = true;
+		}
+		m_requestCond.notify_all();
+		m_loader.join();
+	}
+
+#ifdef _WIN32
+	if (m_pMapping) UnmapViewOfFile(m_pMapping);
+	if (m_hMapping) CloseHandle(m_hMapping);
+	if (m_hFile != INVALID_HANDLE_VALUE) CloseHandle(m_hFile);
+	m_hMapping = nullptr;
+	m_hFile = INVALID_HANDLE_VALUE;
+#else
+	if (m_pMapping) munmap(const_cast<uint8_t*>(m_pMapping), m_mappingSize);
+	if (m_file >= 0) close(m_file);
+	m_file = -1;
+#endif
+	m_pMapping = nullptr;
+	m_mappingSize = 0;
+
+	m_pageTable.clear();
+	m_pool.clear();
+	m_slotPages.clear();
+	m_freeSlots.clear();
+	m_requests.clear();
+	m_pendingRequests.clear();
+	m_residency.reset();
+	m_lastUse.reset();
+	m_pageStates.reset();
+	m_brickCount = 0;
+	m_width = m_height = m_depth = 0;
+	m_pageTableWidth = m_pageTableHeight = m_pageTableDepth = 0;
+}
+
+float StreamedTexture3D::Load(uint32_t x, uint32_t y, uint32_t z) const
+{
+	const auto pBrick = getBrick(static_cast<uint32_t>(pageIndex(x / BrickSize, y / BrickSize, z / BrickSize)));
+
+	return pBrick[(PaddedBrickSize * (z % BrickSize) + y % BrickSize) * PaddedBrickSize + x % BrickSize];
+}
+
+float StreamedTexture3D::SampleLevel(const float3& uvw) const
+{
+	const auto tx = ComputeLinearTap(uvw.x, m_width);
+	const auto ty = ComputeLinearTap(uvw.y, m_height);
+	const auto tz = ComputeLinearTap(uvw.z, m_depth);
+
+	return sample(tx, ty, tz);
+}
+
+float StreamedTexture3D::SampleLevel(const float3& uvw, const int3& offset) const
+{
+	const auto tx = ComputeLinearTap(uvw.x + offset.x / static_cast<float>(m_width), m_width);
+	const auto ty = ComputeLinearTap(uvw.y + offset.y / static_cast<float>(m_height), m_height);
+	const auto tz = ComputeLinearTap(uvw.z + offset.z / static_cast<float>(m_depth), m_depth);
+
+	return sample(tx, ty, tz);
+}
+
+void StreamedTexture3D::Prefetch(const float3& uvw) const
+{
+	const auto tx = ComputeLinearTap(uvw.x, m_width);
+	const auto ty = ComputeLinearTap(uvw.y, m_height);
+	const auto tz = ComputeLinearTap(uvw.z, m_depth);
+	const auto page = static_cast<uint32_t>(pageIndex(tx.i0 / BrickSize, ty.i0 / BrickSize, tz.i0 / BrickSize));
+	if (m_pageTable[page] == 0 || m_residency[page].load(memory_order_relaxed) != 0) return;
+
+	// Only the first request of a page is queued
+	uint8_t state = PAGE_IDLE;
+	if (!m_pageStates[page].compare_exchange_strong(state, PAGE_REQUESTED, memory_order_relaxed)) return;
+
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_requests.push_back(page);
+	}
+	m_requestCond.notify_one();
+}
+
+uint32_t StreamedTexture3D::ResolveBricks(const uint32_t* pPages, uint32_t laneCount, uint32_t laneBits, int32_t* pOffsets) const
+{
+	auto fallbackBits = 0u;
+	for (auto i = 0u; i < laneCount; ++i)
+	{
+		pOffsets[i] = 0;
+		if (!(laneBits & (1 << i))) continue;
+
+		const auto page = pPages[i];
+		auto slot = 0u;
+		if (m_pageTable[page] != 0)
+		{
+			slot = m_residency[page].load(memory_order_acquire);
+			if (slot == 0)
+			{
+				m_misses.fetch_add(1, memory_order_relaxed);
+				slot = loadBrick(page, false);
+				if (slot == 0) fallbackBits |= 1 << i;
+			}
+			else
+			{
+				if (m_lastUse[slot].load(memory_order_relaxed) != m_frame.load(memory_order_relaxed))
+					m_lastUse[slot].store(m_frame.load(memory_order_relaxed), memory_order_relaxed);
+				getShard(m_hits).Value.fetch_add(1, memory_order_relaxed);
+			}
+		}
+		else getShard(m_hits).Value.fetch_add(1, memory_order_relaxed);
+
+		pOffsets[i] = static_cast<int32_t>(slot * BrickTexelCount);
+	}
+
+	return fallbackBits;
+}
+
+void StreamedTexture3D::Update()
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		const auto frame = m_frame.load(memory_order_relaxed) + 1;
+		m_frame.store(frame, memory_order_relaxed);
+
+		// Evict the least recently used bricks; the slots being loaded by the background
+		// thread are neither free nor resident yet
+		const auto slotCount = static_cast<uint32_t>(m_slotPages.size()) - 1;
+		const auto numFreeSlots = static_cast<uint32_t>(m_pendingRequests.size()) + slotCount / 8;
+		if (numFreeSlots > m_freeSlots.size())
+		{
+			vector<uint32_t> slots;
+			slots.reserve(slotCount);
+			for (auto i = 1u; i <= slotCount; ++i) if (m_slotPages[i] != UINT32_MAX) slots.push_back(i);
+
+			const auto numEvictions = (std::min)(numFreeSlots - static_cast<uint32_t>(m_freeSlots.size()),
+				static_cast<uint32_t>(slots.size()));
+			const auto olderUse = [this](uint32_t a, uint32_t b)
+			{
+				return m_lastUse[a].load(memory_order_relaxed) < m_lastUse[b].load(memory_order_relaxed);
+			};
+			if (numEvictions < slots.size()) nth_element(slots.begin(), slots.begin() + numEvictions, slots.end(), olderUse);
+			for (auto i = 0u; i < numEvictions; ++i)
+			{
+				const auto slot = slots[i];
+				m_residency[m_slotPages[slot]].store(0, memory_order_relaxed);
+				m_slotPages[slot] = UINT32_MAX;
+				m_freeSlots.push_back(slot);
+			}
+		}
+
+		m_requests.insert(m_requests.end(), m_pendingRequests.begin(), m_pendingRequests.end());
+		m_pendingRequests.clear();
+	}
+	m_requestCond.notify_one();
+}
+
+StreamedTexture3D::Stats StreamedTexture3D::GetStats() const
+{
+	Stats stats = {};
+	for (const auto& hits : m_hits) stats.Hits += hits.Value.load(memory_order_relaxed);
+	stats.Misses = m_misses.load(memory_order_relaxed);
+	stats.Prefetches = m_prefetches.load(memory_order_relaxed);
+	stats.StallTime = m_stallTime.load(memory_order_relaxed) / 1000000.0;
+
+	lock_guard<mutex> lock(m_mutex);
+	stats.SlotCount = m_slotPages.empty() ? 0 : static_cast<uint32_t>(m_slotPages.size()) - 1;
+	stats.ResidentCount = static_cast<uint32_t>(count_if(m_slotPages.cbegin(), m_slotPages.cend(),
+		[](uint32_t page) { return page != UINT32_MAX; }));
+
+	return stats;
+}
+
+void StreamedTexture3D::ResetStats()
+{
+	for (auto& hits : m_hits) hits.Value.store(0, memory_order_relaxed);
+	m_misses.store(0, memory_order_relaxed);
+	m_prefetches.store(0, memory_order_relaxed);
+	m_stallTime.store(0, memory_order_relaxed);
+}
+
+size_t StreamedTexture3D::GetMemorySize() const
+{
+	const auto slotCount = m_slotPages.size();
+
+	return sizeof(float) * m_pool.size() + (sizeof(uint32_t) * 2 + sizeof(uint8_t)) * m_pageTable.size() +
+		(sizeof(uint32_t) * 2) * slotCount;
+}
+
+const float* StreamedTexture3D::getBrick(uint32_t page) const
+{
+	if (m_pageTable[page] == 0)
+	{
+		getShard(m_hits).Value.fetch_add(1, memory_order_relaxed);
+
+		return m_pool.data();
+	}
+
+	auto slot = m_residency[page].load(memory_order_acquire);
+	if (slot == 0)
+	{
+		m_misses.fetch_add(1, memory_order_relaxed);
+		slot = loadBrick(page, false);
+
+		return slot ? &m_pool[static_cast<size_t>(slot) * BrickTexelCount] : getMappedBrick(page);
+	}
+
+	const auto frame = m_frame.load(memory_order_relaxed);
+	if (m_lastUse[slot].load(memory_order_relaxed) != frame) m_lastUse[slot].store(frame, memory_order_relaxed);
+	getShard(m_hits).Value.fetch_add(1, memory_order_relaxed);
+
+	return &m_pool[static_cast<size_t>(slot) * BrickTexelCount];
+}
+
+const float* StreamedTexture3D::getMappedBrick(uint32_t page) const
+{
+	return reinterpret_cast<const float*>(m_pMapping + m_dataOffset + g_brickBytes * (m_pageTable[page] - 1));
+}
+
+// Returns the slot of the brick, or 0 if it is being loaded by another thread or no slot
+// is free, where the requests of the background thread are left for Update()
+uint32_t StreamedTexture3D::loadBrick(uint32_t page, bool prefetch) const
+{
+	auto state = m_pageStates[page].load(memory_order_relaxed);
+	do if (state == PAGE_LOADING) return 0;
+	while (!m_pageStates[page].compare_exchange_weak(state, PAGE_LOADING, memory_order_acquire));
+
+	auto slot = m_residency[page].load(memory_order_acquire);
+	if (slot == 0)
+	{
+		{
+			lock_guard<mutex> lock(m_mutex);
+			if (m_freeSlots.empty())
+			{
+				if (prefetch) m_pendingRequests.push_back(page);
+				m_pageStates[page].store(prefetch ? static_cast<uint8_t>(PAGE_REQUESTED) : state, memory_order_release);
+
+				return 0;
+			}
+			slot = m_freeSlots.back();
+			m_freeSlots.pop_back();
+		}
+
+		// Page faults of the mapping happen here
+		const auto timeStart = chrono::high_resolution_clock::now();
+		memcpy(&m_pool[static_cast<size_t>(slot) * BrickTexelCount], getMappedBrick(page), g_brickBytes);
+		m_lastUse[slot].store(m_frame.load(memory_order_relaxed), memory_order_relaxed);
+		{
+			lock_guard<mutex> lock(m_mutex);
+			m_slotPages[slot] = page;
+		}
+		m_residency[page].store(slot, memory_order_release);
+
+		if (prefetch) m_prefetches.fetch_add(1, memory_order_relaxed);
+		else m_stallTime.fetch_add(static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(
+			chrono::high_resolution_clock::now() - timeStart).count()), memory_order_relaxed);
+	}
+	m_pageStates[page].store(PAGE_IDLE, memory_order_release);
+
+	return slot;
+}
+
+// Same interpolation order as Texture3D::sample()
+float StreamedTexture3D::sample(const LinearTap& tx, const LinearTap& ty, const LinearTap& tz) const
+{
+	const auto pBrick = getBrick(static_cast<uint32_t>(pageIndex(tx.i0 / BrickSize, ty.i0 / BrickSize, tz.i0 / BrickSize)));
+	const auto x0 = tx.i0 % BrickSize, x1 = x0 + tx.i1 - tx.i0;
+	const auto y0 = ty.i0 % BrickSize, y1 = y0 + ty.i1 - ty.i0;
+	const auto z0 = tz.i0 % BrickSize, z1 = z0 + tz.i1 - tz.i0;
+	const auto s = [pBrick](uint32_t x, uint32_t y, uint32_t z) { return pBrick[(PaddedBrickSize * z + y) * PaddedBrickSize + x]; };
+
+	const auto c00 = lerp(s(x0, y0, z0), s(x1, y0, z0), tx.w);
+	const auto c10 = lerp(s(x0, y1, z0), s(x1, y1, z0), tx.w);
+	const auto c01 = lerp(s(x0, y0, z1), s(x1, y0, z1), tx.w);
+	const auto c11 = lerp(s(x0, y1, z1), s(x1, y1, z1), tx.w);
+
+	return lerp(lerp(c00, c10, ty.w), lerp(c01, c11, ty.w), tz.w);
+}
+
+// Loads the requested bricks in the background, which the samples then hit
+void StreamedTexture3D::loaderMain()
+{
+	vector<uint32_t> requests;
+	for (;;)
+	{
+		{
+			unique_lock<mutex> lock(m_mutex);
+			m_requestCond.wait(lock, [this]() { return m_quit || !m_requests.empty(); });
+			if (m_quit) return;
+			requests.swap(m_requests);
+		}
+
+		for (const auto page : requests)
+			if (m_pageStates[page].load(memory_order_relaxed) == PAGE_REQUESTED) loadBrick(page, true);
+		requests.clear();
+	}
+}
+
+StreamedTexture3D::Counter& StreamedTexture3D::getShard(Counter* pCounters)
+{
+	static thread_local const auto shard = static_cast<uint32_t>(hash<thread::id>()(this_thread::get_id()) % CounterShards);
+
+	return pCounters[shard];
+}
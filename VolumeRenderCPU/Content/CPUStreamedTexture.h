@@ -0,0 +1,151 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "CPUTexture.h"
+
+namespace CPU
+{
+	class ThreadPool;
+
+	//--------------------------------------------------------------------------------------
+	// Out-of-core sparse 3D texture of densities: the padded 8^3 bricks of BrickedTexture3D
+	// are stored in a brick file, which is memory mapped, and only a fixed number of them
+	// are resident in a brick cache. The bricks missed by the samples are loaded on the
+	// calling thread (a stall), or read from the mapping if the cache has no free slot left;
+	// the bricks requested by Prefetch() are loaded by a background thread. The least
+	// recently used bricks are evicted by Update() between frames, so the resident bricks
+	// stay valid for the samples of a whole frame.
+	//--------------------------------------------------------------------------------------
+	class StreamedTexture3D
+	{
+	public:
+		static const uint32_t BrickSize = 8;
+		static const uint32_t PaddedBrickSize = BrickSize + 1;
+		static const uint32_t BrickTexelCount = PaddedBrickSize * PaddedBrickSize * PaddedBrickSize;
+
+		// Brick lookups since the last ResetStats()
+		struct Stats
+		{
+			uint64_t Hits;			// Resident or empty bricks
+			uint64_t Misses;		// Bricks loaded by the samples or read from the mapping
+			uint64_t Prefetches;	// Bricks loaded by the background thread
+			double StallTime;		// Milliseconds of the samples loading bricks
+			uint32_t ResidentCount;	// Bricks in the cache
+			uint32_t SlotCount;		// Capacity of the cache
+		};
+
+		using SlabFunc = std::function<bool(uint32_t zBegin, uint32_t zEnd)>;
+		using TexelFunc = std::function<float(uint32_t x, uint32_t y, uint32_t z)>;
+
+		StreamedTexture3D();
+		virtual ~StreamedTexture3D();
+
+		// Writes the bricks of a volume with the non-zero densities of texelFunc(x, y, z), one
+		// layer of bricks at a time in parallel; loadSlab(zBegin, zEnd) is called before each
+		// layer with the slices [zBegin, zEnd] it reads, so the volume is never held in memory
+		static bool WriteBrickFile(const char* fileName, const uint3& size, ThreadPool& threadPool,
+			const SlabFunc& loadSlab, const TexelFunc& texelFunc);
+
+		// Maps a brick file with a cache of cacheSize bytes
+		bool Open(const char* fileName, size_t cacheSize);
+		void Close();
+
+		float Load(uint32_t x, uint32_t y, uint32_t z) const;
+		float SampleLevel(const float3& uvw) const;
+
+		// Equivalent to SampleLevel() with an integer texel offset
+		float SampleLevel(const float3& uvw, const int3& offset) const;
+
+		// Requests the brick at uvw from the background thread, if it is not resident
+		void Prefetch(const float3& uvw) const;
+
+		// Resolves the bricks of the pages of the lanes set in laneBits to their float offsets
+		// in GetData() (0 for the other of the laneCount lanes), and returns the bits of the
+		// lanes whose bricks are neither resident nor loadable, which must be sampled by
+		// SampleLevel() instead
+		uint32_t ResolveBricks(const uint32_t* pPages, uint32_t laneCount, uint32_t laneBits, int32_t* pOffsets) const;
+
+		// Starts a frame, which must not overlap the samples: evicts the least recently used
+		// bricks for the pending requests and a reserve of free slots for the misses
+		void Update();
+
+		Stats GetStats() const;
+		void ResetStats();
+
+		bool IsOpen() const { return m_pMapping != nullptr; }
+		uint32_t GetWidth() const { return m_width; }
+		uint32_t GetHeight() const { return m_height; }
+		uint32_t GetDepth() const { return m_depth; }
+		uint32_t GetPageTableWidth() const { return m_pageTableWidth; }
+		uint32_t GetPageTableHeight() const { return m_pageTableHeight; }
+		uint32_t GetPageCount() const { return static_cast<uint32_t>(m_pageTable.size()); }
+		uint32_t GetBrickCount() const { return m_brickCount; }
+		size_t GetMemorySize() const;	// Of the cache and the page tables, apart from the mapping
+		const float* GetData() const { return m_pool.data(); }
+
+	protected:
+		// Sharded to keep the cores from contending for the cache lines of the counters;
+		// padded rather than aligned, since operator new does not over-align before C++17
+		struct Counter
+		{
+			std::atomic<uint64_t> Value;
+			uint8_t Padding[64 - sizeof(std::atomic<uint64_t>)];
+		};
+		static const uint32_t CounterShards = 16;
+
+		size_t pageIndex(uint32_t bx, uint32_t by, uint32_t bz) const
+		{
+			return (static_cast<size_t>(m_pageTableHeight) * bz + by) * m_pageTableWidth + bx;
+		}
+
+		bool mapFile(const char* fileName);
+		const float* getBrick(uint32_t page) const;
+		const float* getMappedBrick(uint32_t page) const;
+		uint32_t loadBrick(uint32_t page, bool prefetch) const;
+		float sample(const LinearTap& tx, const LinearTap& ty, const LinearTap& tz) const;
+		void loaderMain();
+
+		static Counter& getShard(Counter* pCounters);
+
+		std::vector<uint32_t> m_pageTable;	// Bricks in the file, 0 for the empty ones
+		mutable std::vector<float> m_pool;	// Slot 0 is the zero brick
+		mutable std::vector<uint32_t> m_slotPages;	// UINT32_MAX for the free slots
+		std::unique_ptr<std::atomic<uint32_t>[]> m_residency;	// Slots of the pages, 0 if not resident
+		std::unique_ptr<std::atomic<uint32_t>[]> m_lastUse;		// Frames of the slots
+		std::unique_ptr<std::atomic<uint8_t>[]> m_pageStates;	// PageState
+
+		mutable std::mutex m_mutex;
+		mutable std::condition_variable m_requestCond;
+		mutable std::vector<uint32_t> m_freeSlots;
+		mutable std::vector<uint32_t> m_requests;
+		mutable std::vector<uint32_t> m_pendingRequests;	// Left for Update() to evict for
+		std::thread m_loader;
+		bool m_quit;
+
+		mutable Counter m_hits[CounterShards];
+		mutable std::atomic<uint64_t> m_misses;
+		mutable std::atomic<uint64_t> m_prefetches;
+		mutable std::atomic<uint64_t> m_stallTime;	// Nanoseconds
+
+		const uint8_t* m_pMapping;
+		size_t m_mappingSize;
+		uint64_t m_dataOffset;
+#ifdef _WIN32
+		void* m_hFile;
+		void* m_hMapping;
+#else
+		int m_file;
+#endif
+		std::atomic<uint32_t> m_frame;
+		uint32_t m_brickCount;
+		uint32_t m_width;
+		uint32_t m_height;
+		uint32_t m_depth;
+		uint32_t m_pageTableWidth;
+		uint32_t m_pageTableHeight;
+		uint32_t m_pageTableDepth;
+	};
+}
@@ -0,0 +1,358 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "CPUMath.h"
+
+namespace CPU
+{
+	//--------------------------------------------------------------------------------------
+	// Texel addressing helpers for LINEAR_CLAMP sampling
+	//--------------------------------------------------------------------------------------
+	struct LinearTap
+	{
+		uint32_t i0, i1;
+		float w;
+	};
+
+	inline LinearTap ComputeLinearTap(float u, uint32_t size)
+	{
+		// Texel centers are at (i + 0.5) / size
+		const auto x = u * size - 0.5f;
+		const auto xf = std::floor(x);
+		const auto last = static_cast<int32_t>(size) - 1;
+		const auto i = static_cast<int32_t>(xf);
+
+		LinearTap tap;
+		tap.i0 = static_cast<uint32_t>((std::min)((std::max)(i, 0), last));
+		tap.i1 = static_cast<uint32_t>((std::min)((std::max)(i + 1, 0), last));
+		tap.w = x - xf;
+
+		return tap;
+	}
+
+	//--------------------------------------------------------------------------------------
+	// 2D texture
+	//--------------------------------------------------------------------------------------
+	template<typename T>
+	class Texture2D
+	{
+	public:
+		Texture2D() : m_width(0), m_height(0) {}
+
+		void Create(uint32_t width, uint32_t height)
+		{
+			m_width = width;
+			m_height = height;
+			m_data.assign(static_cast<size_t>(width) * height, T(0.0f));
+		}
+
+		void Clear(const T& value) { std::fill(m_data.begin(), m_data.end(), value); }
+
+		T& operator()(uint32_t x, uint32_t y) { return m_data[static_cast<size_t>(m_width) * y + x]; }
+		const T& operator()(uint32_t x, uint32_t y) const { return m_data[static_cast<size_t>(m_width) * y + x]; }
+
+		T SampleLevel(const float2& uv) const
+		{
+			const auto tx = ComputeLinearTap(uv.x, m_width);
+			const auto ty = ComputeLinearTap(uv.y, m_height);
+			const auto& s = *this;
+
+			return lerp(lerp(s(tx.i0, ty.i0), s(tx.i1, ty.i0), tx.w),
+				lerp(s(tx.i0, ty.i1), s(tx.i1, ty.i1), tx.w), ty.w);
+		}
+
+		// Bilinear percentage-closer filtering with a LESS_EQUAL comparison
+		float SampleCmpLevelZero(const float2& uv, float ref) const
+		{
+			const auto tx = ComputeLinearTap(uv.x, m_width);
+			const auto ty = ComputeLinearTap(uv.y, m_height);
+			const auto& s = *this;
+			const auto c00 = ref <= s(tx.i0, ty.i0) ? 1.0f : 0.0f;
+			const auto c10 = ref <= s(tx.i1, ty.i0) ? 1.0f : 0.0f;
+			const auto c01 = ref <= s(tx.i0, ty.i1) ? 1.0f : 0.0f;
+			const auto c11 = ref <= s(tx.i1, ty.i1) ? 1.0f : 0.0f;
+
+			return lerp(lerp(c00, c10, tx.w), lerp(c01, c11, tx.w), ty.w);
+		}
+
+		uint32_t GetWidth() const { return m_width; }
+		uint32_t GetHeight() const { return m_height; }
+		T* GetData() { return m_data.data(); }
+		const T* GetData() const { return m_data.data(); }
+
+	protected:
+		std::vector<T> m_data;
+		uint32_t m_width;
+		uint32_t m_height;
+	};
+
+	//--------------------------------------------------------------------------------------
+	// 2D texture array with a mip chain, used for the cube maps
+	//--------------------------------------------------------------------------------------
+	template<typename T>
+	class Texture2DArray
+	{
+	public:
+		Texture2DArray() : m_width(0), m_height(0), m_arraySize(0) {}
+
+		void Create(uint32_t width, uint32_t height, uint32_t arraySize, uint8_t numMips)
+		{
+			m_width = width;
+			m_height = height;
+			m_arraySize = arraySize;
+			m_mipOffsets.resize(numMips);
+
+			size_t size = 0;
+			for (uint8_t i = 0; i < numMips; ++i)
+			{
+				m_mipOffsets[i] = size;
+				size += static_cast<size_t>(GetWidth(i)) * GetHeight(i) * arraySize;
+			}
+			m_data.assign(size, T(0.0f));
+		}
+
+		T& operator()(uint32_t x, uint32_t y, uint32_t slice, uint8_t mip)
+		{
+			return m_data[texelIndex(x, y, slice, mip)];
+		}
+
+		const T& operator()(uint32_t x, uint32_t y, uint32_t slice, uint8_t mip) const
+		{
+			return m_data[texelIndex(x, y, slice, mip)];
+		}
+
+		T SampleLevel(const float2& uv, uint32_t slice, uint8_t mip) const
+		{
+			const auto tx = ComputeLinearTap(uv.x, GetWidth(mip));
+			const auto ty = ComputeLinearTap(uv.y, GetHeight(mip));
+			const auto& s = *this;
+
+			return lerp(lerp(s(tx.i0, ty.i0, slice, mip), s(tx.i1, ty.i0, slice, mip), tx.w),
+				lerp(s(tx.i0, ty.i1, slice, mip), s(tx.i1, ty.i1, slice, mip), tx.w), ty.w);
+		}
+
+		uint32_t GetWidth(uint8_t mip = 0) const { return (std::max)(m_width >> mip, 1u); }
+		uint32_t GetHeight(uint8_t mip = 0) const { return (std::max)(m_height >> mip, 1u); }
+		uint32_t GetArraySize() const { return m_arraySize; }
+		uint8_t GetNumMips() const { return static_cast<uint8_t>(m_mipOffsets.size()); }
+
+	protected:
+		size_t texelIndex(uint32_t x, uint32_t y, uint32_t slice, uint8_t mip) const
+		{
+			const size_t w = GetWidth(mip), h = GetHeight(mip);
+
+			return m_mipOffsets[mip] + (h * slice + y) * w + x;
+		}
+
+		std::vector<T> m_data;
+		std::vector<size_t> m_mipOffsets;
+		uint32_t m_width;
+		uint32_t m_height;
+		uint32_t m_arraySize;
+	};
+
+	//--------------------------------------------------------------------------------------
+	// 3D texture
+	//--------------------------------------------------------------------------------------
+	template<typename T>
+	class Texture3D
+	{
+	public:
+		Texture3D() : m_width(0), m_height(0), m_depth(0) {}
+
+		void Create(uint32_t width, uint32_t height, uint32_t depth)
+		{
+			m_width = width;
+			m_height = height;
+			m_depth = depth;
+			m_data.assign(static_cast<size_t>(width) * height * depth, T(0.0f));
+		}
+
+		T& operator()(uint32_t x, uint32_t y, uint32_t z)
+		{
+			return m_data[(static_cast<size_t>(m_height) * z + y) * m_width + x];
+		}
+
+		const T& operator()(uint32_t x, uint32_t y, uint32_t z) const
+		{
+			return m_data[(static_cast<size_t>(m_height) * z + y) * m_width + x];
+		}
+
+		T SampleLevel(const float3& uvw) const
+		{
+			const auto tx = ComputeLinearTap(uvw.x, m_width);
+			const auto ty = ComputeLinearTap(uvw.y, m_height);
+			const auto tz = ComputeLinearTap(uvw.z, m_depth);
+
+			return sample(tx, ty, tz);
+		}
+
+		// Equivalent to SampleLevel() with an integer texel offset
+		T SampleLevel(const float3& uvw, const int3& offset) const
+		{
+			const auto tx = ComputeLinearTap(uvw.x + offset.x / static_cast<float>(m_width), m_width);
+			const auto ty = ComputeLinearTap(uvw.y + offset.y / static_cast<float>(m_height), m_height);
+			const auto tz = ComputeLinearTap(uvw.z + offset.z / static_cast<float>(m_depth), m_depth);
+
+			return sample(tx, ty, tz);
+		}
+
+		uint32_t GetWidth() const { return m_width; }
+		uint32_t GetHeight() const { return m_height; }
+		uint32_t GetDepth() const { return m_depth; }
+		T* GetData() { return m_data.data(); }
+		const T* GetData() const { return m_data.data(); }
+
+	protected:
+		T sample(const LinearTap& tx, const LinearTap& ty, const LinearTap& tz) const
+		{
+			const auto& s = *this;
+			const auto c00 = lerp(s(tx.i0, ty.i0, tz.i0), s(tx.i1, ty.i0, tz.i0), tx.w);
+			const auto c10 = lerp(s(tx.i0, ty.i1, tz.i0), s(tx.i1, ty.i1, tz.i0), tx.w);
+			const auto c01 = lerp(s(tx.i0, ty.i0, tz.i1), s(tx.i1, ty.i0, tz.i1), tx.w);
+			const auto c11 = lerp(s(tx.i0, ty.i1, tz.i1), s(tx.i1, ty.i1, tz.i1), tx.w);
+
+			return lerp(lerp(c00, c10, ty.w), lerp(c01, c11, ty.w), tz.w);
+		}
+
+		std::vector<T> m_data;
+		uint32_t m_width;
+		uint32_t m_height;
+		uint32_t m_depth;
+	};
+
+	//--------------------------------------------------------------------------------------
+	// Sparse 3D texture: a page table maps each BRICK_SIZE^3 brick to a slot of the brick
+	// pool. Each stored brick carries the next texel on its high sides (clamped at the
+	// border), so the 8 taps of a trilinear sample always lie in the brick of the lower
+	// taps. The pages of the bricks never set all map to the zero brick in slot 0.
+	//--------------------------------------------------------------------------------------
+	template<typename T, uint32_t BRICK_SIZE = 8>
+	class BrickedTexture3D
+	{
+	public:
+		static const uint32_t BrickSize = BRICK_SIZE;
+		static const uint32_t PaddedBrickSize = BRICK_SIZE + 1;
+		static const uint32_t BrickTexelCount = PaddedBrickSize * PaddedBrickSize * PaddedBrickSize;
+
+		// Filtered texels, e.g. float4 for the snorm4 texels
+		using SampleType = decltype(lerp(std::declval<T>(), std::declval<T>(), 0.0f));
+
+		BrickedTexture3D() : m_width(0), m_height(0), m_depth(0),
+			m_pageTableWidth(0), m_pageTableHeight(0), m_pageTableDepth(0) {}
+
+		void Create(uint32_t width, uint32_t height, uint32_t depth)
+		{
+			m_width = width;
+			m_height = height;
+			m_depth = depth;
+			m_pageTableWidth = (width + BRICK_SIZE - 1) / BRICK_SIZE;
+			m_pageTableHeight = (height + BRICK_SIZE - 1) / BRICK_SIZE;
+			m_pageTableDepth = (depth + BRICK_SIZE - 1) / BRICK_SIZE;
+			m_pageTable.assign(static_cast<size_t>(m_pageTableWidth) * m_pageTableHeight * m_pageTableDepth, 0);
+			m_pool.assign(BrickTexelCount, T(0.0f));
+			m_pool.shrink_to_fit();
+		}
+
+		// Stores the padded texels of a brick in x-major order; thread safe
+		void SetBrick(uint32_t bx, uint32_t by, uint32_t bz, const T* pTexels)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+
+			auto& slot = m_pageTable[pageIndex(bx, by, bz)];
+			if (slot == 0)
+			{
+				slot = static_cast<uint32_t>(m_pool.size() / BrickTexelCount);
+				m_pool.insert(m_pool.end(), pTexels, pTexels + BrickTexelCount);
+			}
+			else std::copy(pTexels, pTexels + BrickTexelCount, &m_pool[static_cast<size_t>(slot) * BrickTexelCount]);
+		}
+
+		// Whether a brick is stored, i.e. has been set since Create()
+		bool HasBrick(uint32_t bx, uint32_t by, uint32_t bz) const { return m_pageTable[pageIndex(bx, by, bz)] != 0; }
+
+		T Load(uint32_t x, uint32_t y, uint32_t z) const
+		{
+			const auto pBrick = getBrick(x / BRICK_SIZE, y / BRICK_SIZE, z / BRICK_SIZE);
+
+			return pBrick[texelIndex(x % BRICK_SIZE, y % BRICK_SIZE, z % BRICK_SIZE)];
+		}
+
+		SampleType SampleLevel(const float3& uvw) const
+		{
+			const auto tx = ComputeLinearTap(uvw.x, m_width);
+			const auto ty = ComputeLinearTap(uvw.y, m_height);
+			const auto tz = ComputeLinearTap(uvw.z, m_depth);
+
+			return sample(tx, ty, tz);
+		}
+
+		// Equivalent to SampleLevel() with an integer texel offset
+		SampleType SampleLevel(const float3& uvw, const int3& offset) const
+		{
+			const auto tx = ComputeLinearTap(uvw.x + offset.x / static_cast<float>(m_width), m_width);
+			const auto ty = ComputeLinearTap(uvw.y + offset.y / static_cast<float>(m_height), m_height);
+			const auto tz = ComputeLinearTap(uvw.z + offset.z / static_cast<float>(m_depth), m_depth);
+
+			return sample(tx, ty, tz);
+		}
+
+		uint32_t GetWidth() const { return m_width; }
+		uint32_t GetHeight() const { return m_height; }
+		uint32_t GetDepth() const { return m_depth; }
+		uint32_t GetPageTableWidth() const { return m_pageTableWidth; }
+		uint32_t GetPageTableHeight() const { return m_pageTableHeight; }
+		uint32_t GetPageTableDepth() const { return m_pageTableDepth; }
+		uint32_t GetPageCount() const { return static_cast<uint32_t>(m_pageTable.size()); }
+		uint32_t GetBrickCount() const { return static_cast<uint32_t>(m_pool.size() / BrickTexelCount) - 1; }
+		size_t GetMemorySize() const { return sizeof(T) * m_pool.size() + sizeof(uint32_t) * m_pageTable.size(); }
+		const uint32_t* GetPageTable() const { return m_pageTable.data(); }
+		const T* GetData() const { return m_pool.data(); }
+
+	protected:
+		size_t pageIndex(uint32_t bx, uint32_t by, uint32_t bz) const
+		{
+			return (static_cast<size_t>(m_pageTableHeight) * bz + by) * m_pageTableWidth + bx;
+		}
+
+		static uint32_t texelIndex(uint32_t x, uint32_t y, uint32_t z)
+		{
+			return (PaddedBrickSize * z + y) * PaddedBrickSize + x;
+		}
+
+		const T* getBrick(uint32_t bx, uint32_t by, uint32_t bz) const
+		{
+			return &m_pool[static_cast<size_t>(m_pageTable[pageIndex(bx, by, bz)]) * BrickTexelCount];
+		}
+
+		// Same interpolation order as Texture3D::sample()
+		SampleType sample(const LinearTap& tx, const LinearTap& ty, const LinearTap& tz) const
+		{
+			const auto pBrick = getBrick(tx.i0 / BRICK_SIZE, ty.i0 / BRICK_SIZE, tz.i0 / BRICK_SIZE);
+			const auto x0 = tx.i0 % BRICK_SIZE, x1 = x0 + tx.i1 - tx.i0;
+			const auto y0 = ty.i0 % BRICK_SIZE, y1 = y0 + ty.i1 - ty.i0;
+			const auto z0 = tz.i0 % BRICK_SIZE, z1 = z0 + tz.i1 - tz.i0;
+			const auto s = [pBrick](uint32_t x, uint32_t y, uint32_t z) -> const T& { return pBrick[texelIndex(x, y, z)]; };
+
+			const auto c00 = lerp(s(x0, y0, z0), s(x1, y0, z0), tx.w);
+			const auto c10 = lerp(s(x0, y1, z0), s(x1, y1, z0), tx.w);
+			const auto c01 = lerp(s(x0, y0, z1), s(x1, y0, z1), tx.w);
+			const auto c11 = lerp(s(x0, y1, z1), s(x1, y1, z1), tx.w);
+
+			return lerp(lerp(c00, c10, ty.w), lerp(c01, c11, ty.w), tz.w);
+		}
+
+		std::vector<uint32_t> m_pageTable;
+		std::vector<T> m_pool;
+		std::mutex m_mutex;
+		uint32_t m_width;
+		uint32_t m_height;
+		uint32_t m_depth;
+		uint32_t m_pageTableWidth;
+		uint32_t m_pageTableHeight;
+		uint32_t m_pageTableDepth;
+	};
+}
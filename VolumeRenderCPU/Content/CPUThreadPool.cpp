@@ -0,0 +1,176 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "CPUThreadPool.h"
+
+using namespace std;
+using namespace CPU;
+
+ThreadPool::ThreadPool(uint32_t numThreads) :
+	m_pFunc(nullptr),
+	m_numGroups(0),
+	m_nextGroup(0),
+	m_numBusy(0),
+	m_generation(0),
+	m_stealing(false),
+	m_quit(false)
+{
+	numThreads = numThreads ? numThreads : thread::hardware_concurrency();
+	numThreads = (max)(numThreads, 1u);
+	m_stealQueues.reset(new StealQueue[numThreads]);
+	m_threadStats.assign(numThreads, ThreadStats());
+
+	// Worker 0 is the calling thread
+	m_workers.reserve(numThreads - 1);
+	for (auto i = 1u; i < numThreads; ++i)
+		m_workers.emplace_back(&ThreadPool::workerMain, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_quit = true;
+	}
+	m_wakeCond.notify_all();
+
+	for (auto& worker : m_workers) worker.join();
+}
+
+void ThreadPool::Dispatch(uint32_t numGroups, const GroupFunc& func)
+{
+	run(numGroups, func, false);
+}
+
+void ThreadPool::DispatchStealing(uint32_t numGroups, const GroupFunc& func, const uint32_t* pOrder)
+{
+	const auto numThreads = GetNumThreads();
+	m_threadStats.assign(numThreads, ThreadStats());
+
+	// Dealt round robin, so each thread starts with its share of the first groups
+	m_stealGroups.resize(numGroups);
+	auto offset = 0u;
+	for (auto i = 0u; i < numThreads; ++i)
+	{
+		const auto count = numGroups / numThreads + (i < numGroups % numThreads ? 1 : 0);
+		for (auto j = 0u; j < count; ++j)
+		{
+			const auto k = numThreads * j + i;
+			m_stealGroups[offset + j] = pOrder ? pOrder[k] : k;
+		}
+		m_stealQueues[i].Range = count;
+		m_stealQueues[i].Offset = offset;
+		offset += count;
+	}
+
+	run(numGroups, func, true);
+}
+
+uint32_t ThreadPool::GetNumThreads() const
+{
+	return static_cast<uint32_t>(m_workers.size()) + 1;
+}
+
+const vector<ThreadPool::ThreadStats>& ThreadPool::GetThreadStats() const
+{
+	return m_threadStats;
+}
+
+void ThreadPool::run(uint32_t numGroups, const GroupFunc& func, bool stealing)
+{
+	if (numGroups == 0) return;
+
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_pFunc = &func;
+		m_numGroups = numGroups;
+		m_nextGroup = 0;
+		m_stealing = stealing;
+		m_numBusy = static_cast<uint32_t>(m_workers.size());
+		++m_generation;
+	}
+	m_wakeCond.notify_all();
+
+	runGroups(0);
+
+	// Wait until every worker has drained the group queue
+	unique_lock<mutex> lock(m_mutex);
+	m_doneCond.wait(lock, [this]() { return m_numBusy == 0; });
+	m_pFunc = nullptr;
+}
+
+void ThreadPool::workerMain(uint32_t threadId)
+{
+	uint64_t generation = 0;
+
+	while (true)
+	{
+		{
+			unique_lock<mutex> lock(m_mutex);
+			m_wakeCond.wait(lock, [&]() { return m_quit || m_generation != generation; });
+			if (m_quit) return;
+			generation = m_generation;
+		}
+
+		runGroups(threadId);
+
+		{
+			lock_guard<mutex> lock(m_mutex);
+			if (--m_numBusy == 0) m_doneCond.notify_one();
+		}
+	}
+}
+
+void ThreadPool::runGroups(uint32_t threadId)
+{
+	if (m_stealing) return stealGroups(threadId);
+
+	const auto& func = *m_pFunc;
+	for (auto i = m_nextGroup++; i < m_numGroups; i = m_nextGroup++) func(i, threadId);
+}
+
+void ThreadPool::stealGroups(uint32_t threadId)
+{
+	const auto& func = *m_pFunc;
+	const auto numThreads = GetNumThreads();
+	auto& stats = m_threadStats[threadId];
+
+	while (true)
+	{
+		// Its own queue first, then the others in turn; all of them are drained once none has groups left
+		uint32_t groupId;
+		auto stolen = false;
+		auto found = popGroup(threadId, false, groupId);
+		for (auto i = 1u; !found && i < numThreads; ++i)
+			found = stolen = popGroup((threadId + i) % numThreads, true, groupId);
+		if (!found) break;
+
+		const auto timeStart = chrono::high_resolution_clock::now();
+		func(groupId, threadId);
+		stats.BusyTime += chrono::duration<double, milli>(chrono::high_resolution_clock::now() - timeStart).count();
+		++stats.Groups;
+		if (stolen) ++stats.Steals;
+	}
+}
+
+// Pops the front (by the owner) or the back (by a thief) of the queue
+bool ThreadPool::popGroup(uint32_t queue, bool back, uint32_t& groupId)
+{
+	auto& stealQueue = m_stealQueues[queue];
+	auto range = stealQueue.Range.load(memory_order_relaxed);
+	while (true)
+	{
+		const auto head = static_cast<uint32_t>(range >> 32);
+		const auto tail = static_cast<uint32_t>(range);
+		if (head >= tail) return false;
+
+		const auto newRange = back ? range - 1 : range + (1ull << 32);
+		if (stealQueue.Range.compare_exchange_weak(range, newRange, memory_order_relaxed))
+		{
+			groupId = m_stealGroups[stealQueue.Offset + (back ? tail - 1 : head)];
+
+			return true;
+		}
+	}
+}
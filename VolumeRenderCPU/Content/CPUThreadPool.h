@@ -0,0 +1,71 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+namespace CPU
+{
+	// Persistent worker threads executing "thread groups" in the spirit of a compute
+	// Dispatch(): each group index is handed out exactly once, and Dispatch() returns
+	// after all groups have completed. The calling thread participates as worker 0.
+	class ThreadPool
+	{
+	public:
+		using GroupFunc = std::function<void(uint32_t groupId, uint32_t threadId)>;
+
+		// Per-thread counters of the last DispatchStealing()
+		struct ThreadStats
+		{
+			uint32_t Groups;	// Groups executed
+			uint32_t Steals;	// Of which stolen from the other threads
+			double BusyTime;	// Milliseconds executing the groups
+		};
+
+		ThreadPool(uint32_t numThreads = 0);
+		virtual ~ThreadPool();
+
+		void Dispatch(uint32_t numGroups, const GroupFunc& func);
+
+		// Dispatches the groups in the order of pOrder (group ids, e.g. the most expensive first,
+		// or 0 to numGroups - 1 if null) with work stealing: they are dealt round robin into
+		// per-thread queues, which each thread drains from the front, before stealing from the
+		// back of the queues of the others
+		void DispatchStealing(uint32_t numGroups, const GroupFunc& func, const uint32_t* pOrder = nullptr);
+
+		uint32_t GetNumThreads() const;
+		const std::vector<ThreadStats>& GetThreadStats() const;
+
+	protected:
+		// Range [head, tail) of the groups of a thread in m_stealGroups, as head << 32 | tail
+		struct StealQueue
+		{
+			std::atomic<uint64_t> Range;
+			uint32_t Offset;
+		};
+
+		void run(uint32_t numGroups, const GroupFunc& func, bool stealing);
+		void workerMain(uint32_t threadId);
+		void runGroups(uint32_t threadId);
+		void stealGroups(uint32_t threadId);
+		bool popGroup(uint32_t queue, bool back, uint32_t& groupId);
+
+		std::vector<std::thread> m_workers;
+
+		std::mutex				m_mutex;
+		std::condition_variable	m_wakeCond;
+		std::condition_variable	m_doneCond;
+
+		const GroupFunc*		m_pFunc;
+		uint32_t				m_numGroups;
+		std::atomic<uint32_t>	m_nextGroup;
+		uint32_t				m_numBusy;
+		uint64_t				m_generation;
+		bool					m_stealing;
+		bool					m_quit;
+
+		std::unique_ptr<StealQueue[]> m_stealQueues;	// Per thread
+		std::vector<uint32_t>	m_stealGroups;
+		std::vector<ThreadStats> m_threadStats;
+	};
+}
@@ -0,0 +1,286 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "CPUVolumeResampler.h"
+#include "CPUDDSLoader.h"
+#include "CPUPacket.h"
+#include "CPUThreadPool.h"
+
+using namespace std;
+using namespace CPU;
+
+static const char* g_filterNames[] = { "trilinear", "box", "tent", "lanczos" };
+static const float g_filterRadii[] = { 1.0f, 0.5f, 1.0f, 3.0f };
+
+static float EvaluateFilter(float x, VolumeResampler::Filter filter)
+{
+	x = fabsf(x);
+	switch (filter)
+	{
+	case VolumeResampler::BOX:
+		return x <= 0.5f ? 1.0f : 0.0f;
+	case VolumeResampler::LANCZOS:
+	{
+		if (x < 1.0e-5f) return 1.0f;
+		if (x >= 3.0f) return 0.0f;
+		const auto px = PI * x;
+
+		return 3.0f * sinf(px) * sinf(px / 3.0f) / (px * px);
+	}
+	default:
+		return (std::max)(1.0f - x, 0.0f);
+	}
+}
+
+// pDst[x] = sum of pWeights[k] * pSrc[stride * k + x] over the taps k
+static void FilterRow(float* pDst, const float* pSrc, size_t stride, const float* pWeights, uint32_t numTaps, uint32_t width)
+{
+	auto x = 0u;
+#if CPU_PACKET_WIDTH
+	for (; x + CPU_PACKET_WIDTH <= width; x += CPU_PACKET_WIDTH)
+	{
+		floatP a = 0.0f;
+		for (auto k = 0u; k < numTaps; ++k) a += floatP(pWeights[k]) * floatP::LoadUnaligned(&pSrc[stride * k + x]);
+		a.StoreUnaligned(&pDst[x]);
+	}
+#endif
+
+	for (; x < width; ++x)
+	{
+		auto a = 0.0f;
+		for (auto k = 0u; k < numTaps; ++k) a += pWeights[k] * pSrc[stride * k + x];
+		pDst[x] = a;
+	}
+}
+
+VolumeResampler::VolumeResampler(ThreadPool& threadPool) :
+	m_threadPool(threadPool),
+	m_stats()
+{
+}
+
+VolumeResampler::~VolumeResampler()
+{
+}
+
+bool VolumeResampler::Resample(string& cacheFileName, const char* fileName, const uint3& size,
+	Filter filter, Texture3D<float>* pVolume)
+{
+	XUSG_N_RETURN(filter < NUM_FILTER && size.x > 0 && size.y > 0 && size.z > 0, false);
+
+	auto timeStart = chrono::high_resolution_clock::now();
+	uint64_t hash;
+	XUSG_N_RETURN(HashFile(fileName, hash), false);
+	m_stats.HashTime = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - timeStart).count();
+
+	stringstream name;
+	name << fileName << "." << hex << setw(16) << setfill('0') << hash << dec << "." << g_filterNames[filter]
+		<< "." << size.x << "x" << size.y << "x" << size.z << ".dds";
+	cacheFileName = name.str();
+
+	if (pVolume) pVolume->Create(0, 0, 0);
+	m_stats.FilterTime = 0.0;
+	m_stats.CacheHit = ifstream(cacheFileName, ios::binary).good();
+	if (m_stats.CacheHit) return true;
+
+	timeStart = chrono::high_resolution_clock::now();
+	Texture3D<float> volume;
+	auto& dst = pVolume ? *pVolume : volume;
+	{
+		Texture3D<float> src;
+		DDS::Loader textureLoader;
+		XUSG_N_RETURN(textureLoader.CreateTextureFromFile(fileName, src), false);
+		Resample(dst, src, size, filter);
+	}
+
+	XUSG_N_RETURN(DDS::SaveTextureToFile(cacheFileName.c_str(), dst), false);
+	m_stats.FilterTime = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - timeStart).count();
+
+	return true;
+}
+
+void VolumeResampler::Resample(Texture3D<float>& dst, const Texture3D<float>& src, const uint3& size, Filter filter)
+{
+	auto srcSize = uint3(src.GetWidth(), src.GetHeight(), src.GetDepth());
+	dst.Create(size.x, size.y, size.z);
+
+	// Filtered along z, y, then x, so the gathers of x see the fewest texels when downsampling;
+	// the axes of the same size are skipped, and the last pass writes to dst
+	static const uint8_t axes[] = { 2, 1, 0 };
+	auto numPasses = 0u;
+	for (const auto axis : axes) if (srcSize[axis] != size[axis]) ++numPasses;
+	if (numPasses == 0)
+	{
+		memcpy(dst.GetData(), src.GetData(), sizeof(float) * size.x * size.y * size.z);
+
+		return;
+	}
+
+	vector<float> buffers[2];
+	auto pSrc = src.GetData();
+	for (const auto axis : axes)
+	{
+		if (srcSize[axis] == size[axis]) continue;
+
+		Taps taps;
+		computeTaps(taps, srcSize[axis], size[axis], filter);
+
+		auto passSize = srcSize;
+		passSize[axis] = size[axis];
+		auto pDst = dst.GetData();
+		if (--numPasses > 0)
+		{
+			auto& buffer = buffers[numPasses & 1];
+			buffer.resize(static_cast<size_t>(passSize.x) * passSize.y * passSize.z);
+			pDst = buffer.data();
+		}
+
+		if (axis > 0) filterRows(pDst, pSrc, srcSize, axis, taps);
+		else filterColumns(pDst, pSrc, srcSize, taps);
+
+		pSrc = pDst;
+		srcSize = passSize;
+	}
+
+	// Densities cannot be negative
+	if (filter == LANCZOS)
+	{
+		m_threadPool.Dispatch(size.z, [&](uint32_t z, uint32_t)
+		{
+			const auto pSlice = &dst(0, 0, z);
+			for (size_t i = 0; i < static_cast<size_t>(size.x) * size.y; ++i) pSlice[i] = (std::max)(pSlice[i], 0.0f);
+		});
+	}
+}
+
+const char* VolumeResampler::GetFilterName(Filter filter)
+{
+	return filter < NUM_FILTER ? g_filterNames[filter] : nullptr;
+}
+
+bool VolumeResampler::HashFile(const char* fileName, uint64_t& hash)
+{
+	ifstream file(fileName, ios::binary);
+	XUSG_M_RETURN(!file, cerr, "Failed to open the volume file.", false);
+
+	// Word by word, as the chunks keep the words aligned, then the bytes of the tail
+	const uint64_t prime = 0x100000001b3;
+	hash = 0xcbf29ce484222325;
+	vector<uint64_t> chunk(1 << 17);	// 1 MiB
+	while (file)
+	{
+		file.read(reinterpret_cast<char*>(chunk.data()), sizeof(uint64_t) * chunk.size());
+		const auto numBytes = static_cast<size_t>(file.gcount());
+		const auto numWords = numBytes / sizeof(uint64_t);
+		for (size_t i = 0; i < numWords; ++i) hash = (hash ^ chunk[i]) * prime;
+
+		const auto pTail = reinterpret_cast<const uint8_t*>(&chunk[numWords]);
+		for (size_t i = 0; i < numBytes % sizeof(uint64_t); ++i) hash = (hash ^ pTail[i]) * prime;
+	}
+
+	return true;
+}
+
+void VolumeResampler::computeTaps(Taps& taps, uint32_t srcSize, uint32_t dstSize, Filter filter)
+{
+	// The filter spans the texel spacing of the destination when downsampling
+	const auto ratio = static_cast<float>(srcSize) / dstSize;
+	const auto scale = filter == TRILINEAR ? 1.0f : (std::max)(ratio, 1.0f);
+	const auto radius = g_filterRadii[filter] * scale;
+	const auto last = static_cast<int32_t>(srcSize) - 1;
+	taps.MaxCount = static_cast<uint32_t>(std::ceil(2.0f * radius)) + 1;
+	taps.First.resize(dstSize);
+	taps.Count.resize(dstSize);
+	taps.Weights.assign(static_cast<size_t>(taps.MaxCount) * dstSize, 0.0f);
+
+	for (auto i = 0u; i < dstSize; ++i)
+	{
+		// The taps out of the volume are clamped to the edge texels, like a CLAMP sampler
+		const auto center = (i + 0.5f) * ratio - 0.5f;
+		const auto jMin = static_cast<int32_t>(std::ceil(center - radius));
+		const auto jMax = (std::min)(static_cast<int32_t>(std::floor(center + radius)), jMin + static_cast<int32_t>(taps.MaxCount) - 1);
+		const auto first = (std::min)((std::max)(jMin, 0), last);
+		const auto pWeights = &taps.Weights[static_cast<size_t>(taps.MaxCount) * i];
+		auto weightSum = 0.0f;
+		for (auto j = jMin; j <= jMax; ++j)
+		{
+			const auto w = EvaluateFilter((j - center) / scale, filter);
+			pWeights[(std::min)((std::max)(j, 0), last) - first] += w;
+			weightSum += w;
+		}
+
+		taps.First[i] = static_cast<uint32_t>(first);
+		taps.Count[i] = static_cast<uint32_t>((std::min)((std::max)(jMax, 0), last) - first + 1);
+		for (auto k = 0u; k < taps.Count[i]; ++k) pWeights[k] /= weightSum;
+	}
+}
+
+// Along y (axis 1) or z (axis 2), each destination row is a weighted sum of the source rows of its taps
+void VolumeResampler::filterRows(float* pDst, const float* pSrc, const uint3& srcSize, uint8_t axis, const Taps& taps)
+{
+	const auto width = srcSize.x;
+	const auto height = srcSize.y;
+	const auto dstCount = static_cast<uint32_t>(taps.First.size());
+	const auto tapStride = axis == 1 ? static_cast<size_t>(width) : static_cast<size_t>(width) * height;
+	const auto dstHeight = axis == 1 ? dstCount : height;
+	const auto dstDepth = axis == 1 ? srcSize.z : dstCount;
+
+	m_threadPool.Dispatch(dstHeight * dstDepth, [&](uint32_t row, uint32_t)
+	{
+		const auto y = row % dstHeight;
+		const auto z = row / dstHeight;
+		const auto i = axis == 1 ? y : z;
+		const auto srcY = axis == 1 ? taps.First[i] : y;
+		const auto srcZ = axis == 1 ? z : taps.First[i];
+		FilterRow(&pDst[static_cast<size_t>(width) * row], &pSrc[(static_cast<size_t>(height) * srcZ + srcY) * width],
+			tapStride, &taps.Weights[static_cast<size_t>(taps.MaxCount) * i], taps.Count[i], width);
+	});
+}
+
+// Along x, SIMD across the rows by gathering the taps
+void VolumeResampler::filterColumns(float* pDst, const float* pSrc, const uint3& srcSize, const Taps& taps)
+{
+	const auto srcWidth = srcSize.x;
+	const auto dstWidth = static_cast<uint32_t>(taps.First.size());
+	const auto numRows = srcSize.y * srcSize.z;
+	const auto rowsPerGroup = 64u;
+
+	m_threadPool.Dispatch(XUSG_DIV_UP(numRows, rowsPerGroup), [&](uint32_t groupId, uint32_t)
+	{
+		const auto rowEnd = (std::min)(rowsPerGroup * (groupId + 1), numRows);
+		auto row = rowsPerGroup * groupId;
+#if CPU_PACKET_WIDTH
+		alignas(64) int32_t laneRows[CPU_PACKET_WIDTH];
+		alignas(64) float results[CPU_PACKET_WIDTH];
+		for (auto j = 0u; j < CPU_PACKET_WIDTH; ++j) laneRows[j] = static_cast<int32_t>(srcWidth * j);
+		const auto laneOffsets = intP::Load(laneRows);
+		for (; row + CPU_PACKET_WIDTH <= rowEnd; row += CPU_PACKET_WIDTH)
+		{
+			const auto pRows = &pSrc[static_cast<size_t>(srcWidth) * row];
+			for (auto i = 0u; i < dstWidth; ++i)
+			{
+				const auto pTaps = &pRows[taps.First[i]];
+				const auto pWeights = &taps.Weights[static_cast<size_t>(taps.MaxCount) * i];
+				floatP a = 0.0f;
+				for (auto k = 0u; k < taps.Count[i]; ++k) a += floatP(pWeights[k]) * Gather<4>(&pTaps[k], laneOffsets);
+				a.Store(results);
+				for (auto j = 0u; j < CPU_PACKET_WIDTH; ++j) pDst[static_cast<size_t>(dstWidth) * (row + j) + i] = results[j];
+			}
+		}
+#endif
+
+		for (; row < rowEnd; ++row)
+		{
+			const auto pRow = &pSrc[static_cast<size_t>(srcWidth) * row];
+			for (auto i = 0u; i < dstWidth; ++i)
+			{
+				const auto pTaps = &pRow[taps.First[i]];
+				const auto pWeights = &taps.Weights[static_cast<size_t>(taps.MaxCount) * i];
+				auto a = 0.0f;
+				for (auto k = 0u; k < taps.Count[i]; ++k) a += pWeights[k] * pTaps[k];
+				pDst[static_cast<size_t>(dstWidth) * row + i] = a;
+			}
+		}
+	});
+}
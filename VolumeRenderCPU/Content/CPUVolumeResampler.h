@@ -0,0 +1,79 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "CPUTexture.h"
+
+namespace CPU
+{
+	class ThreadPool;
+
+	//--------------------------------------------------------------------------------------
+	// Resamples volume files to the grid with a separable filter, widened by the ratio of
+	// the file size to the grid size when downsampling, in place of the trilinear sample per
+	// voxel of CSR32FToRGBA16F, which aliases once the file is over twice the grid. The axes
+	// are filtered in turn (z, y, then x), by the rows in parallel with SIMD across each row
+	// (or across rows for x). The results are cached as R32_FLOAT DDS files next to the
+	// volume files, named by the hash of the file contents, the filter and the grid size,
+	// so only the first load of a volume file at a grid size pays for the filtering; the
+	// GPU demo names its cache files alike.
+	//--------------------------------------------------------------------------------------
+	class VolumeResampler
+	{
+	public:
+		enum Filter : uint8_t
+		{
+			TRILINEAR,	// Tent of the texel spacing, i.e. CSR32FToRGBA16F
+			BOX,
+			TENT,
+			LANCZOS,	// 3 lobes; ringing below 0 is clamped
+
+			NUM_FILTER
+		};
+
+		struct Stats
+		{
+			bool CacheHit;
+			double HashTime;	// Milliseconds to hash the volume file
+			double FilterTime;	// Milliseconds to decode, filter and cache the volume file, 0 on a cache hit
+		};
+
+		VolumeResampler(ThreadPool& threadPool);
+		virtual ~VolumeResampler();
+
+		// Returns the name of the cache file of the volume file resampled to size, which is written
+		// first if missing; pVolume, if not null, then receives the resampled volume (else it is
+		// left empty), which saves reading it back from the cache file
+		bool Resample(std::string& cacheFileName, const char* fileName, const uint3& size,
+			Filter filter, Texture3D<float>* pVolume = nullptr);
+
+		// Resamples in memory, without caching
+		void Resample(Texture3D<float>& dst, const Texture3D<float>& src, const uint3& size, Filter filter);
+
+		const Stats& GetStats() const { return m_stats; }
+
+		static const char* GetFilterName(Filter filter);
+		static bool HashFile(const char* fileName, uint64_t& hash);	// 64-bit FNV-1a of the contents
+
+	protected:
+		// Weights of the source texels [First[i], First[i] + Count[i]) for the destination texel i,
+		// stored from Weights[MaxCount * i] on
+		struct Taps
+		{
+			uint32_t MaxCount;
+			std::vector<uint32_t> First;
+			std::vector<uint32_t> Count;
+			std::vector<float> Weights;
+		};
+
+		static void computeTaps(Taps& taps, uint32_t srcSize, uint32_t dstSize, Filter filter);
+
+		void filterRows(float* pDst, const float* pSrc, const uint3& srcSize, uint8_t axis, const Taps& taps);
+		void filterColumns(float* pDst, const float* pSrc, const uint3& srcSize, const Taps& taps);
+
+		ThreadPool& m_threadPool;
+		Stats m_stats;
+	};
+}
@@ -0,0 +1,149 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "CPUVolumeSequence.h"
+#include "CPUDDSLoader.h"
+
+using namespace std;
+using namespace CPU;
+
+VolumeSequence::VolumeSequence() :
+	m_size(0, 0, 0),
+	m_numDigits(0),
+	m_firstFrame(0),
+	m_frameCount(0),
+	m_currentFrame(0),
+	m_nextFrame(0),
+	m_lateFrame(UINT32_MAX),
+	m_framesShown(0),
+	m_missedDeadlines(0),
+	m_framesDecoded(0),
+	m_decodeTime(0.0),
+	m_backDecodeTime(0.0),
+	m_frameRate(24.0f),
+	m_front(0)
+{
+}
+
+VolumeSequence::~VolumeSequence()
+{
+	if (m_pending.valid()) m_pending.wait();
+}
+
+bool VolumeSequence::Open(const char* pattern, float frameRate)
+{
+	XUSG_N_RETURN(frameRate > 0.0f, false);
+
+	const string patternStr(pattern);
+	const auto first = patternStr.find('#');
+	XUSG_M_RETURN(first == string::npos, cerr, "No '#' for the frame number in the sequence pattern.", false);
+	const auto last = patternStr.find_first_not_of('#', first);
+	m_prefix = patternStr.substr(0, first);
+	m_suffix = last == string::npos ? string() : patternStr.substr(last);
+	m_numDigits = static_cast<uint32_t>((last == string::npos ? patternStr.size() : last) - first);
+	m_frameRate = frameRate;
+
+	// Frames are numbered from 0 or 1, up to the first one missing
+	const auto exists = [this](uint32_t frame) { return ifstream(GetFileName(frame)).good(); };
+	m_firstFrame = 0;
+	if (!exists(0)) m_firstFrame = 1;
+	for (m_frameCount = 0; exists(m_frameCount); ++m_frameCount);
+	XUSG_M_RETURN(m_frameCount == 0, cerr, "No volume files of the sequence pattern.", false);
+
+	// The first frame sets the size that the others must match
+	XUSG_N_RETURN(DDS::Loader().GetTextureSize(GetFileName(0).c_str(), m_size), false);
+
+	m_currentFrame = 0;
+	m_lateFrame = UINT32_MAX;
+	m_framesShown = 1;
+	m_missedDeadlines = 0;
+	m_framesDecoded = 0;
+	m_decodeTime = 0.0;
+	if (m_frameCount > 1) requestFrame(1);
+
+	return true;
+}
+
+const Texture3D<float>* VolumeSequence::Acquire(double time)
+{
+	const auto dueFrame = static_cast<uint32_t>(static_cast<uint64_t>(time * m_frameRate) % m_frameCount);
+	if (dueFrame == m_currentFrame || !m_pending.valid()) return nullptr;
+
+	// The frame shown stays until the due one has been decoded
+	if (m_pending.wait_for(chrono::seconds(0)) != future_status::ready)
+	{
+		if (m_lateFrame != dueFrame) ++m_missedDeadlines;
+		m_lateFrame = dueFrame;
+
+		return nullptr;
+	}
+
+	const auto isDecoded = m_pending.get();
+	const auto frame = m_nextFrame;
+	m_decodeTime += m_backDecodeTime;
+	++m_framesDecoded;
+
+	// Skipped if the due frame is already past it
+	if (frame != dueFrame && m_lateFrame != dueFrame)
+	{
+		++m_missedDeadlines;
+		m_lateFrame = dueFrame;
+	}
+
+	if (isDecoded)
+	{
+		m_front ^= 1;
+		m_currentFrame = frame;
+		++m_framesShown;
+	}
+
+	// Decodes ahead from the due frame, into the volume shown before
+	requestFrame((dueFrame + 1) % m_frameCount);
+
+	return isDecoded ? &m_volumes[m_front] : nullptr;
+}
+
+string VolumeSequence::GetFileName(uint32_t frame) const
+{
+	stringstream fileName;
+	fileName << m_prefix << setw(m_numDigits) << setfill('0') << m_firstFrame + frame << m_suffix;
+
+	return fileName.str();
+}
+
+VolumeSequence::Stats VolumeSequence::GetStats() const
+{
+	Stats stats;
+	stats.FramesShown = m_framesShown;
+	stats.MissedDeadlines = m_missedDeadlines;
+	stats.DecodeTime = m_framesDecoded > 0 ? m_decodeTime / m_framesDecoded : 0.0;
+
+	return stats;
+}
+
+bool VolumeSequence::decodeFrame(uint32_t frame, Texture3D<float>& volume) const
+{
+	DDS::Loader textureLoader;
+	const auto fileName = GetFileName(frame);
+	XUSG_N_RETURN(textureLoader.CreateTextureFromFile(fileName.c_str(), volume), false);
+	XUSG_M_RETURN(volume.GetWidth() != m_size.x || volume.GetHeight() != m_size.y || volume.GetDepth() != m_size.z,
+		cerr, "The volume files of the sequence differ in size.", false);
+
+	return true;
+}
+
+void VolumeSequence::requestFrame(uint32_t frame)
+{
+	// The back volume is free once the previous request has completed
+	auto& volume = m_volumes[m_front ^ 1];
+	m_nextFrame = frame;
+	m_pending = async(launch::async, [this, frame, &volume]()
+	{
+		const auto timeStart = chrono::high_resolution_clock::now();
+		const auto isDecoded = decodeFrame(frame, volume);
+		m_backDecodeTime = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - timeStart).count();
+
+		return isDecoded;
+	});
+}
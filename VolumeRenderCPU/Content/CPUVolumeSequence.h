@@ -0,0 +1,69 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "CPUTexture.h"
+#include <future>
+
+namespace CPU
+{
+	//--------------------------------------------------------------------------------------
+	// Time series of DDS volume files of the same size, named by a pattern whose run of '#'
+	// is the zero-padded frame number, e.g. cloud_###.dds for cloud_000.dds (or cloud_001.dds)
+	// on. The file of the next frame is decoded by a worker thread into the back of 2 volumes
+	// while the current frame renders, and the volumes are swapped once the next frame is
+	// due, so the render loop never waits for the file system or the decoding.
+	//--------------------------------------------------------------------------------------
+	class VolumeSequence
+	{
+	public:
+		struct Stats
+		{
+			uint32_t FramesShown;
+			uint32_t MissedDeadlines;	// Frames still being decoded when due, shown late or skipped
+			double DecodeTime;			// Average milliseconds of the worker to decode a frame
+		};
+
+		VolumeSequence();
+		virtual ~VolumeSequence();
+
+		// Finds the frames of the pattern, played back at frameRate frames per second and looped;
+		// the first frame is loaded by the caller from GetFileName(0), and the second one is decoded
+		bool Open(const char* pattern, float frameRate);
+
+		// Returns the volume of the frame due at time in seconds, if it is not the frame shown and
+		// has been decoded, or null otherwise; it stays valid until the next call
+		const Texture3D<float>* Acquire(double time);
+
+		std::string GetFileName(uint32_t frame) const;
+		uint32_t GetFrameCount() const { return m_frameCount; }
+		uint32_t GetCurrentFrame() const { return m_currentFrame; }
+		Stats GetStats() const;
+
+	protected:
+		bool decodeFrame(uint32_t frame, Texture3D<float>& volume) const;
+		void requestFrame(uint32_t frame);
+
+		std::string			m_prefix;
+		std::string			m_suffix;
+		uint3				m_size;			// Of the first frame, which all frames must match
+		Texture3D<float>	m_volumes[2];	// Front and back
+		std::future<bool>	m_pending;		// Decoding of the back volume
+
+		uint32_t	m_numDigits;
+		uint32_t	m_firstFrame;
+		uint32_t	m_frameCount;
+		uint32_t	m_currentFrame;
+		uint32_t	m_nextFrame;	// Frame decoded into the back volume
+		uint32_t	m_lateFrame;	// Last frame counted as missed, UINT32_MAX if none
+		uint32_t	m_framesShown;
+		uint32_t	m_missedDeadlines;
+		uint32_t	m_framesDecoded;
+		double		m_decodeTime;		// Total
+		double		m_backDecodeTime;	// Of the back volume, written by the worker
+		float		m_frameRate;
+		uint8_t		m_front;
+	};
+}
@@ -0,0 +1,582 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "CPURayCaster.h"
+#include "CPUDDSLoader.h"
+#include "CPUVolumeSequence.h"
+#include "stb_image_write.h"
+
+using namespace std;
+using namespace CPU;
+
+enum RenderMethod
+{
+	RAY_MARCH_MERGED,
+	RAY_MARCH_SEPARATE,
+	RAY_MARCH_DIRECT_MERGED,
+	RAY_MARCH_DIRECT_SEPARATE,
+
+	NUM_RENDER_METHOD
+};
+
+static const char* g_renderMethodNames[] =
+{
+	"Cube-map ray marching with merged light pass",
+	"Cube-map ray marching with separate light pass",
+	"Direct ray marching with merged light pass",
+	"Direct ray marching with separate light pass"
+};
+
+static const uint8_t g_renderFlags[] =
+{
+	CPURayCaster::RAY_MARCH_CUBEMAP,
+	CPURayCaster::OPTIMIZED,
+	CPURayCaster::RAY_MARCH_DIRECT,
+	CPURayCaster::SEPARATE_LIGHT_PASS
+};
+
+static const float g_FOVAngleY = PI / 4.0f;
+static const float g_zNear = 1.0f;
+static const float g_zFar = 1000.0f;
+
+struct Args
+{
+	uint32_t Width = 1280;
+	uint32_t Height = 800;
+	uint32_t GridSize = 128;
+	uint32_t LightGridSize = 128;
+	uint32_t MaxRaySamples = 256;
+	uint32_t MaxLightSamples = 128;
+	uint32_t NumThreads = 0;
+	uint32_t NumFrames = 4;
+	uint32_t LightBudget = 0;
+	uint32_t MaxLightStaleFrames = 8;
+	uint32_t StreamCacheSize = 0;	// MiB
+	uint32_t SculptRadius = 0;		// Voxels of the brush, 0 for no sculpting
+	uint32_t WavefrontSteps = 0;	// Steps per batch, 0 for fixed packets
+	float SequenceFrameRate = 24.0f;
+	float ReuseTolerance = 0.0f;	// Voxels, 0 to march all cube-map tiles every frame
+	uint32_t ReuseRefreshFrames = 8;
+	float OrbitAngle = 0.0f;		// Degrees per frame of the camera around the volume
+	uint32_t OrbitFrames = 0;		// Frames of the orbit before turning back, 0 for never
+	uint32_t CubeCacheSize = 0;		// MiB, 0 for no cube-map cache
+	float CubeCacheCellSize = 2.0f;	// Voxels
+	int32_t Method = -1; // All methods
+	VolumeResampler::Filter VolumeFilter = VolumeResampler::TRILINEAR;
+	bool LightSweep = false;
+	bool DynamicLight = false;
+	bool EmptySpaceSkip = true;
+	bool VolumeLOD = true;
+	bool CubeFaceLOD = true;
+	bool GradientVolume = true;
+	bool VolumeCompression = false;
+	bool LightProbe = false;
+	bool RGBAVolume = false;
+	bool ColorLUT = false;
+	bool Cloud = false;		// A procedural cloud in place of the blob
+	CloudGenerator::Desc CloudDesc = CloudGenerator::GetDefaultDesc();
+	string VolumeFile;
+	string SequencePattern;	// Volume files of a time series, replacing VolumeFile
+	string OutputFile;
+	float4 VolPosScale = float4(0.0f, -4.0f, 0.0f, 14.0f);
+};
+
+static void ParseCommandLineArgs(Args& args, char* argv[], int argc)
+{
+	const auto isArg = [](const char* arg, const char* name)
+	{
+		return (arg[0] == '-' || arg[0] == '/') && strcmp(arg + 1, name) == 0;
+	};
+
+	for (auto i = 1; i < argc; ++i)
+	{
+		if (isArg(argv[i], "width"))
+		{
+			if (i + 1 < argc) args.Width = stoul(argv[++i]);
+		}
+		else if (isArg(argv[i], "height"))
+		{
+			if (i + 1 < argc) args.Height = stoul(argv[++i]);
+		}
+		else if (isArg(argv[i], "gridSize"))
+		{
+			if (i + 1 < argc) args.GridSize = stoul(argv[++i]);
+		}
+		else if (isArg(argv[i], "lightGridSize"))
+		{
+			if (i + 1 < argc) args.LightGridSize = stoul(argv[++i]);
+		}
+		else if (isArg(argv[i], "volume"))
+		{
+			if (i + 1 < argc) args.VolumeFile = argv[++i];
+			if (i + 1 < argc && argv[i + 1][0] != '-') args.VolPosScale.x = stof(argv[++i]);
+			if (i + 1 < argc && argv[i + 1][0] != '-') args.VolPosScale.y = stof(argv[++i]);
+			if (i + 1 < argc && argv[i + 1][0] != '-') args.VolPosScale.z = stof(argv[++i]);
+			if (i + 1 < argc && argv[i + 1][0] != '-') args.VolPosScale.w = stof(argv[++i]);
+		}
+		else if (isArg(argv[i], "sequence"))
+		{
+			if (i + 1 < argc) args.SequencePattern = argv[++i];
+			if (i + 1 < argc && argv[i + 1][0] != '-') args.SequenceFrameRate = stof(argv[++i]);
+		}
+		else if (isArg(argv[i], "cloud"))
+		{
+			args.Cloud = true;
+			if (i + 1 < argc && argv[i + 1][0] != '-') args.CloudDesc.Seed = stoul(argv[++i]);
+			if (i + 1 < argc && argv[i + 1][0] != '-') args.CloudDesc.Coverage = stof(argv[++i]);
+		}
+		else if (isArg(argv[i], "sculpt"))
+		{
+			if (i + 1 < argc) args.SculptRadius = stoul(argv[++i]);
+		}
+		else if (isArg(argv[i], "maxRaySamples"))
+		{
+			if (i + 1 < argc) args.MaxRaySamples = stoul(argv[++i]);
+		}
+		else if (isArg(argv[i], "maxLightSamples"))
+		{
+			if (i + 1 < argc) args.MaxLightSamples = stoul(argv[++i]);
+		}
+		else if (isArg(argv[i], "threads"))
+		{
+			if (i + 1 < argc) args.NumThreads = stoul(argv[++i]);
+		}
+		else if (isArg(argv[i], "frames"))
+		{
+			if (i + 1 < argc) args.NumFrames = (max)(stoul(argv[++i]), 1ul);
+		}
+		else if (isArg(argv[i], "lightBudget"))
+		{
+			if (i + 1 < argc) args.LightBudget = stoul(argv[++i]);
+			if (i + 1 < argc && argv[i + 1][0] != '-') args.MaxLightStaleFrames = stoul(argv[++i]);
+		}
+		else if (isArg(argv[i], "method"))
+		{
+			if (i + 1 < argc)
+			{
+				++i;
+				args.Method = strcmp(argv[i], "all") == 0 ? -1 : stoi(argv[i]);
+			}
+		}
+		else if (isArg(argv[i], "lightSweep")) args.LightSweep = true;
+		else if (isArg(argv[i], "dynamicLight")) args.DynamicLight = true;
+		else if (isArg(argv[i], "noSkip")) args.EmptySpaceSkip = false;
+		else if (isArg(argv[i], "noLOD")) args.VolumeLOD = false;
+		else if (isArg(argv[i], "noFaceLOD")) args.CubeFaceLOD = false;
+		else if (isArg(argv[i], "noGradient")) args.GradientVolume = false;
+		else if (isArg(argv[i], "compress")) args.VolumeCompression = true;
+		else if (isArg(argv[i], "wavefront"))
+		{
+			args.WavefrontSteps = 8;
+			if (i + 1 < argc && argv[i + 1][0] != '-') args.WavefrontSteps = (max)(stoul(argv[++i]), 1ul);
+		}
+		else if (isArg(argv[i], "reuse"))
+		{
+			args.ReuseTolerance = 0.5f;
+			if (i + 1 < argc && argv[i + 1][0] != '-') args.ReuseTolerance = stof(argv[++i]);
+			if (i + 1 < argc && argv[i + 1][0] != '-') args.ReuseRefreshFrames = stoul(argv[++i]);
+		}
+		else if (isArg(argv[i], "orbit"))
+		{
+			if (i + 1 < argc) args.OrbitAngle = stof(argv[++i]);
+			if (i + 1 < argc && argv[i + 1][0] != '-') args.OrbitFrames = stoul(argv[++i]);
+		}
+		else if (isArg(argv[i], "cubeCache"))
+		{
+			if (i + 1 < argc) args.CubeCacheSize = stoul(argv[++i]);
+			if (i + 1 < argc && argv[i + 1][0] != '-') args.CubeCacheCellSize = stof(argv[++i]);
+		}
+		else if (isArg(argv[i], "stream"))
+		{
+			if (i + 1 < argc) args.StreamCacheSize = stoul(argv[++i]);
+		}
+		else if (isArg(argv[i], "filter"))
+		{
+			if (i + 1 < argc)
+			{
+				++i;
+				for (uint8_t j = 0; j < VolumeResampler::NUM_FILTER; ++j)
+				{
+					const auto filter = static_cast<VolumeResampler::Filter>(j);
+					if (strcmp(argv[i], VolumeResampler::GetFilterName(filter)) == 0) args.VolumeFilter = filter;
+				}
+			}
+		}
+		else if (isArg(argv[i], "lightProbe")) args.LightProbe = true;
+		else if (isArg(argv[i], "rgbaVolume")) args.RGBAVolume = true;
+		else if (isArg(argv[i], "colorLUT")) args.ColorLUT = true;
+		else if (isArg(argv[i], "output"))
+		{
+			if (i + 1 < argc) args.OutputFile = argv[++i];
+		}
+	}
+}
+
+// Same operator as PSToneMap.hlsl
+static void SaveImage(const char* fileName, const Texture2D<float4>& image)
+{
+	const auto w = image.GetWidth();
+	const auto h = image.GetHeight();
+
+	vector<uint8_t> imageData(3 * w * h);
+	for (auto i = 0u; i < h; ++i)
+		for (auto j = 0u; j < w; ++j)
+		{
+			const auto& src = image(j, i);
+			const auto d = w * i + j;
+			for (uint8_t k = 0; k < 3; ++k)
+			{
+				auto result = src[k];
+				result *= 1.05f / (result + 0.7f);
+				result = powf(fabsf(result), 1.25f);
+				imageData[3 * d + k] = static_cast<uint8_t>(saturate(result) * 255.0f + 0.5f);
+			}
+		}
+
+	stbi_write_png(fileName, w, h, 3, imageData.data(), 0);
+}
+
+int main(int argc, char* argv[])
+{
+	Args args;
+	ParseCommandLineArgs(args, argv, argc);
+
+	// The first frame of a time series loads as the volume file, and the others are decoded ahead during playback
+	unique_ptr<VolumeSequence> volumeSequence;
+	if (!args.SequencePattern.empty())
+	{
+		XUSG_X_RETURN(volumeSequence, make_unique<VolumeSequence>(), EXIT_FAILURE);
+		XUSG_N_RETURN(volumeSequence->Open(args.SequencePattern.c_str(), args.SequenceFrameRate), EXIT_FAILURE);
+		args.VolumeFile = volumeSequence->GetFileName(0);
+	}
+
+	unique_ptr<CPURayCaster> rayCaster;
+	XUSG_X_RETURN(rayCaster, make_unique<CPURayCaster>(), EXIT_FAILURE);
+	const auto densityOnly = (!args.VolumeFile.empty() || args.Cloud) && !args.RGBAVolume;
+	// Volume files keep their aspect, with the grid sizes on the longest axis
+	uint3 volumeSize;
+	const auto hasVolumeSize = !args.VolumeFile.empty() && DDS::Loader().GetTextureSize(args.VolumeFile.c_str(), volumeSize);
+	XUSG_N_RETURN(rayCaster->Init(args.GridSize, args.LightGridSize, args.NumThreads, densityOnly,
+		hasVolumeSize ? &volumeSize : nullptr), EXIT_FAILURE);
+	XUSG_N_RETURN(rayCaster->SetViewport(args.Width, args.Height), EXIT_FAILURE);
+
+	const auto& volPosScale = args.VolPosScale;
+	rayCaster->SetVolumeWorld(volPosScale.w * 2.0f, float3(volPosScale.x, volPosScale.y, volPosScale.z));
+	rayCaster->SetMaxSamples(args.MaxRaySamples, args.MaxLightSamples);
+	rayCaster->SetEmptySpaceSkip(args.EmptySpaceSkip);
+	rayCaster->SetVolumeLOD(args.VolumeLOD);
+	rayCaster->SetCubeFaceLOD(args.CubeFaceLOD);
+	rayCaster->SetGradientVolume(args.GradientVolume);
+	rayCaster->SetVolumeCompression(args.VolumeCompression);
+	rayCaster->SetVolumeStreaming(args.StreamCacheSize);
+	rayCaster->SetVolumeFilter(args.VolumeFilter);
+	rayCaster->SetWavefront(args.WavefrontSteps);
+	rayCaster->SetCubeMapReuse(args.ReuseTolerance, args.ReuseRefreshFrames);
+	rayCaster->SetCubeMapCache(args.CubeCacheSize, args.CubeCacheCellSize);
+	rayCaster->SetLightMapBudget(args.LightBudget, args.MaxLightStaleFrames);
+
+	if (args.ColorLUT)
+	{
+		// Same ramp as the demo
+		const float3 colorThin(0.5f, 0.8f, 1.0f);
+		const float3 colorDense(1.0f, 0.6f, 0.0f);
+		const uint32_t numColors = 17;
+		float3 colors[numColors];
+		for (auto i = 0u; i < numColors; ++i) colors[i] = lerp(colorThin, colorDense, (min)(4.0f * i / (numColors - 1), 1.0f));
+		rayCaster->SetColorLUT(colors, numColors);
+	}
+
+	auto timeStart = chrono::high_resolution_clock::now();
+	if (!args.VolumeFile.empty())
+	{
+		XUSG_N_RETURN(rayCaster->LoadVolumeData(args.VolumeFile.c_str()), EXIT_FAILURE);
+	}
+	else if (args.Cloud)
+	{
+		XUSG_N_RETURN(rayCaster->GenerateVolumeData(args.CloudDesc), EXIT_FAILURE);
+	}
+	else rayCaster->InitVolumeData();
+	const auto loadTime = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - timeStart).count();
+
+	// Set lighting
+	const float3 lightPt(75.0f, 75.0f, -75.0f);
+	const float3 lightColor(1.0f, 0.7f, 0.3f);
+	const float3 ambientColor(0.4f, 0.6f, 1.0f);
+	const auto lightIntensity = 3.0f * PI, ambientIntensity = 2.0f * PI;
+	rayCaster->SetLight(lightPt, lightColor, lightIntensity);
+	rayCaster->SetAmbient(ambientColor, ambientIntensity);
+
+	if (args.LightProbe)
+	{
+		// A sky of the ambient color, brighter from the top, in place of the light probe of the demo
+		float3 coeffSH[CPURayCaster::SHNumCoeffs] = {};
+		coeffSH[0] = ambientColor * ambientIntensity / 0.886227f;
+		coeffSH[1] = -0.5f * coeffSH[0];
+		rayCaster->SetSH(coeffSH);
+	}
+
+	// View
+	const float3 eyePt(4.0f, 16.0f, -40.0f);
+	const float3 focusPt(0.0f, 0.0f, 0.0f);
+	const auto aspectRatio = args.Width / static_cast<float>(args.Height);
+	const auto proj = MatrixPerspectiveFovLH(g_FOVAngleY, aspectRatio, g_zNear, g_zFar);
+	const auto updateView = [&](uint32_t frame)
+	{
+		// Orbits around the y axis through the focus point, back and forth every OrbitFrames frames
+		if (args.OrbitFrames > 0)
+		{
+			frame %= 2 * args.OrbitFrames;
+			if (frame > args.OrbitFrames) frame = 2 * args.OrbitFrames - frame;
+		}
+		const auto angle = args.OrbitAngle * frame * PI / 180.0f;
+		const auto c = cosf(angle), s = sinf(angle);
+		const auto dir = eyePt - focusPt;
+		const auto eye = focusPt + float3(c * dir.x + s * dir.z, dir.y, c * dir.z - s * dir.x);
+		const auto view = MatrixLookAtLH(eye, focusPt, float3(0.0f, 1.0f, 0.0f));
+		rayCaster->UpdateFrame(view * proj, MatrixIdentity(), eye);
+	};
+	updateView(0);
+
+	const auto volumeStats = rayCaster->GetVolumeStats();
+	const auto& gridSize = volumeStats.GridSize;
+	const auto& lightGridSize = volumeStats.LightGridSize;
+	cout << "Grid: " << gridSize.x << "x" << gridSize.y << "x" << gridSize.z << ", light grid: " << lightGridSize.x << "x"
+		<< lightGridSize.y << "x" << lightGridSize.z << ", viewport: " << args.Width << "x" << args.Height << ", threads: "
+		<< rayCaster->GetNumThreads() << endl;
+	const auto isCloud = args.VolumeFile.empty() && args.Cloud;
+	cout << "Volume " << (args.VolumeFile.empty() ? (isCloud ? "generated" : "initialized") : "loaded") << " in "
+		<< fixed << setprecision(2) << loadTime << " ms" << endl;
+	if (isCloud)
+	{
+		const auto cloudStats = rayCaster->GetCloudStats();
+		cout << "Cloud: seed " << args.CloudDesc.Seed << ", coverage " << args.CloudDesc.Coverage << ", ";
+		if (cloudStats.CacheHit) cout << "cache hit" << endl;
+		else cout << "generated and cached in " << cloudStats.GenerateTime << " ms" << endl;
+	}
+	if (!args.VolumeFile.empty() && args.VolumeFilter != VolumeResampler::TRILINEAR)
+	{
+		const auto resampleStats = rayCaster->GetResampleStats();
+		cout << "Volume resampling: " << VolumeResampler::GetFilterName(args.VolumeFilter) << " filter, ";
+		if (resampleStats.CacheHit) cout << "cache hit";
+		else cout << "filtered and cached in " << resampleStats.FilterTime << " ms";
+		cout << ", file hashed in " << resampleStats.HashTime << " ms" << endl;
+	}
+
+	cout << "Volume bricks (" << (densityOnly ? "density only" : "RGBA") << "): " << volumeStats.BrickCount << " of "
+		<< volumeStats.PageCount << " stored, " << volumeStats.MemorySize / 1048576.0 << " MiB (dense RGBA: "
+		<< volumeStats.DenseMemorySize / 1048576.0 << " MiB), gradients: " << volumeStats.GradientMemorySize / 1048576.0
+		<< " MiB" << endl;
+	if (volumeStats.PSNR > 0.0)
+	{
+		// Against the dense RGBA16F texture of the GPU path
+		const auto halfMemorySize = volumeStats.DenseMemorySize / 2;
+		cout << "Block compression: " << static_cast<double>(halfMemorySize) / volumeStats.MemorySize
+			<< ":1 of dense RGBA16F (" << halfMemorySize / 1048576.0 << " MiB), PSNR: ";
+		if (isinf(volumeStats.PSNR)) cout << "lossless" << endl;
+		else cout << volumeStats.PSNR << " dB" << endl;
+	}
+	const auto maxGridSize = static_cast<float>((max)((max)(gridSize.x, gridSize.y), gridSize.z));
+	const auto boundsSize = (volumeStats.BoundsMax - volumeStats.BoundsMin) * 0.5f * maxGridSize /
+		float3(static_cast<float>(gridSize.x), static_cast<float>(gridSize.y), static_cast<float>(gridSize.z));
+	cout << "Occupancy bounds: (" << volumeStats.BoundsMin.x << ", " << volumeStats.BoundsMin.y << ", "
+		<< volumeStats.BoundsMin.z << ") - (" << volumeStats.BoundsMax.x << ", " << volumeStats.BoundsMax.y << ", "
+		<< volumeStats.BoundsMax.z << "), " << 100.0f * boundsSize.x * boundsSize.y * boundsSize.z << "% of the box" << endl;
+
+	// For tuning the ray samples, the grid size and the zero threshold of the asset
+	const auto densityStats = rayCaster->GetDensityStats();
+	const auto& occupiedMin = densityStats.OccupiedMin;
+	const auto& occupiedMax = densityStats.OccupiedMax;
+	cout << "Densities: " << setprecision(4) << densityStats.MinDensity << " - " << densityStats.MaxDensity << ", occupied: "
+		<< setprecision(2) << 100.0f * densityStats.OccupiedFraction << "% of the voxels, within voxels (" << occupiedMin.x
+		<< ", " << occupiedMin.y << ", " << occupiedMin.z << ") - (" << occupiedMax.x << ", " << occupiedMax.y << ", "
+		<< occupiedMax.z << "), " << densityStats.OccupiedRayLength << " voxels per ray, useful ray samples: "
+		<< densityStats.UsefulRaySamples << " of " << args.MaxRaySamples << endl;
+	uint64_t voxelCount = 0;
+	for (const auto& count : densityStats.Histogram) voxelCount += count;
+	cout << "Density histogram (" << CPURayCaster::DensityStats::HistogramBinCount << " bins of the range):";
+	for (const auto& count : densityStats.Histogram) cout << " " << 100.0 * count / voxelCount << "%";
+	cout << endl;
+	cout << "Cube-map LOD: " << static_cast<uint32_t>(rayCaster->GetCubeMapLOD()) << " (+X -X +Y -Y +Z -Z:";
+	for (uint8_t i = 0; i < 6; ++i) cout << " " << static_cast<uint32_t>(rayCaster->GetCubeMapLOD(i));
+	cout << "), ray samples: "
+		<< rayCaster->GetRaySampleCount() << ", light pass: " << (args.LightSweep ? "slice sweep" : "per voxel")
+		<< ", empty-space skipping: " << (args.EmptySpaceSkip ? "on" : "off") << ", volume LOD: "
+		<< (args.VolumeLOD ? "on" : "off") << ", light probe: " << (args.LightProbe ? (args.GradientVolume ?
+		"gradient volume" : "6-tap gradients") : "off") << endl;
+	if (args.LightBudget > 0) cout << "Light-map budget: " << args.LightBudget << " us/frame, stale for at most "
+		<< args.MaxLightStaleFrames << " frames" << endl;
+
+	const auto getSkipRatio = [](uint64_t taken, uint64_t skipped)
+	{
+		return taken + skipped > 0 ? 100.0 * skipped / (taken + skipped) : 0.0;
+	};
+
+	const uint8_t lightFlag = args.LightSweep ? CPURayCaster::SLICE_SWEEP_LIGHT : 0;
+
+	// A brush that stamps a ball of density into its box, moving around the volume center frame by frame
+	const auto sculptRadius = (min)(args.SculptRadius, (min)((min)(gridSize.x, gridSize.y), gridSize.z) / 2);
+	vector<float> brush;
+	for (auto z = 0u; z < 2 * sculptRadius; ++z)
+		for (auto y = 0u; y < 2 * sculptRadius; ++y)
+			for (auto x = 0u; x < 2 * sculptRadius; ++x)
+			{
+				const auto pos = float3(static_cast<float>(x), static_cast<float>(y), static_cast<float>(z)) + 0.5f;
+				const auto r = length(pos / static_cast<float>(sculptRadius) - 1.0f);
+				const auto a = saturate(1.0f - r * r);
+				brush.push_back(a * a * 0.25f);
+			}
+	const auto sculpt = [&](uint32_t frame)
+	{
+		const auto angle = 2.0f * PI * frame / args.NumFrames;
+		uint3 minCorner, maxCorner;
+		for (uint8_t i = 0; i < 3; ++i)
+		{
+			const auto offset = i == 1 ? 0.0f : 0.25f * (i == 0 ? cosf(angle) : sinf(angle));
+			const auto center = static_cast<int32_t>((0.5f + offset) * gridSize[i]);
+			minCorner[i] = static_cast<uint32_t>((min)((max)(center - static_cast<int32_t>(sculptRadius), 0),
+				static_cast<int32_t>(gridSize[i] - 2 * sculptRadius)));
+			maxCorner[i] = minCorner[i] + 2 * sculptRadius;
+		}
+
+		return rayCaster->UpdateVolumeRegion(minCorner, maxCorner, brush.data());
+	};
+
+	// The time series plays back in real time from here on, across the methods
+	const auto playbackStart = chrono::high_resolution_clock::now();
+
+	for (uint8_t i = 0; i < NUM_RENDER_METHOD; ++i)
+	{
+		if (args.Method >= 0 && args.Method != i) continue;
+
+		auto totalTime = 0.0;
+		auto updateTime = 0.0;
+		auto updateCount = 0u;
+		auto sculptTime = 0.0;
+		uint64_t relitTexelCount = 0;
+		uint64_t reusedTileCount = 0;
+		const auto cacheStatsStart = rayCaster->GetCubeCacheStats();
+		uint64_t marchedTileCount = 0;
+		uint64_t bakedTexelCount = 0;
+		for (auto n = 0u; n < args.NumFrames; ++n)
+		{
+			// The frame of the time series due now, if decoded; timed apart from the rendering
+			if (volumeSequence)
+			{
+				timeStart = chrono::high_resolution_clock::now();
+				const auto playbackTime = chrono::duration<double>(timeStart - playbackStart).count();
+				const auto pVolume = volumeSequence->Acquire(playbackTime);
+				if (pVolume)
+				{
+					rayCaster->UpdateVolumeData(*pVolume);
+					updateTime += chrono::duration<double, milli>(chrono::high_resolution_clock::now() - timeStart).count();
+					++updateCount;
+				}
+			}
+
+			// A stroke of the brush per frame, timed apart from the rendering
+			if (sculptRadius > 0)
+			{
+				timeStart = chrono::high_resolution_clock::now();
+				XUSG_N_RETURN(sculpt(n), EXIT_FAILURE);
+				sculptTime += chrono::duration<double, milli>(chrono::high_resolution_clock::now() - timeStart).count();
+			}
+
+			// The light map is otherwise re-lit only when its inputs change
+			if (args.DynamicLight) rayCaster->InvalidateLightMap();
+			if (args.OrbitAngle != 0.0f) updateView(n);
+
+			timeStart = chrono::high_resolution_clock::now();
+			rayCaster->Render(g_renderFlags[i] | lightFlag);
+			totalTime += chrono::duration<double, milli>(chrono::high_resolution_clock::now() - timeStart).count();
+			relitTexelCount += rayCaster->GetRelitTexelCount();
+			reusedTileCount += rayCaster->GetReusedTileCount();
+			for (const auto& thread : rayCaster->GetTileStats()) marchedTileCount += thread.Groups;
+			bakedTexelCount += rayCaster->GetBakedTexelCount();
+		}
+
+		cout << "[" << static_cast<uint32_t>(i) << "] " << g_renderMethodNames[i] << ": "
+			<< totalTime / args.NumFrames << " ms/frame, light-map texels re-lit: "
+			<< relitTexelCount / args.NumFrames << "/frame, stale bricks left: " << rayCaster->GetStaleLightBrickCount()
+			<< ", irradiance texels baked: " << bakedTexelCount / args.NumFrames << "/frame" << endl;
+
+		// Samples per frame
+		const auto stats = rayCaster->GetSkipStats();
+		cout << "    view samples: " << stats.RaySamples << " taken, " << stats.RaySamplesSkipped << " skipped ("
+			<< getSkipRatio(stats.RaySamples, stats.RaySamplesSkipped) << "%); light samples: " << stats.LightSamples
+			<< " taken, " << stats.LightSamplesSkipped << " skipped (" << getSkipRatio(stats.LightSamples, stats.LightSamplesSkipped)
+			<< "%)" << endl;
+
+		// SIMD lanes of the cube-map ray marching, of the last frame
+		const auto laneStats = rayCaster->GetLaneStats();
+		if (laneStats.LaneSteps > 0)
+		{
+			cout << "    packet lanes: " << 100.0 * laneStats.ActiveLaneSteps / laneStats.LaneSteps << "% utilized of "
+				<< laneStats.LaneSteps << " lane steps";
+			if (!laneStats.LiveRays.empty())
+			{
+				cout << ", live rays per batch of " << args.WavefrontSteps << " steps:";
+				for (const auto& count : laneStats.LiveRays) cout << " " << count;
+			}
+			cout << endl;
+		}
+
+		// Load balance of the cube-map tiles, of the last frame
+		const auto tileStats = rayCaster->GetTileStats();
+		if (!tileStats.empty())
+		{
+			auto maxBusyTime = 0.0, totalBusyTime = 0.0;
+			cout << "    cube tiles per thread (busy ms/tiles/stolen):";
+			for (const auto& thread : tileStats)
+			{
+				cout << " " << thread.BusyTime << "/" << thread.Groups << "/" << thread.Steals;
+				maxBusyTime = (max)(maxBusyTime, thread.BusyTime);
+				totalBusyTime += thread.BusyTime;
+			}
+			cout << ", max/mean busy time: " << (totalBusyTime > 0.0 ? maxBusyTime * tileStats.size() / totalBusyTime : 1.0) << endl;
+		}
+		if (args.ReuseTolerance > 0.0f && (g_renderFlags[i] & CPURayCaster::RAY_MARCH_CUBEMAP))
+			cout << "    cube tiles reused: " << reusedTileCount / args.NumFrames << "/frame, marched: "
+			<< marchedTileCount / args.NumFrames << "/frame" << endl;
+
+		if (args.CubeCacheSize > 0 && (g_renderFlags[i] & CPURayCaster::RAY_MARCH_CUBEMAP))
+		{
+			const auto cacheStats = rayCaster->GetCubeCacheStats();
+			cout << "    cube-map cache: " << cacheStats.Hits - cacheStatsStart.Hits << " hits, " << cacheStats.Misses - cacheStatsStart.Misses
+				<< " misses, " << cacheStats.EntryCount << " face sets in " << cacheStats.MemorySize / 1048576.0 << " MiB" << endl;
+		}
+
+		if (volumeSequence)
+		{
+			const auto sequenceStats = volumeSequence->GetStats();
+			cout << "    volume sequence: frame " << volumeSequence->GetCurrentFrame() + 1 << " of " << volumeSequence->GetFrameCount()
+				<< ", deadlines missed: " << sequenceStats.MissedDeadlines << " of " << sequenceStats.FramesShown
+				<< " frames shown, decoded ahead in " << sequenceStats.DecodeTime << " ms/frame, updates: " << updateCount
+				<< " (" << (updateCount > 0 ? updateTime / updateCount : 0.0) << " ms each)" << endl;
+		}
+
+		if (sculptRadius > 0)
+		{
+			const auto brushSize = 2 * sculptRadius;
+			cout << "    sculpting: " << brushSize << "^3-voxel regions updated in " << sculptTime / args.NumFrames
+				<< " ms/frame" << endl;
+		}
+
+		const auto streamStats = rayCaster->GetStreamStats();
+		if (streamStats.SlotCount > 0)
+		{
+			const auto lookups = streamStats.Hits + streamStats.Misses;
+			cout << "    brick cache: " << streamStats.ResidentCount << " of " << streamStats.SlotCount << " slots resident, hit rate: "
+				<< (lookups > 0 ? 100.0 * streamStats.Hits / lookups : 100.0) << "%, misses: " << streamStats.Misses
+				<< ", prefetched: " << streamStats.Prefetches << ", stalls: " << streamStats.StallTime << " ms" << endl;
+		}
+
+		if (!args.OutputFile.empty())
+		{
+			const auto fileName = args.OutputFile + "_" + to_string(i) + ".png";
+			SaveImage(fileName.c_str(), rayCaster->GetRenderTarget());
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,48 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+// stdafx.h : include file for standard system include files,
+// or project specific include files that are used frequently, but
+// are changed infrequently.
+// The headless CPU engine is platform independent, so only the C++ standard
+// library is included here (no Windows or D3D12 headers).
+
+#pragma once
+
+// C RunTime Header Files
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#define XUSG_M_RETURN(x, o, m, r)		if (x) { o << m << std::endl; assert(!m); return r; }
+#define XUSG_C_RETURN(x, r)				if (x) return r
+#define XUSG_N_RETURN(x, r)				XUSG_C_RETURN(!(x), r)
+#define XUSG_X_RETURN(x, f, r)			{ x = f; XUSG_N_RETURN(x, r); }
+
+#define XUSG_DIV_UP(x, n)				(((x) + (n) - 1) / (n))